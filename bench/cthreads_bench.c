@@ -0,0 +1,722 @@
+/*
+  INFO: Contention and tail-latency stress harness for CThreads.
+
+        Build it next to the library, for example:
+          cc -O2 -I. bench/cthreads_bench.c cthreads.c -lpthread -o cthreads_bench
+
+        Every scenario is swept over thread counts, critical-section lengths and think
+          times, recording the latency of each operation in a per-thread HDR histogram.
+          Results can be saved as a baseline, and later runs compared against it, failing
+          when a p99 regressed past a threshold.
+*/
+
+/* INFO: clock_gettime() and the POSIX parts of cthreads.h, also under strict -std=c99 */
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <time.h>
+  #include <unistd.h>        /* sysconf() */
+#endif
+
+#include "cthreads.h"
+
+#define BENCH_MAX_SWEEP 16
+#define BENCH_MAX_THREADS 1024
+#define BENCH_MAX_RESULTS 1024
+
+/*
+  INFO: Log-linear buckets in the HdrHistogram layout. Values below 2^BENCH_HIST_SUB_BITS are
+          exact, above it every power of two is split in 2^(BENCH_HIST_SUB_BITS - 1) buckets,
+          a relative error below 1/64.
+*/
+#define BENCH_HIST_SUB_BITS 7
+#define BENCH_HIST_SUB_COUNT (1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_HALF_COUNT (BENCH_HIST_SUB_COUNT / 2)
+#define BENCH_HIST_BUCKETS (BENCH_HIST_SUB_COUNT + (64 - BENCH_HIST_SUB_BITS) * BENCH_HIST_HALF_COUNT)
+
+struct bench_hist {
+  uint64_t counts[BENCH_HIST_BUCKETS];
+  uint64_t total;
+  uint64_t max;
+};
+
+static unsigned int bench_hist_msb(uint64_t value) {
+  unsigned int msb = 0;
+
+  while (value >>= 1) msb++;
+
+  return msb;
+}
+
+static size_t bench_hist_index(uint64_t value) {
+  unsigned int shift;
+
+  if (value < BENCH_HIST_SUB_COUNT) return (size_t)value;
+
+  shift = bench_hist_msb(value) - (BENCH_HIST_SUB_BITS - 1);
+
+  return BENCH_HIST_SUB_COUNT + (size_t)(shift - 1) * BENCH_HIST_HALF_COUNT + (size_t)((value >> shift) - BENCH_HIST_HALF_COUNT);
+}
+
+/* INFO: Highest value that lands in the bucket, as HdrHistogram reports percentiles */
+static uint64_t bench_hist_value(size_t index) {
+  unsigned int shift;
+  uint64_t sub;
+
+  if (index < BENCH_HIST_SUB_COUNT) return (uint64_t)index;
+
+  shift = (unsigned int)((index - BENCH_HIST_SUB_COUNT) / BENCH_HIST_HALF_COUNT) + 1;
+  sub = (uint64_t)((index - BENCH_HIST_SUB_COUNT) % BENCH_HIST_HALF_COUNT) + BENCH_HIST_HALF_COUNT;
+
+  return ((sub + 1) << shift) - 1;
+}
+
+static void bench_hist_record(struct bench_hist *hist, uint64_t value) {
+  hist->counts[bench_hist_index(value)]++;
+  hist->total++;
+  if (value > hist->max) hist->max = value;
+}
+
+static void bench_hist_merge(struct bench_hist *into, const struct bench_hist *from) {
+  size_t i;
+
+  for (i = 0; i < BENCH_HIST_BUCKETS; i++) into->counts[i] += from->counts[i];
+
+  into->total += from->total;
+  if (from->max > into->max) into->max = from->max;
+}
+
+static uint64_t bench_hist_percentile(const struct bench_hist *hist, double percentile) {
+  uint64_t target = (uint64_t)(percentile / 100.0 * (double)hist->total + 0.5);
+  uint64_t seen = 0;
+  size_t i;
+
+  if (hist->total == 0) return 0;
+  if (target == 0) target = 1;
+
+  for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+    seen += hist->counts[i];
+
+    if (seen >= target) {
+      uint64_t value = bench_hist_value(i);
+
+      return value < hist->max ? value : hist->max;
+    }
+  }
+
+  return hist->max;
+}
+
+static uint64_t bench_now(void) {
+  #ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / (uint64_t)frequency.QuadPart;
+  #else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+  #endif
+}
+
+static void bench_sleep_ms(unsigned int ms) {
+  #ifdef _WIN32
+    Sleep(ms);
+  #else
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+
+    nanosleep(&ts, NULL);
+  #endif
+}
+
+static unsigned int bench_cpus(void) {
+  #ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+
+    return (unsigned int)info.dwNumberOfProcessors;
+  #else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return cpus > 0 ? (unsigned int)cpus : 1;
+  #endif
+}
+
+/* INFO: Busy work standing for a critical section or think time, sleeping would be far too coarse */
+static void bench_spin(uint64_t ns) {
+  uint64_t end;
+
+  if (ns == 0) return;
+
+  end = bench_now() + ns;
+  while (bench_now() < end);
+}
+
+static uint32_t bench_random(uint32_t *state) {
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  return *state = x;
+}
+
+/* INFO: Shared by every worker of a run */
+struct bench_run {
+  uint64_t cs_ns;
+  uint64_t think_ns;
+  unsigned int threads;
+  /* INFO: Out of 100, for the rwlock scenarios */
+  unsigned int read_percent;
+  volatile int stop;
+  volatile int go;
+  struct cthreads_mutex mutex;
+  struct cthreads_cond not_empty;
+  struct cthreads_cond not_full;
+  /* INFO: Producer/consumer ring of enqueue timestamps */
+  uint64_t ring[64];
+  size_t head;
+  size_t tail;
+  uint64_t shared[8];
+  #ifdef CTHREADS_RWLOCK
+    struct cthreads_rwlock rwlock;
+  #endif
+  #ifdef CTHREADS_SEMAPHORE
+    struct cthreads_semaphore sem;
+  #endif
+};
+
+struct bench_worker {
+  struct bench_run *run;
+  struct bench_hist hist;
+  unsigned int index;
+  uint32_t seed;
+};
+
+static void bench_wait_go(struct bench_run *run) {
+  while (!run->go) bench_spin(1000);
+}
+
+/* INFO: Latency is the time from enqueue to dequeue, across the condition variable handoff */
+static void *bench_cond_producer(void *data) {
+  struct bench_worker *worker = data;
+  struct bench_run *run = worker->run;
+
+  bench_wait_go(run);
+
+  for (;;) {
+    cthreads_mutex_lock(&run->mutex);
+    while (!run->stop && run->head - run->tail == sizeof(run->ring) / sizeof(run->ring[0]))
+      cthreads_cond_wait(&run->not_full, &run->mutex);
+
+    if (run->stop) {
+      cthreads_mutex_unlock(&run->mutex);
+
+      break;
+    }
+
+    bench_spin(run->cs_ns);
+    run->ring[run->head++ % (sizeof(run->ring) / sizeof(run->ring[0]))] = bench_now();
+    cthreads_cond_signal(&run->not_empty);
+    cthreads_mutex_unlock(&run->mutex);
+
+    bench_spin(run->think_ns);
+  }
+
+  return NULL;
+}
+
+static void *bench_cond_consumer(void *data) {
+  struct bench_worker *worker = data;
+  struct bench_run *run = worker->run;
+  uint64_t enqueued;
+
+  bench_wait_go(run);
+
+  for (;;) {
+    cthreads_mutex_lock(&run->mutex);
+    while (!run->stop && run->head == run->tail)
+      cthreads_cond_wait(&run->not_empty, &run->mutex);
+
+    if (run->head == run->tail) {
+      cthreads_mutex_unlock(&run->mutex);
+
+      break;
+    }
+
+    enqueued = run->ring[run->tail++ % (sizeof(run->ring) / sizeof(run->ring[0]))];
+    bench_spin(run->cs_ns);
+    cthreads_cond_signal(&run->not_full);
+    cthreads_mutex_unlock(&run->mutex);
+
+    bench_hist_record(&worker->hist, bench_now() - enqueued);
+    bench_spin(run->think_ns);
+  }
+
+  return NULL;
+}
+
+static void *bench_cond_worker(void *data) {
+  struct bench_worker *worker = data;
+
+  /* INFO: Even workers produce, odd ones consume */
+  return worker->index % 2 ? bench_cond_consumer(data) : bench_cond_producer(data);
+}
+
+/* INFO: Latency is the time to acquire the lock */
+static void *bench_mutex_worker(void *data) {
+  struct bench_worker *worker = data;
+  struct bench_run *run = worker->run;
+  uint64_t start;
+
+  bench_wait_go(run);
+
+  while (!run->stop) {
+    start = bench_now();
+    cthreads_mutex_lock(&run->mutex);
+    bench_hist_record(&worker->hist, bench_now() - start);
+
+    run->shared[0]++;
+    bench_spin(run->cs_ns);
+    cthreads_mutex_unlock(&run->mutex);
+
+    bench_spin(run->think_ns);
+  }
+
+  return NULL;
+}
+
+#ifdef CTHREADS_RWLOCK
+  static void *bench_rwlock_worker(void *data) {
+    struct bench_worker *worker = data;
+    struct bench_run *run = worker->run;
+    volatile uint64_t sink = 0;
+    uint64_t start;
+
+    bench_wait_go(run);
+
+    while (!run->stop) {
+      if (bench_random(&worker->seed) % 100 < run->read_percent) {
+        start = bench_now();
+        cthreads_rwlock_rdlock(&run->rwlock);
+        bench_hist_record(&worker->hist, bench_now() - start);
+
+        sink += run->shared[worker->index % 8];
+        bench_spin(run->cs_ns);
+        cthreads_rwlock_unlock_shared(&run->rwlock);
+      } else {
+        start = bench_now();
+        cthreads_rwlock_wrlock(&run->rwlock);
+        bench_hist_record(&worker->hist, bench_now() - start);
+
+        run->shared[worker->index % 8]++;
+        bench_spin(run->cs_ns);
+        cthreads_rwlock_unlock_exclusive(&run->rwlock);
+      }
+
+      bench_spin(run->think_ns);
+    }
+
+    (void) sink;
+
+    return NULL;
+  }
+#endif
+
+#ifdef CTHREADS_SEMAPHORE
+  /* INFO: Latency is the time to take a permit of the bounded pool */
+  static void *bench_sem_worker(void *data) {
+    struct bench_worker *worker = data;
+    struct bench_run *run = worker->run;
+    uint64_t start;
+
+    bench_wait_go(run);
+
+    while (!run->stop) {
+      start = bench_now();
+      cthreads_sem_wait(&run->sem);
+      bench_hist_record(&worker->hist, bench_now() - start);
+
+      bench_spin(run->cs_ns);
+      cthreads_sem_post(&run->sem);
+
+      bench_spin(run->think_ns);
+    }
+
+    return NULL;
+  }
+#endif
+
+#define BENCH_COND 0
+#define BENCH_RWLOCK_READ 1
+#define BENCH_RWLOCK_WRITE 2
+#define BENCH_SEM_POOL 3
+#define BENCH_OVERSUB 4
+#define BENCH_SCENARIOS 5
+
+static const char *bench_scenario_names[BENCH_SCENARIOS] = {
+  "cond", "rwlock-read", "rwlock-write", "sem-pool", "oversub"
+};
+
+struct bench_result {
+  char scenario[32];
+  unsigned int threads;
+  uint64_t cs_ns;
+  uint64_t think_ns;
+  uint64_t ops;
+  uint64_t p50, p90, p99, p999, max;
+};
+
+static int bench_available(int scenario) {
+  switch (scenario) {
+    #ifndef CTHREADS_RWLOCK
+      case BENCH_RWLOCK_READ:
+      case BENCH_RWLOCK_WRITE: return 0;
+    #endif
+    #ifndef CTHREADS_SEMAPHORE
+      case BENCH_SEM_POOL: return 0;
+    #endif
+    default: return 1;
+  }
+}
+
+static int bench_execute(int scenario, unsigned int threads, uint64_t cs_ns, uint64_t think_ns, unsigned int duration_ms, struct bench_result *result) {
+  struct bench_run *run = calloc(1, sizeof(struct bench_run));
+  struct bench_worker *workers = calloc(threads, sizeof(struct bench_worker));
+  struct cthreads_thread *handles = calloc(threads, sizeof(struct cthreads_thread));
+  struct cthreads_args *args = calloc(threads, sizeof(struct cthreads_args));
+  struct bench_hist *total = calloc(1, sizeof(struct bench_hist));
+  void *(*func)(void *data) = bench_mutex_worker;
+  unsigned int i, started = 0;
+  int ret = 1;
+
+  if (!run || !workers || !handles || !args || !total) goto done;
+
+  run->cs_ns = cs_ns;
+  run->think_ns = think_ns;
+  run->threads = threads;
+
+  if (cthreads_mutex_init(&run->mutex, NULL) || cthreads_cond_init(&run->not_empty, NULL) || cthreads_cond_init(&run->not_full, NULL)) goto done;
+
+  switch (scenario) {
+    case BENCH_COND: func = bench_cond_worker; break;
+    #ifdef CTHREADS_RWLOCK
+      case BENCH_RWLOCK_READ:
+      case BENCH_RWLOCK_WRITE: {
+        if (cthreads_rwlock_init(&run->rwlock)) goto done;
+
+        run->read_percent = scenario == BENCH_RWLOCK_READ ? 90 : 10;
+        func = bench_rwlock_worker;
+
+        break;
+      }
+    #endif
+    #ifdef CTHREADS_SEMAPHORE
+      case BENCH_SEM_POOL: {
+        /* INFO: A quarter as many permits as threads, so that most acquisitions contend */
+        if (cthreads_sem_init(&run->sem, threads / 4 ? (int)(threads / 4) : 1)) goto done;
+
+        func = bench_sem_worker;
+
+        break;
+      }
+    #endif
+    default: func = bench_mutex_worker; break;
+  }
+
+  for (i = 0; i < threads; i++) {
+    workers[i].run = run;
+    workers[i].index = i;
+    workers[i].seed = 2463534242u + i * 2654435761u;
+
+    if (cthreads_thread_create(&handles[i], NULL, func, &workers[i], &args[i])) break;
+
+    started++;
+  }
+
+  if (started == threads) {
+    run->go = 1;
+    bench_sleep_ms(duration_ms);
+    ret = 0;
+  }
+
+  cthreads_mutex_lock(&run->mutex);
+  run->stop = 1;
+  run->go = 1;
+  cthreads_cond_broadcast(&run->not_empty);
+  cthreads_cond_broadcast(&run->not_full);
+  cthreads_mutex_unlock(&run->mutex);
+
+  for (i = 0; i < started; i++) {
+    cthreads_thread_join(handles[i], NULL);
+    bench_hist_merge(total, &workers[i].hist);
+  }
+
+  #ifdef CTHREADS_RWLOCK
+    if (scenario == BENCH_RWLOCK_READ || scenario == BENCH_RWLOCK_WRITE) cthreads_rwlock_destroy(&run->rwlock);
+  #endif
+  #ifdef CTHREADS_SEMAPHORE
+    if (scenario == BENCH_SEM_POOL) cthreads_sem_destroy(&run->sem);
+  #endif
+  cthreads_cond_destroy(&run->not_full);
+  cthreads_cond_destroy(&run->not_empty);
+  cthreads_mutex_destroy(&run->mutex);
+
+  if (ret == 0) {
+    snprintf(result->scenario, sizeof(result->scenario), "%s", bench_scenario_names[scenario]);
+    result->threads = threads;
+    result->cs_ns = cs_ns;
+    result->think_ns = think_ns;
+    result->ops = total->total;
+    result->p50 = bench_hist_percentile(total, 50.0);
+    result->p90 = bench_hist_percentile(total, 90.0);
+    result->p99 = bench_hist_percentile(total, 99.0);
+    result->p999 = bench_hist_percentile(total, 99.9);
+    result->max = total->max;
+  }
+
+  done:
+  free(total);
+  free(args);
+  free(handles);
+  free(workers);
+  free(run);
+
+  return ret;
+}
+
+/* INFO: Parses a comma-separated list of unsigned integers */
+static int bench_parse_list(const char *text, uint64_t *values, size_t *count) {
+  char *end;
+
+  *count = 0;
+
+  while (*text) {
+    if (*count == BENCH_MAX_SWEEP) return 1;
+
+    values[(*count)++] = strtoull(text, &end, 10);
+    if (end == text) return 1;
+
+    text = end;
+    if (*text == ',') text++;
+    else if (*text) return 1;
+  }
+
+  return *count == 0;
+}
+
+static int bench_save(const char *path, const struct bench_result *results, size_t count) {
+  FILE *file = fopen(path, "w");
+  size_t i;
+
+  if (!file) return 1;
+
+  fprintf(file, "# scenario threads cs_ns think_ns p99_ns\n");
+  for (i = 0; i < count; i++) {
+    fprintf(file, "%s %u %llu %llu %llu\n", results[i].scenario, results[i].threads,
+            (unsigned long long)results[i].cs_ns, (unsigned long long)results[i].think_ns, (unsigned long long)results[i].p99);
+  }
+
+  return fclose(file) != 0;
+}
+
+/* INFO: Returns the number of regressions, or -1 if the baseline could not be read */
+static int bench_compare(const char *path, const struct bench_result *results, size_t count, double threshold, uint64_t slack_ns) {
+  FILE *file = fopen(path, "r");
+  char line[256], scenario[32];
+  unsigned long long cs_ns, think_ns, p99;
+  unsigned int threads;
+  int regressions = 0;
+  size_t i;
+
+  if (!file) return -1;
+
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%31s %u %llu %llu %llu", scenario, &threads, &cs_ns, &think_ns, &p99) != 5) continue;
+
+    for (i = 0; i < count; i++) {
+      double limit;
+
+      if (strcmp(results[i].scenario, scenario) != 0 || results[i].threads != threads ||
+          results[i].cs_ns != cs_ns || results[i].think_ns != think_ns) continue;
+
+      /* INFO: The absolute slack keeps tiny p99s from failing on scheduler noise */
+      limit = (double)p99 * (1.0 + threshold / 100.0) + (double)slack_ns;
+      if ((double)results[i].p99 > limit) {
+        printf("REGRESSION %s threads=%u cs=%llu think=%llu: p99 %llu ns, baseline %llu ns\n", scenario, threads,
+               cs_ns, think_ns, (unsigned long long)results[i].p99, p99);
+
+        regressions++;
+      }
+
+      break;
+    }
+  }
+
+  fclose(file);
+
+  return regressions;
+}
+
+static void bench_usage(const char *name) {
+  printf("Usage: %s [options]\n"
+         "  -S list   scenarios: cond,rwlock-read,rwlock-write,sem-pool,oversub (default: all)\n"
+         "  -t list   thread counts (default: 2,4,8), multiples of the online CPUs for oversub\n"
+         "  -c list   critical-section lengths in ns (default: 0,1000)\n"
+         "  -k list   think times in ns (default: 0,5000)\n"
+         "  -d ms     duration of each run (default: 200)\n"
+         "  -s file   save the p99s as a baseline\n"
+         "  -b file   compare the p99s against a baseline, exiting with 1 on regression\n"
+         "  -r pct    allowed p99 regression in percent (default: 20)\n"
+         "  -m ns     absolute p99 slack added to the threshold (default: 2000)\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t thread_counts[BENCH_MAX_SWEEP] = { 2, 4, 8 }, cs_lengths[BENCH_MAX_SWEEP] = { 0, 1000 }, think_times[BENCH_MAX_SWEEP] = { 0, 5000 };
+  size_t thread_count = 3, cs_count = 2, think_count = 2, result_count = 0;
+  int selected[BENCH_SCENARIOS] = { 1, 1, 1, 1, 1 }, requested = 0;
+  const char *save_path = NULL, *baseline_path = NULL;
+  unsigned int duration_ms = 200, cpus = bench_cpus();
+  uint64_t slack_ns = 2000;
+  double threshold = 20.0;
+  struct bench_result *results;
+  size_t t, c, k;
+  int i, s;
+
+  for (i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    int bad = value == NULL;
+
+    if (strcmp(argv[i], "-h") == 0) {
+      bench_usage(argv[0]);
+
+      return 0;
+    }
+
+    if (!bad && strcmp(argv[i], "-S") == 0) {
+      char list[256], *name;
+
+      memset(selected, 0, sizeof(selected));
+      requested = 1;
+      snprintf(list, sizeof(list), "%s", value);
+
+      for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        for (s = 0; s < BENCH_SCENARIOS; s++) {
+          if (strcmp(name, bench_scenario_names[s]) == 0) break;
+        }
+
+        if (s == BENCH_SCENARIOS) bad = 1;
+        else selected[s] = 1;
+      }
+    }
+    else if (!bad && strcmp(argv[i], "-t") == 0) bad = bench_parse_list(value, thread_counts, &thread_count);
+    else if (!bad && strcmp(argv[i], "-c") == 0) bad = bench_parse_list(value, cs_lengths, &cs_count);
+    else if (!bad && strcmp(argv[i], "-k") == 0) bad = bench_parse_list(value, think_times, &think_count);
+    else if (!bad && strcmp(argv[i], "-d") == 0) duration_ms = (unsigned int)strtoul(value, NULL, 10);
+    else if (!bad && strcmp(argv[i], "-s") == 0) save_path = value;
+    else if (!bad && strcmp(argv[i], "-b") == 0) baseline_path = value;
+    else if (!bad && strcmp(argv[i], "-r") == 0) threshold = strtod(value, NULL);
+    else if (!bad && strcmp(argv[i], "-m") == 0) slack_ns = strtoull(value, NULL, 10);
+    else bad = 1;
+
+    if (bad) {
+      bench_usage(argv[0]);
+
+      return 2;
+    }
+
+    i++;
+  }
+
+  /* INFO: Scenarios named with -S must run, the default list only skips the missing ones */
+  for (s = 0; s < BENCH_SCENARIOS; s++) {
+    if (!selected[s] || bench_available(s)) continue;
+
+    fprintf(stderr, "%s: not available in this build of CThreads%s\n", bench_scenario_names[s], requested ? "" : ", skipped");
+    if (requested) return 2;
+
+    selected[s] = 0;
+  }
+
+  results = calloc(BENCH_MAX_RESULTS, sizeof(struct bench_result));
+  if (!results) return 2;
+
+  printf("%-13s %7s %7s %8s %10s %9s %9s %9s %9s %9s\n", "scenario", "threads", "cs_ns", "think_ns", "ops", "p50", "p90", "p99", "p99.9", "max");
+
+  for (s = 0; s < BENCH_SCENARIOS; s++) {
+    if (!selected[s]) continue;
+
+    for (t = 0; t < thread_count; t++) {
+      uint64_t threads = s == BENCH_OVERSUB ? thread_counts[t] * cpus : thread_counts[t];
+
+      if (threads == 0 || threads > BENCH_MAX_THREADS) continue;
+
+      for (c = 0; c < cs_count; c++) {
+        for (k = 0; k < think_count && result_count < BENCH_MAX_RESULTS; k++) {
+          struct bench_result *result = &results[result_count];
+
+          if (bench_execute(s, (unsigned int)threads, cs_lengths[c], think_times[k], duration_ms, result)) {
+            fprintf(stderr, "%s: failed to run with %u threads\n", bench_scenario_names[s], (unsigned int)threads);
+
+            continue;
+          }
+
+          printf("%-13s %7u %7llu %8llu %10llu %9llu %9llu %9llu %9llu %9llu\n", result->scenario, result->threads,
+                 (unsigned long long)result->cs_ns, (unsigned long long)result->think_ns, (unsigned long long)result->ops,
+                 (unsigned long long)result->p50, (unsigned long long)result->p90, (unsigned long long)result->p99,
+                 (unsigned long long)result->p999, (unsigned long long)result->max);
+          fflush(stdout);
+
+          result_count++;
+        }
+      }
+    }
+  }
+
+  if (save_path && bench_save(save_path, results, result_count)) {
+    fprintf(stderr, "Failed to save the baseline to %s\n", save_path);
+    free(results);
+
+    return 2;
+  }
+
+  if (baseline_path) {
+    int regressions = bench_compare(baseline_path, results, result_count, threshold, slack_ns);
+
+    free(results);
+
+    if (regressions < 0) {
+      fprintf(stderr, "Failed to read the baseline from %s\n", baseline_path);
+
+      return 2;
+    }
+
+    if (regressions) printf("%d p99 regression(s) past %.1f%% + %llu ns\n", regressions, threshold, (unsigned long long)slack_ns);
+
+    return regressions ? 1 : 0;
+  }
+
+  free(results);
+
+  return 0;
+}
@@ -1,697 +1,7695 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h> /* memcpy(), strerror(), strlen() */
 
 #ifndef _WIN32
   #include <errno.h>  /* errno */
-  #include <string.h> /* strerror(), strlen() */
+#endif
+
+#ifndef _WIN32
+  #include <sched.h>         /* sched_yield(), struct sched_param */
+  #include <unistd.h>        /* getpid() */
+#else
+  #include <malloc.h>        /* _alloca() */
+#endif
+
+#ifdef __linux__
+  #include <sys/syscall.h>   /* SYS_futex, SYS_gettid, SYS_memfd_create */
+  #include <linux/futex.h>   /* FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE */
+
+  /* INFO: glibc hides syscall() in strict -std=c99 builds, declared here instead of a feature macro, which would change the header's layout */
+  long syscall(long number, ...);
+#elif defined(__FreeBSD__)
+  #include <sys/types.h>
+  #include <sys/umtx.h>      /* _umtx_op() */
 #endif
 
 #include "cthreads.h"
 
+#ifdef CTHREADS_THREAD_NICE
+  #include <sys/resource.h>  /* setpriority() */
+#endif
+
+#if defined(CTHREADS_LOW_LATENCY) && !defined(_WIN32)
+  #include <alloca.h>        /* alloca() */
+  #include <malloc.h>        /* mallopt() */
+  #include <sys/mman.h>      /* mlockall() */
+#endif
+
+#ifdef CTHREADS_IPC
+  #include <fcntl.h>         /* open(), fcntl() */
+  #include <sys/mman.h>      /* mmap(), shm_open() */
+  #include <sys/stat.h>      /* fstat() */
+  #include <signal.h>        /* kill() */
+#endif
+
+#if defined(CTHREADS_REGISTRY) && defined(__linux__)
+  #include <sys/prctl.h>     /* prctl() */
+#endif
+
+#if defined(CTHREADS_TRACE) || defined(CTHREADS_REGISTRY)
+  #define __CTHREADS_THREAD_HOOKS 1
+#endif
+
+#ifdef __CTHREADS_THREAD_HOOKS
+  /* INFO: Run on the new thread before its function, and when it returns, exits or is cancelled */
+  static void __cthreads_thread_started(struct cthreads_args *args);
+  static void __cthreads_thread_finished(void);
+#endif
+
 #ifdef _WIN32
 #include <windows.h>
 DWORD WINAPI __cthreads_winthreads_function_wrapper(void *data) {
   struct cthreads_args *args = data;
-  return (DWORD)(uintptr_t)args->func(args->data);
+  #ifdef __CTHREADS_THREAD_HOOKS
+    void *(*func)(void *data) = args->func;
+    void *func_data = args->data;
+    DWORD ret;
+
+    __cthreads_thread_started(args);
+    ret = (DWORD)(uintptr_t)func(func_data);
+    __cthreads_thread_finished();
+
+    return ret;
+  #else
+    return (DWORD)(uintptr_t)args->func(args->data);
+  #endif
 }
 #else
 #include <pthread.h>
-#endif
-
-int cthreads_thread_create(struct cthreads_thread *thread, struct cthreads_thread_attr *attr, void *(*func)(void *data), void *data, struct cthreads_args *args) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_thread_create");
-  #endif
+#ifdef __CTHREADS_THREAD_HOOKS
+  /* INFO: A cleanup handler, so that pthread_exit and cancellation unwind through the hook too */
+  static void __cthreads_pthread_function_cleanup(void *data) {
+    (void) data;
 
-  /* INFO: POSIX path may not use it, but we must guarantee symmetry */
-  if (!args) return 1;
+    __cthreads_thread_finished();
+  }
 
-  #ifdef _WIN32
-    args->func = func;
-    args->data = data;
+  static void *__cthreads_pthread_function_wrapper(void *data) {
+    struct cthreads_args *args = data;
+    void *(*func)(void *data) = args->func;
+    void *func_data = args->data;
+    void *ret;
 
-    DWORD tid;
-    if (attr) {
-      thread->wThread = CreateThread(NULL, attr->stacksize ? attr->stacksize : 0,
-                                     __cthreads_winthreads_function_wrapper, args,
-                                     attr->dwCreationFlags ? (DWORD)attr->dwCreationFlags : 0, &tid);
-    } else {
-      thread->wThread = CreateThread(NULL, 0, __cthreads_winthreads_function_wrapper, args, 0, &tid);
-    }
+    __cthreads_thread_started(args);
 
-    /* INFO: If successful, write tid for later access */
-    if (thread->wThread) thread->wThreadId = tid;
+    pthread_cleanup_push(__cthreads_pthread_function_cleanup, NULL);
+    ret = func(func_data);
+    pthread_cleanup_pop(1);
 
-    return thread->wThread == NULL;
-  #else
-    pthread_attr_t pAttr;
-    if (attr) {
-      if (pthread_attr_init(&pAttr)) return 1;
+    return ret;
+  }
+#endif
+#endif
 
-      int ret = 0;
-      if (attr->detachstate) ret = pthread_attr_setdetachstate(&pAttr, attr->detachstate);
-      if (ret == 0 && attr->guardsize) ret = pthread_attr_setguardsize(&pAttr, attr->guardsize);
-      #ifdef CTHREADS_THREAD_INHERITSCHED
-        if (ret == 0 && attr->inheritsched) ret = pthread_attr_setinheritsched(&pAttr, attr->inheritsched);
-      #endif
-      if (ret == 0 && attr->schedpolicy) ret = pthread_attr_setschedpolicy(&pAttr, attr->schedpolicy);
-      if (ret == 0 && attr->scope) ret = pthread_attr_setscope(&pAttr, attr->scope);
-      #ifdef CTHREADS_THREAD_STACK
-        if (ret == 0 && attr->stack) ret = pthread_attr_setstack(&pAttr, attr->stackaddr, attr->stack);
-        /* INFO: Using both _setstack and _setstacksize is disallowed by POSIX */
-        #ifdef CTHREADS_THREAD_STACKADDR
-        else
-        #endif
-      #endif
-      #ifdef CTHREADS_THREAD_STACKADDR
-        if (ret == 0 && attr->stacksize) ret = pthread_attr_setstacksize(&pAttr, attr->stacksize);
-      #endif
+/* INFO: Monotonic clock in nanoseconds, for deadlines that must not move with the wall clock */
+static __CTHREADS_INLINE uint64_t __cthreads_monotonic_ns(void) {
+  #ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
 
-      if (ret) {
-        pthread_attr_destroy(&pAttr);
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
 
-        return 1;
-      }
-    }
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / (uint64_t)frequency.QuadPart;
+  #else
+    struct timespec ts;
 
-    int ret = pthread_create(&thread->pThread, attr ? &pAttr : NULL, func, data);
-    if (attr) pthread_attr_destroy(&pAttr);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    return ret;
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
   #endif
 }
 
-int cthreads_thread_detach(struct cthreads_thread thread) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_thread_detach");
-  #endif
-
+/* INFO: Gives the rest of the time slice away, for spin loops that have spun for too long */
+static __CTHREADS_INLINE void __cthreads_yield(void) {
   #ifdef _WIN32
-    return CloseHandle(thread.wThread) == 0;
+    SwitchToThread();
   #else
-    return pthread_detach(thread.pThread);
+    sched_yield();
   #endif
 }
 
-int cthreads_thread_join(struct cthreads_thread thread, void *code) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_thread_join");
-  #endif
+#if defined(CTHREADS_TRACE) || defined(CTHREADS_REGISTRY)
+  /* INFO: ID the OS tools show for the calling thread, the kernel TID on Linux */
+  static unsigned long __cthreads_thread_tid(void) {
+    #ifdef _WIN32
+      return (unsigned long)GetCurrentThreadId();
+    #elif defined(__linux__)
+      return (unsigned long)syscall(SYS_gettid);
+    #else
+      return cthreads_thread_id(cthreads_thread_self());
+    #endif
+  }
+#endif
 
-  #ifdef _WIN32
-    HANDLE handle = thread.wThread;
-    int opened = 0;
+#ifdef CTHREADS_REGISTRY
+  struct __cthreads_registry_entry {
+    struct __cthreads_registry_entry *next;
+    struct __cthreads_registry_entry **pprev;
+    /* INFO: Name, TID and attributes, the counters are only filled in snapshots */
+    struct cthreads_thread_stats stats;
+    uint64_t blocked_ns;
+    /* INFO: Start of the sleep in progress, 0 while running */
+    uint64_t blocked_since;
+    #ifdef _WIN32
+      HANDLE handle;
+    #else
+      pthread_t thread;
+    #endif
+  };
 
-    if (!handle) {
-      handle = OpenThread(SYNCHRONIZE | THREAD_QUERY_INFORMATION, FALSE, thread.wThreadId);
-      if (!handle) return 1;
+  /* INFO: NULL for threads not created by cthreads */
+  static __CTHREADS_THREAD_LOCAL struct __cthreads_registry_entry *__cthreads_registry_self;
 
-      opened = 1;
+  static __CTHREADS_INLINE uint64_t __cthreads_registry_block_begin(void) {
+    uint64_t start;
+
+    if (!__cthreads_registry_self) return 0;
+
+    start = __cthreads_monotonic_ns();
+    cthreads_atomic_store_u64(&__cthreads_registry_self->blocked_since, start, CTHREADS_ATOMIC_RELAXED);
+
+    return start;
+  }
+
+  static __CTHREADS_INLINE void __cthreads_registry_block_end(uint64_t start) {
+    if (!__cthreads_registry_self) return;
+
+    cthreads_atomic_fetch_add_u64(&__cthreads_registry_self->blocked_ns, __cthreads_monotonic_ns() - start, CTHREADS_ATOMIC_RELAXED);
+    cthreads_atomic_store_u64(&__cthreads_registry_self->blocked_since, 0, CTHREADS_ATOMIC_RELAXED);
+  }
+#endif
+
+#ifdef CTHREADS_ATOMIC
+  /*
+    INFO: Address-based wait and wake. Waits return when `*addr != expected`, on wake, on
+            timeout (`ns` is relative, UINT64_MAX means infinite) or spuriously.
+  */
+  #if defined(__linux__)
+    static void __cthreads_futex_sleep(volatile uint32_t *addr, uint32_t expected, uint64_t ns) {
+      struct timespec ts;
+
+      ts.tv_sec = (time_t)(ns / 1000000000);
+      ts.tv_nsec = (long)(ns % 1000000000);
+
+      syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, ns == UINT64_MAX ? NULL : &ts, NULL, 0);
     }
-  
-    if (WaitForSingleObject(handle, INFINITE) == WAIT_FAILED) {
-      if (opened) CloseHandle(handle);
 
-      return 1;
+    static void __cthreads_futex_wake(volatile uint32_t *addr, int all) {
+      syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, all ? INT32_MAX : 1, NULL, NULL, 0);
     }
 
-    DWORD exit_code;
-    if (!GetExitCodeThread(handle, (LPDWORD)&exit_code)) {
-      if (opened) CloseHandle(handle);
+    static void __cthreads_futex_wake_n(volatile uint32_t *addr, uint32_t count) {
+      syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count > INT32_MAX ? INT32_MAX : (int)count, NULL, NULL, 0);
+    }
+  #elif defined(_WIN32)
+    #pragma comment(lib, "synchronization.lib")
 
-      return 1;
+    static void __cthreads_futex_sleep(volatile uint32_t *addr, uint32_t expected, uint64_t ns) {
+      WaitOnAddress(addr, &expected, sizeof(expected), ns == UINT64_MAX ? INFINITE : (DWORD)((ns + 999999) / 1000000));
     }
 
-    CloseHandle(handle);
+    static void __cthreads_futex_wake(volatile uint32_t *addr, int all) {
+      if (all) WakeByAddressAll((PVOID)addr);
+      else WakeByAddressSingle((PVOID)addr);
+    }
 
-    if (code) *(void **)code = (void *)(uintptr_t)exit_code;
+    static void __cthreads_futex_wake_n(volatile uint32_t *addr, uint32_t count) {
+      while (count--) WakeByAddressSingle((PVOID)addr);
+    }
+  #elif defined(__FreeBSD__)
+    static void __cthreads_futex_sleep(volatile uint32_t *addr, uint32_t expected, uint64_t ns) {
+      struct _umtx_time timeout;
 
-    return cthreads_thread_detach(thread);
-  #else
-    return pthread_join(thread.pThread, code ? (void **)code : NULL);
-  #endif
-}
+      timeout._timeout.tv_sec = (time_t)(ns / 1000000000);
+      timeout._timeout.tv_nsec = (long)(ns % 1000000000);
+      timeout._flags = 0;
+      timeout._clockid = CLOCK_MONOTONIC;
 
-int cthreads_thread_equal(struct cthreads_thread thread1, struct cthreads_thread thread2) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_thread_equal");
-  #endif
+      _umtx_op((void *)addr, UMTX_OP_WAIT_UINT_PRIVATE, expected, ns == UINT64_MAX ? NULL : (void *)sizeof(timeout), ns == UINT64_MAX ? NULL : &timeout);
+    }
 
-  #ifdef _WIN32
-    return thread1.wThreadId == thread2.wThreadId;
+    static void __cthreads_futex_wake(volatile uint32_t *addr, int all) {
+      _umtx_op((void *)addr, UMTX_OP_WAKE_PRIVATE, all ? INT32_MAX : 1, NULL, NULL);
+    }
+
+    static void __cthreads_futex_wake_n(volatile uint32_t *addr, uint32_t count) {
+      _umtx_op((void *)addr, UMTX_OP_WAKE_PRIVATE, count > INT32_MAX ? INT32_MAX : (int)count, NULL, NULL);
+    }
   #else
-    return pthread_equal(thread1.pThread, thread2.pThread);
-  #endif
-}
+    /* INFO: Portable emulation, waiters sleep on a condition variable picked by hashing the address */
+    #define __CTHREADS_FUTEX_BUCKETS 64
 
-struct cthreads_thread cthreads_thread_self(void) {
-  struct cthreads_thread t;
+    static struct {
+      pthread_mutex_t mutex;
+      pthread_cond_t cond;
+    } __cthreads_futex_buckets[__CTHREADS_FUTEX_BUCKETS];
+    static pthread_once_t __cthreads_futex_once = PTHREAD_ONCE_INIT;
 
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_thread_self");
-  #endif
+    static void __cthreads_futex_init(void) {
+      size_t i;
 
-  #ifdef _WIN32
-    /* INFO: No real handle, only the ID. */
-    t.wThread = NULL;
-    t.wThreadId = GetCurrentThreadId();
-  #else
-    t.pThread = pthread_self();
-  #endif
+      for (i = 0; i < __CTHREADS_FUTEX_BUCKETS; i++) {
+        pthread_mutex_init(&__cthreads_futex_buckets[i].mutex, NULL);
+        pthread_cond_init(&__cthreads_futex_buckets[i].cond, NULL);
+      }
+    }
 
-  return t;
-}
+    static __CTHREADS_INLINE size_t __cthreads_futex_bucket(volatile uint32_t *addr) {
+      return (size_t)(((uintptr_t)addr >> 2) * 0x9E3779B1u) % __CTHREADS_FUTEX_BUCKETS;
+    }
 
-/*
-   INFO: This is a best-effort implementation on POSIX systems. There is no
-           reliable way to get the thread ID, as pthread_t is an opaque type.
+    static void __cthreads_futex_sleep(volatile uint32_t *addr, uint32_t expected, uint64_t ns) {
+      size_t bucket = __cthreads_futex_bucket(addr);
 
-         On Windows we return the stable thread ID stored at creation.
-*/
-unsigned long cthreads_thread_id(struct cthreads_thread thread) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_thread_id");
-  #endif
+      pthread_once(&__cthreads_futex_once, __cthreads_futex_init);
+      pthread_mutex_lock(&__cthreads_futex_buckets[bucket].mutex);
 
-  #ifdef _WIN32
-    return (unsigned long)thread.wThreadId;
-  #else
-    return (unsigned long)(uintptr_t)thread.pThread;
-  #endif
-}
+      if (cthreads_atomic_load_u32(addr, CTHREADS_ATOMIC_ACQUIRE) == expected) {
+        if (ns == UINT64_MAX) {
+          pthread_cond_wait(&__cthreads_futex_buckets[bucket].cond, &__cthreads_futex_buckets[bucket].mutex);
+        } else {
+          struct timespec ts;
 
-void cthreads_thread_exit(void *code) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_thread_exit");
-  #endif
+          clock_gettime(CLOCK_REALTIME, &ts);
+          ns += (uint64_t)ts.tv_nsec;
+          ts.tv_sec += (time_t)(ns / 1000000000);
+          ts.tv_nsec = (long)(ns % 1000000000);
 
-  #ifdef _WIN32
-    /* INFO: On Windows 64-bit, we cannot losslessly convert a pointer to a DWORD */
-    ExitThread((DWORD)(uintptr_t)code);
-  #else
-    pthread_exit(code);
-  #endif
-}
+          pthread_cond_timedwait(&__cthreads_futex_buckets[bucket].cond, &__cthreads_futex_buckets[bucket].mutex, &ts);
+        }
+      }
 
-int cthreads_thread_cancel(struct cthreads_thread thread) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_thread_cancel");
-  #endif
+      pthread_mutex_unlock(&__cthreads_futex_buckets[bucket].mutex);
+    }
 
-  #ifdef _WIN32
-    HANDLE handle = thread.wThread;
-    int opened = 0;
+    static void __cthreads_futex_wake(volatile uint32_t *addr, int all) {
+      size_t bucket = __cthreads_futex_bucket(addr);
 
-    if (!handle) {
-      handle = OpenThread(THREAD_TERMINATE, FALSE, thread.wThreadId);
-      if (!handle) return 1;
+      (void) all;
 
-      opened = 1;
+      /* INFO: Other addresses may share the bucket, so everyone is woken to recheck */
+      pthread_once(&__cthreads_futex_once, __cthreads_futex_init);
+      pthread_mutex_lock(&__cthreads_futex_buckets[bucket].mutex);
+      pthread_cond_broadcast(&__cthreads_futex_buckets[bucket].cond);
+      pthread_mutex_unlock(&__cthreads_futex_buckets[bucket].mutex);
     }
 
-    BOOL ret = TerminateThread(handle, 0);
-    if (opened) CloseHandle(handle);
+    static void __cthreads_futex_wake_n(volatile uint32_t *addr, uint32_t count) {
+      (void) count;
 
-    return ret == 0;
-  #else
-    return pthread_cancel(thread.pThread);
+      __cthreads_futex_wake(addr, 1);
+    }
   #endif
-}
 
-#ifdef CTHREADS_MUTEX_ATTR
-  int cthreads_mutex_init(struct cthreads_mutex *mutex, struct cthreads_mutex_attr *attr) {
-#else
-  int cthreads_mutex_init(struct cthreads_mutex *mutex, void *attr) {
-#endif
-  #ifdef _WIN32
-    #ifdef CTHREADS_DEBUG
-      puts("cthreads_mutex_init");
+  /* INFO: Every sleep of the library goes through here */
+  static __CTHREADS_INLINE void __cthreads_futex_wait(volatile uint32_t *addr, uint32_t expected, uint64_t ns) {
+    #ifdef CTHREADS_REGISTRY
+      uint64_t start = __cthreads_registry_block_begin();
     #endif
 
-    (void) attr;
+    __cthreads_futex_sleep(addr, expected, ns);
 
-    InitializeCriticalSection(&mutex->wMutex);
+    #ifdef CTHREADS_REGISTRY
+      __cthreads_registry_block_end(start);
+    #endif
+  }
+#endif
 
-    return 0;
+#ifdef CTHREADS_TRACE
+  #define __CTHREADS_TRACE_BEGIN 0
+  #define __CTHREADS_TRACE_END 1
+  #define __CTHREADS_TRACE_INSTANT 2
+
+  struct __cthreads_trace_event {
+    uint64_t ticks;
+    const char *name;
+    const void *object;
+    uint32_t type;
+  };
+
+  /* INFO: Single-writer ring, owned by one thread and only read by flushes */
+  struct __cthreads_trace_ring {
+    struct __cthreads_trace_ring *next;
+    /* INFO: Link in the free list, rings are never unlinked from `next` as flushes walk it without a lock */
+    struct __cthreads_trace_ring *free_next;
+    uint64_t head;
+    /* INFO: First event of the current owner, the ones before it belong to a previous owner */
+    uint64_t base;
+    unsigned long tid;
+    /* INFO: Guarded by the free list lock, set once a flush wrote the events of the exited owner */
+    uint32_t flushing;
+    uint32_t flushed;
+    struct __cthreads_trace_event events[CTHREADS_TRACE_EVENTS];
+  };
+
+  static struct __cthreads_trace_ring *__cthreads_trace_rings;
+  static __CTHREADS_THREAD_LOCAL struct __cthreads_trace_ring *__cthreads_trace_self;
+  /* INFO: Rings of exited threads, oldest first, handed to the next threads that start recording */
+  static struct __cthreads_trace_ring *__cthreads_trace_free;
+  static struct __cthreads_trace_ring *__cthreads_trace_free_tail;
+  static uint32_t __cthreads_trace_count;
+  static struct cthreads_lock __cthreads_trace_free_lock = CTHREADS_LOCK_INITIALIZER;
+  static uint64_t __cthreads_trace_origin_ticks;
+  static uint64_t __cthreads_trace_origin_ns;
+  static uint32_t __cthreads_trace_origin_state;
+
+  #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #define __cthreads_trace_ticks() __rdtsc()
+  #elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define __cthreads_trace_ticks() __builtin_ia32_rdtsc()
+  #elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+    static __CTHREADS_INLINE uint64_t __cthreads_trace_ticks(void) {
+      uint64_t ticks;
+
+      __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+
+      return ticks;
+    }
   #else
-    pthread_mutexattr_t pAttr;
+    #define __cthreads_trace_ticks() __cthreads_monotonic_ns()
+  #endif
 
-    #ifdef CTHREADS_DEBUG
-      puts("cthreads_mutex_init");
-    #endif
-  
-    /* CTHREADS_MUTEX_ATTR is always available on non-Windows platforms */
-    if (attr) {
-      if (pthread_mutexattr_init(&pAttr)) return 1;
+  /*
+    INFO: Only rings whose events were flushed after their owner exited are reused, the oldest first. Past
+            CTHREADS_TRACE_RINGS rings, the oldest exited ring is reused anyway and its unflushed events are lost.
+  */
+  static struct __cthreads_trace_ring *__cthreads_trace_take(void) {
+    struct __cthreads_trace_ring *ring, *prev = NULL;
 
-      int ret = 0;
-      if (attr->pshared) ret = pthread_mutexattr_setpshared(&pAttr, attr->pshared);
-      #ifdef CTHREADS_MUTEX_TYPE
-        if (ret == 0 && attr->type) ret = pthread_mutexattr_settype(&pAttr, attr->type);
-      #endif
-      #ifdef CTHREADS_MUTEX_ROBUST
-        if (ret == 0 && attr->robust) ret = pthread_mutexattr_setrobust(&pAttr, attr->robust);
-      #endif
-      #ifdef CTHREADS_MUTEX_PROTOCOL
-        if (ret == 0 && attr->protocol) ret = pthread_mutexattr_setprotocol(&pAttr, attr->protocol);
-      #endif
-      #ifdef CTHREADS_MUTEX_PRIOCEILING
-        if (ret == 0 && attr->prioceiling) ret = pthread_mutexattr_setprioceiling(&pAttr, attr->prioceiling);
-      #endif
+    for (ring = __cthreads_trace_free; ring && !ring->flushed; ring = ring->free_next)
+      prev = ring;
 
-      if (ret) {
-        pthread_mutexattr_destroy(&pAttr);
+    if (!ring) {
+      if (__cthreads_trace_count < CTHREADS_TRACE_RINGS || !__cthreads_trace_free) return NULL;
 
-        return 1;
-      }
+      ring = __cthreads_trace_free;
+      prev = NULL;
     }
 
-    int ret = pthread_mutex_init(&mutex->pMutex, attr ? &pAttr : NULL);
-    if (attr) pthread_mutexattr_destroy(&pAttr);
+    if (prev) prev->free_next = ring->free_next;
+    else __cthreads_trace_free = ring->free_next;
+    if (__cthreads_trace_free_tail == ring) __cthreads_trace_free_tail = prev;
 
-    return ret;
-  #endif
-}
+    return ring;
+  }
 
-int cthreads_mutex_lock(struct cthreads_mutex *mutex) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_mutex_lock");
-  #endif
+  static struct __cthreads_trace_ring *__cthreads_trace_ring_create(void) {
+    struct __cthreads_trace_ring *ring;
+    uint32_t state = 0;
 
-  #ifdef _WIN32
-    EnterCriticalSection(&mutex->wMutex);
+    cthreads_lock_lock(&__cthreads_trace_free_lock);
+    ring = __cthreads_trace_take();
+    if (!ring) __cthreads_trace_count++;
+    cthreads_lock_unlock(&__cthreads_trace_free_lock);
 
-    return 0;
-  #else
-    return pthread_mutex_lock(&mutex->pMutex);
-  #endif
-}
+    /* INFO: `head` keeps counting, so that a concurrent flush still notices overwritten events */
+    if (ring) {
+      ring->tid = __cthreads_thread_tid();
+      cthreads_atomic_store_u64(&ring->base, ring->head, CTHREADS_ATOMIC_RELEASE);
+      __cthreads_trace_self = ring;
 
-int cthreads_mutex_trylock(struct cthreads_mutex *mutex) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_mutex_trylock");
-  #endif
+      return ring;
+    }
 
-  #ifdef _WIN32
-    return TryEnterCriticalSection(&mutex->wMutex) == 0;
-  #else
-    return pthread_mutex_trylock(&mutex->pMutex);
-  #endif
-}
+    ring = malloc(sizeof(struct __cthreads_trace_ring));
+    if (!ring) {
+      cthreads_lock_lock(&__cthreads_trace_free_lock);
+      __cthreads_trace_count--;
+      cthreads_lock_unlock(&__cthreads_trace_free_lock);
 
-int cthreads_mutex_unlock(struct cthreads_mutex *mutex) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_mutex_unlock");
-  #endif
+      return NULL;
+    }
 
-  #ifdef _WIN32
-    LeaveCriticalSection(&mutex->wMutex);
+    /* INFO: The first ring pins the tick <-> nanosecond origin, flushes measure the rate against it */
+    if (cthreads_atomic_cas_u32(&__cthreads_trace_origin_state, &state, 1, CTHREADS_ATOMIC_ACQ_REL)) {
+      __cthreads_trace_origin_ns = __cthreads_monotonic_ns();
+      __cthreads_trace_origin_ticks = __cthreads_trace_ticks();
+      cthreads_atomic_store_u32(&__cthreads_trace_origin_state, 2, CTHREADS_ATOMIC_RELEASE);
+    }
 
-    return 0;
-  #else
-    return pthread_mutex_unlock(&mutex->pMutex);
-  #endif
-}
+    ring->head = 0;
+    ring->base = 0;
+    ring->tid = __cthreads_thread_tid();
+    ring->flushing = 0;
+    ring->flushed = 0;
+    ring->next = cthreads_atomic_load_ptr((void *volatile *)&__cthreads_trace_rings, CTHREADS_ATOMIC_RELAXED);
+    while (!cthreads_atomic_cas_ptr((void *volatile *)&__cthreads_trace_rings, (void **)&ring->next, ring, CTHREADS_ATOMIC_RELEASE));
 
-int cthreads_mutex_destroy(struct cthreads_mutex *mutex) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_mutex_destroy");
-  #endif
+    __cthreads_trace_self = ring;
 
-  #ifdef _WIN32
-    DeleteCriticalSection(&mutex->wMutex);
+    return ring;
+  }
 
-    return 0;
-  #else
-    return pthread_mutex_destroy(&mutex->pMutex);
-  #endif
-}
+  static void __cthreads_trace_record(uint32_t type, const char *name, const void *object) {
+    struct __cthreads_trace_ring *ring = __cthreads_trace_self;
+    struct __cthreads_trace_event *event;
+    uint64_t head;
 
-#ifdef CTHREADS_COND_ATTR
-  int cthreads_cond_init(struct cthreads_cond *cond, struct cthreads_cond_attr *attr) {
-#else
-  int cthreads_cond_init(struct cthreads_cond *cond, void *attr) {
+    if (!ring && !(ring = __cthreads_trace_ring_create())) return;
+
+    head = ring->head;
+    event = &ring->events[head & (CTHREADS_TRACE_EVENTS - 1)];
+    event->ticks = __cthreads_trace_ticks();
+    event->name = name;
+    event->object = object;
+    event->type = type;
+
+    cthreads_atomic_store_u64(&ring->head, head + 1, CTHREADS_ATOMIC_RELEASE);
+  }
+
+  /* INFO: Run as the thread exits, its ring keeps its events until the next complete flush wrote them */
+  static void __cthreads_trace_ring_release(void) {
+    struct __cthreads_trace_ring *ring = __cthreads_trace_self;
+
+    if (!ring) return;
+
+    __cthreads_trace_self = NULL;
+
+    cthreads_lock_lock(&__cthreads_trace_free_lock);
+    ring->flushing = 0;
+    ring->flushed = 0;
+    ring->free_next = NULL;
+    if (__cthreads_trace_free_tail) __cthreads_trace_free_tail->free_next = ring;
+    else __cthreads_trace_free = ring;
+    __cthreads_trace_free_tail = ring;
+    cthreads_lock_unlock(&__cthreads_trace_free_lock);
+  }
+#endif
+
+#ifdef CTHREADS_REGISTRY
+  static struct __cthreads_registry_entry *__cthreads_registry;
+  static struct cthreads_lock __cthreads_registry_lock = CTHREADS_LOCK_INITIALIZER;
+
+  /* INFO: Run by the creator, a thread whose entry could not be allocated simply goes unregistered */
+  static void __cthreads_registry_prepare(struct cthreads_thread_attr *attr, struct cthreads_args *args) {
+    struct __cthreads_registry_entry *entry = calloc(1, sizeof(struct __cthreads_registry_entry));
+
+    args->entry = entry;
+    if (!entry || !attr) return;
+
+    entry->stats.attr = *attr;
+    entry->stats.attr.name = NULL;
+    entry->stats.attr_set = 1;
+
+    if (attr->name) {
+      strncpy(entry->stats.name, attr->name, CTHREADS_THREAD_NAME_MAX - 1);
+      entry->stats.name[CTHREADS_THREAD_NAME_MAX - 1] = '\0';
+    }
+  }
+
+  /* INFO: Run by the creator when the thread never started */
+  static void __cthreads_registry_discard(struct cthreads_args *args) {
+    free(args->entry);
+    args->entry = NULL;
+  }
+
+  static void __cthreads_registry_started(struct __cthreads_registry_entry *entry) {
+    if (!entry) return;
+
+    entry->stats.tid = __cthreads_thread_tid();
+
+    #ifdef _WIN32
+      entry->handle = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentThreadId());
+    #else
+      entry->thread = pthread_self();
+
+      if (entry->stats.name[0]) {
+        #if defined(__GLIBC__) && defined(_GNU_SOURCE)
+          pthread_setname_np(entry->thread, entry->stats.name);
+        #elif defined(__linux__)
+          prctl(PR_SET_NAME, (unsigned long)entry->stats.name, 0, 0, 0);
+        #elif defined(__APPLE__)
+          pthread_setname_np(entry->stats.name);
+        #endif
+      }
+    #endif
+
+    __cthreads_registry_self = entry;
+
+    cthreads_lock_lock(&__cthreads_registry_lock);
+    entry->next = __cthreads_registry;
+    entry->pprev = &__cthreads_registry;
+    if (__cthreads_registry) __cthreads_registry->pprev = &entry->next;
+    __cthreads_registry = entry;
+    cthreads_lock_unlock(&__cthreads_registry_lock);
+  }
+
+  static void __cthreads_registry_finished(void) {
+    struct __cthreads_registry_entry *entry = __cthreads_registry_self;
+
+    if (!entry) return;
+
+    __cthreads_registry_self = NULL;
+
+    cthreads_lock_lock(&__cthreads_registry_lock);
+    *entry->pprev = entry->next;
+    if (entry->next) entry->next->pprev = entry->pprev;
+    cthreads_lock_unlock(&__cthreads_registry_lock);
+
+    #ifdef _WIN32
+      if (entry->handle) CloseHandle(entry->handle);
+    #endif
+
+    free(entry);
+  }
+
+  /* INFO: Entries leave the registry before their thread exits, returns or is cancelled, so the thread is alive under the lock */
+  static void __cthreads_registry_sample(struct __cthreads_registry_entry *entry, struct cthreads_thread_stats *stats) {
+    uint64_t since = cthreads_atomic_load_u64(&entry->blocked_since, CTHREADS_ATOMIC_RELAXED);
+
+    *stats = entry->stats;
+    stats->blocked_ns = cthreads_atomic_load_u64(&entry->blocked_ns, CTHREADS_ATOMIC_RELAXED);
+    if (since) stats->blocked_ns += __cthreads_monotonic_ns() - since;
+
+    #ifdef _WIN32
+      FILETIME creation, exit, kernel, user;
+
+      if (entry->handle && GetThreadTimes(entry->handle, &creation, &exit, &kernel, &user)) {
+        uint64_t ticks = (((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+                         (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime);
+
+        /* INFO: FILETIME counts 100ns intervals */
+        stats->cpu_ns = ticks * 100;
+      }
+    #else
+      #ifdef _POSIX_THREAD_CPUTIME
+        clockid_t clock;
+        struct timespec ts;
+
+        if (pthread_getcpuclockid(entry->thread, &clock) == 0 && clock_gettime(clock, &ts) == 0)
+          stats->cpu_ns = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+      #endif
+
+      #ifdef __linux__
+        char path[64], line[128];
+        unsigned long long value;
+        FILE *file;
+
+        snprintf(path, sizeof(path), "/proc/self/task/%lu/status", entry->stats.tid);
+
+        file = fopen(path, "r");
+        if (file) {
+          while (fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1) stats->voluntary_switches = value;
+            else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu", &value) == 1) stats->involuntary_switches = value;
+          }
+
+          fclose(file);
+        }
+      #endif
+    #endif
+  }
+
+  size_t cthreads_registry_snapshot(struct cthreads_thread_stats *stats, size_t max) {
+    struct __cthreads_registry_entry *entry;
+    size_t count = 0;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_registry_snapshot");
+    #endif
+
+    cthreads_lock_lock(&__cthreads_registry_lock);
+
+    for (entry = __cthreads_registry; entry; entry = entry->next) {
+      if (count < max) __cthreads_registry_sample(entry, &stats[count]);
+
+      count++;
+    }
+
+    cthreads_lock_unlock(&__cthreads_registry_lock);
+
+    return count;
+  }
+#endif
+
+#ifdef __CTHREADS_THREAD_HOOKS
+  static void __cthreads_thread_started(struct cthreads_args *args) {
+    #ifdef CTHREADS_REGISTRY
+      __cthreads_registry_started(args->entry);
+    #else
+      (void) args;
+    #endif
+
+    #ifdef CTHREADS_TRACE
+      __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, "cthreads_thread_start", NULL);
+    #endif
+  }
+
+  static void __cthreads_thread_finished(void) {
+    #ifdef CTHREADS_TRACE
+      __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, "cthreads_thread_exit", NULL);
+      __cthreads_trace_ring_release();
+    #endif
+
+    #ifdef CTHREADS_REGISTRY
+      __cthreads_registry_finished();
+    #endif
+  }
+#endif
+
+#ifdef CTHREADS_THREAD_NICE
+  /* INFO: Linux keeps a nice value per thread, which only the thread itself can name through its TID */
+  static void *__cthreads_pthread_nice_wrapper(void *data) {
+    struct cthreads_args *args = data;
+    void *(*func)(void *data) = args->func;
+    void *func_data = args->data;
+    int error = 0;
+
+    if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), args->nice) != 0) error = errno;
+
+    #ifdef __CTHREADS_THREAD_HOOKS
+      /* INFO: The hook still reads `args`, so it runs before handing it back */
+      if (!error) __cthreads_thread_started(args);
+    #endif
+
+    /* INFO: `args` belongs to the creator again once the result is published */
+    args->error = error;
+    cthreads_atomic_store_u32(&args->ready, 1, CTHREADS_ATOMIC_RELEASE);
+    __cthreads_futex_wake(&args->ready, 0);
+
+    if (error) return NULL;
+
+    #ifdef __CTHREADS_THREAD_HOOKS
+      void *ret;
+
+      pthread_cleanup_push(__cthreads_pthread_function_cleanup, NULL);
+      ret = func(func_data);
+      pthread_cleanup_pop(1);
+
+      return ret;
+    #else
+      return func(func_data);
+    #endif
+  }
 #endif
+
+int cthreads_thread_create(struct cthreads_thread *thread, struct cthreads_thread_attr *attr, void *(*func)(void *data), void *data, struct cthreads_args *args) {
   #ifdef CTHREADS_DEBUG
-    puts("cthreads_cond_init");
+    puts("cthreads_thread_create");
   #endif
 
+  /* INFO: POSIX path may not use it, but we must guarantee symmetry */
+  if (!args) return 1;
+
   #ifdef _WIN32
-    (void) attr;
+    args->func = func;
+    args->data = data;
 
-    InitializeConditionVariable(&cond->wCond);
+    #ifdef CTHREADS_REGISTRY
+      __cthreads_registry_prepare(attr, args);
+    #endif
 
-    return 0;
-  #else
-    pthread_condattr_t pAttr;
+    DWORD tid;
+    if (attr) {
+      int priority = attr->realtime ? THREAD_PRIORITY_TIME_CRITICAL : attr->priority;
+      DWORD flags = attr->dwCreationFlags ? (DWORD)attr->dwCreationFlags : 0;
 
-    /* CTHREADS_COND_ATTR is always available on non-Windows platforms */
+      /* INFO: Starts suspended so that the thread never runs a moment at the wrong priority */
+      thread->wThread = CreateThread(NULL, attr->stacksize ? attr->stacksize : 0,
+                                     __cthreads_winthreads_function_wrapper, args,
+                                     priority ? flags | CREATE_SUSPENDED : flags, &tid);
+
+      if (thread->wThread && priority) {
+        if (!SetThreadPriority(thread->wThread, priority)) {
+          DWORD error = GetLastError();
+
+          TerminateThread(thread->wThread, 0);
+          CloseHandle(thread->wThread);
+          thread->wThread = NULL;
+          #ifdef CTHREADS_REGISTRY
+            __cthreads_registry_discard(args);
+          #endif
+          SetLastError(error);
+
+          return 1;
+        }
+
+        if (!(flags & CREATE_SUSPENDED)) ResumeThread(thread->wThread);
+      }
+    } else {
+      thread->wThread = CreateThread(NULL, 0, __cthreads_winthreads_function_wrapper, args, 0, &tid);
+    }
+
+    /* INFO: If successful, write tid for later access */
+    if (thread->wThread) thread->wThreadId = tid;
+    #ifdef CTHREADS_REGISTRY
+      else __cthreads_registry_discard(args);
+    #endif
+
+    #ifdef CTHREADS_TRACE
+      if (thread->wThread) __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, "cthreads_thread_create", thread);
+    #endif
+
+    return thread->wThread == NULL;
+  #else
+    pthread_attr_t pAttr;
     if (attr) {
-      if (pthread_condattr_init(&pAttr) != 0) return 1;
+      if (pthread_attr_init(&pAttr)) return 1;
 
       int ret = 0;
-      if (attr->pshared) ret = pthread_condattr_setpshared(&pAttr, attr->pshared);
-      #ifdef CTHREADS_COND_CLOCK
-        if (ret == 0 && attr->clock) ret = pthread_condattr_setclock(&pAttr, attr->clock);
+      if (attr->detachstate) ret = pthread_attr_setdetachstate(&pAttr, attr->detachstate);
+      if (ret == 0 && attr->guardsize) ret = pthread_attr_setguardsize(&pAttr, attr->guardsize);
+      #ifdef CTHREADS_THREAD_INHERITSCHED
+        if (ret == 0 && attr->inheritsched) ret = pthread_attr_setinheritsched(&pAttr, attr->inheritsched);
+      #endif
+      if (ret == 0 && (attr->schedpolicy || attr->realtime)) ret = pthread_attr_setschedpolicy(&pAttr, attr->schedpolicy ? attr->schedpolicy : SCHED_FIFO);
+      if (ret == 0 && (attr->priority || attr->realtime)) {
+        struct sched_param param;
+
+        /* INFO: Priority 0 is out of range for SCHED_FIFO and SCHED_RR, so realtime alone takes the lowest one */
+        param.sched_priority = attr->priority ? attr->priority : sched_get_priority_min(attr->schedpolicy ? attr->schedpolicy : SCHED_FIFO);
+        ret = pthread_attr_setschedparam(&pAttr, &param);
+      }
+      #ifdef CTHREADS_THREAD_INHERITSCHED
+        /* INFO: Policy and priority are ignored while inherited, which is the default on most systems */
+        if (ret == 0 && !attr->inheritsched && (attr->schedpolicy || attr->realtime || attr->priority))
+          ret = pthread_attr_setinheritsched(&pAttr, PTHREAD_EXPLICIT_SCHED);
+      #endif
+      if (ret == 0 && attr->scope) ret = pthread_attr_setscope(&pAttr, attr->scope);
+      #ifdef CTHREADS_THREAD_STACK
+        if (ret == 0 && attr->stack) ret = pthread_attr_setstack(&pAttr, attr->stackaddr, attr->stack);
+        /* INFO: Using both _setstack and _setstacksize is disallowed by POSIX */
+        #ifdef CTHREADS_THREAD_STACKADDR
+        else
+        #endif
+      #endif
+      #ifdef CTHREADS_THREAD_STACKADDR
+        if (ret == 0 && attr->stacksize) ret = pthread_attr_setstacksize(&pAttr, attr->stacksize);
       #endif
 
       if (ret) {
-        pthread_condattr_destroy(&pAttr);
+        pthread_attr_destroy(&pAttr);
+        errno = ret;
 
         return 1;
       }
     }
 
-    #ifdef CTHREADS_COND_CLOCK
-      cond->clock = (attr && attr->clock) ? attr->clock : CLOCK_REALTIME;
+    #ifdef CTHREADS_REGISTRY
+      __cthreads_registry_prepare(attr, args);
     #endif
 
-    int ret = pthread_cond_init(&cond->pCond, attr ? &pAttr : NULL);
-    if (attr) pthread_condattr_destroy(&pAttr);
+    #ifdef CTHREADS_THREAD_NICE
+      if (attr && attr->nice) {
+        args->func = func;
+        args->data = data;
+        args->nice = attr->nice;
+        args->ready = 0;
+
+        /* INFO: Joinable until the handshake is over, so that a thread that failed can be reaped */
+        int ret = pthread_attr_setdetachstate(&pAttr, PTHREAD_CREATE_JOINABLE);
+        if (ret == 0) ret = pthread_create(&thread->pThread, &pAttr, __cthreads_pthread_nice_wrapper, args);
+        pthread_attr_destroy(&pAttr);
+
+        if (ret) {
+          #ifdef CTHREADS_REGISTRY
+            __cthreads_registry_discard(args);
+          #endif
+          errno = ret;
+
+          return 1;
+        }
+
+        while (!cthreads_atomic_load_u32(&args->ready, CTHREADS_ATOMIC_ACQUIRE))
+          __cthreads_futex_wait(&args->ready, 0, UINT64_MAX);
+
+        if (args->error) {
+          ret = args->error;
+          pthread_join(thread->pThread, NULL);
+          #ifdef CTHREADS_REGISTRY
+            __cthreads_registry_discard(args);
+          #endif
+          errno = ret;
+
+          return 1;
+        }
+
+        if (attr->detachstate == PTHREAD_CREATE_DETACHED) pthread_detach(thread->pThread);
+
+        #ifdef CTHREADS_TRACE
+          __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, "cthreads_thread_create", thread);
+        #endif
+
+        return 0;
+      }
+    #endif
+
+    #ifdef __CTHREADS_THREAD_HOOKS
+      /* INFO: Same contract as on Windows, `args` must outlive the start of the thread */
+      args->func = func;
+      args->data = data;
+
+      int ret = pthread_create(&thread->pThread, attr ? &pAttr : NULL, __cthreads_pthread_function_wrapper, args);
+    #else
+      int ret = pthread_create(&thread->pThread, attr ? &pAttr : NULL, func, data);
+    #endif
+    if (attr) pthread_attr_destroy(&pAttr);
+    if (ret) errno = ret;
+    #ifdef CTHREADS_REGISTRY
+      if (ret) __cthreads_registry_discard(args);
+    #endif
+
+    #ifdef CTHREADS_TRACE
+      if (ret == 0) __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, "cthreads_thread_create", thread);
+    #endif
 
     return ret;
   #endif
 }
 
-int cthreads_cond_signal(struct cthreads_cond *cond) {
+int cthreads_thread_detach(struct cthreads_thread thread) {
   #ifdef CTHREADS_DEBUG
-    puts("cthreads_cond_signal");
+    puts("cthreads_thread_detach");
   #endif
 
   #ifdef _WIN32
-    WakeConditionVariable(&cond->wCond);
-
-    return 0;
+    return CloseHandle(thread.wThread) == 0;
   #else
-    return pthread_cond_signal(&cond->pCond);
+    return pthread_detach(thread.pThread);
   #endif
 }
 
-int cthreads_cond_broadcast(struct cthreads_cond *cond) {
+int cthreads_thread_join(struct cthreads_thread thread, void *code) {
   #ifdef CTHREADS_DEBUG
-    puts("cthreads_cond_broadcast");
+    puts("cthreads_thread_join");
   #endif
 
   #ifdef _WIN32
-    WakeAllConditionVariable(&cond->wCond);
+    HANDLE handle = thread.wThread;
+    int opened = 0;
 
-    return 0;
-  #else
-    return pthread_cond_broadcast(&cond->pCond);
-  #endif
-}
+    if (!handle) {
+      handle = OpenThread(SYNCHRONIZE | THREAD_QUERY_INFORMATION, FALSE, thread.wThreadId);
+      if (!handle) return 1;
 
-int cthreads_cond_destroy(struct cthreads_cond *cond) {
+      opened = 1;
+    }
+  
+    if (WaitForSingleObject(handle, INFINITE) == WAIT_FAILED) {
+      if (opened) CloseHandle(handle);
+
+      return 1;
+    }
+
+    DWORD exit_code;
+    if (!GetExitCodeThread(handle, (LPDWORD)&exit_code)) {
+      if (opened) CloseHandle(handle);
+
+      return 1;
+    }
+
+    CloseHandle(handle);
+
+    if (code) *(void **)code = (void *)(uintptr_t)exit_code;
+
+    return cthreads_thread_detach(thread);
+  #else
+    return pthread_join(thread.pThread, code ? (void **)code : NULL);
+  #endif
+}
+
+#ifndef CTHREADS_INLINE
+int cthreads_thread_equal(struct cthreads_thread thread1, struct cthreads_thread thread2) {
   #ifdef CTHREADS_DEBUG
-    puts("cthreads_cond_destroy");
+    puts("cthreads_thread_equal");
+  #endif
+
+  #ifdef _WIN32
+    return thread1.wThreadId == thread2.wThreadId;
+  #else
+    return pthread_equal(thread1.pThread, thread2.pThread);
+  #endif
+}
+
+struct cthreads_thread cthreads_thread_self(void) {
+  struct cthreads_thread t;
+
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_thread_self");
+  #endif
+
+  #ifdef _WIN32
+    /* INFO: No real handle, only the ID. */
+    t.wThread = NULL;
+    t.wThreadId = GetCurrentThreadId();
+  #else
+    t.pThread = pthread_self();
+  #endif
+
+  return t;
+}
+#endif
+
+/*
+   INFO: This is a best-effort implementation on POSIX systems. There is no
+           reliable way to get the thread ID, as pthread_t is an opaque type.
+
+         On Windows we return the stable thread ID stored at creation.
+*/
+unsigned long cthreads_thread_id(struct cthreads_thread thread) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_thread_id");
+  #endif
+
+  #ifdef _WIN32
+    return (unsigned long)thread.wThreadId;
+  #else
+    return (unsigned long)(uintptr_t)thread.pThread;
+  #endif
+}
+
+void cthreads_thread_exit(void *code) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_thread_exit");
+  #endif
+
+  /* INFO: pthread_exit runs the wrapper's cleanup handler, which calls the hook instead */
+  #if defined(__CTHREADS_THREAD_HOOKS) && defined(_WIN32)
+    __cthreads_thread_finished();
+  #endif
+
+  #ifdef _WIN32
+    /* INFO: On Windows 64-bit, we cannot losslessly convert a pointer to a DWORD */
+    ExitThread((DWORD)(uintptr_t)code);
+  #else
+    pthread_exit(code);
+  #endif
+}
+
+int cthreads_thread_cancel(struct cthreads_thread thread) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_thread_cancel");
+  #endif
+
+  #ifdef _WIN32
+    HANDLE handle = thread.wThread;
+    int opened = 0;
+
+    if (!handle) {
+      handle = OpenThread(THREAD_TERMINATE, FALSE, thread.wThreadId);
+      if (!handle) return 1;
+
+      opened = 1;
+    }
+
+    BOOL ret = TerminateThread(handle, 0);
+    if (opened) CloseHandle(handle);
+
+    return ret == 0;
+  #else
+    return pthread_cancel(thread.pThread);
+  #endif
+}
+
+#ifdef CTHREADS_LOW_LATENCY
+  #ifdef __linux__
+    /* INFO: First CPU of the kernel's isolcpus= list, e.g. "2-3,6" */
+    static int __cthreads_isolated_cpu(void) {
+      FILE *file = fopen("/sys/devices/system/cpu/isolated", "r");
+      int cpu = -1;
+
+      if (!file) return -1;
+      if (fscanf(file, "%d", &cpu) != 1) cpu = -1;
+      fclose(file);
+
+      if (cpu < 0) errno = ENODEV;
+
+      return cpu;
+    }
+  #endif
+
+  int cthreads_thread_low_latency(struct cthreads_low_latency_attr *attr) {
+    int cpu = attr->cpu;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_thread_low_latency");
+    #endif
+
+    #ifdef _WIN32
+      /* INFO: Goes through the CRT heap like on POSIX, so later allocations reuse the committed pages */
+      if (attr->heap_prefault) {
+        volatile char *heap = malloc(attr->heap_prefault);
+        size_t i;
+
+        if (!heap) return CTHREADS_LOW_LATENCY_PREFAULT;
+
+        for (i = 0; i < attr->heap_prefault; i += 4096) heap[i] = 0;
+        free((void *)heap);
+      }
+
+      /* INFO: No mlockall on Windows, the prefaulted stack is what gets locked */
+      if (attr->stack_prefault) {
+        volatile char *stack = _alloca(attr->stack_prefault);
+        size_t i;
+
+        for (i = 0; i < attr->stack_prefault; i += 4096) stack[i] = 0;
+
+        if (attr->lock_memory) {
+          SIZE_T minimum, maximum;
+
+          if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum) ||
+              !SetProcessWorkingSetSize(GetCurrentProcess(), minimum + attr->stack_prefault, maximum + attr->stack_prefault) ||
+              !VirtualLock((void *)stack, attr->stack_prefault)) return CTHREADS_LOW_LATENCY_MEMLOCK;
+        }
+      }
+
+      if (cpu == CTHREADS_CPU_ISOLATED) {
+        SetLastError(ERROR_NOT_SUPPORTED);
+
+        return CTHREADS_LOW_LATENCY_AFFINITY;
+      }
+
+      if (cpu >= 0 && !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu)) return CTHREADS_LOW_LATENCY_AFFINITY;
+
+      if (attr->priority && !SetThreadPriority(GetCurrentThread(), attr->priority)) return CTHREADS_LOW_LATENCY_PRIORITY;
+    #else
+      if (attr->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) return CTHREADS_LOW_LATENCY_MEMLOCK;
+
+      if (attr->heap_prefault) {
+        volatile char *heap;
+        size_t i;
+
+        #ifdef __GLIBC__
+          /* INFO: Keeps freed memory in the arena instead of handing it back, so it stays faulted in */
+          if (!mallopt(M_TRIM_THRESHOLD, -1) || !mallopt(M_MMAP_MAX, 0)) {
+            errno = EINVAL;
+
+            return CTHREADS_LOW_LATENCY_PREFAULT;
+          }
+        #endif
+
+        heap = malloc(attr->heap_prefault);
+        if (!heap) return CTHREADS_LOW_LATENCY_PREFAULT;
+
+        for (i = 0; i < attr->heap_prefault; i += 4096) heap[i] = 0;
+        free((void *)heap);
+      }
+
+      if (attr->stack_prefault) {
+        volatile char *stack = alloca(attr->stack_prefault);
+        size_t i;
+
+        for (i = 0; i < attr->stack_prefault; i += 4096) stack[i] = 0;
+      }
+
+      if (cpu == CTHREADS_CPU_ISOLATED && (cpu = __cthreads_isolated_cpu()) < 0) return CTHREADS_LOW_LATENCY_AFFINITY;
+
+      if (cpu >= 0) {
+        unsigned long mask[1024 / (8 * sizeof(unsigned long))] = { 0 };
+
+        if ((size_t)cpu >= 8 * sizeof(mask)) {
+          errno = EINVAL;
+
+          return CTHREADS_LOW_LATENCY_AFFINITY;
+        }
+
+        mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) != 0) return CTHREADS_LOW_LATENCY_AFFINITY;
+      }
+
+      if (attr->priority) {
+        struct sched_param param;
+        int ret;
+
+        param.sched_priority = attr->priority;
+        ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret) {
+          errno = ret;
+
+          return CTHREADS_LOW_LATENCY_PRIORITY;
+        }
+      }
+    #endif
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_MUTEX_ATTR
+  int cthreads_mutex_init(struct cthreads_mutex *mutex, struct cthreads_mutex_attr *attr) {
+#else
+  int cthreads_mutex_init(struct cthreads_mutex *mutex, void *attr) {
+#endif
+  #ifdef _WIN32
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mutex_init");
+    #endif
+
+    (void) attr;
+
+    InitializeCriticalSection(&mutex->wMutex);
+
+    return 0;
+  #else
+    pthread_mutexattr_t pAttr;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mutex_init");
+    #endif
+  
+    /* CTHREADS_MUTEX_ATTR is always available on non-Windows platforms */
+    if (attr) {
+      if (pthread_mutexattr_init(&pAttr)) return 1;
+
+      int ret = 0;
+      if (attr->pshared) ret = pthread_mutexattr_setpshared(&pAttr, attr->pshared);
+      #ifdef CTHREADS_MUTEX_TYPE
+        if (ret == 0 && attr->type) ret = pthread_mutexattr_settype(&pAttr, attr->type);
+      #endif
+      #ifdef CTHREADS_MUTEX_ROBUST
+        if (ret == 0 && attr->robust) ret = pthread_mutexattr_setrobust(&pAttr, attr->robust);
+      #endif
+      #ifdef CTHREADS_MUTEX_PROTOCOL
+        if (ret == 0 && attr->protocol) ret = pthread_mutexattr_setprotocol(&pAttr, attr->protocol);
+      #endif
+      #ifdef CTHREADS_MUTEX_PRIOCEILING
+        if (ret == 0 && attr->prioceiling) ret = pthread_mutexattr_setprioceiling(&pAttr, attr->prioceiling);
+      #endif
+
+      if (ret) {
+        pthread_mutexattr_destroy(&pAttr);
+
+        return 1;
+      }
+    }
+
+    int ret = pthread_mutex_init(&mutex->pMutex, attr ? &pAttr : NULL);
+    if (attr) pthread_mutexattr_destroy(&pAttr);
+
+    return ret;
+  #endif
+}
+
+#ifndef CTHREADS_INLINE
+int cthreads_mutex_lock(struct cthreads_mutex *mutex) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_mutex_lock");
+  #endif
+
+  #if defined(CTHREADS_TRACE) || defined(CTHREADS_REGISTRY)
+    /* INFO: Only contended acquisitions get a wait slice and count as blocked time */
+    #ifdef _WIN32
+      int ret = 0, contended = !TryEnterCriticalSection(&mutex->wMutex);
+    #else
+      int ret = pthread_mutex_trylock(&mutex->pMutex), contended = ret == EBUSY;
+    #endif
+    if (contended) {
+      #ifdef CTHREADS_TRACE
+        __cthreads_trace_record(__CTHREADS_TRACE_BEGIN, "cthreads_mutex_wait", mutex);
+      #endif
+      #ifdef CTHREADS_REGISTRY
+        uint64_t start = __cthreads_registry_block_begin();
+      #endif
+
+      #ifdef _WIN32
+        EnterCriticalSection(&mutex->wMutex);
+      #else
+        ret = pthread_mutex_lock(&mutex->pMutex);
+      #endif
+
+      #ifdef CTHREADS_REGISTRY
+        __cthreads_registry_block_end(start);
+      #endif
+      #ifdef CTHREADS_TRACE
+        __cthreads_trace_record(__CTHREADS_TRACE_END, "cthreads_mutex_wait", mutex);
+      #endif
+    }
+    #ifdef CTHREADS_TRACE
+      if (ret == 0) __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, "cthreads_mutex_acquire", mutex);
+    #endif
+
+    return ret;
+  #elif defined(_WIN32)
+    EnterCriticalSection(&mutex->wMutex);
+
+    return 0;
+  #else
+    return pthread_mutex_lock(&mutex->pMutex);
+  #endif
+}
+
+int cthreads_mutex_trylock(struct cthreads_mutex *mutex) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_mutex_trylock");
   #endif
 
-  #ifdef _WIN32
+  #ifdef _WIN32
+    int ret = TryEnterCriticalSection(&mutex->wMutex) == 0;
+  #else
+    int ret = pthread_mutex_trylock(&mutex->pMutex);
+  #endif
+
+  #ifdef CTHREADS_TRACE
+    if (ret == 0) __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, "cthreads_mutex_acquire", mutex);
+  #endif
+
+  return ret;
+}
+
+int cthreads_mutex_unlock(struct cthreads_mutex *mutex) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_mutex_unlock");
+  #endif
+
+  #ifdef CTHREADS_TRACE
+    __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, "cthreads_mutex_release", mutex);
+  #endif
+
+  #ifdef _WIN32
+    LeaveCriticalSection(&mutex->wMutex);
+
+    return 0;
+  #else
+    return pthread_mutex_unlock(&mutex->pMutex);
+  #endif
+}
+#endif
+
+int cthreads_mutex_destroy(struct cthreads_mutex *mutex) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_mutex_destroy");
+  #endif
+
+  #ifdef _WIN32
+    DeleteCriticalSection(&mutex->wMutex);
+
+    return 0;
+  #else
+    return pthread_mutex_destroy(&mutex->pMutex);
+  #endif
+}
+
+#ifdef CTHREADS_MUTEX_ROBUST
+  int cthreads_mutex_consistent(struct cthreads_mutex *mutex) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mutex_consistent");
+    #endif
+
+    return pthread_mutex_consistent(&mutex->pMutex);
+  }
+#endif
+
+#ifdef CTHREADS_COND_ATTR
+  int cthreads_cond_init(struct cthreads_cond *cond, struct cthreads_cond_attr *attr) {
+#else
+  int cthreads_cond_init(struct cthreads_cond *cond, void *attr) {
+#endif
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_cond_init");
+  #endif
+
+  #ifdef _WIN32
+    (void) attr;
+
+    InitializeConditionVariable(&cond->wCond);
+
+    return 0;
+  #else
+    pthread_condattr_t pAttr;
+
+    /* CTHREADS_COND_ATTR is always available on non-Windows platforms */
+    if (attr) {
+      if (pthread_condattr_init(&pAttr) != 0) return 1;
+
+      int ret = 0;
+      if (attr->pshared) ret = pthread_condattr_setpshared(&pAttr, attr->pshared);
+      #ifdef CTHREADS_COND_CLOCK
+        if (ret == 0 && attr->clock) ret = pthread_condattr_setclock(&pAttr, attr->clock);
+      #endif
+
+      if (ret) {
+        pthread_condattr_destroy(&pAttr);
+
+        return 1;
+      }
+    }
+
+    #ifdef CTHREADS_COND_CLOCK
+      cond->clock = (attr && attr->clock) ? attr->clock : CLOCK_REALTIME;
+    #endif
+
+    int ret = pthread_cond_init(&cond->pCond, attr ? &pAttr : NULL);
+    if (attr) pthread_condattr_destroy(&pAttr);
+
+    return ret;
+  #endif
+}
+
+#ifndef CTHREADS_INLINE
+int cthreads_cond_signal(struct cthreads_cond *cond) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_cond_signal");
+  #endif
+
+  #ifdef _WIN32
+    WakeConditionVariable(&cond->wCond);
+
+    return 0;
+  #else
+    return pthread_cond_signal(&cond->pCond);
+  #endif
+}
+
+int cthreads_cond_broadcast(struct cthreads_cond *cond) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_cond_broadcast");
+  #endif
+
+  #ifdef _WIN32
+    WakeAllConditionVariable(&cond->wCond);
+
+    return 0;
+  #else
+    return pthread_cond_broadcast(&cond->pCond);
+  #endif
+}
+#endif
+
+int cthreads_cond_destroy(struct cthreads_cond *cond) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_cond_destroy");
+  #endif
+
+  #ifdef _WIN32
+    return 0;
+  #else
+    return pthread_cond_destroy(&cond->pCond);
+  #endif
+}
+
+#ifndef CTHREADS_INLINE
+int cthreads_cond_wait(struct cthreads_cond *cond, struct cthreads_mutex *mutex) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_cond_wait");
+  #endif
+
+  #ifdef CTHREADS_TRACE
+    __cthreads_trace_record(__CTHREADS_TRACE_BEGIN, "cthreads_cond_wait", cond);
+  #endif
+
+  #ifdef CTHREADS_REGISTRY
+    uint64_t start = __cthreads_registry_block_begin();
+  #endif
+
+  #ifdef _WIN32
+    int ret = SleepConditionVariableCS(&cond->wCond, &mutex->wMutex, INFINITE) == 0;
+  #else
+    int ret = pthread_cond_wait(&cond->pCond, &mutex->pMutex);
+  #endif
+
+  #ifdef CTHREADS_REGISTRY
+    __cthreads_registry_block_end(start);
+  #endif
+
+  #ifdef CTHREADS_TRACE
+    __cthreads_trace_record(__CTHREADS_TRACE_END, "cthreads_cond_wait", cond);
+  #endif
+
+  return ret;
+}
+#endif
+
+int cthreads_cond_timedwait(struct cthreads_cond *cond, struct cthreads_mutex *mutex, unsigned int ms) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_cond_wait");
+  #endif
+
+  #ifdef CTHREADS_TRACE
+    __cthreads_trace_record(__CTHREADS_TRACE_BEGIN, "cthreads_cond_wait", cond);
+  #endif
+
+  #ifdef CTHREADS_REGISTRY
+    uint64_t start = __cthreads_registry_block_begin();
+  #endif
+
+  #ifdef _WIN32
+    int ret = SleepConditionVariableCS(&cond->wCond, &mutex->wMutex, (DWORD)ms) == 0;
+  #else
+    struct timespec ts;
+    #ifdef CTHREADS_COND_CLOCK
+      if (clock_gettime(cond->clock, &ts)) return 1;
+    #else
+      if (clock_gettime(CLOCK_REALTIME, &ts)) return 1;
+    #endif
+
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    ts.tv_sec += ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+
+    int ret = pthread_cond_timedwait(&cond->pCond, &mutex->pMutex, &ts);
+  #endif
+
+  #ifdef CTHREADS_REGISTRY
+    __cthreads_registry_block_end(start);
+  #endif
+
+  #ifdef CTHREADS_TRACE
+    __cthreads_trace_record(__CTHREADS_TRACE_END, "cthreads_cond_wait", cond);
+  #endif
+
+  return ret;
+}
+
+#ifdef CTHREADS_RWLOCK
+  /*
+    INFO: Every exclusive owner, writers and the upgradable reader alike, first takes the
+            `upgrade` gate. Holding it across the shared -> exclusive and exclusive -> shared
+            transitions is what keeps other writers from slipping in between.
+  */
+  /* INFO: Takes the underlying lock, a contended acquisition counts as blocked time in registry builds */
+  static int __cthreads_rwlock_acquire(struct cthreads_rwlock *rwlock, int exclusive) {
+    int ret = 0;
+    #ifdef CTHREADS_REGISTRY
+      uint64_t start;
+
+      #ifdef _WIN32
+        if (exclusive ? TryAcquireSRWLockExclusive(rwlock->wRWLock) : TryAcquireSRWLockShared(rwlock->wRWLock)) return 0;
+      #else
+        ret = exclusive ? pthread_rwlock_trywrlock(&rwlock->pRWLock) : pthread_rwlock_tryrdlock(&rwlock->pRWLock);
+        if (ret != EBUSY) return ret;
+      #endif
+
+      start = __cthreads_registry_block_begin();
+    #endif
+
+    #ifdef _WIN32
+      if (exclusive) AcquireSRWLockExclusive(rwlock->wRWLock);
+      else AcquireSRWLockShared(rwlock->wRWLock);
+    #else
+      ret = exclusive ? pthread_rwlock_wrlock(&rwlock->pRWLock) : pthread_rwlock_rdlock(&rwlock->pRWLock);
+    #endif
+
+    #ifdef CTHREADS_REGISTRY
+      __cthreads_registry_block_end(start);
+    #endif
+
+    return ret;
+  }
+
+  int cthreads_rwlock_init(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_init");
+    #endif
+
+    if (cthreads_mutex_init(&rwlock->upgrade, NULL)) return 1;
+    rwlock->exclusive = 0;
+
+    #ifdef _WIN32
+      rwlock->wRWLock = malloc(sizeof(SRWLOCK));
+      if (!rwlock->wRWLock) {
+        cthreads_mutex_destroy(&rwlock->upgrade);
+
+        return 1;
+      }
+
+      InitializeSRWLock(rwlock->wRWLock);
+
+      return 0;
+    #else
+      int ret = pthread_rwlock_init(&rwlock->pRWLock, NULL);
+      if (ret) cthreads_mutex_destroy(&rwlock->upgrade);
+
+      return ret;
+    #endif
+  }
+
+  int cthreads_rwlock_rdlock(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_rdlock");
+    #endif
+
+    return __cthreads_rwlock_acquire(rwlock, 0);
+  }
+
+  int cthreads_rwlock_unlock_shared(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_unlock_shared");
+    #endif
+
+    #ifdef _WIN32
+      ReleaseSRWLockShared(rwlock->wRWLock);
+
+      return 0;
+    #else
+      /* INFO: POSIX allows releasing a write lock through here, which must release the gate too */
+      if (rwlock->exclusive) return cthreads_rwlock_unlock_exclusive(rwlock);
+
+      return pthread_rwlock_unlock(&rwlock->pRWLock);
+    #endif
+  }
+
+  int cthreads_rwlock_unlock_exclusive(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_unlock_exclusive");
+    #endif
+
+    rwlock->exclusive = 0;
+
+    #ifdef _WIN32
+      ReleaseSRWLockExclusive(rwlock->wRWLock);
+    #else
+      int ret = pthread_rwlock_unlock(&rwlock->pRWLock);
+      if (ret) return ret;
+    #endif
+
+    return cthreads_mutex_unlock(&rwlock->upgrade);
+  }
+
+  int cthreads_rwlock_wrlock(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_wrlock");
+    #endif
+
+    if (cthreads_mutex_lock(&rwlock->upgrade)) return 1;
+
+    int ret = __cthreads_rwlock_acquire(rwlock, 1);
+    if (ret) {
+      cthreads_mutex_unlock(&rwlock->upgrade);
+
+      return ret;
+    }
+
+    rwlock->exclusive = 1;
+
+    return 0;
+  }
+
+  int cthreads_rwlock_upgradable_lock(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_upgradable_lock");
+    #endif
+
+    if (cthreads_mutex_lock(&rwlock->upgrade)) return 1;
+
+    int ret = __cthreads_rwlock_acquire(rwlock, 0);
+    if (ret) {
+      cthreads_mutex_unlock(&rwlock->upgrade);
+
+      return ret;
+    }
+
+    return 0;
+  }
+
+  int cthreads_rwlock_unlock_upgradable(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_unlock_upgradable");
+    #endif
+
+    #ifdef _WIN32
+      ReleaseSRWLockShared(rwlock->wRWLock);
+    #else
+      int ret = pthread_rwlock_unlock(&rwlock->pRWLock);
+      if (ret) return ret;
+    #endif
+
+    return cthreads_mutex_unlock(&rwlock->upgrade);
+  }
+
+  int cthreads_rwlock_upgrade(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_upgrade");
+    #endif
+
+    /* INFO: Only plain readers can get in while the shared lock is released, and they cannot modify anything */
+    #ifdef _WIN32
+      ReleaseSRWLockShared(rwlock->wRWLock);
+      int ret = 0;
+    #else
+      int ret = pthread_rwlock_unlock(&rwlock->pRWLock);
+    #endif
+
+    if (ret == 0) ret = __cthreads_rwlock_acquire(rwlock, 1);
+    if (ret) return ret;
+
+    rwlock->exclusive = 1;
+
+    return 0;
+  }
+
+  int cthreads_rwlock_downgrade(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_downgrade");
+    #endif
+
+    rwlock->exclusive = 0;
+
+    #ifdef _WIN32
+      ReleaseSRWLockExclusive(rwlock->wRWLock);
+      int ret = 0;
+    #else
+      int ret = pthread_rwlock_unlock(&rwlock->pRWLock);
+    #endif
+
+    if (ret == 0) ret = __cthreads_rwlock_acquire(rwlock, 0);
+    if (ret) return ret;
+
+    return cthreads_mutex_unlock(&rwlock->upgrade);
+  }
+
+  int cthreads_rwlock_destroy(struct cthreads_rwlock *rwlock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_rwlock_destroy");
+    #endif
+
+    cthreads_mutex_destroy(&rwlock->upgrade);
+
+    #ifdef _WIN32
+      free(rwlock->wRWLock);
+      rwlock->wRWLock = NULL;
+
+      return 0;
+    #else
+      return pthread_rwlock_destroy(&rwlock->pRWLock);
+    #endif
+  }
+#endif
+
+int cthreads_error_code(void) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_error_code");
+  #endif
+
+  #ifdef _WIN32
+    return GetLastError();
+  #else
+    return errno;
+  #endif
+}
+
+size_t cthreads_error_string(int error_code, char *buf, size_t length) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_error_string");
+  #endif
+
+  if (length == 0) return 0;
+
+  #ifdef _WIN32
+    LPSTR error_str = NULL;
+
+    /* 
+      INFO: The string that is written also contains a \n, which we must ignore, besides the
+              NULL terminator.
+    */
+    DWORD format_ret = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                                      NULL, error_code, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&error_str, 0, NULL);
+    if (format_ret == 0) {
+      strncpy(buf, "Unknown error", length - 1);
+      buf[length - 1] = '\0';
+
+      return sizeof("Unknown error");
+    }
+
+    size_t error_str_len = (size_t)format_ret;
+
+    /* INFO: Remove trailing newline and carriage return */
+    while (error_str_len > 0 && (error_str[error_str_len - 1] == '\n' || error_str[error_str_len - 1] == '\r'))
+      error_str_len--;
+  #else
+    char error_buf[256];
+  #if defined(__GLIBC__) && defined(_GNU_SOURCE)
+    const char *error_str = strerror_r(error_code, error_buf, sizeof(error_buf));
+  #else
+    int strerror_ret = strerror_r(error_code, error_buf, sizeof(error_buf));
+    const char *error_str = (strerror_ret == 0) ? error_buf : "Unknown error";
+  #endif
+    const size_t error_str_len = strlen(error_str);
+  #endif
+
+  size_t final_len = length > error_str_len ? error_str_len : length - 1;
+  if (final_len == 0) return 0;
+
+  strncpy(buf, (char *)error_str, final_len);
+  buf[final_len] = '\0';
+
+  #ifdef _WIN32
+    LocalFree(error_str);
+  #endif
+
+  return error_str_len + 1;
+}
+
+#ifdef CTHREADS_WAIT_ANY
+  /* INFO: Shared notifier for `cthreads_wait_any` callers that cannot sleep on every object at once */
+  static uint32_t __cthreads_wait_any_sleepers;
+  static uint32_t __cthreads_wait_any_epoch;
+
+  /* INFO: Callers must have published their change with a sequentially consistent operation */
+  static __CTHREADS_INLINE void __cthreads_wait_any_notify(void) {
+    if (!cthreads_atomic_load_u32(&__cthreads_wait_any_sleepers, CTHREADS_ATOMIC_SEQ_CST)) return;
+
+    cthreads_atomic_fetch_add_u32(&__cthreads_wait_any_epoch, 1, CTHREADS_ATOMIC_RELEASE);
+    __cthreads_futex_wake(&__cthreads_wait_any_epoch, 1);
+  }
+#endif
+
+#ifdef CTHREADS_SEMAPHORE
+  #ifdef CTHREADS_ATOMIC
+    #define __CTHREADS_SEM_SPINS 64
+    #define __CTHREADS_SEM_MAX INT32_MAX
+
+    static __CTHREADS_INLINE int __cthreads_sem_take(struct cthreads_semaphore *sem, uint32_t n) {
+      uint32_t count = cthreads_atomic_load_u32(&sem->count, CTHREADS_ATOMIC_RELAXED);
+
+      while (count >= n) {
+        if (cthreads_atomic_cas_u32(&sem->count, &count, count - n, CTHREADS_ATOMIC_ACQUIRE)) return 1;
+      }
+
+      return 0;
+    }
+
+    /* INFO: `ns` is relative, UINT64_MAX waits forever. Returns 0 once the permits are taken, 1 on timeout */
+    static int __cthreads_sem_wait(struct cthreads_semaphore *sem, uint32_t n, uint64_t ns) {
+      uint64_t deadline = 0, now;
+      unsigned int spins;
+      uint32_t count;
+      int ret = 0;
+
+      for (spins = 0; spins < __CTHREADS_SEM_SPINS; spins++) {
+        if (__cthreads_sem_take(sem, n)) return 0;
+
+        cthreads_atomic_pause();
+      }
+
+      if (ns == 0) return 1;
+      if (ns != UINT64_MAX) deadline = __cthreads_monotonic_ns() + ns;
+
+      #ifdef CTHREADS_TRACE
+        __cthreads_trace_record(__CTHREADS_TRACE_BEGIN, "cthreads_sem_wait", sem);
+      #endif
+
+      /* INFO: Sequentially consistent on both sides, so either the poster sees us or we see its permits */
+      if (n > 1) cthreads_atomic_fetch_add_u32(&sem->bulk_waiters, 1, CTHREADS_ATOMIC_SEQ_CST);
+      cthreads_atomic_fetch_add_u32(&sem->waiters, 1, CTHREADS_ATOMIC_SEQ_CST);
+
+      for (;;) {
+        count = cthreads_atomic_load_u32(&sem->count, CTHREADS_ATOMIC_SEQ_CST);
+        if (count >= n) {
+          if (cthreads_atomic_cas_u32(&sem->count, &count, count - n, CTHREADS_ATOMIC_ACQUIRE)) break;
+
+          continue;
+        }
+
+        if (ns == UINT64_MAX) {
+          __cthreads_futex_wait(&sem->count, count, UINT64_MAX);
+
+          continue;
+        }
+
+        now = __cthreads_monotonic_ns();
+        if (now >= deadline) {
+          ret = 1;
+
+          break;
+        }
+
+        __cthreads_futex_wait(&sem->count, count, deadline - now);
+      }
+
+      if (n > 1) cthreads_atomic_fetch_add_u32(&sem->bulk_waiters, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+      cthreads_atomic_fetch_add_u32(&sem->waiters, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+
+      #ifdef CTHREADS_TRACE
+        __cthreads_trace_record(__CTHREADS_TRACE_END, "cthreads_sem_wait", sem);
+      #endif
+
+      return ret;
+    }
+
+    /* INFO: Same failure reporting as the OS semaphores: -1, with the reason in errno or GetLastError */
+    static __CTHREADS_INLINE int __cthreads_sem_fail(int timeout) {
+      #ifdef _WIN32
+        (void) timeout;
+
+        SetLastError(ERROR_TIMEOUT);
+      #else
+        errno = timeout ? ETIMEDOUT : EAGAIN;
+      #endif
+
+      return -1;
+    }
+
+    int cthreads_sem_init(struct cthreads_semaphore *sem, int initial_count) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_init");
+      #endif
+
+      if (initial_count < 0) return 1;
+
+      sem->count = (uint32_t)initial_count;
+      sem->waiters = 0;
+      sem->bulk_waiters = 0;
+
+      return 0;
+    }
+
+    int cthreads_sem_wait(struct cthreads_semaphore *sem) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_wait");
+      #endif
+
+      return __cthreads_sem_wait(sem, 1, UINT64_MAX);
+    }
+
+    int cthreads_sem_wait_n(struct cthreads_semaphore *sem, unsigned int count) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_wait_n");
+      #endif
+
+      if (count > __CTHREADS_SEM_MAX) return 1;
+      if (count == 0) return 0;
+
+      return __cthreads_sem_wait(sem, count, UINT64_MAX);
+    }
+
+    int cthreads_sem_trywait(struct cthreads_semaphore *sem) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_trywait");
+      #endif
+
+      return __cthreads_sem_take(sem, 1) ? 0 : __cthreads_sem_fail(0);
+    }
+
+    int cthreads_sem_trywait_n(struct cthreads_semaphore *sem, unsigned int count) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_trywait_n");
+      #endif
+
+      if (count > __CTHREADS_SEM_MAX) return 1;
+
+      return __cthreads_sem_take(sem, count) ? 0 : __cthreads_sem_fail(0);
+    }
+
+    int cthreads_sem_timedwait(struct cthreads_semaphore *sem, unsigned int ms) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_timedwait");
+      #endif
+
+      return __cthreads_sem_wait(sem, 1, (uint64_t)ms * 1000000) ? __cthreads_sem_fail(1) : 0;
+    }
+
+    int cthreads_sem_timedwait_n(struct cthreads_semaphore *sem, unsigned int count, unsigned int ms) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_timedwait_n");
+      #endif
+
+      if (count > __CTHREADS_SEM_MAX) return 1;
+      if (count == 0) return 0;
+
+      return __cthreads_sem_wait(sem, count, (uint64_t)ms * 1000000) ? __cthreads_sem_fail(1) : 0;
+    }
+
+    int cthreads_sem_post_n(struct cthreads_semaphore *sem, unsigned int count) {
+      uint32_t value, waiters;
+
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_post_n");
+      #endif
+
+      if (count == 0) return 0;
+
+      value = cthreads_atomic_load_u32(&sem->count, CTHREADS_ATOMIC_RELAXED);
+      do {
+        if (count > __CTHREADS_SEM_MAX - value) {
+          #ifndef _WIN32
+            errno = EOVERFLOW;
+          #endif
+
+          return -1;
+        }
+      } while (!cthreads_atomic_cas_u32(&sem->count, &value, value + count, CTHREADS_ATOMIC_SEQ_CST));
+
+      /* INFO: Pairs with waiters publishing themselves before their last look at the count */
+      waiters = cthreads_atomic_load_u32(&sem->waiters, CTHREADS_ATOMIC_SEQ_CST);
+      if (!waiters) return 0;
+
+      /* INFO: A waiter for several permits may need these and more, and a `cthreads_wait_any` waiter may take a wake without the permit, so only everyone rechecking is safe */
+      if (cthreads_atomic_load_u32(&sem->bulk_waiters, CTHREADS_ATOMIC_RELAXED)) __cthreads_futex_wake(&sem->count, 1);
+      else __cthreads_futex_wake_n(&sem->count, count < waiters ? count : waiters);
+
+      /* INFO: `cthreads_wait_any` counts itself as a waiter, so this stays off the uncontended path */
+      #ifdef CTHREADS_WAIT_ANY
+        __cthreads_wait_any_notify();
+      #endif
+
+      return 0;
+    }
+
+    int cthreads_sem_post(struct cthreads_semaphore *sem) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_post");
+      #endif
+
+      return cthreads_sem_post_n(sem, 1);
+    }
+
+    int cthreads_sem_destroy(struct cthreads_semaphore *sem) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_destroy");
+      #endif
+
+      (void) sem;
+
+      return 0;
+    }
+  #else
+    int cthreads_sem_init(struct cthreads_semaphore *sem, int initial_count) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_init");
+      #endif
+  
+      #ifdef _WIN32
+        sem->wSemaphore = CreateSemaphore(NULL, initial_count, LONG_MAX, NULL);
+
+        return sem->wSemaphore == NULL;
+      #else
+        return sem_init(&sem->pSemaphore,0, initial_count);
+      #endif
+    }
+  
+    int cthreads_sem_wait(struct cthreads_semaphore *sem) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_wait");
+      #endif
+
+      #ifdef CTHREADS_TRACE
+        __cthreads_trace_record(__CTHREADS_TRACE_BEGIN, "cthreads_sem_wait", sem);
+      #endif
+
+      #ifdef _WIN32
+        int ret = (WaitForSingleObject(sem->wSemaphore, INFINITE) != WAIT_OBJECT_0);
+      #else
+        int ret = sem_wait(&sem->pSemaphore);
+      #endif
+
+      #ifdef CTHREADS_TRACE
+        __cthreads_trace_record(__CTHREADS_TRACE_END, "cthreads_sem_wait", sem);
+      #endif
+
+      return ret;
+    }
+  
+    int cthreads_sem_trywait(struct cthreads_semaphore *sem) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_trywait");
+      #endif
+
+      #ifdef _WIN32
+        DWORD ret = WaitForSingleObject(sem->wSemaphore, 0);
+        if (ret == WAIT_OBJECT_0) return 0;
+        if (ret == WAIT_TIMEOUT) SetLastError(ERROR_TIMEOUT);
+
+        return -1;
+      #else
+        return sem_trywait(&sem->pSemaphore);
+      #endif
+    }
+  
+    int cthreads_sem_timedwait(struct cthreads_semaphore *sem, unsigned int ms) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_timedwait");
+      #endif
+
+      #ifdef CTHREADS_TRACE
+        __cthreads_trace_record(__CTHREADS_TRACE_BEGIN, "cthreads_sem_wait", sem);
+      #endif
+
+      #ifdef _WIN32
+        DWORD wait = WaitForSingleObject(sem->wSemaphore, (DWORD)ms);
+        int ret = 0;
+        if (wait != WAIT_OBJECT_0) {
+          if (wait == WAIT_TIMEOUT) SetLastError(ERROR_TIMEOUT);
+
+          ret = -1;
+        }
+      #else
+        struct timespec ts;
+        if (clock_gettime(CLOCK_REALTIME, &ts)) return 1;
+ 
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (ms % 1000) * 1000000;
+        ts.tv_sec += ts.tv_nsec / 1000000000;
+        ts.tv_nsec %= 1000000000;
+ 
+        int ret = sem_timedwait(&sem->pSemaphore, &ts);
+      #endif
+
+      #ifdef CTHREADS_TRACE
+        __cthreads_trace_record(__CTHREADS_TRACE_END, "cthreads_sem_wait", sem);
+      #endif
+
+      return ret;
+    }
+    int cthreads_sem_post(struct cthreads_semaphore *sem) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_post");
+      #endif
+
+      #ifdef _WIN32
+        return ReleaseSemaphore(sem->wSemaphore, 1, NULL) == 0;
+      #else
+        return sem_post(&sem->pSemaphore);
+      #endif
+    }
+  
+    int cthreads_sem_destroy(struct cthreads_semaphore *sem) {
+      #ifdef CTHREADS_DEBUG
+        puts("cthreads_sem_destroy");
+      #endif
+
+      #ifdef _WIN32
+        return CloseHandle(sem->wSemaphore) == 0;
+      #else
+        return sem_destroy(&sem->pSemaphore);
+      #endif
+    }
+  #endif
+#endif
+
+#ifdef CTHREADS_WAIT_ANY
+  #ifdef __linux__
+    /* INFO: Not in older kernel headers, the number is the same on every architecture */
+    #define __CTHREADS_SYS_FUTEX_WAITV 449
+    #define __CTHREADS_FUTEX2_SIZE_U32 0x02
+    #define __CTHREADS_FUTEX2_PRIVATE 128
+
+    struct __cthreads_futex_waitv {
+      uint64_t val;
+      uint64_t uaddr;
+      uint32_t flags;
+      uint32_t __reserved;
+    };
+
+    static uint32_t __cthreads_futex_waitv_missing;
+  #endif
+
+  /* INFO: Returns 1 and takes the permit, if any, of the first object that fired */
+  static int __cthreads_wait_any_poll(struct cthreads_wait_object *objects, size_t count, size_t *index) {
+    size_t i;
+
+    /* INFO: Pairs with posters and word updates reading the waiter counts after their change */
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+    for (i = 0; i < count; i++) {
+      if (objects[i].type == CTHREADS_WAIT_SEMAPHORE) {
+        if (!__cthreads_sem_take(objects[i].object, 1)) continue;
+      } else if (cthreads_atomic_load_u32(objects[i].object, CTHREADS_ATOMIC_ACQUIRE) == objects[i].value) {
+        continue;
+      }
+
+      if (index) *index = i;
+
+      return 1;
+    }
+
+    return 0;
+  }
+
+  #ifdef __linux__
+    /* INFO: Returns 0 once an object fired, CTHREADS_WAIT_TIMEOUT on timeout, or -1 without futex_waitv */
+    static int __cthreads_wait_any_waitv(struct cthreads_wait_object *objects, size_t count, uint64_t deadline, size_t *index) {
+      struct __cthreads_futex_waitv waiters[CTHREADS_WAIT_ANY_MAX];
+      struct timespec ts;
+      size_t i;
+
+      for (i = 0; i < count; i++) {
+        struct cthreads_semaphore *sem = objects[i].object;
+
+        waiters[i].val = objects[i].type == CTHREADS_WAIT_SEMAPHORE ? 0 : objects[i].value;
+        waiters[i].uaddr = (uint64_t)(uintptr_t)(objects[i].type == CTHREADS_WAIT_SEMAPHORE ? &sem->count : (uint32_t *)objects[i].object);
+        waiters[i].flags = __CTHREADS_FUTEX2_SIZE_U32 | __CTHREADS_FUTEX2_PRIVATE;
+        waiters[i].__reserved = 0;
+      }
+
+      ts.tv_sec = (time_t)(deadline / 1000000000);
+      ts.tv_nsec = (long)(deadline % 1000000000);
+
+      for (;;) {
+        if (__cthreads_wait_any_poll(objects, count, index)) return 0;
+        if (deadline != UINT64_MAX && __cthreads_monotonic_ns() >= deadline) return CTHREADS_WAIT_TIMEOUT;
+
+        #ifdef CTHREADS_REGISTRY
+          uint64_t start = __cthreads_registry_block_begin();
+        #endif
+
+        /* INFO: Woken, value changed or interrupted, all of them mean polling again */
+        long ret = syscall(__CTHREADS_SYS_FUTEX_WAITV, waiters, (unsigned int)count, 0, deadline == UINT64_MAX ? NULL : &ts, CLOCK_MONOTONIC);
+
+        #ifdef CTHREADS_REGISTRY
+          __cthreads_registry_block_end(start);
+        #endif
+
+        if (ret < 0 && errno == ENOSYS) {
+          cthreads_atomic_store_u32(&__cthreads_futex_waitv_missing, 1, CTHREADS_ATOMIC_RELAXED);
+
+          return -1;
+        }
+      }
+    }
+  #endif
+
+  int cthreads_wait_any(struct cthreads_wait_object *objects, size_t count, unsigned int ms, size_t *index) {
+    uint64_t deadline = UINT64_MAX, now;
+    uint32_t epoch;
+    size_t i;
+    int ret = -1;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_wait_any");
+    #endif
+
+    if (count == 0 || count > CTHREADS_WAIT_ANY_MAX) return 1;
+
+    for (i = 0; i < count; i++) {
+      if (objects[i].type != CTHREADS_WAIT_SEMAPHORE && objects[i].type != CTHREADS_WAIT_WORD) return 1;
+    }
+
+    if (__cthreads_wait_any_poll(objects, count, index)) return 0;
+    if (ms == 0) return CTHREADS_WAIT_TIMEOUT;
+    if (ms != CTHREADS_INFINITE) deadline = __cthreads_monotonic_ns() + (uint64_t)ms * 1000000;
+
+    #ifdef CTHREADS_TRACE
+      __cthreads_trace_record(__CTHREADS_TRACE_BEGIN, "cthreads_wait_any", objects);
+    #endif
+
+    /*
+      INFO: Makes posts on the semaphores wake us, whichever way we sleep. We count as a bulk waiter, as
+              another object may fire first and leave the permit, so a post must not spend its only wake on us.
+    */
+    for (i = 0; i < count; i++) {
+      if (objects[i].type == CTHREADS_WAIT_SEMAPHORE) {
+        cthreads_atomic_fetch_add_u32(&((struct cthreads_semaphore *)objects[i].object)->bulk_waiters, 1, CTHREADS_ATOMIC_SEQ_CST);
+        cthreads_atomic_fetch_add_u32(&((struct cthreads_semaphore *)objects[i].object)->waiters, 1, CTHREADS_ATOMIC_SEQ_CST);
+      }
+    }
+
+    #ifdef __linux__
+      if (!cthreads_atomic_load_u32(&__cthreads_futex_waitv_missing, CTHREADS_ATOMIC_RELAXED))
+        ret = __cthreads_wait_any_waitv(objects, count, deadline, index);
+    #endif
+
+    if (ret == -1) {
+      cthreads_atomic_fetch_add_u32(&__cthreads_wait_any_sleepers, 1, CTHREADS_ATOMIC_SEQ_CST);
+
+      for (;;) {
+        epoch = cthreads_atomic_load_u32(&__cthreads_wait_any_epoch, CTHREADS_ATOMIC_ACQUIRE);
+
+        if (__cthreads_wait_any_poll(objects, count, index)) {
+          ret = 0;
+
+          break;
+        }
+
+        if (deadline == UINT64_MAX) {
+          __cthreads_futex_wait(&__cthreads_wait_any_epoch, epoch, UINT64_MAX);
+
+          continue;
+        }
+
+        now = __cthreads_monotonic_ns();
+        if (now >= deadline) {
+          ret = CTHREADS_WAIT_TIMEOUT;
+
+          break;
+        }
+
+        __cthreads_futex_wait(&__cthreads_wait_any_epoch, epoch, deadline - now);
+      }
+
+      cthreads_atomic_fetch_add_u32(&__cthreads_wait_any_sleepers, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+    }
+
+    for (i = 0; i < count; i++) {
+      if (objects[i].type == CTHREADS_WAIT_SEMAPHORE) {
+        cthreads_atomic_fetch_add_u32(&((struct cthreads_semaphore *)objects[i].object)->bulk_waiters, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+        cthreads_atomic_fetch_add_u32(&((struct cthreads_semaphore *)objects[i].object)->waiters, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+      }
+    }
+
+    #ifdef CTHREADS_TRACE
+      __cthreads_trace_record(__CTHREADS_TRACE_END, "cthreads_wait_any", objects);
+    #endif
+
+    return ret;
+  }
+
+  void cthreads_word_store(uint32_t *word, uint32_t value) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_word_store");
+    #endif
+
+    cthreads_atomic_store_u32(word, value, CTHREADS_ATOMIC_SEQ_CST);
+
+    __cthreads_futex_wake(word, 1);
+    __cthreads_wait_any_notify();
+  }
+
+  uint32_t cthreads_word_add(uint32_t *word, uint32_t value) {
+    uint32_t previous;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_word_add");
+    #endif
+
+    previous = cthreads_atomic_fetch_add_u32(word, value, CTHREADS_ATOMIC_SEQ_CST);
+
+    __cthreads_futex_wake(word, 1);
+    __cthreads_wait_any_notify();
+
+    return previous;
+  }
+#endif
+
+
+
+#ifdef __CTHREADS_TLS_FAST
+  /* INFO: Rounds of destructors at thread exit, as destructors may set values again */
+  #define __CTHREADS_TLS_DESTRUCTOR_ROUNDS 4
+
+  __CTHREADS_THREAD_LOCAL void *__cthreads_tls_values[CTHREADS_TLS_KEYS];
+
+  /* INFO: Links the value arrays of the threads that set a value, so that deleting a key clears it everywhere */
+  struct __cthreads_tls_thread {
+    struct __cthreads_tls_thread *next;
+    struct __cthreads_tls_thread **pprev;
+    void **values;
+  };
+
+  static __CTHREADS_THREAD_LOCAL struct __cthreads_tls_thread __cthreads_tls_self;
+  static struct __cthreads_tls_thread *__cthreads_tls_threads;
+  static struct cthreads_lock __cthreads_tls_lock = CTHREADS_LOCK_INITIALIZER;
+  static void (*__cthreads_tls_destructors[CTHREADS_TLS_KEYS])(void *value);
+  static uint8_t __cthreads_tls_used[CTHREADS_TLS_KEYS];
+
+  static void __cthreads_tls_release(void *value) {
+    void (*destructors[CTHREADS_TLS_KEYS])(void *value);
+    unsigned int round;
+    size_t i;
+
+    (void) value;
+
+    for (round = 0; round < __CTHREADS_TLS_DESTRUCTOR_ROUNDS; round++) {
+      int ran = 0;
+
+      cthreads_lock_lock(&__cthreads_tls_lock);
+      memcpy(destructors, __cthreads_tls_destructors, sizeof(destructors));
+      cthreads_lock_unlock(&__cthreads_tls_lock);
+
+      for (i = 0; i < CTHREADS_TLS_KEYS; i++) {
+        void *data = __cthreads_tls_values[i];
+
+        if (!data || !destructors[i]) continue;
+
+        __cthreads_tls_values[i] = NULL;
+        destructors[i](data);
+        ran = 1;
+      }
+
+      if (!ran) break;
+    }
+
+    cthreads_lock_lock(&__cthreads_tls_lock);
+    *__cthreads_tls_self.pprev = __cthreads_tls_self.next;
+    if (__cthreads_tls_self.next) __cthreads_tls_self.next->pprev = __cthreads_tls_self.pprev;
+    cthreads_lock_unlock(&__cthreads_tls_lock);
+
+    __cthreads_tls_self.values = NULL;
+  }
+
+  #ifdef _WIN32
+    static DWORD __cthreads_tls_key = FLS_OUT_OF_INDEXES;
+    static INIT_ONCE __cthreads_tls_once = INIT_ONCE_STATIC_INIT;
+
+    static VOID WINAPI __cthreads_tls_callback(PVOID value) {
+      __cthreads_tls_release(value);
+    }
+
+    static BOOL CALLBACK __cthreads_tls_key_create(PINIT_ONCE once, PVOID param, PVOID *context) {
+      (void) once; (void) param; (void) context;
+
+      __cthreads_tls_key = FlsAlloc(__cthreads_tls_callback);
+
+      return TRUE;
+    }
+  #else
+    static pthread_key_t __cthreads_tls_key;
+    static int __cthreads_tls_key_ok;
+    static pthread_once_t __cthreads_tls_once = PTHREAD_ONCE_INIT;
+
+    static void __cthreads_tls_key_create(void) {
+      __cthreads_tls_key_ok = pthread_key_create(&__cthreads_tls_key, __cthreads_tls_release) == 0;
+    }
+  #endif
+
+  /* INFO: Run on the first value a thread sets, arming the exit callback that runs the destructors */
+  static int __cthreads_tls_register(void) {
+    #ifdef _WIN32
+      InitOnceExecuteOnce(&__cthreads_tls_once, __cthreads_tls_key_create, NULL, NULL);
+      if (__cthreads_tls_key == FLS_OUT_OF_INDEXES || !FlsSetValue(__cthreads_tls_key, &__cthreads_tls_self)) return 1;
+    #else
+      pthread_once(&__cthreads_tls_once, __cthreads_tls_key_create);
+      if (!__cthreads_tls_key_ok || pthread_setspecific(__cthreads_tls_key, &__cthreads_tls_self) != 0) return 1;
+    #endif
+
+    __cthreads_tls_self.values = __cthreads_tls_values;
+
+    cthreads_lock_lock(&__cthreads_tls_lock);
+    __cthreads_tls_self.next = __cthreads_tls_threads;
+    __cthreads_tls_self.pprev = &__cthreads_tls_threads;
+    if (__cthreads_tls_threads) __cthreads_tls_threads->pprev = &__cthreads_tls_self.next;
+    __cthreads_tls_threads = &__cthreads_tls_self;
+    cthreads_lock_unlock(&__cthreads_tls_lock);
+
+    return 0;
+  }
+#endif
+
+int cthreads_tls_create(struct cthreads_tls *tls, void (*destructor)(void *value)) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_tls_create");
+  #endif
+
+  #ifdef __CTHREADS_TLS_FAST
+    size_t i;
+
+    cthreads_lock_lock(&__cthreads_tls_lock);
+
+    for (i = 0; i < CTHREADS_TLS_KEYS; i++) {
+      if (__cthreads_tls_used[i]) continue;
+
+      __cthreads_tls_used[i] = 1;
+      __cthreads_tls_destructors[i] = destructor;
+      cthreads_lock_unlock(&__cthreads_tls_lock);
+
+      tls->index = i;
+
+      return 0;
+    }
+
+    cthreads_lock_unlock(&__cthreads_tls_lock);
+
+    return 1;
+  #elif defined(_WIN32)
+    (void) destructor;
+
+    tls->index = TlsAlloc();
+
+    return tls->index == TLS_OUT_OF_INDEXES;
+  #else
+    return pthread_key_create(&tls->key, destructor);
+  #endif
+}
+
+int cthreads_tls_set(struct cthreads_tls *tls, void *value) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_tls_set");
+  #endif
+
+  #ifdef __CTHREADS_TLS_FAST
+    if (!__cthreads_tls_self.values && value && __cthreads_tls_register()) return 1;
+
+    __cthreads_tls_values[tls->index] = value;
+
+    return 0;
+  #elif defined(_WIN32)
+    return TlsSetValue(tls->index, value) == 0;
+  #else
+    return pthread_setspecific(tls->key, value);
+  #endif
+}
+
+#ifndef __CTHREADS_TLS_FAST
+  void *cthreads_tls_get(struct cthreads_tls *tls) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_tls_get");
+    #endif
+
+    #ifdef _WIN32
+      return TlsGetValue(tls->index);
+    #else
+      return pthread_getspecific(tls->key);
+    #endif
+  }
+#endif
+
+int cthreads_tls_delete(struct cthreads_tls *tls) {
+  #ifdef CTHREADS_DEBUG
+    puts("cthreads_tls_delete");
+  #endif
+
+  #ifdef __CTHREADS_TLS_FAST
+    struct __cthreads_tls_thread *thread;
+
+    /* INFO: A later key reusing the index must start as NULL in every thread */
+    cthreads_lock_lock(&__cthreads_tls_lock);
+
+    for (thread = __cthreads_tls_threads; thread; thread = thread->next)
+      thread->values[tls->index] = NULL;
+
+    __cthreads_tls_destructors[tls->index] = NULL;
+    __cthreads_tls_used[tls->index] = 0;
+
+    cthreads_lock_unlock(&__cthreads_tls_lock);
+
+    return 0;
+  #elif defined(_WIN32)
+    return TlsFree(tls->index) == 0;
+  #else
+    return pthread_key_delete(tls->key);
+  #endif
+}
+
+#ifdef CTHREADS_ONCE
+  int __cthreads_once(struct cthreads_once *once, void (*func)(void)) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_once");
+    #endif
+
+    #ifdef CTHREADS_ATOMIC
+      uint32_t state = 0;
+
+      if (cthreads_atomic_cas_u32(&once->state, &state, __CTHREADS_ONCE_RUNNING, CTHREADS_ATOMIC_ACQUIRE)) {
+        func();
+
+        if (cthreads_atomic_exchange_u32(&once->state, __CTHREADS_ONCE_DONE, CTHREADS_ATOMIC_ACQ_REL) == __CTHREADS_ONCE_CONTENDED)
+          __cthreads_futex_wake(&once->state, 1);
+
+        return 0;
+      }
+
+      while (state != __CTHREADS_ONCE_DONE) {
+        if (state == __CTHREADS_ONCE_RUNNING) {
+          if (!cthreads_atomic_cas_u32(&once->state, &state, __CTHREADS_ONCE_CONTENDED, CTHREADS_ATOMIC_ACQUIRE)) continue;
+
+          state = __CTHREADS_ONCE_CONTENDED;
+        }
+
+        __cthreads_futex_wait(&once->state, __CTHREADS_ONCE_CONTENDED, UINT64_MAX);
+        state = cthreads_atomic_load_u32(&once->state, CTHREADS_ATOMIC_ACQUIRE);
+      }
+
+      return 0;
+    #else
+      return pthread_once(&once->pOnce, func);
+    #endif
+  }
+#endif
+
+#ifdef CTHREADS_STACK
+  #ifndef CTHREADS_ATOMIC_DWCAS
+    static __CTHREADS_INLINE uint64_t __cthreads_stack_index(struct cthreads_stack *stack, struct cthreads_stack_node *node) {
+      return node ? (uint64_t)((char *)node - stack->base) / stack->stride + 1 : 0;
+    }
+
+    static __CTHREADS_INLINE struct cthreads_stack_node *__cthreads_stack_node(struct cthreads_stack *stack, uint64_t head) {
+      uint32_t index = (uint32_t)head;
+
+      return index ? (struct cthreads_stack_node *)(stack->base + (size_t)(index - 1) * stack->stride) : NULL;
+    }
+  #endif
+
+  int cthreads_stack_init(struct cthreads_stack *stack, void *base, size_t stride) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_stack_init");
+    #endif
+
+    #ifdef CTHREADS_ATOMIC_DWCAS
+      stack->head.node = NULL;
+      stack->head.tag = 0;
+    #else
+      /* INFO: Without a double-width CAS, nodes are addressed by their index in `base` */
+      if (!base || !stride) return 1;
+
+      stack->head = 0;
+    #endif
+
+    stack->base = base;
+    stack->stride = stride;
+
+    return 0;
+  }
+
+  void cthreads_stack_push_chain(struct cthreads_stack *stack, struct cthreads_stack_node *first, struct cthreads_stack_node *last) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_stack_push_chain");
+    #endif
+
+    #ifdef CTHREADS_ATOMIC_DWCAS
+      uintptr_t old[2], new[2];
+
+      old[1] = (uintptr_t)cthreads_atomic_load_ptr((void *volatile *)&stack->head.tag, CTHREADS_ATOMIC_RELAXED);
+      old[0] = (uintptr_t)cthreads_atomic_load_ptr((void *volatile *)&stack->head.node, CTHREADS_ATOMIC_RELAXED);
+
+      do {
+        cthreads_atomic_store_ptr((void *volatile *)&last->next, (void *)old[0], CTHREADS_ATOMIC_RELAXED);
+        new[0] = (uintptr_t)first;
+        new[1] = old[1] + 1;
+      } while (!cthreads_atomic_dwcas(&stack->head, old, new));
+    #else
+      uint64_t old = cthreads_atomic_load_u64(&stack->head, CTHREADS_ATOMIC_RELAXED);
+      uint64_t new;
+
+      do {
+        cthreads_atomic_store_ptr((void *volatile *)&last->next, __cthreads_stack_node(stack, old), CTHREADS_ATOMIC_RELAXED);
+        new = (((old >> 32) + 1) << 32) | __cthreads_stack_index(stack, first);
+      } while (!cthreads_atomic_cas_u64(&stack->head, &old, new, CTHREADS_ATOMIC_ACQ_REL));
+    #endif
+  }
+
+  void cthreads_stack_push(struct cthreads_stack *stack, struct cthreads_stack_node *node) {
+    cthreads_stack_push_chain(stack, node, node);
+  }
+
+  struct cthreads_stack_node *cthreads_stack_pop(struct cthreads_stack *stack) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_stack_pop");
+    #endif
+
+    #ifdef CTHREADS_ATOMIC_DWCAS
+      uintptr_t old[2], new[2];
+
+      /* INFO: The tag is read first, so a torn read can only make the CAS fail */
+      old[1] = (uintptr_t)cthreads_atomic_load_ptr((void *volatile *)&stack->head.tag, CTHREADS_ATOMIC_ACQUIRE);
+      old[0] = (uintptr_t)cthreads_atomic_load_ptr((void *volatile *)&stack->head.node, CTHREADS_ATOMIC_ACQUIRE);
+
+      do {
+        if (!old[0]) return NULL;
+
+        /* INFO: May read a node already popped by another thread, the tag makes the CAS fail then */
+        new[0] = (uintptr_t)cthreads_atomic_load_ptr((void *volatile *)&((struct cthreads_stack_node *)old[0])->next, CTHREADS_ATOMIC_RELAXED);
+        new[1] = old[1] + 1;
+      } while (!cthreads_atomic_dwcas(&stack->head, old, new));
+
+      return (struct cthreads_stack_node *)old[0];
+    #else
+      uint64_t old = cthreads_atomic_load_u64(&stack->head, CTHREADS_ATOMIC_ACQUIRE);
+      uint64_t new;
+      struct cthreads_stack_node *node;
+
+      do {
+        node = __cthreads_stack_node(stack, old);
+        if (!node) return NULL;
+
+        new = (((old >> 32) + 1) << 32) | __cthreads_stack_index(stack, cthreads_atomic_load_ptr((void *volatile *)&node->next, CTHREADS_ATOMIC_RELAXED));
+      } while (!cthreads_atomic_cas_u64(&stack->head, &old, new, CTHREADS_ATOMIC_ACQ_REL));
+
+      return node;
+    #endif
+  }
+
+  struct cthreads_stack_node *cthreads_stack_pop_all(struct cthreads_stack *stack) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_stack_pop_all");
+    #endif
+
+    #ifdef CTHREADS_ATOMIC_DWCAS
+      uintptr_t old[2], new[2];
+
+      old[1] = (uintptr_t)cthreads_atomic_load_ptr((void *volatile *)&stack->head.tag, CTHREADS_ATOMIC_ACQUIRE);
+      old[0] = (uintptr_t)cthreads_atomic_load_ptr((void *volatile *)&stack->head.node, CTHREADS_ATOMIC_ACQUIRE);
+
+      do {
+        if (!old[0]) return NULL;
+
+        new[0] = 0;
+        new[1] = old[1] + 1;
+      } while (!cthreads_atomic_dwcas(&stack->head, old, new));
+
+      return (struct cthreads_stack_node *)old[0];
+    #else
+      uint64_t old = cthreads_atomic_load_u64(&stack->head, CTHREADS_ATOMIC_ACQUIRE);
+
+      do {
+        if (!(uint32_t)old) return NULL;
+      } while (!cthreads_atomic_cas_u64(&stack->head, &old, ((old >> 32) + 1) << 32, CTHREADS_ATOMIC_ACQ_REL));
+
+      return __cthreads_stack_node(stack, old);
+    #endif
+  }
+#endif
+
+#ifdef CTHREADS_OBJPOOL
+  /*
+    INFO: Magazines are indexed by a small per-thread slot, recycled when the thread exits,
+            so a new thread simply inherits the magazines of a dead one.
+  */
+  static struct cthreads_stack_node __cthreads_thread_slot_nodes[CTHREADS_OBJPOOL_THREADS];
+  #ifdef CTHREADS_ATOMIC_DWCAS
+    static struct cthreads_stack __cthreads_thread_slot_free = { { NULL, 0 }, (char *)__cthreads_thread_slot_nodes, sizeof(struct cthreads_stack_node) };
+  #else
+    static struct cthreads_stack __cthreads_thread_slot_free = { 0, (char *)__cthreads_thread_slot_nodes, sizeof(struct cthreads_stack_node) };
+  #endif
+  static uint32_t __cthreads_thread_slot_next;
+  /* INFO: Slot + 1, 0 when not assigned yet, UINT32_MAX when every slot is taken */
+  static __CTHREADS_THREAD_LOCAL uint32_t __cthreads_thread_slot_current;
+
+  #ifdef CTHREADS_SLAB
+    static void __cthreads_slab_thread_exit(long slot);
+  #endif
+
+  static void __cthreads_thread_slot_release(void *value) {
+    uint32_t slot = (uint32_t)(uintptr_t)value;
+
+    if (slot == 0 || slot == UINT32_MAX) return;
+
+    #ifdef CTHREADS_SLAB
+      __cthreads_slab_thread_exit((long)(slot - 1));
+    #endif
+
+    __cthreads_thread_slot_current = 0;
+    cthreads_stack_push(&__cthreads_thread_slot_free, &__cthreads_thread_slot_nodes[slot - 1]);
+  }
+
+  #ifdef _WIN32
+    static DWORD __cthreads_thread_slot_key = FLS_OUT_OF_INDEXES;
+    static INIT_ONCE __cthreads_thread_slot_once = INIT_ONCE_STATIC_INIT;
+
+    static VOID WINAPI __cthreads_thread_slot_callback(PVOID value) {
+      __cthreads_thread_slot_release(value);
+    }
+
+    static BOOL CALLBACK __cthreads_thread_slot_key_create(PINIT_ONCE once, PVOID param, PVOID *context) {
+      (void) once; (void) param; (void) context;
+
+      __cthreads_thread_slot_key = FlsAlloc(__cthreads_thread_slot_callback);
+
+      return TRUE;
+    }
+  #else
+    static pthread_key_t __cthreads_thread_slot_key;
+    static int __cthreads_thread_slot_key_ok;
+    static pthread_once_t __cthreads_thread_slot_once = PTHREAD_ONCE_INIT;
+
+    static void __cthreads_thread_slot_key_create(void) {
+      __cthreads_thread_slot_key_ok = pthread_key_create(&__cthreads_thread_slot_key, __cthreads_thread_slot_release) == 0;
+    }
+  #endif
+
+  static long __cthreads_thread_slot(void) {
+    uint32_t slot = __cthreads_thread_slot_current;
+    struct cthreads_stack_node *node;
+
+    if (slot) return slot == UINT32_MAX ? -1 : (long)(slot - 1);
+
+    node = cthreads_stack_pop(&__cthreads_thread_slot_free);
+    if (node) {
+      slot = (uint32_t)(node - __cthreads_thread_slot_nodes) + 1;
+    } else {
+      slot = cthreads_atomic_load_u32(&__cthreads_thread_slot_next, CTHREADS_ATOMIC_RELAXED);
+      do {
+        if (slot >= CTHREADS_OBJPOOL_THREADS) {
+          __cthreads_thread_slot_current = UINT32_MAX;
+
+          return -1;
+        }
+      } while (!cthreads_atomic_cas_u32(&__cthreads_thread_slot_next, &slot, slot + 1, CTHREADS_ATOMIC_RELAXED));
+
+      slot++;
+    }
+
+    /* INFO: Without an exit callback the slot is simply never recycled */
+    #ifdef _WIN32
+      InitOnceExecuteOnce(&__cthreads_thread_slot_once, __cthreads_thread_slot_key_create, NULL, NULL);
+      if (__cthreads_thread_slot_key != FLS_OUT_OF_INDEXES) FlsSetValue(__cthreads_thread_slot_key, (PVOID)(uintptr_t)slot);
+    #else
+      pthread_once(&__cthreads_thread_slot_once, __cthreads_thread_slot_key_create);
+      if (__cthreads_thread_slot_key_ok) pthread_setspecific(__cthreads_thread_slot_key, (void *)(uintptr_t)slot);
+    #endif
+
+    __cthreads_thread_slot_current = slot;
+
+    return (long)(slot - 1);
+  }
+
+  /* INFO: Layout of a free object while it sits in the depot, heading a batch */
+  struct __cthreads_objpool_batch {
+    struct cthreads_stack_node node;
+    struct __cthreads_objpool_batch *chain;
+    size_t count;
+  };
+
+  struct cthreads_objpool_magazines {
+    void **loaded;
+    void **previous;
+    size_t loaded_count;
+    size_t previous_count;
+    void *storage[2 * CTHREADS_OBJPOOL_MAGAZINE];
+  };
+
+  static void __cthreads_objpool_push_batch(struct cthreads_objpool *pool, void **objects, size_t count) {
+    struct __cthreads_objpool_batch *first = objects[0];
+    size_t i;
+
+    for (i = 0; i < count; i++)
+      ((struct __cthreads_objpool_batch *)objects[i])->chain = i + 1 < count ? objects[i + 1] : NULL;
+
+    first->count = count;
+
+    cthreads_stack_push(&pool->depot, &first->node);
+  }
+
+  static struct cthreads_objpool_magazines *__cthreads_objpool_magazines(struct cthreads_objpool *pool) {
+    struct cthreads_objpool_magazines *magazines;
+    long slot = __cthreads_thread_slot();
+
+    if (slot < 0) return NULL;
+
+    magazines = pool->magazines[slot];
+    if (magazines) return magazines;
+
+    magazines = malloc(sizeof(struct cthreads_objpool_magazines));
+    if (!magazines) return NULL;
+
+    magazines->loaded = magazines->storage;
+    magazines->previous = magazines->storage + CTHREADS_OBJPOOL_MAGAZINE;
+    magazines->loaded_count = 0;
+    magazines->previous_count = 0;
+
+    pool->magazines[slot] = magazines;
+
+    return magazines;
+  }
+
+  int cthreads_objpool_init(struct cthreads_objpool *pool, size_t object_size, size_t capacity) {
+    size_t i, count;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_objpool_init");
+    #endif
+
+    /* INFO: Index + generation packing limits the pool to 32-bit indexes */
+    if (capacity == 0 || capacity >= UINT32_MAX) return 1;
+
+    pool->stride = object_size > sizeof(struct __cthreads_objpool_batch) ? object_size : sizeof(struct __cthreads_objpool_batch);
+    pool->stride = (pool->stride + 2 * sizeof(void *) - 1) & ~(2 * sizeof(void *) - 1);
+    pool->capacity = capacity;
+
+    if (pool->stride > SIZE_MAX / capacity) return 1;
+
+    pool->arena = malloc(pool->stride * capacity);
+    if (!pool->arena) return 1;
+
+    pool->magazines = calloc(CTHREADS_OBJPOOL_THREADS, sizeof(struct cthreads_objpool_magazines *));
+    if (!pool->magazines) {
+      free(pool->arena);
+
+      return 1;
+    }
+
+    if (cthreads_stack_init(&pool->depot, pool->arena, pool->stride)) {
+      free(pool->magazines);
+      free(pool->arena);
+
+      return 1;
+    }
+
+    for (i = 0; i < capacity; i += count) {
+      struct __cthreads_objpool_batch *batch = (struct __cthreads_objpool_batch *)(pool->arena + i * pool->stride);
+      size_t j;
+
+      count = capacity - i < CTHREADS_OBJPOOL_MAGAZINE ? capacity - i : CTHREADS_OBJPOOL_MAGAZINE;
+      for (j = 0; j < count; j++)
+        ((struct __cthreads_objpool_batch *)((char *)batch + j * pool->stride))->chain = j + 1 < count ? (struct __cthreads_objpool_batch *)((char *)batch + (j + 1) * pool->stride) : NULL;
+
+      batch->count = count;
+      cthreads_stack_push(&pool->depot, &batch->node);
+    }
+
+    return 0;
+  }
+
+  void *cthreads_objpool_alloc(struct cthreads_objpool *pool) {
+    struct cthreads_objpool_magazines *magazines;
+    struct __cthreads_objpool_batch *batch;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_objpool_alloc");
+    #endif
+
+    magazines = __cthreads_objpool_magazines(pool);
+    if (magazines) {
+      if (magazines->loaded_count) return magazines->loaded[--magazines->loaded_count];
+
+      if (magazines->previous_count) {
+        void **loaded = magazines->loaded;
+
+        magazines->loaded = magazines->previous;
+        magazines->loaded_count = magazines->previous_count;
+        magazines->previous = loaded;
+        magazines->previous_count = 0;
+
+        return magazines->loaded[--magazines->loaded_count];
+      }
+    }
+
+    batch = (struct __cthreads_objpool_batch *)cthreads_stack_pop(&pool->depot);
+    if (!batch) return NULL;
+
+    if (magazines) {
+      struct __cthreads_objpool_batch *object;
+
+      for (object = batch->chain; object; object = object->chain)
+        magazines->loaded[magazines->loaded_count++] = object;
+    } else if (batch->count > 1) {
+      /* INFO: Threads without magazines put the rest of the batch straight back */
+      batch->chain->count = batch->count - 1;
+      cthreads_stack_push(&pool->depot, &batch->chain->node);
+    }
+
+    return batch;
+  }
+
+  void cthreads_objpool_free(struct cthreads_objpool *pool, void *object) {
+    struct cthreads_objpool_magazines *magazines;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_objpool_free");
+    #endif
+
+    magazines = __cthreads_objpool_magazines(pool);
+    if (!magazines) {
+      __cthreads_objpool_push_batch(pool, &object, 1);
+
+      return;
+    }
+
+    if (magazines->loaded_count == CTHREADS_OBJPOOL_MAGAZINE) {
+      void **loaded = magazines->loaded;
+
+      if (magazines->previous_count) __cthreads_objpool_push_batch(pool, magazines->previous, magazines->previous_count);
+
+      magazines->loaded = magazines->previous;
+      magazines->loaded_count = 0;
+      magazines->previous = loaded;
+      magazines->previous_count = CTHREADS_OBJPOOL_MAGAZINE;
+    }
+
+    magazines->loaded[magazines->loaded_count++] = object;
+  }
+
+  void cthreads_objpool_flush(struct cthreads_objpool *pool) {
+    struct cthreads_objpool_magazines *magazines;
+    long slot;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_objpool_flush");
+    #endif
+
+    slot = __cthreads_thread_slot();
+    if (slot < 0 || !pool->magazines[slot]) return;
+
+    magazines = pool->magazines[slot];
+
+    if (magazines->loaded_count) __cthreads_objpool_push_batch(pool, magazines->loaded, magazines->loaded_count);
+    if (magazines->previous_count) __cthreads_objpool_push_batch(pool, magazines->previous, magazines->previous_count);
+
+    magazines->loaded_count = 0;
+    magazines->previous_count = 0;
+  }
+
+  int cthreads_objpool_destroy(struct cthreads_objpool *pool) {
+    size_t i;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_objpool_destroy");
+    #endif
+
+    for (i = 0; i < CTHREADS_OBJPOOL_THREADS; i++)
+      free(pool->magazines[i]);
+
+    free(pool->magazines);
+    free(pool->arena);
+
+    pool->magazines = NULL;
+    pool->arena = NULL;
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_COMBINER
+  #define __CTHREADS_COMBINER_SPINS 64
+  #define __CTHREADS_COMBINER_PASSES 3
+
+  #define __CTHREADS_COMBINER_IDLE 0
+  #define __CTHREADS_COMBINER_PENDING 1
+  #define __CTHREADS_COMBINER_PARKED 2
+  #define __CTHREADS_COMBINER_DONE 3
+
+  /* INFO: One per thread slot and combiner, padded so that each waiter spins on its own line */
+  struct __cthreads_combiner_record {
+    void (*func)(void *data);
+    void *data;
+    struct __cthreads_combiner_record *next;
+    uint32_t state;
+    char __pad0[CTHREADS_CACHE_LINE - 3 * sizeof(void *) - sizeof(uint32_t)];
+  };
+
+  static struct __cthreads_combiner_record *__cthreads_combiner_record(struct cthreads_combiner *combiner) {
+    struct __cthreads_combiner_record *record;
+    long slot = __cthreads_thread_slot();
+
+    if (slot < 0) return NULL;
+
+    record = combiner->records[slot];
+    if (record) return record;
+
+    /* INFO: The padding only keeps waiters apart if the record also starts a line */
+    #ifdef _WIN32
+      record = _aligned_malloc(sizeof(struct __cthreads_combiner_record), CTHREADS_CACHE_LINE);
+      if (!record) return NULL;
+    #else
+      if (posix_memalign((void **)&record, CTHREADS_CACHE_LINE, sizeof(struct __cthreads_combiner_record)) != 0) return NULL;
+    #endif
+
+    record->state = __CTHREADS_COMBINER_IDLE;
+    record->next = cthreads_atomic_load_ptr((void *volatile *)&combiner->head, CTHREADS_ATOMIC_RELAXED);
+    while (!cthreads_atomic_cas_ptr((void *volatile *)&combiner->head, (void **)&record->next, record, CTHREADS_ATOMIC_RELEASE));
+
+    combiner->records[slot] = record;
+
+    return record;
+  }
+
+  static __CTHREADS_INLINE int __cthreads_combiner_trylock(struct cthreads_combiner *combiner) {
+    uint32_t unlocked = 0;
+
+    if (cthreads_atomic_load_u32(&combiner->lock, CTHREADS_ATOMIC_RELAXED)) return 0;
+
+    return cthreads_atomic_cas_u32(&combiner->lock, &unlocked, 1, CTHREADS_ATOMIC_ACQUIRE);
+  }
+
+  static void __cthreads_combiner_combine(struct cthreads_combiner *combiner) {
+    struct __cthreads_combiner_record *record;
+    unsigned int pass;
+    size_t served;
+
+    /* INFO: Later passes pick up the records published while a busy previous one ran */
+    for (pass = 0; pass < __CTHREADS_COMBINER_PASSES; pass++) {
+      served = 0;
+
+      record = cthreads_atomic_load_ptr((void *volatile *)&combiner->head, CTHREADS_ATOMIC_ACQUIRE);
+      for (; record; record = record->next) {
+        uint32_t state = cthreads_atomic_load_u32(&record->state, CTHREADS_ATOMIC_ACQUIRE);
+        if (state != __CTHREADS_COMBINER_PENDING && state != __CTHREADS_COMBINER_PARKED) continue;
+
+        record->func(record->data);
+        served++;
+
+        if (cthreads_atomic_exchange_u32(&record->state, __CTHREADS_COMBINER_DONE, CTHREADS_ATOMIC_ACQ_REL) == __CTHREADS_COMBINER_PARKED)
+          __cthreads_futex_wake(&record->state, 0);
+      }
+
+      if (served <= 1) break;
+    }
+  }
+
+  static void __cthreads_combiner_unlock(struct cthreads_combiner *combiner) {
+    struct __cthreads_combiner_record *record;
+
+    cthreads_atomic_store_u32(&combiner->lock, 0, CTHREADS_ATOMIC_RELEASE);
+
+    /* INFO: Pairs with waiters publishing PARKED before their last look at the lock */
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+    /* INFO: Hands the lock to a single waiter published too late for the last pass, which serves the rest */
+    record = cthreads_atomic_load_ptr((void *volatile *)&combiner->head, CTHREADS_ATOMIC_ACQUIRE);
+    for (; record; record = record->next) {
+      uint32_t state = cthreads_atomic_load_u32(&record->state, CTHREADS_ATOMIC_RELAXED);
+
+      if (state == __CTHREADS_COMBINER_PENDING) return;
+      if (state == __CTHREADS_COMBINER_PARKED) {
+        if (cthreads_atomic_cas_u32(&record->state, &state, __CTHREADS_COMBINER_PENDING, CTHREADS_ATOMIC_RELAXED))
+          __cthreads_futex_wake(&record->state, 0);
+
+        return;
+      }
+    }
+  }
+
+  int cthreads_combiner_init(struct cthreads_combiner *combiner) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_combiner_init");
+    #endif
+
+    combiner->records = calloc(CTHREADS_OBJPOOL_THREADS, sizeof(struct __cthreads_combiner_record *));
+    if (!combiner->records) return 1;
+
+    combiner->lock = 0;
+    combiner->head = NULL;
+
+    return 0;
+  }
+
+  void cthreads_combiner_execute(struct cthreads_combiner *combiner, void (*func)(void *data), void *data) {
+    struct __cthreads_combiner_record *record;
+    unsigned int spins = 0;
+    uint32_t state;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_combiner_execute");
+    #endif
+
+    record = __cthreads_combiner_record(combiner);
+    if (!record) {
+      while (!__cthreads_combiner_trylock(combiner)) {
+        if (++spins < __CTHREADS_COMBINER_SPINS) cthreads_atomic_pause();
+        else __cthreads_yield();
+      }
+
+      func(data);
+      __cthreads_combiner_unlock(combiner);
+
+      return;
+    }
+
+    record->func = func;
+    record->data = data;
+    cthreads_atomic_store_u32(&record->state, __CTHREADS_COMBINER_PENDING, CTHREADS_ATOMIC_RELEASE);
+
+    while (cthreads_atomic_load_u32(&record->state, CTHREADS_ATOMIC_ACQUIRE) != __CTHREADS_COMBINER_DONE) {
+      if (__cthreads_combiner_trylock(combiner)) {
+        /* INFO: Our own record is pending and published, so the first pass serves it */
+        __cthreads_combiner_combine(combiner);
+        __cthreads_combiner_unlock(combiner);
+
+        return;
+      }
+
+      if (++spins < __CTHREADS_COMBINER_SPINS) {
+        cthreads_atomic_pause();
+
+        continue;
+      }
+
+      spins = 0;
+
+      state = __CTHREADS_COMBINER_PENDING;
+      if (!cthreads_atomic_cas_u32(&record->state, &state, __CTHREADS_COMBINER_PARKED, CTHREADS_ATOMIC_SEQ_CST)) continue;
+
+      cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+      /* INFO: The combiner left before seeing us parked, so take over instead of sleeping */
+      if (cthreads_atomic_load_u32(&combiner->lock, CTHREADS_ATOMIC_RELAXED) == 0) {
+        state = __CTHREADS_COMBINER_PARKED;
+        cthreads_atomic_cas_u32(&record->state, &state, __CTHREADS_COMBINER_PENDING, CTHREADS_ATOMIC_RELAXED);
+
+        continue;
+      }
+
+      __cthreads_futex_wait(&record->state, __CTHREADS_COMBINER_PARKED, UINT64_MAX);
+    }
+  }
+
+  int cthreads_combiner_destroy(struct cthreads_combiner *combiner) {
+    struct __cthreads_combiner_record *record = combiner->head;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_combiner_destroy");
+    #endif
+
+    while (record) {
+      struct __cthreads_combiner_record *next = record->next;
+
+      #ifdef _WIN32
+        _aligned_free(record);
+      #else
+        free(record);
+      #endif
+      record = next;
+    }
+
+    free(combiner->records);
+
+    combiner->head = NULL;
+    combiner->records = NULL;
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_SLAB
+  #define __CTHREADS_SLAB_SPAN_SIZE 65536
+  #define __CTHREADS_SLAB_SPAN_MIN_OBJECTS 8
+
+  /* INFO: Heads every span, which is aligned to its size so that any object finds it by masking */
+  struct __cthreads_slab_span {
+    struct __cthreads_slab_span *next;
+    struct __cthreads_slab_cache *owner;
+  };
+
+  struct __cthreads_slab_cache {
+    /* INFO: Objects returned by other threads, only ever emptied at once by the owner */
+    void *remote;
+    char __pad0[CTHREADS_CACHE_LINE - sizeof(void *)];
+    void *local;
+    /* INFO: Objects of another cache freed by this one, returned as a single chain */
+    struct __cthreads_slab_cache *pending_owner;
+    void *pending_head;
+    void *pending_tail;
+    size_t pending_count;
+    char __pad1[CTHREADS_CACHE_LINE - 4 * sizeof(void *) - sizeof(size_t)];
+  };
+
+  /* INFO: Every live slab, so that an exiting thread can flush its caches */
+  static struct cthreads_slab *__cthreads_slabs;
+  static struct cthreads_lock __cthreads_slabs_lock = CTHREADS_LOCK_INITIALIZER;
+
+  static void *__cthreads_slab_span_alloc(size_t size) {
+    #ifdef _WIN32
+      return _aligned_malloc(size, size);
+    #else
+      void *span;
+
+      if (posix_memalign(&span, size, size) != 0) return NULL;
+
+      return span;
+    #endif
+  }
+
+  static void __cthreads_slab_span_free(void *span) {
+    #ifdef _WIN32
+      _aligned_free(span);
+    #else
+      free(span);
+    #endif
+  }
+
+  static void __cthreads_slab_flush_pending(struct __cthreads_slab_cache *cache) {
+    struct __cthreads_slab_cache *owner = cache->pending_owner;
+    void *head;
+
+    if (!cache->pending_head) return;
+
+    head = cthreads_atomic_load_ptr((void *volatile *)&owner->remote, CTHREADS_ATOMIC_RELAXED);
+    do {
+      *(void **)cache->pending_tail = head;
+    } while (!cthreads_atomic_cas_ptr((void *volatile *)&owner->remote, &head, cache->pending_head, CTHREADS_ATOMIC_RELEASE));
+
+    cache->pending_owner = NULL;
+    cache->pending_head = NULL;
+    cache->pending_tail = NULL;
+    cache->pending_count = 0;
+  }
+
+  /* INFO: Called from the thread slot destructor, before the slot goes back to the free list */
+  static void __cthreads_slab_thread_exit(long slot) {
+    struct cthreads_slab *slab;
+
+    cthreads_lock_lock(&__cthreads_slabs_lock);
+
+    for (slab = __cthreads_slabs; slab; slab = slab->next) {
+      if (slab->caches[slot]) __cthreads_slab_flush_pending(slab->caches[slot]);
+    }
+
+    cthreads_lock_unlock(&__cthreads_slabs_lock);
+  }
+
+  /* INFO: Cache of the calling thread, NULL when it has no slot, in which case the shared one must be locked */
+  static struct __cthreads_slab_cache *__cthreads_slab_cache(struct cthreads_slab *slab) {
+    struct __cthreads_slab_cache *cache;
+    long slot = __cthreads_thread_slot();
+
+    if (slot < 0) return NULL;
+
+    cache = slab->caches[slot];
+    if (cache) return cache;
+
+    cache = calloc(1, sizeof(struct __cthreads_slab_cache));
+    if (!cache) return NULL;
+
+    slab->caches[slot] = cache;
+
+    return cache;
+  }
+
+  static void *__cthreads_slab_refill(struct cthreads_slab *slab, struct __cthreads_slab_cache *cache) {
+    struct __cthreads_slab_span *span;
+    char *object;
+    void *chain;
+    size_t i;
+
+    /* INFO: Nothing else would ever return what this thread freed for others if it only allocates */
+    __cthreads_slab_flush_pending(cache);
+
+    chain = cthreads_atomic_exchange_ptr((void *volatile *)&cache->remote, NULL, CTHREADS_ATOMIC_ACQUIRE);
+    if (chain) return chain;
+
+    span = __cthreads_slab_span_alloc(slab->span_size);
+    if (!span) return NULL;
+
+    span->owner = cache;
+
+    object = (char *)span + slab->offset;
+    for (i = 0; i < slab->per_span - 1; i++) {
+      *(void **)object = object + slab->stride;
+      object += slab->stride;
+    }
+    *(void **)object = NULL;
+
+    cthreads_lock_lock(&slab->lock);
+    span->next = slab->spans;
+    slab->spans = span;
+    cthreads_lock_unlock(&slab->lock);
+
+    return (char *)span + slab->offset;
+  }
+
+  static void __cthreads_slab_release(struct cthreads_slab *slab, struct __cthreads_slab_cache *cache, void *object) {
+    struct __cthreads_slab_span *span = (struct __cthreads_slab_span *)((uintptr_t)object & ~(uintptr_t)(slab->span_size - 1));
+
+    if (span->owner == cache) {
+      *(void **)object = cache->local;
+      cache->local = object;
+
+      return;
+    }
+
+    if (cache->pending_owner != span->owner || cache->pending_count == CTHREADS_SLAB_BATCH)
+      __cthreads_slab_flush_pending(cache);
+
+    *(void **)object = cache->pending_head;
+    if (!cache->pending_head) cache->pending_tail = object;
+    cache->pending_head = object;
+    cache->pending_owner = span->owner;
+    cache->pending_count++;
+  }
+
+  int cthreads_slab_init(struct cthreads_slab *slab, size_t object_size) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_slab_init");
+    #endif
+
+    if (object_size < sizeof(void *)) object_size = sizeof(void *);
+
+    slab->stride = (object_size + CTHREADS_CACHE_LINE - 1) / CTHREADS_CACHE_LINE * CTHREADS_CACHE_LINE;
+    slab->offset = (sizeof(struct __cthreads_slab_span) + CTHREADS_CACHE_LINE - 1) / CTHREADS_CACHE_LINE * CTHREADS_CACHE_LINE;
+
+    /* INFO: Spans stay a power of two, as objects find theirs by masking */
+    slab->span_size = __CTHREADS_SLAB_SPAN_SIZE;
+    while ((slab->span_size - slab->offset) / slab->stride < __CTHREADS_SLAB_SPAN_MIN_OBJECTS) {
+      if (slab->span_size > SIZE_MAX / 2) return 1;
+
+      slab->span_size *= 2;
+    }
+    slab->per_span = (slab->span_size - slab->offset) / slab->stride;
+
+    /* INFO: One more cache, shared under a lock by threads without a slot */
+    slab->caches = calloc(CTHREADS_OBJPOOL_THREADS + 1, sizeof(struct __cthreads_slab_cache *));
+    if (!slab->caches) return 1;
+
+    slab->caches[CTHREADS_OBJPOOL_THREADS] = calloc(1, sizeof(struct __cthreads_slab_cache));
+    if (!slab->caches[CTHREADS_OBJPOOL_THREADS]) {
+      free(slab->caches);
+      slab->caches = NULL;
+
+      return 1;
+    }
+
+    cthreads_lock_init(&slab->lock);
+    cthreads_lock_init(&slab->shared_lock);
+    slab->spans = NULL;
+
+    cthreads_lock_lock(&__cthreads_slabs_lock);
+    slab->next = __cthreads_slabs;
+    __cthreads_slabs = slab;
+    cthreads_lock_unlock(&__cthreads_slabs_lock);
+
+    return 0;
+  }
+
+  void *cthreads_slab_alloc(struct cthreads_slab *slab) {
+    struct __cthreads_slab_cache *cache;
+    void *object;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_slab_alloc");
+    #endif
+
+    cache = __cthreads_slab_cache(slab);
+    if (!cache) {
+      cache = slab->caches[CTHREADS_OBJPOOL_THREADS];
+      cthreads_lock_lock(&slab->shared_lock);
+    }
+
+    object = cache->local;
+    if (!object) object = __cthreads_slab_refill(slab, cache);
+    if (object) cache->local = *(void **)object;
+
+    if (cache == slab->caches[CTHREADS_OBJPOOL_THREADS]) cthreads_lock_unlock(&slab->shared_lock);
+
+    return object;
+  }
+
+  void cthreads_slab_free(struct cthreads_slab *slab, void *object) {
+    struct __cthreads_slab_cache *cache;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_slab_free");
+    #endif
+
+    cache = __cthreads_slab_cache(slab);
+    if (cache) {
+      __cthreads_slab_release(slab, cache, object);
+
+      return;
+    }
+
+    cache = slab->caches[CTHREADS_OBJPOOL_THREADS];
+
+    cthreads_lock_lock(&slab->shared_lock);
+    __cthreads_slab_release(slab, cache, object);
+    cthreads_lock_unlock(&slab->shared_lock);
+  }
+
+  void cthreads_slab_flush(struct cthreads_slab *slab) {
+    struct __cthreads_slab_cache *cache;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_slab_flush");
+    #endif
+
+    cache = __cthreads_slab_cache(slab);
+    if (cache) {
+      __cthreads_slab_flush_pending(cache);
+
+      return;
+    }
+
+    cache = slab->caches[CTHREADS_OBJPOOL_THREADS];
+
+    cthreads_lock_lock(&slab->shared_lock);
+    __cthreads_slab_flush_pending(cache);
+    cthreads_lock_unlock(&slab->shared_lock);
+  }
+
+  int cthreads_slab_destroy(struct cthreads_slab *slab) {
+    struct cthreads_slab **link;
+    size_t i;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_slab_destroy");
+    #endif
+
+    cthreads_lock_lock(&__cthreads_slabs_lock);
+    for (link = &__cthreads_slabs; *link; link = &(*link)->next) {
+      if (*link == slab) {
+        *link = slab->next;
+
+        break;
+      }
+    }
+    cthreads_lock_unlock(&__cthreads_slabs_lock);
+
+    while (slab->spans) {
+      struct __cthreads_slab_span *next = slab->spans->next;
+
+      __cthreads_slab_span_free(slab->spans);
+      slab->spans = next;
+    }
+
+    for (i = 0; i <= CTHREADS_OBJPOOL_THREADS; i++) free(slab->caches[i]);
+    free(slab->caches);
+
+    slab->caches = NULL;
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_LEFTRIGHT
+  #define __CTHREADS_LEFTRIGHT_SPINS 64
+
+  struct __cthreads_leftright_indicator {
+    uint32_t readers;
+    char __pad0[CTHREADS_CACHE_LINE - sizeof(uint32_t)];
+  };
+
+  /* INFO: Spins, then yields, until every stripe of a version is empty. Readers only stay for one read. */
+  static void __cthreads_leftright_drain(struct cthreads_leftright *lr, uint32_t version) {
+    struct __cthreads_leftright_indicator *indicator = &lr->indicators[version * CTHREADS_LEFTRIGHT_STRIPES];
+    unsigned int spins = 0;
+    size_t i;
+
+    for (i = 0; i < CTHREADS_LEFTRIGHT_STRIPES; i++) {
+      while (cthreads_atomic_load_u32(&indicator[i].readers, CTHREADS_ATOMIC_SEQ_CST) != 0) {
+        if (++spins < __CTHREADS_LEFTRIGHT_SPINS) cthreads_atomic_pause();
+        else __cthreads_yield();
+      }
+    }
+  }
+
+  int cthreads_leftright_init(struct cthreads_leftright *lr, void *left, void *right) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_leftright_init");
+    #endif
+
+    lr->indicators = calloc(2 * CTHREADS_LEFTRIGHT_STRIPES, sizeof(struct __cthreads_leftright_indicator));
+    if (!lr->indicators) return 1;
+
+    lr->left_right = 0;
+    lr->version = 0;
+    lr->instances[0] = left;
+    lr->instances[1] = right;
+
+    return cthreads_lock_init(&lr->lock);
+  }
+
+  const void *cthreads_leftright_read_begin(struct cthreads_leftright *lr, size_t *token) {
+    long slot = __cthreads_thread_slot();
+    uint32_t version;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_leftright_read_begin");
+    #endif
+
+    /* INFO: Threads without a slot share the first stripe */
+    version = cthreads_atomic_load_u32(&lr->version, CTHREADS_ATOMIC_SEQ_CST);
+    *token = version * CTHREADS_LEFTRIGHT_STRIPES + (slot < 0 ? 0 : (size_t)slot % CTHREADS_LEFTRIGHT_STRIPES);
+
+    /* INFO: Must be visible before the instance is chosen, pairs with the writer's drain */
+    cthreads_atomic_fetch_add_u32(&lr->indicators[*token].readers, 1, CTHREADS_ATOMIC_SEQ_CST);
+
+    return lr->instances[cthreads_atomic_load_u32(&lr->left_right, CTHREADS_ATOMIC_SEQ_CST)];
+  }
+
+  void cthreads_leftright_read_end(struct cthreads_leftright *lr, size_t token) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_leftright_read_end");
+    #endif
+
+    cthreads_atomic_fetch_add_u32(&lr->indicators[token].readers, UINT32_MAX, CTHREADS_ATOMIC_RELEASE);
+  }
+
+  int cthreads_leftright_write(struct cthreads_leftright *lr, void (*apply)(void *instance, void *data), void *data) {
+    uint32_t current, version;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_leftright_write");
+    #endif
+
+    if (cthreads_lock_lock(&lr->lock)) return 1;
+
+    current = cthreads_atomic_load_u32(&lr->left_right, CTHREADS_ATOMIC_RELAXED);
+    apply(lr->instances[!current], data);
+    cthreads_atomic_store_u32(&lr->left_right, !current, CTHREADS_ATOMIC_SEQ_CST);
+
+    /*
+      INFO: A reader may have read the version before the flip and still be about to pick the
+              old instance, so both versions are drained around the toggle.
+    */
+    version = cthreads_atomic_load_u32(&lr->version, CTHREADS_ATOMIC_RELAXED);
+    __cthreads_leftright_drain(lr, !version);
+    cthreads_atomic_store_u32(&lr->version, !version, CTHREADS_ATOMIC_SEQ_CST);
+    __cthreads_leftright_drain(lr, version);
+
+    apply(lr->instances[current], data);
+
+    return cthreads_lock_unlock(&lr->lock);
+  }
+
+  int cthreads_leftright_destroy(struct cthreads_leftright *lr) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_leftright_destroy");
+    #endif
+
+    free(lr->indicators);
+    lr->indicators = NULL;
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_CHANNEL
+  /* INFO: One per blocked select call, shared by the waiters it queued on every channel */
+  struct __cthreads_chan_sleeper {
+    struct cthreads_mutex mutex;
+    struct cthreads_cond cond;
+    uint32_t selected;
+    int done;
+    int closed;
+  };
+
+  struct cthreads_chan_waiter {
+    struct cthreads_chan_waiter *prev;
+    struct cthreads_chan_waiter *next;
+    struct __cthreads_chan_sleeper *sleeper;
+    void *data;
+    uint32_t index;
+    int queued;
+  };
+
+  #define __CTHREADS_CHAN_NONE UINT32_MAX
+  #define __CTHREADS_CHAN_SELF (UINT32_MAX - 1)
+  #define __CTHREADS_CHAN_BLOCK -1
+  #define __CTHREADS_CHAN_LOCAL 8
+
+  #ifdef __CTHREADS_THREAD_LOCAL
+    static __CTHREADS_THREAD_LOCAL uint32_t __cthreads_select_seed;
+  #else
+    static uint32_t __cthreads_select_seed;
+  #endif
+
+  static void __cthreads_chan_enqueue(struct cthreads_chan_waiter **head, struct cthreads_chan_waiter **tail, struct cthreads_chan_waiter *waiter) {
+    waiter->next = NULL;
+    waiter->prev = *tail;
+    if (*tail) (*tail)->next = waiter;
+    else *head = waiter;
+    *tail = waiter;
+    waiter->queued = 1;
+  }
+
+  static void __cthreads_chan_unlink(struct cthreads_chan_waiter **head, struct cthreads_chan_waiter **tail, struct cthreads_chan_waiter *waiter) {
+    if (waiter->prev) waiter->prev->next = waiter->next;
+    else *head = waiter->next;
+    if (waiter->next) waiter->next->prev = waiter->prev;
+    else *tail = waiter->prev;
+    waiter->queued = 0;
+  }
+
+  /* INFO: Pops the first waiter whose select call has not been completed by another channel yet */
+  static struct cthreads_chan_waiter *__cthreads_chan_dequeue(struct cthreads_chan_waiter **head, struct cthreads_chan_waiter **tail) {
+    struct cthreads_chan_waiter *waiter;
+
+    while ((waiter = *head)) {
+      uint32_t none = __CTHREADS_CHAN_NONE;
+
+      __cthreads_chan_unlink(head, tail, waiter);
+
+      if (cthreads_atomic_cas_u32(&waiter->sleeper->selected, &none, waiter->index, CTHREADS_ATOMIC_ACQ_REL)) return waiter;
+    }
+
+    return NULL;
+  }
+
+  static void __cthreads_chan_wake(struct cthreads_chan_waiter *waiter, int closed) {
+    struct __cthreads_chan_sleeper *sleeper = waiter->sleeper;
+
+    cthreads_mutex_lock(&sleeper->mutex);
+    sleeper->closed = closed;
+    sleeper->done = 1;
+    cthreads_cond_signal(&sleeper->cond);
+    cthreads_mutex_unlock(&sleeper->mutex);
+  }
+
+  static __CTHREADS_INLINE char *__cthreads_chan_slot(struct cthreads_chan *chan, size_t index) {
+    return chan->buffer + ((chan->head + index) % chan->capacity) * chan->size;
+  }
+
+  static int __cthreads_chan_try_send(struct cthreads_chan *chan, const void *data) {
+    struct cthreads_chan_waiter *waiter;
+
+    if (chan->closed) return CTHREADS_CHAN_CLOSED;
+
+    /* INFO: A queued receiver implies an empty buffer, so the element goes straight to it */
+    if ((waiter = __cthreads_chan_dequeue(&chan->recvq, &chan->recvq_tail))) {
+      if (waiter->data) memcpy(waiter->data, data, chan->size);
+      __cthreads_chan_wake(waiter, 0);
+
+      return 0;
+    }
+
+    if (chan->count < chan->capacity) {
+      memcpy(__cthreads_chan_slot(chan, chan->count), data, chan->size);
+      chan->count++;
+
+      return 0;
+    }
+
+    return __CTHREADS_CHAN_BLOCK;
+  }
+
+  static int __cthreads_chan_try_recv(struct cthreads_chan *chan, void *data) {
+    struct cthreads_chan_waiter *waiter;
+
+    if (chan->count) {
+      if (data) memcpy(data, __cthreads_chan_slot(chan, 0), chan->size);
+      chan->head = (chan->head + 1) % chan->capacity;
+      chan->count--;
+
+      /* INFO: A queued sender implies a full buffer, its element takes the freed slot */
+      if ((waiter = __cthreads_chan_dequeue(&chan->sendq, &chan->sendq_tail))) {
+        memcpy(__cthreads_chan_slot(chan, chan->count), waiter->data, chan->size);
+        chan->count++;
+        __cthreads_chan_wake(waiter, 0);
+      }
+
+      return 0;
+    }
+
+    if ((waiter = __cthreads_chan_dequeue(&chan->sendq, &chan->sendq_tail))) {
+      if (data) memcpy(data, waiter->data, chan->size);
+      __cthreads_chan_wake(waiter, 0);
+
+      return 0;
+    }
+
+    if (chan->closed) {
+      if (data) memset(data, 0, chan->size);
+
+      return CTHREADS_CHAN_CLOSED;
+    }
+
+    return __CTHREADS_CHAN_BLOCK;
+  }
+
+  static void __cthreads_chan_lock_all(struct cthreads_chan **chans, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++)
+      cthreads_mutex_lock(&chans[i]->lock);
+  }
+
+  static void __cthreads_chan_unlock_all(struct cthreads_chan **chans, size_t count) {
+    size_t i;
+
+    for (i = count; i > 0; i--)
+      cthreads_mutex_unlock(&chans[i - 1]->lock);
+  }
+
+  int cthreads_chan_init(struct cthreads_chan *chan, size_t size, size_t capacity) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_chan_init");
+    #endif
+
+    chan->buffer = NULL;
+    if (capacity && size) {
+      if (size > SIZE_MAX / capacity) return 1;
+
+      chan->buffer = malloc(size * capacity);
+      if (!chan->buffer) return 1;
+    }
+
+    if (cthreads_mutex_init(&chan->lock, NULL)) {
+      free(chan->buffer);
+
+      return 1;
+    }
+
+    chan->size = size;
+    chan->capacity = capacity;
+    chan->head = 0;
+    chan->count = 0;
+    chan->closed = 0;
+    chan->recvq = NULL;
+    chan->recvq_tail = NULL;
+    chan->sendq = NULL;
+    chan->sendq_tail = NULL;
+
+    return 0;
+  }
+
+  int cthreads_chan_send(struct cthreads_chan *chan, const void *data) {
+    return cthreads_chan_timedsend(chan, data, CTHREADS_CHAN_INFINITE);
+  }
+
+  int cthreads_chan_timedsend(struct cthreads_chan *chan, const void *data, unsigned int ms) {
+    struct cthreads_select_case c;
+    size_t selected;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_chan_timedsend");
+    #endif
+
+    c.chan = chan;
+    c.op = CTHREADS_CHAN_SEND;
+    c.data = (void *)data;
+
+    return cthreads_select(&c, 1, ms, &selected);
+  }
+
+  int cthreads_chan_recv(struct cthreads_chan *chan, void *data) {
+    return cthreads_chan_timedrecv(chan, data, CTHREADS_CHAN_INFINITE);
+  }
+
+  int cthreads_chan_timedrecv(struct cthreads_chan *chan, void *data, unsigned int ms) {
+    struct cthreads_select_case c;
+    size_t selected;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_chan_timedrecv");
+    #endif
+
+    c.chan = chan;
+    c.op = CTHREADS_CHAN_RECV;
+    c.data = data;
+
+    return cthreads_select(&c, 1, ms, &selected);
+  }
+
+  int cthreads_chan_close(struct cthreads_chan *chan) {
+    struct cthreads_chan_waiter *waiter;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_chan_close");
+    #endif
+
+    cthreads_mutex_lock(&chan->lock);
+
+    if (chan->closed) {
+      cthreads_mutex_unlock(&chan->lock);
+
+      return 1;
+    }
+
+    chan->closed = 1;
+
+    /* INFO: Queued receivers imply an empty buffer, so all of them observe the close */
+    while ((waiter = __cthreads_chan_dequeue(&chan->recvq, &chan->recvq_tail))) {
+      if (waiter->data) memset(waiter->data, 0, chan->size);
+      __cthreads_chan_wake(waiter, 1);
+    }
+
+    while ((waiter = __cthreads_chan_dequeue(&chan->sendq, &chan->sendq_tail)))
+      __cthreads_chan_wake(waiter, 1);
+
+    cthreads_mutex_unlock(&chan->lock);
+
+    return 0;
+  }
+
+  int cthreads_chan_destroy(struct cthreads_chan *chan) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_chan_destroy");
+    #endif
+
+    free(chan->buffer);
+    chan->buffer = NULL;
+
+    return cthreads_mutex_destroy(&chan->lock);
+  }
+
+  int cthreads_select(struct cthreads_select_case *cases, size_t count, unsigned int ms, size_t *selected) {
+    struct cthreads_chan *local_chans[__CTHREADS_CHAN_LOCAL];
+    struct cthreads_chan_waiter local_waiters[__CTHREADS_CHAN_LOCAL];
+    struct cthreads_chan **chans = local_chans;
+    struct cthreads_chan_waiter *waiters = local_waiters;
+    struct __cthreads_chan_sleeper sleeper;
+    size_t chans_count = 0, start, i, j;
+    uint64_t deadline = 0;
+    int ret = CTHREADS_CHAN_TIMEOUT;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_select");
+    #endif
+
+    if (count > __CTHREADS_CHAN_LOCAL) {
+      chans = malloc(count * sizeof(struct cthreads_chan *));
+      waiters = malloc(count * sizeof(struct cthreads_chan_waiter));
+      if (!chans || !waiters) {
+        free(chans);
+        free(waiters);
+
+        return 1;
+      }
+    }
+
+    /* INFO: Channels are locked in address order, each once, so concurrent selects cannot deadlock */
+    for (i = 0; i < count; i++) {
+      struct cthreads_chan *chan = cases[i].chan;
+
+      if (!chan) continue;
+
+      for (j = chans_count; j > 0 && chans[j - 1] > chan; j--);
+      if (j > 0 && chans[j - 1] == chan) continue;
+
+      memmove(&chans[j + 1], &chans[j], (chans_count - j) * sizeof(struct cthreads_chan *));
+      chans[j] = chan;
+      chans_count++;
+    }
+
+    __cthreads_chan_lock_all(chans, chans_count);
+
+    /* INFO: Rotating the first polled case keeps one always-ready case from starving the others */
+    start = count ? __cthreads_select_seed++ % count : 0;
+    for (i = 0; i < count; i++) {
+      struct cthreads_select_case *c = &cases[(start + i) % count];
+
+      if (!c->chan) continue;
+
+      ret = c->op == CTHREADS_CHAN_SEND ? __cthreads_chan_try_send(c->chan, c->data) : __cthreads_chan_try_recv(c->chan, c->data);
+      if (ret != __CTHREADS_CHAN_BLOCK) {
+        __cthreads_chan_unlock_all(chans, chans_count);
+
+        *selected = (start + i) % count;
+
+        goto cleanup;
+      }
+    }
+
+    ret = CTHREADS_CHAN_TIMEOUT;
+
+    if (ms == 0) {
+      __cthreads_chan_unlock_all(chans, chans_count);
+
+      goto cleanup;
+    }
+
+    if (cthreads_mutex_init(&sleeper.mutex, NULL)) {
+      __cthreads_chan_unlock_all(chans, chans_count);
+      ret = 1;
+
+      goto cleanup;
+    }
+
+    if (cthreads_cond_init(&sleeper.cond, NULL)) {
+      __cthreads_chan_unlock_all(chans, chans_count);
+      cthreads_mutex_destroy(&sleeper.mutex);
+      ret = 1;
+
+      goto cleanup;
+    }
+
+    sleeper.selected = __CTHREADS_CHAN_NONE;
+    sleeper.done = 0;
+    sleeper.closed = 0;
+
+    for (i = 0; i < count; i++) {
+      struct cthreads_select_case *c = &cases[i];
+
+      waiters[i].queued = 0;
+      if (!c->chan) continue;
+
+      waiters[i].sleeper = &sleeper;
+      waiters[i].data = c->data;
+      waiters[i].index = (uint32_t)i;
+
+      if (c->op == CTHREADS_CHAN_SEND) __cthreads_chan_enqueue(&c->chan->sendq, &c->chan->sendq_tail, &waiters[i]);
+      else __cthreads_chan_enqueue(&c->chan->recvq, &c->chan->recvq_tail, &waiters[i]);
+    }
+
+    __cthreads_chan_unlock_all(chans, chans_count);
+
+    if (ms != CTHREADS_CHAN_INFINITE) deadline = __cthreads_monotonic_ns() + (uint64_t)ms * 1000000;
+
+    cthreads_mutex_lock(&sleeper.mutex);
+    while (!sleeper.done) {
+      if (ms == CTHREADS_CHAN_INFINITE) {
+        cthreads_cond_wait(&sleeper.cond, &sleeper.mutex);
+      } else {
+        uint64_t now = __cthreads_monotonic_ns();
+
+        if (now >= deadline) break;
+
+        cthreads_cond_timedwait(&sleeper.cond, &sleeper.mutex, (unsigned int)((deadline - now + 999999) / 1000000));
+      }
+    }
+    cthreads_mutex_unlock(&sleeper.mutex);
+
+    /*
+      INFO: A peer completes a case entirely under its channel lock, so once every lock is
+              held again, either a case was completed or no peer can complete one anymore.
+    */
+    __cthreads_chan_lock_all(chans, chans_count);
+
+    {
+      uint32_t none = __CTHREADS_CHAN_NONE;
+
+      if (cthreads_atomic_cas_u32(&sleeper.selected, &none, __CTHREADS_CHAN_SELF, CTHREADS_ATOMIC_ACQ_REL)) {
+        ret = CTHREADS_CHAN_TIMEOUT;
+      } else {
+        *selected = sleeper.selected;
+        ret = sleeper.closed ? CTHREADS_CHAN_CLOSED : 0;
+      }
+    }
+
+    for (i = 0; i < count; i++) {
+      struct cthreads_select_case *c = &cases[i];
+
+      if (!c->chan || !waiters[i].queued) continue;
+
+      if (c->op == CTHREADS_CHAN_SEND) __cthreads_chan_unlink(&c->chan->sendq, &c->chan->sendq_tail, &waiters[i]);
+      else __cthreads_chan_unlink(&c->chan->recvq, &c->chan->recvq_tail, &waiters[i]);
+    }
+
+    __cthreads_chan_unlock_all(chans, chans_count);
+
+    cthreads_cond_destroy(&sleeper.cond);
+    cthreads_mutex_destroy(&sleeper.mutex);
+
+    cleanup:
+    if (chans != local_chans) {
+      free(chans);
+      free(waiters);
+    }
+
+    return ret;
+  }
+#endif
+
+#ifdef CTHREADS_MPSC
+  #define __CTHREADS_MPSC_AWAKE 0
+  #define __CTHREADS_MPSC_PARKED 1
+
+  static __CTHREADS_INLINE void __cthreads_mpsc_link(struct cthreads_mpsc *queue, struct cthreads_mpsc_node *node) {
+    struct cthreads_mpsc_node *prev;
+
+    cthreads_atomic_store_ptr((void *volatile *)&node->next, NULL, CTHREADS_ATOMIC_RELAXED);
+    prev = cthreads_atomic_exchange_ptr((void *volatile *)&queue->head, node, CTHREADS_ATOMIC_ACQ_REL);
+    cthreads_atomic_store_ptr((void *volatile *)&prev->next, node, CTHREADS_ATOMIC_RELEASE);
+  }
+
+  int cthreads_mpsc_init(struct cthreads_mpsc *queue) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mpsc_init");
+    #endif
+
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+    queue->parked = __CTHREADS_MPSC_AWAKE;
+
+    return 0;
+  }
+
+  void cthreads_mpsc_push(struct cthreads_mpsc *queue, struct cthreads_mpsc_node *node) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mpsc_push");
+    #endif
+
+    __cthreads_mpsc_link(queue, node);
+
+    /* INFO: Pairs with the consumer publishing `parked` before its last emptiness check */
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+    if (cthreads_atomic_load_u32(&queue->parked, CTHREADS_ATOMIC_RELAXED) == __CTHREADS_MPSC_PARKED)
+      cthreads_mpsc_unpark(queue);
+  }
+
+  struct cthreads_mpsc_node *cthreads_mpsc_pop(struct cthreads_mpsc *queue) {
+    struct cthreads_mpsc_node *tail = queue->tail;
+    struct cthreads_mpsc_node *next = cthreads_atomic_load_ptr((void *volatile *)&tail->next, CTHREADS_ATOMIC_ACQUIRE);
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mpsc_pop");
+    #endif
+
+    if (tail == &queue->stub) {
+      if (!next) return NULL;
+
+      queue->tail = next;
+      tail = next;
+      next = cthreads_atomic_load_ptr((void *volatile *)&next->next, CTHREADS_ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+      queue->tail = next;
+
+      return tail;
+    }
+
+    /* INFO: A producer swapped the head but did not link it yet */
+    if (tail != cthreads_atomic_load_ptr((void *volatile *)&queue->head, CTHREADS_ATOMIC_ACQUIRE)) return NULL;
+
+    /* INFO: The last node can only be taken once something, the stub at worst, follows it */
+    __cthreads_mpsc_link(queue, &queue->stub);
+
+    next = cthreads_atomic_load_ptr((void *volatile *)&tail->next, CTHREADS_ATOMIC_ACQUIRE);
+    if (next) {
+      queue->tail = next;
+
+      return tail;
+    }
+
+    return NULL;
+  }
+
+  struct cthreads_mpsc_node *cthreads_mpsc_pop_all(struct cthreads_mpsc *queue) {
+    struct cthreads_mpsc_node *first = NULL;
+    struct cthreads_mpsc_node **link = &first;
+    struct cthreads_mpsc_node *tail = queue->tail;
+    struct cthreads_mpsc_node *next;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mpsc_pop_all");
+    #endif
+
+    /* INFO: Every node with a successor is detached, the stub is skipped wherever it is */
+    while ((next = cthreads_atomic_load_ptr((void *volatile *)&tail->next, CTHREADS_ATOMIC_ACQUIRE))) {
+      if (tail != &queue->stub) {
+        *link = tail;
+        link = &tail->next;
+      }
+
+      tail = next;
+    }
+
+    if (tail != &queue->stub && tail == cthreads_atomic_load_ptr((void *volatile *)&queue->head, CTHREADS_ATOMIC_ACQUIRE)) {
+      __cthreads_mpsc_link(queue, &queue->stub);
+
+      next = cthreads_atomic_load_ptr((void *volatile *)&tail->next, CTHREADS_ATOMIC_ACQUIRE);
+      if (next) {
+        *link = tail;
+        link = &tail->next;
+        tail = next;
+      }
+    }
+
+    *link = NULL;
+    queue->tail = tail;
+
+    return first;
+  }
+
+  int cthreads_mpsc_empty(struct cthreads_mpsc *queue) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mpsc_empty");
+    #endif
+
+    return queue->tail == &queue->stub && cthreads_atomic_load_ptr((void *volatile *)&queue->head, CTHREADS_ATOMIC_SEQ_CST) == &queue->stub;
+  }
+
+  int cthreads_mpsc_park(struct cthreads_mpsc *queue, unsigned int ms) {
+    uint64_t deadline = 0;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mpsc_park");
+    #endif
+
+    if (ms != CTHREADS_INFINITE) deadline = __cthreads_monotonic_ns() + (uint64_t)ms * 1000000;
+
+    cthreads_atomic_store_u32(&queue->parked, __CTHREADS_MPSC_PARKED, CTHREADS_ATOMIC_SEQ_CST);
+
+    while (cthreads_atomic_load_u32(&queue->parked, CTHREADS_ATOMIC_ACQUIRE) == __CTHREADS_MPSC_PARKED) {
+      uint64_t now;
+
+      if (!cthreads_mpsc_empty(queue)) break;
+
+      if (ms == CTHREADS_INFINITE) {
+        __cthreads_futex_wait(&queue->parked, __CTHREADS_MPSC_PARKED, UINT64_MAX);
+
+        continue;
+      }
+
+      now = __cthreads_monotonic_ns();
+      if (now >= deadline) {
+        cthreads_atomic_store_u32(&queue->parked, __CTHREADS_MPSC_AWAKE, CTHREADS_ATOMIC_RELAXED);
+
+        return cthreads_mpsc_empty(queue);
+      }
+
+      __cthreads_futex_wait(&queue->parked, __CTHREADS_MPSC_PARKED, deadline - now);
+    }
+
+    cthreads_atomic_store_u32(&queue->parked, __CTHREADS_MPSC_AWAKE, CTHREADS_ATOMIC_RELAXED);
+
+    return 0;
+  }
+
+  void cthreads_mpsc_unpark(struct cthreads_mpsc *queue) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mpsc_unpark");
+    #endif
+
+    if (cthreads_atomic_exchange_u32(&queue->parked, __CTHREADS_MPSC_AWAKE, CTHREADS_ATOMIC_RELEASE) == __CTHREADS_MPSC_PARKED)
+      __cthreads_futex_wake(&queue->parked, 0);
+  }
+#endif
+
+#ifdef CTHREADS_TRIPLEBUF
+  #define __CTHREADS_TRIPLEBUF_INDEX 3
+  #define __CTHREADS_TRIPLEBUF_FRESH 4
+
+  int cthreads_triplebuf_init(struct cthreads_triplebuf *buffer, void *first, void *second, void *third) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_triplebuf_init");
+    #endif
+
+    buffer->buffers[0] = first;
+    buffer->buffers[1] = second;
+    buffer->buffers[2] = third;
+    buffer->front = 0;
+    buffer->back = 1;
+    buffer->middle = 2;
+
+    return 0;
+  }
+
+  void *cthreads_triplebuf_write_buffer(struct cthreads_triplebuf *buffer) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_triplebuf_write_buffer");
+    #endif
+
+    return buffer->buffers[buffer->back];
+  }
+
+  void cthreads_triplebuf_publish(struct cthreads_triplebuf *buffer) {
+    uint32_t middle;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_triplebuf_publish");
+    #endif
+
+    middle = cthreads_atomic_exchange_u32(&buffer->middle, buffer->back | __CTHREADS_TRIPLEBUF_FRESH, CTHREADS_ATOMIC_ACQ_REL);
+    buffer->back = middle & __CTHREADS_TRIPLEBUF_INDEX;
+  }
+
+  const void *cthreads_triplebuf_read(struct cthreads_triplebuf *buffer, int *updated) {
+    int fresh;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_triplebuf_read");
+    #endif
+
+    fresh = (cthreads_atomic_load_u32(&buffer->middle, CTHREADS_ATOMIC_RELAXED) & __CTHREADS_TRIPLEBUF_FRESH) != 0;
+    if (fresh) {
+      uint32_t middle = cthreads_atomic_exchange_u32(&buffer->middle, buffer->front, CTHREADS_ATOMIC_ACQ_REL);
+
+      buffer->front = middle & __CTHREADS_TRIPLEBUF_INDEX;
+    }
+
+    if (updated) *updated = fresh;
+
+    return buffer->buffers[buffer->front];
+  }
+#endif
+
+#ifdef CTHREADS_DEQUE
+  #define __CTHREADS_DEQUE_CAPACITY 256
+
+  /* INFO: Thieves may still read from an outgrown array, so it is kept, chained, until the deque is destroyed */
+  struct __cthreads_deque_array {
+    struct __cthreads_deque_array *retired;
+    uint64_t mask;
+    void *items[1];
+  };
+
+  static struct __cthreads_deque_array *__cthreads_deque_array_create(uint64_t capacity, struct __cthreads_deque_array *retired) {
+    struct __cthreads_deque_array *array = malloc(sizeof(struct __cthreads_deque_array) + (size_t)(capacity - 1) * sizeof(void *));
+
+    if (!array) return NULL;
+
+    array->retired = retired;
+    array->mask = capacity - 1;
+
+    return array;
+  }
+
+  int cthreads_deque_init(struct cthreads_deque *deque, size_t capacity) {
+    uint64_t size = __CTHREADS_DEQUE_CAPACITY;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_deque_init");
+    #endif
+
+    if (capacity) {
+      for (size = 1; size < capacity; size <<= 1);
+    }
+
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->array = __cthreads_deque_array_create(size, NULL);
+
+    return deque->array == NULL;
+  }
+
+  int cthreads_deque_push(struct cthreads_deque *deque, void *item) {
+    uint64_t bottom = cthreads_atomic_load_u64(&deque->bottom, CTHREADS_ATOMIC_RELAXED);
+    uint64_t top = cthreads_atomic_load_u64(&deque->top, CTHREADS_ATOMIC_ACQUIRE);
+    struct __cthreads_deque_array *array = deque->array;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_deque_push");
+    #endif
+
+    if (bottom - top > array->mask) {
+      struct __cthreads_deque_array *grown = __cthreads_deque_array_create((array->mask + 1) * 2, array);
+      uint64_t i;
+
+      if (!grown) return 1;
+
+      for (i = top; i != bottom; i++)
+        grown->items[i & grown->mask] = cthreads_atomic_load_ptr(&array->items[i & array->mask], CTHREADS_ATOMIC_RELAXED);
+
+      cthreads_atomic_store_ptr((void *volatile *)&deque->array, grown, CTHREADS_ATOMIC_RELEASE);
+      array = grown;
+    }
+
+    /* INFO: The release store stands for the fence + relaxed store of the paper, which TSan does not model */
+    cthreads_atomic_store_ptr(&array->items[bottom & array->mask], item, CTHREADS_ATOMIC_RELAXED);
+    cthreads_atomic_store_u64(&deque->bottom, bottom + 1, CTHREADS_ATOMIC_RELEASE);
+
+    return 0;
+  }
+
+  void *cthreads_deque_pop(struct cthreads_deque *deque) {
+    uint64_t bottom = cthreads_atomic_load_u64(&deque->bottom, CTHREADS_ATOMIC_RELAXED) - 1;
+    struct __cthreads_deque_array *array = deque->array;
+    uint64_t top;
+    void *item;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_deque_pop");
+    #endif
+
+    cthreads_atomic_store_u64(&deque->bottom, bottom, CTHREADS_ATOMIC_RELAXED);
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+    top = cthreads_atomic_load_u64(&deque->top, CTHREADS_ATOMIC_RELAXED);
+
+    if ((int64_t)(bottom - top) < 0) {
+      cthreads_atomic_store_u64(&deque->bottom, bottom + 1, CTHREADS_ATOMIC_RELAXED);
+
+      return NULL;
+    }
+
+    item = cthreads_atomic_load_ptr(&array->items[bottom & array->mask], CTHREADS_ATOMIC_RELAXED);
+
+    /* INFO: The last item may be stolen concurrently, whoever moves `top` first gets it */
+    if (top == bottom) {
+      if (!cthreads_atomic_cas_u64(&deque->top, &top, top + 1, CTHREADS_ATOMIC_SEQ_CST)) item = NULL;
+
+      cthreads_atomic_store_u64(&deque->bottom, bottom + 1, CTHREADS_ATOMIC_RELAXED);
+    }
+
+    return item;
+  }
+
+  /* INFO: One steal attempt, returns 0 when empty, -1 when another thief or the owner won the race */
+  static int __cthreads_deque_steal(struct cthreads_deque *deque, void **item) {
+    uint64_t top = cthreads_atomic_load_u64(&deque->top, CTHREADS_ATOMIC_ACQUIRE);
+    struct __cthreads_deque_array *array;
+    uint64_t bottom;
+
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+    bottom = cthreads_atomic_load_u64(&deque->bottom, CTHREADS_ATOMIC_ACQUIRE);
+
+    if ((int64_t)(bottom - top) <= 0) return 0;
+
+    array = cthreads_atomic_load_ptr((void *volatile *)&deque->array, CTHREADS_ATOMIC_ACQUIRE);
+    *item = cthreads_atomic_load_ptr(&array->items[top & array->mask], CTHREADS_ATOMIC_RELAXED);
+
+    return cthreads_atomic_cas_u64(&deque->top, &top, top + 1, CTHREADS_ATOMIC_SEQ_CST) ? 1 : -1;
+  }
+
+  void *cthreads_deque_steal(struct cthreads_deque *deque) {
+    void *item;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_deque_steal");
+    #endif
+
+    while (1) {
+      int ret = __cthreads_deque_steal(deque, &item);
+
+      if (ret == 1) return item;
+      if (ret == 0) return NULL;
+    }
+  }
+
+  size_t cthreads_deque_steal_half(struct cthreads_deque *deque, void **items, size_t max) {
+    uint64_t top, bottom, half;
+    size_t count = 0;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_deque_steal_half");
+    #endif
+
+    top = cthreads_atomic_load_u64(&deque->top, CTHREADS_ATOMIC_ACQUIRE);
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+    bottom = cthreads_atomic_load_u64(&deque->bottom, CTHREADS_ATOMIC_ACQUIRE);
+
+    if ((int64_t)(bottom - top) <= 0) return 0;
+
+    half = (bottom - top + 1) / 2;
+    if (half < max) max = (size_t)half;
+
+    /*
+      INFO: A single CAS over the whole range could overlap items the owner took meanwhile,
+              as it pops without an RMW, so the range is claimed one CAS at a time. Those
+              CASes hit a line this thief already owns, and stop at the first lost race.
+    */
+    while (count < max) {
+      int ret = __cthreads_deque_steal(deque, &items[count]);
+
+      if (ret != 1) {
+        if (ret == 0 || count) break;
+
+        continue;
+      }
+
+      count++;
+    }
+
+    return count;
+  }
+
+  size_t cthreads_deque_size(struct cthreads_deque *deque) {
+    int64_t size = (int64_t)(cthreads_atomic_load_u64(&deque->bottom, CTHREADS_ATOMIC_RELAXED) - cthreads_atomic_load_u64(&deque->top, CTHREADS_ATOMIC_RELAXED));
+
+    return size > 0 ? (size_t)size : 0;
+  }
+
+  int cthreads_deque_destroy(struct cthreads_deque *deque) {
+    struct __cthreads_deque_array *array = deque->array;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_deque_destroy");
+    #endif
+
+    while (array) {
+      struct __cthreads_deque_array *retired = array->retired;
+
+      free(array);
+      array = retired;
+    }
+
+    deque->array = NULL;
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_PARKING_LOT
+  struct __cthreads_parker {
+    struct __cthreads_parker *next;
+    const void *address;
+    uintptr_t token;
+    /* INFO: Futex word, 1 while queued, 0 once unparked */
+    uint32_t parked;
+  };
+
+  struct __cthreads_park_bucket {
+    uint32_t lock;
+    struct __cthreads_parker *head;
+    struct __cthreads_parker *tail;
+    char __pad[CTHREADS_CACHE_LINE - sizeof(uint32_t) - 2 * sizeof(void *)];
+  };
+
+  static struct __cthreads_park_bucket __cthreads_park_buckets[CTHREADS_PARKING_LOT_BUCKETS];
+  static __CTHREADS_THREAD_LOCAL struct __cthreads_parker __cthreads_parker_self;
+
+  /* INFO: Bucket critical sections are a handful of pointer moves, so they spin, then yield */
+  static void __cthreads_spin_lock(uint32_t *lock) {
+    unsigned int spins = 0;
+
+    while (cthreads_atomic_load_u32(lock, CTHREADS_ATOMIC_RELAXED) || cthreads_atomic_exchange_u32(lock, 1, CTHREADS_ATOMIC_ACQUIRE)) {
+      if (++spins < 64) cthreads_atomic_pause();
+      else __cthreads_yield();
+    }
+  }
+
+  static __CTHREADS_INLINE void __cthreads_spin_unlock(uint32_t *lock) {
+    cthreads_atomic_store_u32(lock, 0, CTHREADS_ATOMIC_RELEASE);
+  }
+
+  static __CTHREADS_INLINE struct __cthreads_park_bucket *__cthreads_park_bucket(const void *address) {
+    uint64_t hash = (uint64_t)((uintptr_t)address >> 3) * UINT64_C(0x9E3779B97F4A7C15);
+
+    return &__cthreads_park_buckets[(hash >> 32) % CTHREADS_PARKING_LOT_BUCKETS];
+  }
+
+  static void __cthreads_park_lock_pair(struct __cthreads_park_bucket *a, struct __cthreads_park_bucket *b) {
+    if (a == b) {
+      __cthreads_spin_lock(&a->lock);
+    } else if (a < b) {
+      __cthreads_spin_lock(&a->lock);
+      __cthreads_spin_lock(&b->lock);
+    } else {
+      __cthreads_spin_lock(&b->lock);
+      __cthreads_spin_lock(&a->lock);
+    }
+  }
+
+  static void __cthreads_park_unlock_pair(struct __cthreads_park_bucket *a, struct __cthreads_park_bucket *b) {
+    __cthreads_spin_unlock(&a->lock);
+    if (a != b) __cthreads_spin_unlock(&b->lock);
+  }
+
+  static void __cthreads_park_append(struct __cthreads_park_bucket *bucket, struct __cthreads_parker *parker) {
+    parker->next = NULL;
+    if (bucket->tail) bucket->tail->next = parker;
+    else bucket->head = parker;
+    bucket->tail = parker;
+  }
+
+  /* INFO: Removes `parker`, whose predecessor in the bucket is `prev` (NULL for the head) */
+  static void __cthreads_park_remove(struct __cthreads_park_bucket *bucket, struct __cthreads_parker *prev, struct __cthreads_parker *parker) {
+    if (prev) prev->next = parker->next;
+    else bucket->head = parker->next;
+    if (bucket->tail == parker) bucket->tail = prev;
+  }
+
+  static int __cthreads_park_has(struct __cthreads_parker *parker, const void *address) {
+    for (; parker; parker = parker->next)
+      if (parker->address == address) return 1;
+
+    return 0;
+  }
+
+  int cthreads_park(const void *address, int (*validate)(void *context), void (*before_sleep)(void *context),
+                    void (*timed_out)(void *context, const void *address, int have_more), void *context,
+                    unsigned int ms, uintptr_t *token) {
+    struct __cthreads_parker *self = &__cthreads_parker_self;
+    struct __cthreads_park_bucket *bucket = __cthreads_park_bucket(address);
+    uint64_t deadline = 0;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_park");
+    #endif
+
+    __cthreads_spin_lock(&bucket->lock);
+
+    if (validate && !validate(context)) {
+      __cthreads_spin_unlock(&bucket->lock);
+
+      return CTHREADS_PARK_INVALID;
+    }
+
+    self->address = address;
+    self->token = 0;
+    cthreads_atomic_store_u32(&self->parked, 1, CTHREADS_ATOMIC_RELAXED);
+    __cthreads_park_append(bucket, self);
+
+    __cthreads_spin_unlock(&bucket->lock);
+
+    if (before_sleep) before_sleep(context);
+
+    if (ms != CTHREADS_INFINITE) deadline = __cthreads_monotonic_ns() + (uint64_t)ms * 1000000;
+
+    while (cthreads_atomic_load_u32(&self->parked, CTHREADS_ATOMIC_ACQUIRE)) {
+      uint64_t now;
+
+      if (ms == CTHREADS_INFINITE) {
+        __cthreads_futex_wait(&self->parked, 1, UINT64_MAX);
+
+        continue;
+      }
+
+      now = __cthreads_monotonic_ns();
+      if (now >= deadline) {
+        struct __cthreads_parker *prev = NULL, *parker;
+
+        /* INFO: A requeue may have moved the thread to another key, so the bucket is found under its lock */
+        for (;;) {
+          const void *current = self->address;
+
+          bucket = __cthreads_park_bucket(current);
+          __cthreads_spin_lock(&bucket->lock);
+          if (self->address == current) break;
+          __cthreads_spin_unlock(&bucket->lock);
+        }
+
+        if (!cthreads_atomic_load_u32(&self->parked, CTHREADS_ATOMIC_ACQUIRE)) {
+          __cthreads_spin_unlock(&bucket->lock);
+
+          break;
+        }
+
+        for (parker = bucket->head; parker != self; parker = parker->next)
+          prev = parker;
+
+        __cthreads_park_remove(bucket, prev, self);
+
+        if (timed_out) timed_out(context, self->address, __cthreads_park_has(bucket->head, self->address));
+
+        __cthreads_spin_unlock(&bucket->lock);
+
+        return CTHREADS_PARK_TIMEOUT;
+      }
+
+      __cthreads_futex_wait(&self->parked, 1, deadline - now);
+    }
+
+    if (token) *token = self->token;
+
+    return CTHREADS_PARK_UNPARKED;
+  }
+
+  size_t cthreads_unpark_one(const void *address, uintptr_t (*callback)(void *context, size_t unparked, int have_more), void *context) {
+    struct __cthreads_park_bucket *bucket = __cthreads_park_bucket(address);
+    struct __cthreads_parker *prev = NULL, *parker;
+    uintptr_t token;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_unpark_one");
+    #endif
+
+    __cthreads_spin_lock(&bucket->lock);
+
+    for (parker = bucket->head; parker && parker->address != address; parker = parker->next)
+      prev = parker;
+
+    if (parker) __cthreads_park_remove(bucket, prev, parker);
+
+    token = callback ? callback(context, parker ? 1 : 0, __cthreads_park_has(parker ? parker->next : NULL, address)) : 0;
+
+    if (!parker) {
+      __cthreads_spin_unlock(&bucket->lock);
+
+      return 0;
+    }
+
+    parker->token = token;
+    cthreads_atomic_store_u32(&parker->parked, 0, CTHREADS_ATOMIC_RELEASE);
+
+    __cthreads_spin_unlock(&bucket->lock);
+
+    /* INFO: The thread may already be gone, a stray wake is harmless as every wait loops */
+    __cthreads_futex_wake(&parker->parked, 1);
+
+    return 1;
+  }
+
+  size_t cthreads_unpark_all(const void *address, uintptr_t token) {
+    struct __cthreads_park_bucket *bucket = __cthreads_park_bucket(address);
+    struct __cthreads_parker *woken[32];
+    size_t total = 0, count;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_unpark_all");
+    #endif
+
+    /* INFO: Woken in rounds, so the futex wakes happen outside of the bucket lock */
+    do {
+      struct __cthreads_parker *prev = NULL, *parker, *next;
+      size_t i;
+
+      count = 0;
+
+      __cthreads_spin_lock(&bucket->lock);
+
+      for (parker = bucket->head; parker && count < sizeof(woken) / sizeof(woken[0]); parker = next) {
+        next = parker->next;
+
+        if (parker->address != address) {
+          prev = parker;
+
+          continue;
+        }
+
+        __cthreads_park_remove(bucket, prev, parker);
+        woken[count++] = parker;
+      }
+
+      for (i = 0; i < count; i++) {
+        woken[i]->token = token;
+        cthreads_atomic_store_u32(&woken[i]->parked, 0, CTHREADS_ATOMIC_RELEASE);
+      }
+
+      __cthreads_spin_unlock(&bucket->lock);
+
+      for (i = 0; i < count; i++)
+        __cthreads_futex_wake(&woken[i]->parked, 1);
+
+      total += count;
+    } while (count == sizeof(woken) / sizeof(woken[0]));
+
+    return total;
+  }
+
+  size_t cthreads_unpark_requeue(const void *from, const void *to, int (*validate)(void *context),
+                                 uintptr_t (*callback)(void *context, int op, size_t unparked, size_t requeued), void *context) {
+    struct __cthreads_park_bucket *from_bucket = __cthreads_park_bucket(from);
+    struct __cthreads_park_bucket *to_bucket = __cthreads_park_bucket(to);
+    struct __cthreads_parker *prev = NULL, *parker, *next, *unparked = NULL;
+    size_t requeued = 0;
+    uintptr_t token;
+    int op;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_unpark_requeue");
+    #endif
+
+    __cthreads_park_lock_pair(from_bucket, to_bucket);
+
+    op = validate(context);
+    if (op == CTHREADS_REQUEUE_ABORT) {
+      __cthreads_park_unlock_pair(from_bucket, to_bucket);
+
+      return 0;
+    }
+
+    /* INFO: If both keys share a bucket, requeued threads are appended behind the scan and skipped */
+    for (parker = from_bucket->head; parker; parker = next) {
+      next = parker->next;
+
+      if (parker->address != from) {
+        prev = parker;
+
+        continue;
+      }
+
+      __cthreads_park_remove(from_bucket, prev, parker);
+
+      if (op == CTHREADS_REQUEUE_UNPARK_ONE_REQUEUE_REST && !unparked) {
+        unparked = parker;
+
+        continue;
+      }
+
+      parker->address = to;
+      __cthreads_park_append(to_bucket, parker);
+      requeued++;
+    }
+
+    token = callback ? callback(context, op, unparked ? 1 : 0, requeued) : 0;
+
+    if (unparked) {
+      unparked->token = token;
+      cthreads_atomic_store_u32(&unparked->parked, 0, CTHREADS_ATOMIC_RELEASE);
+    }
+
+    __cthreads_park_unlock_pair(from_bucket, to_bucket);
+
+    if (unparked) __cthreads_futex_wake(&unparked->parked, 1);
+
+    return unparked ? 1 : 0;
+  }
+
+  #define __CTHREADS_LOCK_LOCKED 1
+  #define __CTHREADS_LOCK_PARKED 2
+
+  static int __cthreads_lock_validate(void *context) {
+    struct cthreads_lock *lock = context;
+
+    return cthreads_atomic_load_u8(&lock->state, CTHREADS_ATOMIC_RELAXED) == (__CTHREADS_LOCK_LOCKED | __CTHREADS_LOCK_PARKED);
+  }
+
+  static uintptr_t __cthreads_lock_unpark_callback(void *context, size_t unparked, int have_more) {
+    struct cthreads_lock *lock = context;
+
+    (void) unparked;
+
+    /* INFO: Runs with the queue locked, so no thread can park between this store and the wake */
+    cthreads_atomic_store_u8(&lock->state, have_more ? __CTHREADS_LOCK_PARKED : 0, CTHREADS_ATOMIC_RELEASE);
+
+    return 0;
+  }
+
+  int cthreads_lock_init(struct cthreads_lock *lock) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_lock_init");
+    #endif
+
+    lock->state = 0;
+
+    return 0;
+  }
+
+  int cthreads_lock_trylock(struct cthreads_lock *lock) {
+    uint8_t state = cthreads_atomic_load_u8(&lock->state, CTHREADS_ATOMIC_RELAXED);
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_lock_trylock");
+    #endif
+
+    while (!(state & __CTHREADS_LOCK_LOCKED)) {
+      if (cthreads_atomic_cas_u8(&lock->state, &state, state | __CTHREADS_LOCK_LOCKED, CTHREADS_ATOMIC_ACQUIRE)) return 0;
+    }
+
+    return 1;
+  }
+
+  int cthreads_lock_lock(struct cthreads_lock *lock) {
+    uint8_t state = 0;
+    unsigned int spins = 0;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_lock_lock");
+    #endif
+
+    if (cthreads_atomic_cas_u8(&lock->state, &state, __CTHREADS_LOCK_LOCKED, CTHREADS_ATOMIC_ACQUIRE)) return 0;
+
+    for (;;) {
+      if (!(state & __CTHREADS_LOCK_LOCKED)) {
+        if (cthreads_atomic_cas_u8(&lock->state, &state, state | __CTHREADS_LOCK_LOCKED, CTHREADS_ATOMIC_ACQUIRE)) return 0;
+
+        continue;
+      }
+
+      /* INFO: Spinning only pays off while nobody is parked yet */
+      if (!(state & __CTHREADS_LOCK_PARKED) && spins < 10) {
+        unsigned int i;
+
+        if (spins < 3) {
+          for (i = 0; i < (2u << spins); i++) cthreads_atomic_pause();
+        } else {
+          __cthreads_yield();
+        }
+
+        spins++;
+        state = cthreads_atomic_load_u8(&lock->state, CTHREADS_ATOMIC_RELAXED);
+
+        continue;
+      }
+
+      if (!(state & __CTHREADS_LOCK_PARKED) && !cthreads_atomic_cas_u8(&lock->state, &state, state | __CTHREADS_LOCK_PARKED, CTHREADS_ATOMIC_RELAXED))
+        continue;
+
+      cthreads_park(lock, __cthreads_lock_validate, NULL, NULL, lock, CTHREADS_INFINITE, NULL);
+
+      spins = 0;
+      state = cthreads_atomic_load_u8(&lock->state, CTHREADS_ATOMIC_RELAXED);
+    }
+  }
+
+  int cthreads_lock_unlock(struct cthreads_lock *lock) {
+    uint8_t state = __CTHREADS_LOCK_LOCKED;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_lock_unlock");
+    #endif
+
+    if (cthreads_atomic_cas_u8(&lock->state, &state, 0, CTHREADS_ATOMIC_RELEASE)) return 0;
+
+    cthreads_unpark_one(lock, __cthreads_lock_unpark_callback, lock);
+
+    return 0;
+  }
+
+  struct __cthreads_condition_wait {
+    struct cthreads_condition *cond;
+    struct cthreads_lock *lock;
+    int bad_lock;
+  };
+
+  static int __cthreads_condition_validate(void *context) {
+    struct __cthreads_condition_wait *wait = context;
+    struct cthreads_lock *current = cthreads_atomic_load_ptr((void *volatile *)&wait->cond->lock, CTHREADS_ATOMIC_RELAXED);
+
+    if (!current) {
+      cthreads_atomic_store_ptr((void *volatile *)&wait->cond->lock, wait->lock, CTHREADS_ATOMIC_RELAXED);
+    } else if (current != wait->lock) {
+      wait->bad_lock = 1;
+
+      return 0;
+    }
+
+    return 1;
+  }
+
+  static void __cthreads_condition_before_sleep(void *context) {
+    struct __cthreads_condition_wait *wait = context;
+
+    cthreads_lock_unlock(wait->lock);
+  }
+
+  static void __cthreads_condition_timed_out(void *context, const void *address, int have_more) {
+    struct __cthreads_condition_wait *wait = context;
+
+    /* INFO: A thread requeued onto the lock no longer counts as a waiter of the condition */
+    if (address == wait->cond && !have_more)
+      cthreads_atomic_store_ptr((void *volatile *)&wait->cond->lock, NULL, CTHREADS_ATOMIC_RELAXED);
+  }
+
+  static uintptr_t __cthreads_condition_signal_callback(void *context, size_t unparked, int have_more) {
+    struct cthreads_condition *cond = context;
+
+    (void) unparked;
+
+    if (!have_more) cthreads_atomic_store_ptr((void *volatile *)&cond->lock, NULL, CTHREADS_ATOMIC_RELAXED);
+
+    return 0;
+  }
+
+  static int __cthreads_condition_requeue_validate(void *context) {
+    struct __cthreads_condition_wait *wait = context;
+    uint8_t state;
+
+    if (cthreads_atomic_load_ptr((void *volatile *)&wait->cond->lock, CTHREADS_ATOMIC_RELAXED) != wait->lock) return CTHREADS_REQUEUE_ABORT;
+
+    cthreads_atomic_store_ptr((void *volatile *)&wait->cond->lock, NULL, CTHREADS_ATOMIC_RELAXED);
+
+    /* INFO: A held lock will unpark a waiter on release, so nobody needs waking right now */
+    state = cthreads_atomic_load_u8(&wait->lock->state, CTHREADS_ATOMIC_RELAXED);
+    while (state & __CTHREADS_LOCK_LOCKED) {
+      if (cthreads_atomic_cas_u8(&wait->lock->state, &state, state | __CTHREADS_LOCK_PARKED, CTHREADS_ATOMIC_RELAXED)) return CTHREADS_REQUEUE_ALL;
+    }
+
+    return CTHREADS_REQUEUE_UNPARK_ONE_REQUEUE_REST;
+  }
+
+  static uintptr_t __cthreads_condition_requeue_callback(void *context, int op, size_t unparked, size_t requeued) {
+    struct __cthreads_condition_wait *wait = context;
+
+    (void) unparked;
+
+    if (op == CTHREADS_REQUEUE_UNPARK_ONE_REQUEUE_REST && requeued)
+      cthreads_atomic_fetch_or_u8(&wait->lock->state, __CTHREADS_LOCK_PARKED, CTHREADS_ATOMIC_RELAXED);
+
+    return 0;
+  }
+
+  int cthreads_condition_init(struct cthreads_condition *cond) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_condition_init");
+    #endif
+
+    cond->lock = NULL;
+
+    return 0;
+  }
+
+  int cthreads_condition_timedwait(struct cthreads_condition *cond, struct cthreads_lock *lock, unsigned int ms) {
+    struct __cthreads_condition_wait wait;
+    int ret;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_condition_timedwait");
+    #endif
+
+    wait.cond = cond;
+    wait.lock = lock;
+    wait.bad_lock = 0;
+
+    ret = cthreads_park(cond, __cthreads_condition_validate, __cthreads_condition_before_sleep, __cthreads_condition_timed_out, &wait, ms, NULL);
+    if (ret == CTHREADS_PARK_INVALID) return 1;
+
+    cthreads_lock_lock(lock);
+
+    return ret == CTHREADS_PARK_TIMEOUT ? CTHREADS_PARK_TIMEOUT : 0;
+  }
+
+  int cthreads_condition_wait(struct cthreads_condition *cond, struct cthreads_lock *lock) {
+    return cthreads_condition_timedwait(cond, lock, CTHREADS_INFINITE);
+  }
+
+  int cthreads_condition_signal(struct cthreads_condition *cond) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_condition_signal");
+    #endif
+
+    if (!cthreads_atomic_load_ptr((void *volatile *)&cond->lock, CTHREADS_ATOMIC_RELAXED)) return 0;
+
+    cthreads_unpark_one(cond, __cthreads_condition_signal_callback, cond);
+
+    return 0;
+  }
+
+  int cthreads_condition_broadcast(struct cthreads_condition *cond) {
+    struct __cthreads_condition_wait wait;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_condition_broadcast");
+    #endif
+
+    wait.cond = cond;
+    wait.lock = cthreads_atomic_load_ptr((void *volatile *)&cond->lock, CTHREADS_ATOMIC_RELAXED);
+    if (!wait.lock) return 0;
+
+    cthreads_unpark_requeue(cond, wait.lock, __cthreads_condition_requeue_validate, __cthreads_condition_requeue_callback, &wait);
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_POOL
+  #define __CTHREADS_POOL_SPINS 64
+  #define __CTHREADS_POOL_STEAL_BATCH 32
+
+  #define __CTHREADS_WORKER_FREE 0
+  #define __CTHREADS_WORKER_RUNNING 1
+
+  #define __CTHREADS_GROUP_WAITING 1
+  #define __CTHREADS_GROUP_TASK 2
+
+  struct cthreads_pool_worker {
+    struct cthreads_deque deques[CTHREADS_POOL_PRIORITIES];
+    struct cthreads_pool *pool;
+    /* INFO: Binary min-heap of the worker's deadline tasks, earliest first */
+    struct cthreads_lock heap_lock;
+    uint32_t heap_size;
+    uint32_t heap_capacity;
+    struct cthreads_task **heap;
+    /* INFO: Stride scheduling state of the priority classes, only touched by the worker */
+    uint64_t pass[CTHREADS_POOL_PRIORITIES];
+    uint64_t vtime;
+    /* INFO: Tasks run by the worker, sampled by the pool's monitor to spot stalls */
+    uint64_t started;
+    uint32_t state;
+    int joinable;
+    struct cthreads_thread thread;
+    struct cthreads_args args;
+  };
+
+  static __CTHREADS_THREAD_LOCAL struct cthreads_pool_worker *__cthreads_pool_self;
+  static __CTHREADS_THREAD_LOCAL uint32_t __cthreads_pool_seed;
+  /* INFO: Priority of the task running on this thread, inherited by the tasks it spawns */
+  static __CTHREADS_THREAD_LOCAL unsigned int __cthreads_pool_priority = CTHREADS_PRIORITY_NORMAL;
+
+  static size_t __cthreads_cpu_count(void) {
+    #ifdef _WIN32
+      SYSTEM_INFO info;
+
+      GetSystemInfo(&info);
+
+      return info.dwNumberOfProcessors;
+    #else
+      long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+      return count > 0 ? (size_t)count : 1;
+    #endif
+  }
+
+  static uint32_t __cthreads_pool_random(void) {
+    uint32_t seed = __cthreads_pool_seed;
+
+    if (!seed) seed = (uint32_t)(uintptr_t)&seed | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    return __cthreads_pool_seed = seed;
+  }
+
+  static int __cthreads_pool_heap_push(struct cthreads_pool *pool, struct cthreads_pool_worker *worker, struct cthreads_task *task) {
+    struct cthreads_task **heap;
+    uint32_t i;
+
+    cthreads_lock_lock(&worker->heap_lock);
+
+    if (worker->heap_size == worker->heap_capacity) {
+      uint32_t capacity = worker->heap_capacity ? worker->heap_capacity * 2 : 64;
+
+      heap = realloc(worker->heap, capacity * sizeof(struct cthreads_task *));
+      if (!heap) {
+        cthreads_lock_unlock(&worker->heap_lock);
+
+        return 1;
+      }
+
+      worker->heap = heap;
+      worker->heap_capacity = capacity;
+    }
+
+    heap = worker->heap;
+    for (i = worker->heap_size; i > 0 && heap[(i - 1) / 2]->deadline > task->deadline; i = (i - 1) / 2)
+      heap[i] = heap[(i - 1) / 2];
+    heap[i] = task;
+
+    cthreads_atomic_store_u32(&worker->heap_size, worker->heap_size + 1, CTHREADS_ATOMIC_RELAXED);
+    cthreads_atomic_fetch_add_u32(&pool->deadlines, 1, CTHREADS_ATOMIC_RELAXED);
+
+    cthreads_lock_unlock(&worker->heap_lock);
+
+    return 0;
+  }
+
+  static struct cthreads_task *__cthreads_pool_heap_pop(struct cthreads_pool *pool, struct cthreads_pool_worker *worker) {
+    struct cthreads_task **heap;
+    struct cthreads_task *task, *last;
+    uint32_t size, i, child;
+
+    if (!cthreads_atomic_load_u32(&worker->heap_size, CTHREADS_ATOMIC_RELAXED)) return NULL;
+
+    cthreads_lock_lock(&worker->heap_lock);
+
+    size = worker->heap_size;
+    if (!size) {
+      cthreads_lock_unlock(&worker->heap_lock);
+
+      return NULL;
+    }
+
+    heap = worker->heap;
+    task = heap[0];
+    last = heap[--size];
+
+    for (i = 0; (child = 2 * i + 1) < size; i = child) {
+      if (child + 1 < size && heap[child + 1]->deadline < heap[child]->deadline) child++;
+      if (heap[child]->deadline >= last->deadline) break;
+
+      heap[i] = heap[child];
+    }
+    heap[i] = last;
+
+    cthreads_atomic_store_u32(&worker->heap_size, size, CTHREADS_ATOMIC_RELAXED);
+    cthreads_atomic_fetch_add_u32(&pool->deadlines, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+
+    cthreads_lock_unlock(&worker->heap_lock);
+
+    return task;
+  }
+
+  static void __cthreads_pool_inject(struct cthreads_pool *pool, struct cthreads_task *task) {
+    task->next = NULL;
+
+    cthreads_mutex_lock(&pool->inject_lock);
+
+    if (pool->inject_tail[task->priority]) pool->inject_tail[task->priority]->next = task;
+    else cthreads_atomic_store_ptr((void *volatile *)&pool->inject_head[task->priority], task, CTHREADS_ATOMIC_RELAXED);
+    pool->inject_tail[task->priority] = task;
+
+    cthreads_mutex_unlock(&pool->inject_lock);
+  }
+
+  /* INFO: Work of a class that needs no stealing, the worker's own deque and then the injection queue */
+  static struct cthreads_task *__cthreads_pool_take(struct cthreads_pool *pool, struct cthreads_pool_worker *self, unsigned int priority) {
+    struct cthreads_task *task;
+
+    if (self && (task = cthreads_deque_pop(&self->deques[priority]))) return task;
+
+    if (cthreads_atomic_load_ptr((void *volatile *)&pool->inject_head[priority], CTHREADS_ATOMIC_RELAXED)) {
+      cthreads_mutex_lock(&pool->inject_lock);
+
+      task = pool->inject_head[priority];
+      if (task) {
+        cthreads_atomic_store_ptr((void *volatile *)&pool->inject_head[priority], task->next, CTHREADS_ATOMIC_RELAXED);
+        if (!task->next) pool->inject_tail[priority] = NULL;
+      }
+
+      cthreads_mutex_unlock(&pool->inject_lock);
+
+      return task;
+    }
+
+    return NULL;
+  }
+
+  static struct cthreads_task *__cthreads_pool_steal(struct cthreads_pool *pool, struct cthreads_pool_worker *self, unsigned int priority, uint32_t seed, uint32_t threads) {
+    struct cthreads_task *task;
+    uint32_t i;
+
+    for (i = 0; i < threads; i++) {
+      struct cthreads_pool_worker *victim = &pool->workers[(seed + i) % threads];
+      void *batch[__CTHREADS_POOL_STEAL_BATCH];
+      size_t count, j;
+
+      if (victim == self) continue;
+
+      if (!self) {
+        if ((task = cthreads_deque_steal(&victim->deques[priority]))) return task;
+
+        continue;
+      }
+
+      /* INFO: Workers take up to half of the victim's tasks, and keep the rest in their own deque */
+      count = cthreads_deque_steal_half(&victim->deques[priority], batch, __CTHREADS_POOL_STEAL_BATCH);
+      if (!count) continue;
+
+      for (j = count - 1; j > 0; j--) {
+        if (cthreads_deque_push(&self->deques[priority], batch[j])) break;
+      }
+
+      /* INFO: Out of memory for the deque, the leftovers go to the injection queue */
+      for (; j > 0; j--) __cthreads_pool_inject(pool, (struct cthreads_task *)batch[j]);
+
+      return (struct cthreads_task *)batch[0];
+    }
+
+    return NULL;
+  }
+
+  static struct cthreads_task *__cthreads_pool_find(struct cthreads_pool *pool, struct cthreads_pool_worker *self) {
+    uint32_t threads = cthreads_atomic_load_u32(&pool->threads, CTHREADS_ATOMIC_ACQUIRE);
+    unsigned int order[CTHREADS_POOL_PRIORITIES], priority = 0;
+    struct cthreads_task *task = NULL;
+    uint32_t seed;
+    size_t i, j;
+
+    /* INFO: Victims are visited from a random worker on, so thieves do not all pile on the first one */
+    seed = __cthreads_pool_random();
+
+    /* INFO: Deadline tasks come before every priority class, earliest deadline first */
+    if (cthreads_atomic_load_u32(&pool->deadlines, CTHREADS_ATOMIC_RELAXED)) {
+      if (self && (task = __cthreads_pool_heap_pop(pool, self))) return task;
+
+      for (i = 0; i < threads; i++) {
+        struct cthreads_pool_worker *victim = &pool->workers[(seed + i) % threads];
+
+        if (victim != self && (task = __cthreads_pool_heap_pop(pool, victim))) return task;
+      }
+    }
+
+    /* INFO: Workers serve their own and injected work by the class that got the least service for its weight, outsiders go by priority */
+    for (i = 0; i < CTHREADS_POOL_PRIORITIES; i++) {
+      for (j = i; self && j > 0 && self->pass[order[j - 1]] > self->pass[i]; j--)
+        order[j] = order[j - 1];
+      order[j] = (unsigned int)i;
+    }
+
+    for (i = 0; !task && i < CTHREADS_POOL_PRIORITIES; i++)
+      task = __cthreads_pool_take(pool, self, priority = order[i]);
+
+    /* INFO: Stealing goes by priority alone, so no thief takes low priority work while high priority work waits elsewhere */
+    for (i = 0; !task && i < CTHREADS_POOL_PRIORITIES; i++)
+      task = __cthreads_pool_steal(pool, self, priority = (unsigned int)i, seed, threads);
+
+    if (!task) return NULL;
+
+    /* INFO: A class that sat empty restarts from the current virtual time, not from where it was left */
+    if (self) {
+      if (self->pass[priority] < self->vtime) self->pass[priority] = self->vtime;
+
+      self->vtime = self->pass[priority];
+      self->pass[priority] += pool->strides[priority];
+    }
+
+    return task;
+  }
+
+  static void __cthreads_task_group_done(struct cthreads_task_group *group) {
+    uint32_t state = cthreads_atomic_fetch_add_u32(&group->state, (uint32_t)-__CTHREADS_GROUP_TASK, CTHREADS_ATOMIC_ACQ_REL);
+
+    /* INFO: Only the address is used once the count drops, the syncing thread may free the group already */
+    if (state == (__CTHREADS_GROUP_TASK | __CTHREADS_GROUP_WAITING))
+      __cthreads_futex_wake(&group->state, 1);
+  }
+
+  static void __cthreads_pool_run(struct cthreads_task *task) {
+    struct cthreads_pool_worker *self = __cthreads_pool_self;
+    struct cthreads_task_group *group = task->group;
+    unsigned int priority = __cthreads_pool_priority;
+
+    if (self) cthreads_atomic_store_u64(&self->started, self->started + 1, CTHREADS_ATOMIC_RELAXED);
+
+    __cthreads_pool_priority = task->priority;
+    task->func(task->data);
+    __cthreads_pool_priority = priority;
+
+    if (group) __cthreads_task_group_done(group);
+  }
+
+  static int __cthreads_pool_push(struct cthreads_pool *pool, struct cthreads_task *task) {
+    struct cthreads_pool_worker *self = __cthreads_pool_self;
+
+    if (self && self->pool != pool) self = NULL;
+
+    if (task->deadline) {
+      /* INFO: Any thread may push to a heap, outsiders spread their deadline tasks over the workers */
+      if (!self) {
+        self = &pool->workers[__cthreads_pool_random() % cthreads_atomic_load_u32(&pool->threads, CTHREADS_ATOMIC_ACQUIRE)];
+      }
+
+      if (__cthreads_pool_heap_push(pool, self, task)) return 1;
+    } else if (self) {
+      if (cthreads_deque_push(&self->deques[task->priority], task)) return 1;
+    } else {
+      __cthreads_pool_inject(pool, task);
+    }
+
+    /* INFO: Pairs with an idle worker announcing itself in `sleepers` before its last look for work */
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+    if (cthreads_atomic_load_u32(&pool->sleepers, CTHREADS_ATOMIC_RELAXED)) {
+      cthreads_atomic_fetch_add_u32(&pool->epoch, 1, CTHREADS_ATOMIC_RELEASE);
+      __cthreads_futex_wake(&pool->epoch, 0);
+    }
+
+    return 0;
+  }
+
+  static int __cthreads_pool_has_work(struct cthreads_pool *pool) {
+    uint32_t threads = cthreads_atomic_load_u32(&pool->threads, CTHREADS_ATOMIC_ACQUIRE);
+    uint32_t i, j;
+
+    if (cthreads_atomic_load_u32(&pool->deadlines, CTHREADS_ATOMIC_RELAXED)) return 1;
+
+    for (i = 0; i < CTHREADS_POOL_PRIORITIES; i++)
+      if (cthreads_atomic_load_ptr((void *volatile *)&pool->inject_head[i], CTHREADS_ATOMIC_RELAXED)) return 1;
+
+    for (i = 0; i < threads; i++) {
+      for (j = 0; j < CTHREADS_POOL_PRIORITIES; j++) {
+        if (cthreads_deque_size(&pool->workers[i].deques[j])) return 1;
+      }
+    }
+
+    return 0;
+  }
+
+  static void *__cthreads_pool_worker_function(void *data);
+
+  /* INFO: Starts one more worker in the lowest free slot, unless the pool is at its maximum */
+  static int __cthreads_pool_spawn(struct cthreads_pool *pool) {
+    struct cthreads_pool_worker *worker = NULL;
+    uint32_t threads, i;
+    int ret = 0;
+
+    cthreads_mutex_lock(&pool->grow_lock);
+
+    if (cthreads_atomic_load_u32(&pool->shutdown, CTHREADS_ATOMIC_ACQUIRE) || cthreads_atomic_load_u32(&pool->alive, CTHREADS_ATOMIC_RELAXED) >= pool->max_threads) goto done;
+
+    threads = pool->threads;
+    for (i = 0; i < pool->max_threads; i++) {
+      if (cthreads_atomic_load_u32(&pool->workers[i].state, CTHREADS_ATOMIC_ACQUIRE) == __CTHREADS_WORKER_FREE) {
+        worker = &pool->workers[i];
+
+        break;
+      }
+    }
+    if (!worker) goto done;
+
+    /* INFO: A retired worker leaves its slot, and its empty deques, to the next one */
+    if (worker->joinable) {
+      cthreads_thread_join(worker->thread, NULL);
+      worker->joinable = 0;
+    }
+
+    worker->state = __CTHREADS_WORKER_RUNNING;
+    cthreads_atomic_fetch_add_u32(&pool->alive, 1, CTHREADS_ATOMIC_RELAXED);
+
+    /* INFO: Slots below `threads` are visited by thieves, so they become visible only once started */
+    if (i >= threads) cthreads_atomic_store_u32(&pool->threads, i + 1, CTHREADS_ATOMIC_RELEASE);
+
+    if (cthreads_thread_create(&worker->thread, pool->thread_attr_set ? &pool->thread_attr : NULL, __cthreads_pool_worker_function, worker, &worker->args) != 0) {
+      cthreads_atomic_fetch_add_u32(&pool->alive, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+      cthreads_atomic_store_u32(&worker->state, __CTHREADS_WORKER_FREE, CTHREADS_ATOMIC_RELEASE);
+      ret = 1;
+
+      goto done;
+    }
+
+    worker->joinable = 1;
+
+    done:
+      cthreads_mutex_unlock(&pool->grow_lock);
+
+      return ret;
+  }
+
+  /* INFO: An idle worker past its keep-alive leaves, as long as the pool stays at its minimum */
+  static int __cthreads_pool_retire(struct cthreads_pool *pool) {
+    uint32_t alive = cthreads_atomic_load_u32(&pool->alive, CTHREADS_ATOMIC_RELAXED);
+
+    while (alive > pool->min_threads)
+      if (cthreads_atomic_cas_u32(&pool->alive, &alive, alive - 1, CTHREADS_ATOMIC_RELAXED)) return 1;
+
+    return 0;
+  }
+
+  static void *__cthreads_pool_worker_function(void *data) {
+    struct cthreads_pool_worker *self = data;
+    struct cthreads_pool *pool = self->pool;
+    int elastic = pool->min_threads < pool->max_threads;
+    struct cthreads_task *task;
+    unsigned int spins = 0;
+    uint64_t idle_since;
+    uint32_t epoch;
+
+    __cthreads_pool_self = self;
+
+    while (1) {
+      if ((task = __cthreads_pool_find(pool, self))) {
+        __cthreads_pool_run(task);
+        spins = 0;
+
+        continue;
+      }
+
+      if (++spins < __CTHREADS_POOL_SPINS) {
+        cthreads_atomic_pause();
+
+        continue;
+      }
+
+      spins = 0;
+      epoch = cthreads_atomic_load_u32(&pool->epoch, CTHREADS_ATOMIC_ACQUIRE);
+      cthreads_atomic_fetch_add_u32(&pool->sleepers, 1, CTHREADS_ATOMIC_SEQ_CST);
+      cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+      if ((task = __cthreads_pool_find(pool, self))) {
+        cthreads_atomic_fetch_add_u32(&pool->sleepers, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+        __cthreads_pool_run(task);
+
+        continue;
+      }
+
+      if (cthreads_atomic_load_u32(&pool->shutdown, CTHREADS_ATOMIC_ACQUIRE)) {
+        cthreads_atomic_fetch_add_u32(&pool->sleepers, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+
+        break;
+      }
+
+      idle_since = elastic ? __cthreads_monotonic_ns() : 0;
+      __cthreads_futex_wait(&pool->epoch, epoch, elastic ? pool->keep_alive_ns : UINT64_MAX);
+      cthreads_atomic_fetch_add_u32(&pool->sleepers, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+
+      if (elastic && cthreads_atomic_load_u32(&pool->epoch, CTHREADS_ATOMIC_ACQUIRE) == epoch && __cthreads_monotonic_ns() - idle_since >= pool->keep_alive_ns) {
+        /* INFO: A wake may have raced with the timeout, so the last look happens after leaving `sleepers` */
+        cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+        if ((task = __cthreads_pool_find(pool, self))) {
+          __cthreads_pool_run(task);
+
+          continue;
+        }
+
+        if (__cthreads_pool_retire(pool)) break;
+      }
+    }
+
+    __cthreads_pool_self = NULL;
+    cthreads_atomic_store_u32(&self->state, __CTHREADS_WORKER_FREE, CTHREADS_ATOMIC_RELEASE);
+
+    return NULL;
+  }
+
+  /* INFO: Adds a worker when tasks are queued but no worker started one for a whole period */
+  static void *__cthreads_pool_monitor_function(void *data) {
+    struct cthreads_pool *pool = data;
+    uint64_t last = UINT64_MAX;
+
+    while (!cthreads_atomic_load_u32(&pool->shutdown, CTHREADS_ATOMIC_ACQUIRE)) {
+      uint32_t threads = cthreads_atomic_load_u32(&pool->threads, CTHREADS_ATOMIC_ACQUIRE);
+      uint64_t progress = 0;
+      uint32_t i;
+
+      __cthreads_futex_wait(&pool->shutdown, 0, pool->stall_ns);
+
+      for (i = 0; i < threads; i++)
+        progress += cthreads_atomic_load_u64(&pool->workers[i].started, CTHREADS_ATOMIC_RELAXED);
+
+      if (progress == last && !cthreads_atomic_load_u32(&pool->sleepers, CTHREADS_ATOMIC_RELAXED) && __cthreads_pool_has_work(pool))
+        __cthreads_pool_spawn(pool);
+
+      last = progress;
+    }
+
+    return NULL;
+  }
+
+  static void __cthreads_pool_worker_destroy(struct cthreads_pool_worker *worker) {
+    size_t i;
+
+    for (i = 0; i < CTHREADS_POOL_PRIORITIES; i++)
+      cthreads_deque_destroy(&worker->deques[i]);
+
+    free(worker->heap);
+  }
+
+  static void __cthreads_pool_stop(struct cthreads_pool *pool) {
+    uint32_t i;
+
+    cthreads_atomic_store_u32(&pool->shutdown, 1, CTHREADS_ATOMIC_SEQ_CST);
+    cthreads_atomic_fetch_add_u32(&pool->epoch, 1, CTHREADS_ATOMIC_RELEASE);
+    __cthreads_futex_wake(&pool->epoch, 1);
+    __cthreads_futex_wake(&pool->shutdown, 1);
+
+    if (pool->monitor_started) cthreads_thread_join(pool->monitor, NULL);
+
+    /* INFO: Waits for a spawn in progress, none can start after it */
+    cthreads_mutex_lock(&pool->grow_lock);
+    cthreads_mutex_unlock(&pool->grow_lock);
+
+    for (i = 0; i < pool->max_threads; i++)
+      if (pool->workers[i].joinable) cthreads_thread_join(pool->workers[i].thread, NULL);
+
+    for (i = 0; i < pool->max_threads; i++)
+      __cthreads_pool_worker_destroy(&pool->workers[i]);
+
+    cthreads_mutex_destroy(&pool->grow_lock);
+    cthreads_mutex_destroy(&pool->inject_lock);
+    free(pool->workers);
+  }
+
+  int cthreads_pool_init(struct cthreads_pool *pool, size_t threads) {
+    struct cthreads_pool_attr attr = CTHREADS_POOL_ATTR_INITIALIZER;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pool_init");
+    #endif
+
+    attr.threads = threads;
+
+    return cthreads_pool_init_attr(pool, &attr);
+  }
+
+  int cthreads_pool_init_attr(struct cthreads_pool *pool, struct cthreads_pool_attr *attr) {
+    size_t threads = attr->threads ? attr->threads : __cthreads_cpu_count();
+    size_t i, j;
+    int ret = 0;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pool_init_attr");
+    #endif
+
+    pool->min_threads = (uint32_t)(attr->min_threads ? attr->min_threads : threads);
+    pool->max_threads = (uint32_t)(attr->max_threads > threads ? attr->max_threads : threads);
+    pool->target_threads = (uint32_t)threads;
+    if (pool->min_threads > threads) pool->min_threads = (uint32_t)threads;
+    pool->keep_alive_ns = (uint64_t)(attr->keep_alive_ms ? attr->keep_alive_ms : 10000) * 1000000;
+    pool->stall_ns = (uint64_t)(attr->stall_ms ? attr->stall_ms : 10) * 1000000;
+
+    pool->workers = calloc(pool->max_threads, sizeof(struct cthreads_pool_worker));
+    if (!pool->workers) return 1;
+
+    pool->threads = 0;
+    pool->alive = 0;
+    pool->blocked = 0;
+    pool->epoch = 0;
+    pool->sleepers = 0;
+    pool->shutdown = 0;
+    pool->deadlines = 0;
+    pool->monitor_started = 0;
+    pool->thread_attr_set = attr->thread_attr != NULL;
+    if (attr->thread_attr) pool->thread_attr = *attr->thread_attr;
+
+    for (i = 0; i < CTHREADS_POOL_PRIORITIES; i++) {
+      pool->inject_head[i] = NULL;
+      pool->inject_tail[i] = NULL;
+      pool->strides[i] = (1 << 20) / (attr->weights[i] ? attr->weights[i] : 1);
+    }
+
+    if (cthreads_mutex_init(&pool->inject_lock, NULL) != 0) {
+      free(pool->workers);
+
+      return 1;
+    }
+
+    if (cthreads_mutex_init(&pool->grow_lock, NULL) != 0) {
+      cthreads_mutex_destroy(&pool->inject_lock);
+      free(pool->workers);
+
+      return 1;
+    }
+
+    /* INFO: Deques of every slot exist upfront, a worker starting later only has to claim one */
+    for (i = 0; i < pool->max_threads && ret == 0; i++) {
+      pool->workers[i].pool = pool;
+      cthreads_lock_init(&pool->workers[i].heap_lock);
+
+      for (j = 0; j < CTHREADS_POOL_PRIORITIES && ret == 0; j++)
+        ret = cthreads_deque_init(&pool->workers[i].deques[j], 0);
+    }
+
+    for (i = 0; i < threads && ret == 0; i++)
+      ret = __cthreads_pool_spawn(pool);
+
+    if (ret == 0 && pool->min_threads < pool->max_threads) {
+      ret = cthreads_thread_create(&pool->monitor, NULL, __cthreads_pool_monitor_function, pool, &pool->monitor_args);
+      pool->monitor_started = ret == 0;
+    }
+
+    if (ret != 0) {
+      __cthreads_pool_stop(pool);
+
+      return 1;
+    }
+
+    return 0;
+  }
+
+  int cthreads_pool_submit(struct cthreads_pool *pool, struct cthreads_task *task, void (*func)(void *data), void *data) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pool_submit");
+    #endif
+
+    task->func = func;
+    task->data = data;
+    task->group = NULL;
+    task->priority = __cthreads_pool_priority;
+    task->deadline = 0;
+
+    return __cthreads_pool_push(pool, task);
+  }
+
+  int cthreads_pool_submit_priority(struct cthreads_pool *pool, struct cthreads_task *task, void (*func)(void *data), void *data, unsigned int priority) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pool_submit_priority");
+    #endif
+
+    if (priority >= CTHREADS_POOL_PRIORITIES) return 1;
+
+    task->func = func;
+    task->data = data;
+    task->group = NULL;
+    task->priority = priority;
+    task->deadline = 0;
+
+    return __cthreads_pool_push(pool, task);
+  }
+
+  int cthreads_pool_submit_deadline(struct cthreads_pool *pool, struct cthreads_task *task, void (*func)(void *data), void *data, unsigned int ms) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pool_submit_deadline");
+    #endif
+
+    task->func = func;
+    task->data = data;
+    task->group = NULL;
+    task->priority = CTHREADS_PRIORITY_HIGH;
+    task->deadline = __cthreads_monotonic_ns() + (uint64_t)ms * 1000000;
+
+    return __cthreads_pool_push(pool, task);
+  }
+
+  int cthreads_pool_destroy(struct cthreads_pool *pool) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pool_destroy");
+    #endif
+
+    __cthreads_pool_stop(pool);
+
+    return 0;
+  }
+
+  int cthreads_pool_blocking_begin(void) {
+    struct cthreads_pool_worker *self = __cthreads_pool_self;
+    struct cthreads_pool *pool;
+    uint32_t blocked;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pool_blocking_begin");
+    #endif
+
+    if (!self) return 0;
+
+    pool = self->pool;
+    blocked = cthreads_atomic_fetch_add_u32(&pool->blocked, 1, CTHREADS_ATOMIC_SEQ_CST) + 1;
+
+    /* INFO: Keeps `target_threads` workers runnable while there is work for them */
+    if (cthreads_atomic_load_u32(&pool->alive, CTHREADS_ATOMIC_RELAXED) - blocked >= pool->target_threads) return 0;
+
+    if (cthreads_atomic_load_u32(&pool->sleepers, CTHREADS_ATOMIC_RELAXED)) {
+      cthreads_atomic_fetch_add_u32(&pool->epoch, 1, CTHREADS_ATOMIC_RELEASE);
+      __cthreads_futex_wake(&pool->epoch, 0);
+
+      return 0;
+    }
+
+    return __cthreads_pool_has_work(pool) ? __cthreads_pool_spawn(pool) : 0;
+  }
+
+  int cthreads_pool_blocking_end(void) {
+    struct cthreads_pool_worker *self = __cthreads_pool_self;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pool_blocking_end");
+    #endif
+
+    if (self) cthreads_atomic_fetch_add_u32(&self->pool->blocked, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+
+    return 0;
+  }
+
+  int cthreads_task_group_init(struct cthreads_task_group *group, struct cthreads_pool *pool) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_task_group_init");
+    #endif
+
+    group->pool = pool;
+    group->state = 0;
+
+    return 0;
+  }
+
+  int cthreads_task_group_spawn(struct cthreads_task_group *group, struct cthreads_task *task, void (*func)(void *data), void *data) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_task_group_spawn");
+    #endif
+
+    task->func = func;
+    task->data = data;
+    task->group = group;
+    task->priority = __cthreads_pool_priority;
+    task->deadline = 0;
+
+    cthreads_atomic_fetch_add_u32(&group->state, __CTHREADS_GROUP_TASK, CTHREADS_ATOMIC_RELAXED);
+
+    if (__cthreads_pool_push(group->pool, task)) {
+      __cthreads_task_group_done(group);
+
+      return 1;
+    }
+
+    return 0;
+  }
+
+  int cthreads_task_group_sync(struct cthreads_task_group *group) {
+    struct cthreads_pool *pool = group->pool;
+    struct cthreads_pool_worker *self = __cthreads_pool_self;
+    struct cthreads_task *task;
+    unsigned int spins = 0;
+    uint32_t state;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_task_group_sync");
+    #endif
+
+    /* INFO: Workers of another pool help as outsiders, their own deque belongs to that pool */
+    if (self && self->pool != pool) self = NULL;
+
+    while ((state = cthreads_atomic_load_u32(&group->state, CTHREADS_ATOMIC_ACQUIRE)) >= __CTHREADS_GROUP_TASK) {
+      if ((task = __cthreads_pool_find(pool, self))) {
+        __cthreads_pool_run(task);
+        spins = 0;
+
+        continue;
+      }
+
+      if (++spins < __CTHREADS_POOL_SPINS) {
+        cthreads_atomic_pause();
+
+        continue;
+      }
+
+      /* INFO: Nothing left to help with, every pending task of the group is running somewhere */
+      if (!(state & __CTHREADS_GROUP_WAITING) && !cthreads_atomic_cas_u32(&group->state, &state, state | __CTHREADS_GROUP_WAITING, CTHREADS_ATOMIC_ACQUIRE)) continue;
+
+      __cthreads_futex_wait(&group->state, state | __CTHREADS_GROUP_WAITING, UINT64_MAX);
+      spins = 0;
+    }
+
+    state = __CTHREADS_GROUP_WAITING;
+    cthreads_atomic_cas_u32(&group->state, &state, 0, CTHREADS_ATOMIC_RELAXED);
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_PARALLEL
+  #define __CTHREADS_SCAN_NONE 0
+  #define __CTHREADS_SCAN_AGGREGATE 1
+  #define __CTHREADS_SCAN_PREFIX 2
+
+  /* INFO: Samples taken per bucket of cthreads_parallel_sort */
+  #define __CTHREADS_PARALLEL_OVERSAMPLING 16
+
+  /* INFO: A loop over `count` indices, handed out one at a time to whichever thread asks next */
+  struct __cthreads_parallel_for {
+    void (*body)(void *context, size_t index, void *scratch);
+    void *context;
+    size_t count;
+    uint64_t next;
+  };
+
+  struct __cthreads_parallel_task {
+    struct cthreads_task task;
+    struct __cthreads_parallel_for *loop;
+    void *scratch;
+  };
+
+  /* INFO: Decoupled look-back (Merrill & Garland): every block publishes its own total, then the prefix of what precedes it */
+  struct __cthreads_parallel_scan {
+    const char *input;
+    char *output;
+    size_t count;
+    size_t size;
+    size_t block;
+    void (*op)(void *accumulator, const void *element, void *data);
+    void *data;
+    const void *init;
+    int inclusive;
+    /* INFO: Per block, __CTHREADS_SCAN_* and the values it announces */
+    uint32_t *states;
+    char *aggregates;
+    char *prefixes;
+    size_t value_size;
+    void (*combine)(void *accumulator, const void *element, void *data);
+    void *combine_data;
+  };
+
+  struct __cthreads_parallel_transform {
+    const char *input;
+    char *output;
+    size_t count;
+    size_t in_size;
+    size_t out_size;
+    size_t block;
+    void (*func)(const void *in, void *out, void *data);
+    int (*predicate)(const void *element, void *data);
+    void *data;
+    struct __cthreads_parallel_scan offsets;
+  };
+
+  /* INFO: Sample sort over sorted runs: splitters cut every run into buckets, each bucket is merged into place at once */
+  struct __cthreads_parallel_sort {
+    char *base;
+    /* INFO: Copy of `base` holding the sorted runs, of `block` elements each */
+    char *runs;
+    size_t count;
+    size_t size;
+    size_t block;
+    size_t run_count;
+    /* INFO: Positions in `runs` of the elements bucket j ends at, ascending */
+    size_t *splitters;
+    size_t buckets;
+    /* INFO: Per run, `buckets + 1` offsets into the run where each bucket starts */
+    size_t *bounds;
+    int (*compare)(const void *a, const void *b);
+  };
+
+  struct __cthreads_parallel_cursor {
+    const char *at;
+    const char *end;
+  };
+
+  static void __cthreads_parallel_worker(void *data) {
+    struct __cthreads_parallel_task *task = data;
+    struct __cthreads_parallel_for *loop = task->loop;
+    uint64_t index;
+
+    while ((index = cthreads_atomic_fetch_add_u64(&loop->next, 1, CTHREADS_ATOMIC_RELAXED)) < loop->count)
+      loop->body(loop->context, (size_t)index, task->scratch);
+  }
+
+  /* INFO: Runs `body` on every index, on as many of the pool's workers as there is work for and on the calling thread */
+  static int __cthreads_parallel_run(struct cthreads_pool *pool, size_t count, void (*body)(void *context, size_t index, void *scratch), void *context, size_t scratch_size) {
+    struct __cthreads_parallel_for loop;
+    struct __cthreads_parallel_task *tasks;
+    struct cthreads_task_group group;
+    size_t threads = 0, head, i;
+
+    if (count == 0) return 0;
+
+    if (pool) threads = cthreads_atomic_load_u32(&pool->threads, CTHREADS_ATOMIC_ACQUIRE);
+    if (threads > count - 1) threads = count - 1;
+
+    /* INFO: Scratch areas hold user values, so they keep the allocation's alignment, and get a cache line each */
+    head = (threads + 1) * sizeof(*tasks);
+    head = (head + CTHREADS_CACHE_LINE - 1) & ~(size_t)(CTHREADS_CACHE_LINE - 1);
+    scratch_size = (scratch_size + CTHREADS_CACHE_LINE - 1) & ~(size_t)(CTHREADS_CACHE_LINE - 1);
+
+    tasks = malloc(head + (threads + 1) * scratch_size);
+    if (!tasks) return 1;
+
+    loop.body = body;
+    loop.context = context;
+    loop.count = count;
+    loop.next = 0;
+
+    for (i = 0; i <= threads; i++) {
+      tasks[i].loop = &loop;
+      tasks[i].scratch = scratch_size ? (char *)tasks + head + i * scratch_size : NULL;
+    }
+
+    if (threads) cthreads_task_group_init(&group, pool);
+
+    /* INFO: Indices are claimed in order, so a task that failed to spawn only leaves more of them to the others */
+    for (i = 0; i < threads; i++)
+      if (cthreads_task_group_spawn(&group, &tasks[i].task, __cthreads_parallel_worker, &tasks[i]) != 0) break;
+
+    __cthreads_parallel_worker(&tasks[threads]);
+
+    if (threads) cthreads_task_group_sync(&group);
+
+    free(tasks);
+
+    return 0;
+  }
+
+  static void __cthreads_parallel_add_size(void *accumulator, const void *element, void *data) {
+    (void) data;
+
+    *(size_t *)accumulator += *(const size_t *)element;
+  }
+
+  /*
+    INFO: Publishes the total of block `index` and returns in `prefix` the combination of everything before it, 0 if
+            there is nothing. Blocks are claimed in order, so the ones looked at are already being worked on.
+  */
+  static int __cthreads_parallel_look_back(struct __cthreads_parallel_scan *scan, size_t index, const void *aggregate, void *prefix, void *scratch) {
+    size_t size = scan->value_size;
+    size_t j = index;
+    int found = 0;
+
+    memcpy(scan->aggregates + index * size, aggregate, size);
+    if (index > 0) cthreads_atomic_store_u32(&scan->states[index], __CTHREADS_SCAN_AGGREGATE, CTHREADS_ATOMIC_RELEASE);
+
+    while (j-- > 0) {
+      uint32_t state, round = 0;
+
+      while ((state = cthreads_atomic_load_u32(&scan->states[j], CTHREADS_ATOMIC_ACQUIRE)) == __CTHREADS_SCAN_NONE)
+        if (cthreads_atomic_backoff(&round)) __cthreads_yield();
+
+      /* INFO: Values are found right to left, each one goes in front of what was combined so far */
+      memcpy(scratch, (state == __CTHREADS_SCAN_PREFIX ? scan->prefixes : scan->aggregates) + j * size, size);
+      if (found) scan->combine(scratch, prefix, scan->combine_data);
+      memcpy(prefix, scratch, size);
+      found = 1;
+
+      if (state == __CTHREADS_SCAN_PREFIX) break;
+    }
+
+    if (index == 0 && scan->init) {
+      memcpy(prefix, scan->init, size);
+      found = 1;
+    }
+
+    memcpy(scratch, found ? prefix : aggregate, size);
+    if (found) scan->combine(scratch, aggregate, scan->combine_data);
+    memcpy(scan->prefixes + index * size, scratch, size);
+    cthreads_atomic_store_u32(&scan->states[index], __CTHREADS_SCAN_PREFIX, CTHREADS_ATOMIC_RELEASE);
+
+    return found;
+  }
+
+  static int __cthreads_parallel_scan_init(struct __cthreads_parallel_scan *scan, size_t blocks, size_t value_size) {
+    scan->value_size = value_size;
+    scan->states = calloc(blocks, sizeof(uint32_t));
+    scan->aggregates = malloc(blocks * value_size);
+    scan->prefixes = malloc(blocks * value_size);
+
+    if (!scan->states || !scan->aggregates || !scan->prefixes) {
+      free(scan->states);
+      free(scan->aggregates);
+      free(scan->prefixes);
+
+      return 1;
+    }
+
+    return 0;
+  }
+
+  static void __cthreads_parallel_scan_destroy(struct __cthreads_parallel_scan *scan) {
+    free(scan->states);
+    free(scan->aggregates);
+    free(scan->prefixes);
+  }
+
+  /* INFO: Reduces the block, then scans it again while it is still in cache */
+  static void __cthreads_parallel_scan_block(void *context, size_t index, void *scratch) {
+    struct __cthreads_parallel_scan *scan = context;
+    size_t size = scan->size;
+    size_t first = index * scan->block;
+    size_t last = first + scan->block < scan->count ? first + scan->block : scan->count;
+    const char *in = scan->input + first * size;
+    char *out = scan->output + first * size;
+    char *aggregate = scratch, *prefix = aggregate + size, *temp = prefix + size;
+    size_t i;
+    int found;
+
+    memcpy(aggregate, in, size);
+    for (i = 1; i < last - first; i++) scan->op(aggregate, in + i * size, scan->data);
+
+    found = __cthreads_parallel_look_back(scan, index, aggregate, prefix, temp);
+
+    for (i = 0; i < last - first; i++) {
+      if (scan->inclusive) {
+        if (found) scan->op(prefix, in + i * size, scan->data);
+        else memcpy(prefix, in + i * size, size);
+        found = 1;
+
+        memcpy(out + i * size, prefix, size);
+      } else {
+        /* INFO: The element is saved first, the output may alias it */
+        memcpy(temp, in + i * size, size);
+        memcpy(out + i * size, prefix, size);
+        scan->op(prefix, temp, scan->data);
+      }
+    }
+  }
+
+  static int __cthreads_parallel_scan(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t size, const void *init, void (*op)(void *accumulator, const void *element, void *data), void *data) {
+    struct __cthreads_parallel_scan scan;
+    size_t blocks;
+    int ret;
+
+    if (count == 0) return 0;
+    if (size == 0) return 1;
+
+    scan.input = input;
+    scan.output = output;
+    scan.count = count;
+    scan.size = size;
+    scan.block = size < CTHREADS_PARALLEL_BLOCK ? CTHREADS_PARALLEL_BLOCK / size : 1;
+    scan.op = op;
+    scan.data = data;
+    scan.init = init;
+    scan.inclusive = init == NULL;
+    scan.combine = op;
+    scan.combine_data = data;
+
+    blocks = (count + scan.block - 1) / scan.block;
+    if (__cthreads_parallel_scan_init(&scan, blocks, size) != 0) return 1;
+
+    ret = __cthreads_parallel_run(pool, blocks, __cthreads_parallel_scan_block, &scan, 3 * size);
+
+    __cthreads_parallel_scan_destroy(&scan);
+
+    return ret;
+  }
+
+  static void __cthreads_parallel_transform_block(void *context, size_t index, void *scratch) {
+    struct __cthreads_parallel_transform *transform = context;
+    size_t first = index * transform->block;
+    size_t last = first + transform->block < transform->count ? first + transform->block : transform->count;
+    size_t i;
+
+    (void) scratch;
+
+    for (i = first; i < last; i++)
+      transform->func(transform->input + i * transform->in_size, transform->output + i * transform->out_size, transform->data);
+  }
+
+  /* INFO: Tests the block once into a flag per element, then copies the kept ones after every earlier block's */
+  static void __cthreads_parallel_copy_if_block(void *context, size_t index, void *scratch) {
+    struct __cthreads_parallel_transform *transform = context;
+    size_t size = transform->in_size;
+    size_t first = index * transform->block;
+    size_t last = first + transform->block < transform->count ? first + transform->block : transform->count;
+    size_t *kept = scratch, *offset = kept + 1, *temp = kept + 2;
+    unsigned char *flags = (unsigned char *)(kept + 3);
+    size_t i;
+
+    *kept = 0;
+    for (i = first; i < last; i++) {
+      flags[i - first] = transform->predicate(transform->input + i * size, transform->data) != 0;
+      *kept += flags[i - first];
+    }
+
+    if (!__cthreads_parallel_look_back(&transform->offsets, index, kept, offset, temp)) *offset = 0;
+
+    for (i = first; i < last; i++) {
+      if (!flags[i - first]) continue;
+
+      memcpy(transform->output + *offset * size, transform->input + i * size, size);
+      (*offset)++;
+    }
+  }
+
+  static void __cthreads_parallel_sort_block(void *context, size_t index, void *scratch) {
+    struct __cthreads_parallel_sort *sort = context;
+    size_t first = index * sort->block;
+    size_t last = first + sort->block < sort->count ? first + sort->block : sort->count;
+    char *run = sort->runs + first * sort->size;
+
+    (void) scratch;
+
+    /* INFO: The block is still in cache from the copy when qsort starts on it */
+    memcpy(run, sort->base + first * sort->size, (last - first) * sort->size);
+    qsort(run, last - first, sort->size, sort->compare);
+  }
+
+  /* INFO: Orders elements of the runs by value, then by position, so that splitters cut through equal elements too */
+  static int __cthreads_parallel_sort_order(const struct __cthreads_parallel_sort *sort, size_t a, size_t b) {
+    int ret = sort->compare(sort->runs + a * sort->size, sort->runs + b * sort->size);
+
+    if (ret != 0) return ret;
+
+    return a < b ? -1 : a > b;
+  }
+
+  static void __cthreads_parallel_sift_samples(const struct __cthreads_parallel_sort *sort, size_t *samples, size_t root, size_t count) {
+    size_t child, swap;
+
+    while ((child = 2 * root + 1) < count) {
+      if (child + 1 < count && __cthreads_parallel_sort_order(sort, samples[child], samples[child + 1]) < 0) child++;
+      if (__cthreads_parallel_sort_order(sort, samples[root], samples[child]) >= 0) return;
+
+      swap = samples[root];
+      samples[root] = samples[child];
+      samples[child] = swap;
+      root = child;
+    }
+  }
+
+  /* INFO: Heapsort, qsort cannot hand `sort` to its comparator */
+  static void __cthreads_parallel_sort_samples(const struct __cthreads_parallel_sort *sort, size_t *samples, size_t count) {
+    size_t i, swap;
+
+    for (i = count / 2; i-- > 0;) __cthreads_parallel_sift_samples(sort, samples, i, count);
+
+    for (i = count; i-- > 1;) {
+      swap = samples[0];
+      samples[0] = samples[i];
+      samples[i] = swap;
+      __cthreads_parallel_sift_samples(sort, samples, 0, i);
+    }
+  }
+
+  static void __cthreads_parallel_sort_bounds(void *context, size_t index, void *scratch) {
+    struct __cthreads_parallel_sort *sort = context;
+    size_t first = index * sort->block;
+    size_t length = sort->count - first < sort->block ? sort->count - first : sort->block;
+    size_t *bounds = sort->bounds + index * (sort->buckets + 1);
+    size_t low = 0, j;
+
+    (void) scratch;
+
+    bounds[0] = 0;
+
+    /* INFO: Splitters ascend, so each search starts where the previous one ended */
+    for (j = 0; j + 1 < sort->buckets; j++) {
+      size_t high = length;
+
+      while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (__cthreads_parallel_sort_order(sort, first + middle, sort->splitters[j]) <= 0) low = middle + 1;
+        else high = middle;
+      }
+
+      bounds[j + 1] = low;
+    }
+
+    bounds[sort->buckets] = length;
+  }
+
+  /* INFO: Bottom-up (Floyd): the hole goes down to a leaf for one comparison per level, the cursor rarely climbs back far */
+  static void __cthreads_parallel_sift_cursors(struct __cthreads_parallel_cursor *heap, size_t root, size_t count, int (*compare)(const void *a, const void *b)) {
+    struct __cthreads_parallel_cursor cursor = heap[root];
+    size_t hole = root, child;
+
+    while ((child = 2 * hole + 1) < count) {
+      if (child + 1 < count && compare(heap[child + 1].at, heap[child].at) < 0) child++;
+
+      heap[hole] = heap[child];
+      hole = child;
+    }
+
+    while (hole > root && compare(heap[(hole - 1) / 2].at, cursor.at) > 0) {
+      heap[hole] = heap[(hole - 1) / 2];
+      hole = (hole - 1) / 2;
+    }
+
+    heap[hole] = cursor;
+  }
+
+  /* INFO: Merges one bucket's slice of every run straight into its place in `base`, through a heap of run cursors */
+  static void __cthreads_parallel_sort_merge(void *context, size_t index, void *scratch) {
+    struct __cthreads_parallel_sort *sort = context;
+    struct __cthreads_parallel_cursor *heap = scratch;
+    size_t size = sort->size, stride = sort->buckets + 1, offset = 0, count = 0, r;
+    char *out;
+
+    for (r = 0; r < sort->run_count; r++) {
+      const size_t *bounds = sort->bounds + r * stride;
+      const char *run = sort->runs + r * sort->block * size;
+
+      offset += bounds[index];
+      if (bounds[index] == bounds[index + 1]) continue;
+
+      heap[count].at = run + bounds[index] * size;
+      heap[count].end = run + bounds[index + 1] * size;
+      count++;
+    }
+
+    out = sort->base + offset * size;
+
+    for (r = count / 2; r-- > 0;) __cthreads_parallel_sift_cursors(heap, r, count, sort->compare);
+
+    while (count > 1) {
+      memcpy(out, heap[0].at, size);
+      out += size;
+
+      heap[0].at += size;
+      if (heap[0].at == heap[0].end) heap[0] = heap[--count];
+
+      __cthreads_parallel_sift_cursors(heap, 0, count, sort->compare);
+    }
+
+    if (count) memcpy(out, heap[0].at, (size_t)(heap[0].end - heap[0].at));
+  }
+
+  int cthreads_parallel_sort(struct cthreads_pool *pool, void *base, size_t count, size_t size, int (*compare)(const void *a, const void *b)) {
+    struct __cthreads_parallel_sort sort;
+    size_t threads = pool ? cthreads_atomic_load_u32(&pool->threads, CTHREADS_ATOMIC_RELAXED) : 0;
+    size_t samples, i;
+    size_t *index;
+    int ret;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_parallel_sort");
+    #endif
+
+    if (count < 2) return 0;
+    if (size == 0) return 1;
+
+    sort.base = base;
+    sort.count = count;
+    sort.size = size;
+    sort.block = size < CTHREADS_PARALLEL_BLOCK ? CTHREADS_PARALLEL_BLOCK / size : 1;
+    sort.run_count = (count + sort.block - 1) / sort.block;
+    sort.compare = compare;
+
+    if (sort.run_count == 1) {
+      qsort(base, count, size, compare);
+
+      return 0;
+    }
+
+    /* INFO: Enough buckets to keep every thread busy, chosen from oversampled splitters so that they come out even */
+    sort.buckets = 4 * (threads + 1);
+    if (sort.buckets > count) sort.buckets = count;
+    samples = sort.buckets * __CTHREADS_PARALLEL_OVERSAMPLING;
+    if (samples > count) samples = count;
+
+    sort.runs = malloc(count * size);
+    if (!sort.runs) return 1;
+
+    index = malloc((samples + sort.run_count * (sort.buckets + 1)) * sizeof(size_t));
+    if (!index) {
+      free(sort.runs);
+
+      return 1;
+    }
+
+    sort.splitters = index;
+    sort.bounds = index + samples;
+
+    /* INFO: Nothing is written to `base` before the merge, which cannot fail once it started */
+    ret = __cthreads_parallel_run(pool, sort.run_count, __cthreads_parallel_sort_block, &sort, 0);
+
+    if (ret == 0) {
+      for (i = 0; i < samples; i++)
+        sort.splitters[i] = (size_t)(((uint64_t)2 * i + 1) * count / (2 * (uint64_t)samples));
+
+      __cthreads_parallel_sort_samples(&sort, sort.splitters, samples);
+
+      /* INFO: Splitters are picked in place, (j + 1) * samples / buckets never falls behind j */
+      for (i = 0; i + 1 < sort.buckets; i++)
+        sort.splitters[i] = sort.splitters[(i + 1) * samples / sort.buckets];
+
+      ret = __cthreads_parallel_run(pool, sort.run_count, __cthreads_parallel_sort_bounds, &sort, 0);
+    }
+
+    if (ret == 0)
+      ret = __cthreads_parallel_run(pool, sort.buckets, __cthreads_parallel_sort_merge, &sort, sort.run_count * sizeof(struct __cthreads_parallel_cursor));
+
+    free(index);
+    free(sort.runs);
+
+    return ret;
+  }
+
+  int cthreads_parallel_inclusive_scan(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t size, void (*op)(void *accumulator, const void *element, void *data), void *data) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_parallel_inclusive_scan");
+    #endif
+
+    return __cthreads_parallel_scan(pool, input, output, count, size, NULL, op, data);
+  }
+
+  int cthreads_parallel_exclusive_scan(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t size, const void *init, void (*op)(void *accumulator, const void *element, void *data), void *data) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_parallel_exclusive_scan");
+    #endif
+
+    if (!init) return 1;
+
+    return __cthreads_parallel_scan(pool, input, output, count, size, init, op, data);
+  }
+
+  int cthreads_parallel_transform(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t in_size, size_t out_size, void (*func)(const void *in, void *out, void *data), void *data) {
+    struct __cthreads_parallel_transform transform;
+    size_t size = in_size > out_size ? in_size : out_size;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_parallel_transform");
+    #endif
+
+    transform.input = input;
+    transform.output = output;
+    transform.count = count;
+    transform.in_size = in_size;
+    transform.out_size = out_size;
+    transform.block = size && size < CTHREADS_PARALLEL_BLOCK ? CTHREADS_PARALLEL_BLOCK / size : 1;
+    transform.func = func;
+    transform.data = data;
+
+    return __cthreads_parallel_run(pool, (count + transform.block - 1) / transform.block, __cthreads_parallel_transform_block, &transform, 0);
+  }
+
+  int cthreads_parallel_copy_if(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t size, int (*predicate)(const void *element, void *data), void *data, size_t *copied) {
+    struct __cthreads_parallel_transform transform;
+    size_t blocks;
+    int ret;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_parallel_copy_if");
+    #endif
+
+    *copied = 0;
+    if (count == 0) return 0;
+    if (size == 0) return 1;
+
+    transform.input = input;
+    transform.output = output;
+    transform.count = count;
+    transform.in_size = size;
+    transform.out_size = size;
+    transform.block = size < CTHREADS_PARALLEL_BLOCK ? CTHREADS_PARALLEL_BLOCK / size : 1;
+    transform.predicate = predicate;
+    transform.data = data;
+    transform.offsets.init = NULL;
+    transform.offsets.combine = __cthreads_parallel_add_size;
+    transform.offsets.combine_data = NULL;
+
+    blocks = (count + transform.block - 1) / transform.block;
+    if (__cthreads_parallel_scan_init(&transform.offsets, blocks, sizeof(size_t)) != 0) return 1;
+
+    ret = __cthreads_parallel_run(pool, blocks, __cthreads_parallel_copy_if_block, &transform, 3 * sizeof(size_t) + transform.block);
+    if (ret == 0) memcpy(copied, transform.offsets.prefixes + (blocks - 1) * sizeof(size_t), sizeof(size_t));
+
+    __cthreads_parallel_scan_destroy(&transform.offsets);
+
+    return ret;
+  }
+#endif
+
+#ifdef CTHREADS_TIMER
+  #define __CTHREADS_TIMER_BITS 6
+  #define __CTHREADS_TIMER_MASK (CTHREADS_TIMER_SLOTS - 1)
+
+  #define __CTHREADS_TIMER_IDLE 0
+  #define __CTHREADS_TIMER_PENDING 1
+  #define __CTHREADS_TIMER_FIRING 2
+
+  static __CTHREADS_INLINE unsigned int __cthreads_timer_ctz(uint64_t bits) {
+    #if defined(__GNUC__) || defined(__clang__)
+      return (unsigned int)__builtin_ctzll(bits);
+    #elif defined(_MSC_VER) && defined(_M_X64)
+      unsigned long index;
+
+      _BitScanForward64(&index, bits);
+
+      return (unsigned int)index;
+    #else
+      unsigned int index = 0;
+
+      while (!(bits & 1)) {
+        bits >>= 1;
+        index++;
+      }
+
+      return index;
+    #endif
+  }
+
+  static void __cthreads_timer_link(struct cthreads_timer_wheel *wheel, struct cthreads_timer *timer) {
+    struct cthreads_timer **head;
+    uint64_t placed, delta;
+    unsigned int level = 0, index;
+
+    if (timer->expires < wheel->current) timer->expires = wheel->current;
+
+    placed = timer->expires;
+    delta = placed - wheel->current;
+
+    /* INFO: Timers beyond the top level wait in its furthest slot, and get placed again when it cascades */
+    if (delta >> (__CTHREADS_TIMER_BITS * CTHREADS_TIMER_LEVELS)) {
+      delta = ((uint64_t)1 << (__CTHREADS_TIMER_BITS * CTHREADS_TIMER_LEVELS)) - 1;
+      placed = wheel->current + delta;
+    }
+
+    while (level + 1 < CTHREADS_TIMER_LEVELS && delta >> (__CTHREADS_TIMER_BITS * (level + 1))) level++;
+
+    index = (unsigned int)(placed >> (__CTHREADS_TIMER_BITS * level)) & __CTHREADS_TIMER_MASK;
+    head = &wheel->slots[level][index];
+
+    timer->next = *head;
+    if (timer->next) timer->next->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+
+    timer->slot = level * CTHREADS_TIMER_SLOTS + index;
+    wheel->occupied[level] |= (uint64_t)1 << index;
+  }
+
+  static void __cthreads_timer_unlink(struct cthreads_timer_wheel *wheel, struct cthreads_timer *timer) {
+    unsigned int level = timer->slot / CTHREADS_TIMER_SLOTS;
+    unsigned int index = timer->slot % CTHREADS_TIMER_SLOTS;
+
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+
+    if (!wheel->slots[level][index]) wheel->occupied[level] &= ~((uint64_t)1 << index);
+  }
+
+  /* INFO: First tick at or after `current` where a slot of any level has to be handled, UINT64_MAX if none */
+  static uint64_t __cthreads_timer_next(struct cthreads_timer_wheel *wheel) {
+    uint64_t next = UINT64_MAX;
+    unsigned int level;
+
+    for (level = 0; level < CTHREADS_TIMER_LEVELS; level++) {
+      unsigned int shift = __CTHREADS_TIMER_BITS * level, from;
+      uint64_t bits = wheel->occupied[level], block, at;
+
+      if (!bits) continue;
+
+      /* INFO: Slots of a level are handled on its block boundaries, the first one at or after `current` */
+      block = (wheel->current + ((uint64_t)1 << shift) - 1) >> shift;
+      from = (unsigned int)block & __CTHREADS_TIMER_MASK;
+      if (from) bits = (bits >> from) | (bits << (CTHREADS_TIMER_SLOTS - from));
+
+      at = (block + __cthreads_timer_ctz(bits)) << shift;
+      if (at < next) next = at;
+    }
+
+    return next;
+  }
+
+  /* INFO: Moves the slots due at `current` down, higher levels first */
+  static void __cthreads_timer_cascade(struct cthreads_timer_wheel *wheel) {
+    unsigned int level;
+
+    for (level = CTHREADS_TIMER_LEVELS - 1; level > 0; level--) {
+      unsigned int shift = __CTHREADS_TIMER_BITS * level, index;
+      struct cthreads_timer *timer;
+
+      if (wheel->current & (((uint64_t)1 << shift) - 1)) continue;
+
+      index = (unsigned int)(wheel->current >> shift) & __CTHREADS_TIMER_MASK;
+      timer = wheel->slots[level][index];
+      if (!timer) continue;
+
+      wheel->slots[level][index] = NULL;
+      wheel->occupied[level] &= ~((uint64_t)1 << index);
+
+      while (timer) {
+        struct cthreads_timer *next = timer->next;
+
+        __cthreads_timer_link(wheel, timer);
+        timer = next;
+      }
+    }
+  }
+
+  /* INFO: Must be called with the lock held, returns 1 if the driver has to be woken once it is released */
+  static int __cthreads_timer_kick(struct cthreads_timer_wheel *wheel, uint64_t expires) {
+    if (expires >= wheel->sleep_until) return 0;
+
+    wheel->sleep_until = expires;
+    cthreads_atomic_fetch_add_u32(&wheel->epoch, 1, CTHREADS_ATOMIC_RELEASE);
+
+    return 1;
+  }
+
+  /*
+    INFO: Runs every callback, inline or as the timer's pool task. The task may be submitted again once it started,
+            expiries while it is still queued are folded into it and run the latest callback. Periodic timers are
+            rescheduled only after their callback returned, one-shot ones are not touched after it, which may free them.
+  */
+  static void __cthreads_timer_run(void *data) {
+    struct cthreads_timer *timer = data;
+    struct cthreads_timer_wheel *wheel = timer->wheel;
+    void (*func)(void *data);
+    void *func_data;
+    int periodic;
+    int kick = 0;
+
+    cthreads_lock_lock(&wheel->lock);
+
+    timer->queued = 0;
+    func = timer->func;
+    func_data = timer->data;
+    periodic = timer->state == __CTHREADS_TIMER_FIRING;
+
+    cthreads_lock_unlock(&wheel->lock);
+
+    func(func_data);
+
+    if (!periodic) return;
+
+    cthreads_lock_lock(&wheel->lock);
+
+    /* INFO: Otherwise it was cancelled or started again meanwhile */
+    if (timer->state == __CTHREADS_TIMER_FIRING) {
+      timer->expires += timer->period;
+      timer->state = __CTHREADS_TIMER_PENDING;
+
+      __cthreads_timer_link(wheel, timer);
+      kick = __cthreads_timer_kick(wheel, timer->expires);
+    }
+
+    cthreads_lock_unlock(&wheel->lock);
+
+    if (kick) __cthreads_futex_wake(&wheel->epoch, 0);
+  }
+
+  /* INFO: Called with the lock held, which inline callbacks release while they run */
+  static void __cthreads_timer_fire(struct cthreads_timer_wheel *wheel, struct cthreads_timer *timer) {
+    timer->state = timer->period ? __CTHREADS_TIMER_FIRING : __CTHREADS_TIMER_IDLE;
+
+    /* INFO: Resubmitting a queued task would corrupt the pool's queue, it runs the latest callback anyway */
+    if (timer->queued) return;
+
+    timer->queued = 1;
+
+    if (wheel->pool && cthreads_pool_submit(wheel->pool, &timer->task, __cthreads_timer_run, timer) == 0) return;
+
+    cthreads_lock_unlock(&wheel->lock);
+    __cthreads_timer_run(timer);
+    cthreads_lock_lock(&wheel->lock);
+  }
+
+  static void *__cthreads_timer_driver(void *data) {
+    struct cthreads_timer_wheel *wheel = data;
+
+    cthreads_lock_lock(&wheel->lock);
+
+    while (!wheel->shutdown) {
+      uint64_t now = (__cthreads_monotonic_ns() - wheel->start_ns) / wheel->tick_ns, next, target;
+      uint32_t epoch;
+
+      while ((next = __cthreads_timer_next(wheel)) <= now) {
+        struct cthreads_timer *timer;
+        unsigned int index = (unsigned int)next & __CTHREADS_TIMER_MASK;
+
+        /* INFO: Nothing happens on the ticks skipped over */
+        wheel->current = next;
+        __cthreads_timer_cascade(wheel);
+
+        while ((timer = wheel->slots[0][index])) {
+          __cthreads_timer_unlink(wheel, timer);
+          __cthreads_timer_fire(wheel, timer);
+        }
+
+        wheel->current = next + 1;
+      }
+
+      wheel->current = now + 1;
+      wheel->sleep_until = next;
+      epoch = cthreads_atomic_load_u32(&wheel->epoch, CTHREADS_ATOMIC_RELAXED);
+
+      cthreads_lock_unlock(&wheel->lock);
+
+      if (next == UINT64_MAX) {
+        __cthreads_futex_wait(&wheel->epoch, epoch, UINT64_MAX);
+      } else {
+        target = wheel->start_ns + next * wheel->tick_ns;
+        now = __cthreads_monotonic_ns();
+
+        if (target > now) __cthreads_futex_wait(&wheel->epoch, epoch, target - now);
+      }
+
+      cthreads_lock_lock(&wheel->lock);
+    }
+
+    cthreads_lock_unlock(&wheel->lock);
+
+    return NULL;
+  }
+
+  int cthreads_timer_wheel_init(struct cthreads_timer_wheel *wheel, unsigned int resolution_ms, struct cthreads_pool *pool) {
+    unsigned int level, index;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_timer_wheel_init");
+    #endif
+
+    cthreads_lock_init(&wheel->lock);
+    wheel->epoch = 0;
+    wheel->shutdown = 0;
+    wheel->current = 0;
+    wheel->sleep_until = 0;
+    wheel->start_ns = __cthreads_monotonic_ns();
+    wheel->tick_ns = (uint64_t)(resolution_ms ? resolution_ms : 1) * 1000000;
+    wheel->pool = pool;
+
+    for (level = 0; level < CTHREADS_TIMER_LEVELS; level++) {
+      wheel->occupied[level] = 0;
+
+      for (index = 0; index < CTHREADS_TIMER_SLOTS; index++)
+        wheel->slots[level][index] = NULL;
+    }
+
+    return cthreads_thread_create(&wheel->thread, NULL, __cthreads_timer_driver, wheel, &wheel->args);
+  }
+
+  int cthreads_timer_start(struct cthreads_timer_wheel *wheel, struct cthreads_timer *timer, unsigned int delay_ms, unsigned int period_ms, void (*func)(void *data), void *data) {
+    uint64_t now;
+    int kick;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_timer_start");
+    #endif
+
+    now = __cthreads_monotonic_ns() - wheel->start_ns;
+
+    cthreads_lock_lock(&wheel->lock);
+
+    if (timer->wheel == wheel && timer->state == __CTHREADS_TIMER_PENDING) __cthreads_timer_unlink(wheel, timer);
+
+    timer->func = func;
+    timer->data = data;
+    timer->wheel = wheel;
+    /* INFO: Rounded up, so that timers never expire early */
+    timer->expires = (now + (uint64_t)delay_ms * 1000000 + wheel->tick_ns - 1) / wheel->tick_ns;
+    timer->period = period_ms ? ((uint64_t)period_ms * 1000000 + wheel->tick_ns - 1) / wheel->tick_ns : 0;
+    timer->state = __CTHREADS_TIMER_PENDING;
+
+    __cthreads_timer_link(wheel, timer);
+    kick = __cthreads_timer_kick(wheel, timer->expires);
+
+    cthreads_lock_unlock(&wheel->lock);
+
+    if (kick) __cthreads_futex_wake(&wheel->epoch, 0);
+
+    return 0;
+  }
+
+  int cthreads_timer_cancel(struct cthreads_timer_wheel *wheel, struct cthreads_timer *timer) {
+    int ret = 1;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_timer_cancel");
+    #endif
+
+    cthreads_lock_lock(&wheel->lock);
+
+    if (timer->state == __CTHREADS_TIMER_PENDING) {
+      __cthreads_timer_unlink(wheel, timer);
+
+      ret = 0;
+    }
+
+    timer->state = __CTHREADS_TIMER_IDLE;
+
+    cthreads_lock_unlock(&wheel->lock);
+
+    return ret;
+  }
+
+  int cthreads_timer_wheel_destroy(struct cthreads_timer_wheel *wheel) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_timer_wheel_destroy");
+    #endif
+
+    cthreads_lock_lock(&wheel->lock);
+    wheel->shutdown = 1;
+    cthreads_atomic_fetch_add_u32(&wheel->epoch, 1, CTHREADS_ATOMIC_RELEASE);
+    cthreads_lock_unlock(&wheel->lock);
+
+    __cthreads_futex_wake(&wheel->epoch, 0);
+
+    return cthreads_thread_join(wheel->thread, NULL);
+  }
+#endif
+
+#ifdef CTHREADS_PIPELINE
+  /* INFO: Ring slot. Queues use Vyukov's bounded MPMC sequence numbers, in-order stages index it by item number instead */
+  struct __cthreads_pipeline_cell {
+    uint64_t sequence;
+    uint64_t number;
+    void *item;
+  };
+
+  struct __cthreads_pipeline_worker {
+    struct __cthreads_pipeline_stage *stage;
+    /* INFO: Only written by the worker's thread, summed up by cthreads_pipeline_stats */
+    uint64_t items;
+    uint64_t busy_ns;
+    uint64_t starved_ns;
+    uint64_t blocked_ns;
+    struct cthreads_thread thread;
+    struct cthreads_args args;
+    char __pad0[CTHREADS_CACHE_LINE];
+  };
+
+  struct __cthreads_pipeline_stage {
+    struct cthreads_pipeline *pipeline;
+    struct __cthreads_pipeline_stage *next;
+    void *(*func)(void *item, void *data);
+    void *data;
+    int mode;
+    /* INFO: An in-order stage follows, so dropped items still travel as holes to keep its numbering dense */
+    int ordered_after;
+    size_t threads;
+    size_t started;
+    uint32_t tokens;
+    uint64_t mask;
+    struct __cthreads_pipeline_cell *cells;
+    struct __cthreads_pipeline_worker *workers;
+    char __pad0[CTHREADS_CACHE_LINE];
+    /* INFO: Written by the previous stage */
+    uint64_t enqueue;
+    uint32_t in_flight;
+    uint32_t space_epoch;
+    uint32_t space_sleepers;
+    char __pad1[CTHREADS_CACHE_LINE - sizeof(uint64_t) - 3 * sizeof(uint32_t)];
+    /* INFO: Written by the stage's own threads */
+    uint64_t dequeue;
+    uint32_t epoch;
+    uint32_t sleepers;
+    uint32_t done;
+    uint32_t running;
+    char __pad2[CTHREADS_CACHE_LINE - sizeof(uint64_t) - 4 * sizeof(uint32_t)];
+  };
+
+  /* INFO: Counters have a single writer, but are read by cthreads_pipeline_stats at any time */
+  static __CTHREADS_INLINE void __cthreads_pipeline_count(volatile uint64_t *counter, uint64_t value) {
+    cthreads_atomic_store_u64(counter, cthreads_atomic_load_u64(counter, CTHREADS_ATOMIC_RELAXED) + value, CTHREADS_ATOMIC_RELAXED);
+  }
+
+  static void __cthreads_pipeline_wake(volatile uint32_t *epoch, volatile uint32_t *sleepers, int all) {
+    /* INFO: Pairs with the sleeper registering itself before its last check */
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+    if (!cthreads_atomic_load_u32(sleepers, CTHREADS_ATOMIC_RELAXED)) return;
+
+    cthreads_atomic_fetch_add_u32(epoch, 1, CTHREADS_ATOMIC_RELEASE);
+    __cthreads_futex_wake(epoch, all);
+  }
+
+  /* INFO: Spins, then sleeps until `ready(context)`. Returns the nanoseconds spent asleep, an approximation of the whole wait */
+  static uint64_t __cthreads_pipeline_await(volatile uint32_t *epoch, volatile uint32_t *sleepers, int (*ready)(void *context), void *context) {
+    uint64_t start = 0;
+    uint32_t round = 0;
+
+    while (!ready(context)) {
+      uint32_t seen;
+
+      if (!cthreads_atomic_backoff(&round)) continue;
+
+      if (!start) start = __cthreads_monotonic_ns();
+
+      cthreads_atomic_fetch_add_u32(sleepers, 1, CTHREADS_ATOMIC_SEQ_CST);
+      seen = cthreads_atomic_load_u32(epoch, CTHREADS_ATOMIC_ACQUIRE);
+      if (!ready(context)) __cthreads_futex_wait(epoch, seen, UINT64_MAX);
+      cthreads_atomic_fetch_add_u32(sleepers, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+    }
+
+    return start ? __cthreads_monotonic_ns() - start : 0;
+  }
+
+  static int __cthreads_pipeline_has_live(void *context) {
+    struct cthreads_pipeline *pipeline = context;
+
+    return cthreads_atomic_load_u32(&pipeline->live, CTHREADS_ATOMIC_SEQ_CST) < pipeline->max_live;
+  }
+
+  static int __cthreads_pipeline_has_space(void *context) {
+    struct __cthreads_pipeline_stage *stage = context;
+
+    return cthreads_atomic_load_u32(&stage->in_flight, CTHREADS_ATOMIC_SEQ_CST) < stage->tokens;
+  }
+
+  static int __cthreads_pipeline_has_item(void *context) {
+    struct __cthreads_pipeline_stage *stage = context;
+    uint64_t position = cthreads_atomic_load_u64(&stage->dequeue, CTHREADS_ATOMIC_RELAXED);
+    struct __cthreads_pipeline_cell *cell = &stage->cells[position & stage->mask];
+
+    if (cthreads_atomic_load_u32(&stage->done, CTHREADS_ATOMIC_SEQ_CST)) return 1;
+
+    return cthreads_atomic_load_u64(&cell->sequence, CTHREADS_ATOMIC_ACQUIRE) == position + 1;
+  }
+
+  static void __cthreads_pipeline_release_live(struct cthreads_pipeline *pipeline) {
+    cthreads_atomic_fetch_add_u32(&pipeline->live, (uint32_t)-1, CTHREADS_ATOMIC_SEQ_CST);
+    if (pipeline->max_live != UINT32_MAX) __cthreads_pipeline_wake(&pipeline->live_epoch, &pipeline->live_sleepers, 0);
+  }
+
+  static void __cthreads_pipeline_release_token(struct __cthreads_pipeline_stage *stage) {
+    cthreads_atomic_fetch_add_u32(&stage->in_flight, (uint32_t)-1, CTHREADS_ATOMIC_SEQ_CST);
+    if (stage->mode != CTHREADS_PIPELINE_SERIAL_IN_ORDER)
+      __cthreads_pipeline_wake(&stage->space_epoch, &stage->space_sleepers, 0);
+  }
+
+  /* INFO: Admits an item into `stage`, waiting for one of its tokens unless it reorders */
+  static void __cthreads_pipeline_push(struct __cthreads_pipeline_stage *stage, uint64_t number, void *item, struct __cthreads_pipeline_worker *self) {
+    struct __cthreads_pipeline_cell *cell;
+
+    if (stage->mode == CTHREADS_PIPELINE_SERIAL_IN_ORDER) {
+      /* INFO: Live items never exceed its tokens, so the slot of `number` is free */
+      cthreads_atomic_fetch_add_u32(&stage->in_flight, 1, CTHREADS_ATOMIC_RELAXED);
+
+      cell = &stage->cells[number & stage->mask];
+      cell->number = number;
+      cell->item = item;
+      cthreads_atomic_store_u64(&cell->sequence, number + 1, CTHREADS_ATOMIC_RELEASE);
+    } else {
+      uint64_t position;
+
+      for (;;) {
+        uint32_t in_flight = cthreads_atomic_load_u32(&stage->in_flight, CTHREADS_ATOMIC_RELAXED);
+
+        if (in_flight < stage->tokens) {
+          if (cthreads_atomic_cas_weak_u32(&stage->in_flight, &in_flight, in_flight + 1, CTHREADS_ATOMIC_ACQUIRE)) break;
+
+          continue;
+        }
+
+        __cthreads_pipeline_count(&self->blocked_ns, __cthreads_pipeline_await(&stage->space_epoch, &stage->space_sleepers, __cthreads_pipeline_has_space, stage));
+      }
+
+      /* INFO: A token guarantees a free slot, only the race for it with other producers remains */
+      position = cthreads_atomic_load_u64(&stage->enqueue, CTHREADS_ATOMIC_RELAXED);
+      for (;;) {
+        cell = &stage->cells[position & stage->mask];
+
+        if (cthreads_atomic_load_u64(&cell->sequence, CTHREADS_ATOMIC_ACQUIRE) == position) {
+          if (cthreads_atomic_cas_weak_u64(&stage->enqueue, &position, position + 1, CTHREADS_ATOMIC_RELAXED)) break;
+        } else {
+          cthreads_atomic_pause();
+          position = cthreads_atomic_load_u64(&stage->enqueue, CTHREADS_ATOMIC_RELAXED);
+        }
+      }
+
+      cell->number = number;
+      cell->item = item;
+      cthreads_atomic_store_u64(&cell->sequence, position + 1, CTHREADS_ATOMIC_RELEASE);
+    }
+
+    __cthreads_pipeline_wake(&stage->epoch, &stage->sleepers, 0);
+  }
+
+  /* INFO: Returns 0 with the next item of the stage, or non-zero once the previous stage finished and it is drained */
+  static int __cthreads_pipeline_pop(struct __cthreads_pipeline_stage *stage, uint64_t *number, void **item, struct __cthreads_pipeline_worker *self) {
+    struct __cthreads_pipeline_cell *cell;
+    uint64_t position, sequence;
+
+    for (;;) {
+      position = cthreads_atomic_load_u64(&stage->dequeue, CTHREADS_ATOMIC_RELAXED);
+      cell = &stage->cells[position & stage->mask];
+      sequence = cthreads_atomic_load_u64(&cell->sequence, CTHREADS_ATOMIC_ACQUIRE);
+
+      if (sequence == position + 1) {
+        if (stage->mode != CTHREADS_PIPELINE_PARALLEL) {
+          cthreads_atomic_store_u64(&stage->dequeue, position + 1, CTHREADS_ATOMIC_RELAXED);
+
+          break;
+        }
+
+        if (cthreads_atomic_cas_weak_u64(&stage->dequeue, &position, position + 1, CTHREADS_ATOMIC_RELAXED)) break;
+
+        continue;
+      }
+
+      if ((int64_t)(sequence - (position + 1)) > 0) continue;
+
+      /* INFO: Everything pushed before the previous stage finished is visible once `done` is */
+      if (cthreads_atomic_load_u32(&stage->done, CTHREADS_ATOMIC_ACQUIRE)) {
+        if (cthreads_atomic_load_u64(&stage->dequeue, CTHREADS_ATOMIC_RELAXED) != position) continue;
+        if (cthreads_atomic_load_u64(&cell->sequence, CTHREADS_ATOMIC_ACQUIRE) == position + 1) continue;
+
+        return 1;
+      }
+
+      __cthreads_pipeline_count(&self->starved_ns, __cthreads_pipeline_await(&stage->epoch, &stage->sleepers, __cthreads_pipeline_has_item, stage));
+    }
+
+    *number = cell->number;
+    *item = cell->item;
+
+    /* INFO: In-order slots are indexed by item number, so they are only marked empty */
+    if (stage->mode == CTHREADS_PIPELINE_SERIAL_IN_ORDER) cthreads_atomic_store_u64(&cell->sequence, 0, CTHREADS_ATOMIC_RELAXED);
+    else cthreads_atomic_store_u64(&cell->sequence, position + stage->mask + 1, CTHREADS_ATOMIC_RELEASE);
+
+    return 0;
+  }
+
+  /* INFO: The last thread to leave a stage tells the next one no more items will come */
+  static void __cthreads_pipeline_leave(struct __cthreads_pipeline_stage *stage, uint32_t count) {
+    if (cthreads_atomic_fetch_add_u32(&stage->running, (uint32_t)0 - count, CTHREADS_ATOMIC_ACQ_REL) != count || !stage->next) return;
+
+    cthreads_atomic_store_u32(&stage->next->done, 1, CTHREADS_ATOMIC_SEQ_CST);
+    cthreads_atomic_fetch_add_u32(&stage->next->epoch, 1, CTHREADS_ATOMIC_RELEASE);
+    __cthreads_futex_wake(&stage->next->epoch, 1);
+  }
+
+  /* INFO: Hands the stage's output on, or retires the item once nothing needs it anymore */
+  static void __cthreads_pipeline_forward(struct __cthreads_pipeline_stage *stage, uint64_t number, void *item, struct __cthreads_pipeline_worker *self) {
+    if (stage->next && (item || stage->ordered_after)) __cthreads_pipeline_push(stage->next, number, item, self);
+    else __cthreads_pipeline_release_live(stage->pipeline);
+  }
+
+  static void *__cthreads_pipeline_worker_function(void *data) {
+    struct __cthreads_pipeline_worker *self = data;
+    struct __cthreads_pipeline_stage *stage = self->stage;
+    uint64_t number;
+    void *item;
+
+    while (!__cthreads_pipeline_pop(stage, &number, &item, self)) {
+      /* INFO: Holes only pass through */
+      if (item) {
+        uint64_t start = __cthreads_monotonic_ns();
+
+        item = stage->func(item, stage->data);
+
+        __cthreads_pipeline_count(&self->busy_ns, __cthreads_monotonic_ns() - start);
+        __cthreads_pipeline_count(&self->items, 1);
+      }
+
+      __cthreads_pipeline_forward(stage, number, item, self);
+      __cthreads_pipeline_release_token(stage);
+    }
+
+    __cthreads_pipeline_leave(stage, 1);
+
+    return NULL;
+  }
+
+  static void __cthreads_pipeline_source(struct __cthreads_pipeline_stage *stage) {
+    struct cthreads_pipeline *pipeline = stage->pipeline;
+    struct __cthreads_pipeline_worker *self = &stage->workers[0];
+    uint64_t number = 0;
+
+    for (;;) {
+      uint64_t start;
+      void *item;
+
+      while (!__cthreads_pipeline_has_live(pipeline))
+        __cthreads_pipeline_count(&self->blocked_ns, __cthreads_pipeline_await(&pipeline->live_epoch, &pipeline->live_sleepers, __cthreads_pipeline_has_live, pipeline));
+
+      cthreads_atomic_fetch_add_u32(&pipeline->live, 1, CTHREADS_ATOMIC_RELAXED);
+
+      start = __cthreads_monotonic_ns();
+      item = stage->func(NULL, stage->data);
+      __cthreads_pipeline_count(&self->busy_ns, __cthreads_monotonic_ns() - start);
+
+      if (!item) {
+        cthreads_atomic_fetch_add_u32(&pipeline->live, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+
+        break;
+      }
+
+      __cthreads_pipeline_count(&self->items, 1);
+      __cthreads_pipeline_forward(stage, number++, item, self);
+    }
+
+    __cthreads_pipeline_leave(stage, 1);
+  }
+
+  int cthreads_pipeline_init(struct cthreads_pipeline *pipeline) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pipeline_init");
+    #endif
+
+    pipeline->stages = NULL;
+    pipeline->count = 0;
+    pipeline->capacity = 0;
+    pipeline->live = 0;
+    pipeline->max_live = UINT32_MAX;
+    pipeline->live_epoch = 0;
+    pipeline->live_sleepers = 0;
+    pipeline->start_ns = 0;
+    pipeline->end_ns = 0;
+
+    return 0;
+  }
+
+  int cthreads_pipeline_add_stage(struct cthreads_pipeline *pipeline, int mode, size_t threads, size_t tokens, void *(*func)(void *item, void *data), void *data) {
+    struct __cthreads_pipeline_stage *stage;
+    uint64_t slots = 1;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pipeline_add_stage");
+    #endif
+
+    if (mode != CTHREADS_PIPELINE_PARALLEL && mode != CTHREADS_PIPELINE_SERIAL_IN_ORDER && mode != CTHREADS_PIPELINE_SERIAL_OUT_OF_ORDER) return 1;
+    if (pipeline->count == 0 && mode == CTHREADS_PIPELINE_PARALLEL) return 1;
+
+    if (mode != CTHREADS_PIPELINE_PARALLEL || threads == 0) threads = 1;
+    if (tokens > UINT32_MAX / 2) return 1;
+    /* INFO: Nothing is ever queued for the first stage, its tokens only bound the live items */
+    if (tokens == 0) tokens = pipeline->count == 0 ? UINT32_MAX : 16 * threads;
+
+    if (pipeline->count == pipeline->capacity) {
+      size_t capacity = pipeline->capacity ? pipeline->capacity * 2 : 4;
+      struct __cthreads_pipeline_stage **stages = realloc(pipeline->stages, capacity * sizeof(*stages));
+
+      if (!stages) return 1;
+
+      pipeline->stages = stages;
+      pipeline->capacity = capacity;
+    }
+
+    stage = calloc(1, sizeof(*stage));
+    if (!stage) return 1;
+
+    if (pipeline->count) while (slots < tokens) slots <<= 1;
+
+    stage->cells = calloc((size_t)slots, sizeof(*stage->cells));
+    stage->workers = calloc(threads, sizeof(*stage->workers));
+    if (!stage->cells || !stage->workers) {
+      free(stage->cells);
+      free(stage->workers);
+      free(stage);
+
+      return 1;
+    }
+
+    stage->pipeline = pipeline;
+    stage->func = func;
+    stage->data = data;
+    stage->mode = mode;
+    stage->threads = threads;
+    stage->tokens = (uint32_t)tokens;
+    stage->mask = slots - 1;
+
+    if (pipeline->count) pipeline->stages[pipeline->count - 1]->next = stage;
+    pipeline->stages[pipeline->count++] = stage;
+
+    return 0;
+  }
+
+  int cthreads_pipeline_run(struct cthreads_pipeline *pipeline) {
+    size_t i, j;
+    int ordered = 0;
+    int ret = 0;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pipeline_run");
+    #endif
+
+    if (pipeline->count == 0) return 1;
+
+    /* INFO: In-order stages must be able to hold every live item, or the one they wait for could never reach them */
+    pipeline->max_live = pipeline->stages[0]->tokens;
+    for (i = pipeline->count; i-- > 0;) {
+      struct __cthreads_pipeline_stage *stage = pipeline->stages[i];
+
+      stage->ordered_after = ordered;
+      if (stage->mode == CTHREADS_PIPELINE_SERIAL_IN_ORDER) {
+        ordered = 1;
+        if (i > 0 && stage->tokens < pipeline->max_live) pipeline->max_live = stage->tokens;
+      }
+    }
+
+    for (i = 0; i < pipeline->count; i++) {
+      struct __cthreads_pipeline_stage *stage = pipeline->stages[i];
+
+      for (j = 0; j <= stage->mask; j++)
+        stage->cells[j].sequence = stage->mode == CTHREADS_PIPELINE_SERIAL_IN_ORDER ? 0 : j;
+
+      for (j = 0; j < stage->threads; j++) {
+        stage->workers[j].stage = stage;
+        stage->workers[j].items = 0;
+        stage->workers[j].busy_ns = 0;
+        stage->workers[j].starved_ns = 0;
+        stage->workers[j].blocked_ns = 0;
+      }
+
+      stage->enqueue = 0;
+      stage->dequeue = 0;
+      stage->in_flight = 0;
+      stage->done = 0;
+      stage->running = (uint32_t)stage->threads;
+      stage->started = 0;
+    }
+
+    pipeline->live = 0;
+    cthreads_atomic_store_u64(&pipeline->end_ns, 0, CTHREADS_ATOMIC_RELAXED);
+    cthreads_atomic_store_u64(&pipeline->start_ns, __cthreads_monotonic_ns(), CTHREADS_ATOMIC_RELEASE);
+
+    for (i = 1; i < pipeline->count; i++) {
+      struct __cthreads_pipeline_stage *stage = pipeline->stages[i];
+
+      while (ret == 0 && stage->started < stage->threads) {
+        struct __cthreads_pipeline_worker *worker = &stage->workers[stage->started];
+
+        if (cthreads_thread_create(&worker->thread, NULL, __cthreads_pipeline_worker_function, worker, &worker->args) != 0) {
+          /* INFO: The input is not read at all then, the threads that started only see their stage finish */
+          __cthreads_pipeline_leave(stage, (uint32_t)(stage->threads - stage->started));
+          ret = 1;
+
+          break;
+        }
+
+        stage->started++;
+      }
+    }
+
+    if (ret == 0) __cthreads_pipeline_source(pipeline->stages[0]);
+    else __cthreads_pipeline_leave(pipeline->stages[0], 1);
+
+    for (i = 1; i < pipeline->count; i++) {
+      struct __cthreads_pipeline_stage *stage = pipeline->stages[i];
+
+      for (j = 0; j < stage->started; j++)
+        cthreads_thread_join(stage->workers[j].thread, NULL);
+    }
+
+    cthreads_atomic_store_u64(&pipeline->end_ns, __cthreads_monotonic_ns(), CTHREADS_ATOMIC_RELEASE);
+
+    return ret;
+  }
+
+  int cthreads_pipeline_stats(struct cthreads_pipeline *pipeline, size_t stage, struct cthreads_pipeline_stats *stats) {
+    struct __cthreads_pipeline_stage *target;
+    uint64_t start, end;
+    size_t i;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pipeline_stats");
+    #endif
+
+    if (stage >= pipeline->count) return 1;
+    target = pipeline->stages[stage];
+
+    stats->items = 0;
+    stats->busy_ns = 0;
+    stats->starved_ns = 0;
+    stats->blocked_ns = 0;
+
+    for (i = 0; i < target->threads; i++) {
+      struct __cthreads_pipeline_worker *worker = &target->workers[i];
+
+      stats->items += cthreads_atomic_load_u64(&worker->items, CTHREADS_ATOMIC_RELAXED);
+      stats->busy_ns += cthreads_atomic_load_u64(&worker->busy_ns, CTHREADS_ATOMIC_RELAXED);
+      stats->starved_ns += cthreads_atomic_load_u64(&worker->starved_ns, CTHREADS_ATOMIC_RELAXED);
+      stats->blocked_ns += cthreads_atomic_load_u64(&worker->blocked_ns, CTHREADS_ATOMIC_RELAXED);
+    }
+
+    start = cthreads_atomic_load_u64(&pipeline->start_ns, CTHREADS_ATOMIC_ACQUIRE);
+    end = cthreads_atomic_load_u64(&pipeline->end_ns, CTHREADS_ATOMIC_ACQUIRE);
+    if (!end) end = __cthreads_monotonic_ns();
+    stats->elapsed_ns = start ? end - start : 0;
+
+    if (stage == 0) {
+      stats->in_flight = cthreads_atomic_load_u32(&pipeline->live, CTHREADS_ATOMIC_RELAXED);
+      stats->tokens = pipeline->max_live;
+    } else {
+      stats->in_flight = cthreads_atomic_load_u32(&target->in_flight, CTHREADS_ATOMIC_RELAXED);
+      stats->tokens = target->tokens;
+    }
+    stats->threads = target->threads;
+
+    return 0;
+  }
+
+  int cthreads_pipeline_destroy(struct cthreads_pipeline *pipeline) {
+    size_t i;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_pipeline_destroy");
+    #endif
+
+    for (i = 0; i < pipeline->count; i++) {
+      free(pipeline->stages[i]->cells);
+      free(pipeline->stages[i]->workers);
+      free(pipeline->stages[i]);
+    }
+
+    free(pipeline->stages);
+    pipeline->stages = NULL;
+    pipeline->count = 0;
+    pipeline->capacity = 0;
+
+    return 0;
+  }
+#endif
+
+#ifdef CTHREADS_IPC
+  #define __CTHREADS_IPC_MAGIC 0x43544950u
+  /* INFO: How often a consumer waiting on a reserved message checks whether its producer still exists */
+  #define __CTHREADS_IPC_OWNER_CHECK_MS 100
+
+  struct __cthreads_ipc_slot {
+    uint64_t seq;
+    uint64_t size;
+    /* INFO: PID of the producer between reserve and commit, 0 otherwise */
+    uint64_t owner;
+    uint64_t __pad;
+  };
+
+  struct __cthreads_ipc_shared {
+    uint32_t magic;
+    uint32_t header_size;
+    uint64_t slot_size;
+    uint64_t slot_stride;
+    uint64_t slots;
+    char __pad0[CTHREADS_CACHE_LINE - 2 * sizeof(uint32_t) - 3 * sizeof(uint64_t)];
+    /* INFO: Written by producers */
+    uint64_t head;
+    uint32_t space_bell;
+    uint32_t producers_waiting;
+    char __pad1[CTHREADS_CACHE_LINE - sizeof(uint64_t) - 2 * sizeof(uint32_t)];
+    /* INFO: Written by the consumer holding `consumer` */
+    uint64_t tail;
+    uint32_t data_bell;
+    uint32_t consumer_waiting;
+    char __pad2[CTHREADS_CACHE_LINE - sizeof(uint64_t) - 2 * sizeof(uint32_t)];
+    struct cthreads_mutex consumer;
+  };
+
+  #define __CTHREADS_IPC_HEADER_SIZE ((sizeof(struct __cthreads_ipc_shared) + CTHREADS_CACHE_LINE - 1) & ~(size_t)(CTHREADS_CACHE_LINE - 1))
+
+  /* INFO: Doorbells live in memory shared between processes, so they cannot use the private futex operations */
+  static void __cthreads_ipc_bell_wait(volatile uint32_t *addr, uint32_t expected, uint64_t ns) {
+    #ifdef __linux__
+      struct timespec ts;
+
+      ts.tv_sec = (time_t)(ns / 1000000000);
+      ts.tv_nsec = (long)(ns % 1000000000);
+
+      syscall(SYS_futex, addr, FUTEX_WAIT, expected, ns == UINT64_MAX ? NULL : &ts, NULL, 0);
+    #else
+      struct _umtx_time timeout;
+
+      timeout._timeout.tv_sec = (time_t)(ns / 1000000000);
+      timeout._timeout.tv_nsec = (long)(ns % 1000000000);
+      timeout._flags = 0;
+      timeout._clockid = CLOCK_MONOTONIC;
+
+      _umtx_op((void *)addr, UMTX_OP_WAIT_UINT, expected, ns == UINT64_MAX ? NULL : (void *)sizeof(timeout), ns == UINT64_MAX ? NULL : &timeout);
+    #endif
+  }
+
+  static void __cthreads_ipc_bell_ring(volatile uint32_t *bell, volatile uint32_t *waiting) {
+    /* INFO: Pairs with the waiter announcing itself before its last look at the ring */
+    cthreads_atomic_fence(CTHREADS_ATOMIC_SEQ_CST);
+
+    if (!cthreads_atomic_load_u32(waiting, CTHREADS_ATOMIC_RELAXED)) return;
+
+    cthreads_atomic_fetch_add_u32(bell, 1, CTHREADS_ATOMIC_RELEASE);
+
+    #ifdef __linux__
+      syscall(SYS_futex, bell, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+    #else
+      _umtx_op((void *)bell, UMTX_OP_WAKE, INT32_MAX, NULL, NULL);
+    #endif
+  }
+
+  static __CTHREADS_INLINE struct __cthreads_ipc_slot *__cthreads_ipc_slot(struct __cthreads_ipc_shared *shared, uint64_t position) {
+    return (struct __cthreads_ipc_slot *)((char *)shared + __CTHREADS_IPC_HEADER_SIZE + (size_t)((position & (shared->slots - 1)) * shared->slot_stride));
+  }
+
+  /* INFO: Returns 0 once `*seq` reaches `expected`, 1 on timeout */
+  static int __cthreads_ipc_await(volatile uint64_t *seq, uint64_t expected, volatile uint32_t *bell, volatile uint32_t *waiting, int shared_waiters, unsigned int ms) {
+    uint64_t deadline = ms == CTHREADS_INFINITE ? UINT64_MAX : __cthreads_monotonic_ns() + (uint64_t)ms * 1000000;
+    unsigned int spins = 0;
+
+    while ((int64_t)(cthreads_atomic_load_u64(seq, CTHREADS_ATOMIC_ACQUIRE) - expected) < 0) {
+      uint64_t now;
+      uint32_t ticket;
+      int ready;
+
+      if (++spins < 64) {
+        cthreads_atomic_pause();
+
+        continue;
+      }
+
+      now = deadline == UINT64_MAX ? 0 : __cthreads_monotonic_ns();
+      if (now >= deadline) return 1;
+
+      ticket = cthreads_atomic_load_u32(bell, CTHREADS_ATOMIC_ACQUIRE);
+      if (shared_waiters) cthreads_atomic_fetch_add_u32(waiting, 1, CTHREADS_ATOMIC_SEQ_CST);
+      else cthreads_atomic_store_u32(waiting, 1, CTHREADS_ATOMIC_SEQ_CST);
+
+      ready = (int64_t)(cthreads_atomic_load_u64(seq, CTHREADS_ATOMIC_ACQUIRE) - expected) >= 0;
+      if (!ready) __cthreads_ipc_bell_wait(bell, ticket, deadline == UINT64_MAX ? UINT64_MAX : deadline - now);
+
+      if (shared_waiters) cthreads_atomic_fetch_add_u32(waiting, (uint32_t)-1, CTHREADS_ATOMIC_RELAXED);
+      else cthreads_atomic_store_u32(waiting, 0, CTHREADS_ATOMIC_RELAXED);
+    }
+
+    return 0;
+  }
+
+  /*
+    INFO: Run by the consumer while the message at `position` is overdue. Its slot was reserved
+            by a producer that has not committed it, and if that process no longer exists
+            nobody ever will, so the slot is freed and `tail` moves past it. A producer that
+            died before storing its PID still holds the ring back.
+  */
+  static int __cthreads_ipc_skip_dead(struct __cthreads_ipc_shared *shared, uint64_t position) {
+    struct __cthreads_ipc_slot *slot = __cthreads_ipc_slot(shared, position);
+    uint64_t owner = cthreads_atomic_load_u64(&slot->owner, CTHREADS_ATOMIC_ACQUIRE);
+
+    if (owner == 0 || kill((pid_t)owner, 0) == 0 || errno != ESRCH) return 0;
+    if (cthreads_atomic_load_u64(&slot->seq, CTHREADS_ATOMIC_ACQUIRE) != position) return 0;
+
+    cthreads_atomic_store_u64(&slot->owner, 0, CTHREADS_ATOMIC_RELAXED);
+    cthreads_atomic_store_u64(&shared->tail, position + 1, CTHREADS_ATOMIC_RELEASE);
+    cthreads_atomic_store_u64(&slot->seq, position + shared->slots, CTHREADS_ATOMIC_RELEASE);
+
+    __cthreads_ipc_bell_ring(&shared->space_bell, &shared->producers_waiting);
+
+    return 1;
+  }
+
+  static int __cthreads_ipc_map(struct cthreads_ipc *ipc, int fd) {
+    struct __cthreads_ipc_shared *shared;
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < __CTHREADS_IPC_HEADER_SIZE) return 1;
+
+    shared = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) return 1;
+
+    if (cthreads_atomic_load_u32(&shared->magic, CTHREADS_ATOMIC_ACQUIRE) != __CTHREADS_IPC_MAGIC || shared->header_size != __CTHREADS_IPC_HEADER_SIZE ||
+        __CTHREADS_IPC_HEADER_SIZE + shared->slots * shared->slot_stride > (uint64_t)st.st_size) {
+      munmap(shared, (size_t)st.st_size);
+
+      return 1;
+    }
+
+    ipc->shared = shared;
+    ipc->size = (size_t)st.st_size;
+    ipc->fd = fd;
+    ipc->position = 0;
+
+    return 0;
+  }
+
+  int cthreads_ipc_create(struct cthreads_ipc *ipc, const char *path, size_t slot_size, size_t slots) {
+    struct __cthreads_ipc_shared *shared;
+    struct cthreads_mutex_attr attr = { 0 };
+    uint64_t stride, i;
+    size_t capacity = 1, size;
+    int fd;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_ipc_create");
+    #endif
+
+    if (slots == 0) return 1;
+    while (capacity < slots) capacity <<= 1;
+
+    stride = (sizeof(struct __cthreads_ipc_slot) + slot_size + CTHREADS_CACHE_LINE - 1) & ~(uint64_t)(CTHREADS_CACHE_LINE - 1);
+    size = __CTHREADS_IPC_HEADER_SIZE + (size_t)(capacity * stride);
+
+    /* INFO: Never reuses an existing file, truncating one a peer still maps would SIGBUS it */
+    if (path) fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    else {
+      #ifdef __linux__
+        fd = (int)syscall(SYS_memfd_create, "cthreads_ipc", 1u /* MFD_CLOEXEC */);
+      #else
+        fd = shm_open(SHM_ANON, O_RDWR | O_CLOEXEC, 0600);
+      #endif
+    }
+    if (fd == -1) return 1;
+
+    if (ftruncate(fd, (off_t)size) != 0) goto fail;
+
+    shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shared == MAP_FAILED) goto fail;
+
+    shared->header_size = __CTHREADS_IPC_HEADER_SIZE;
+    shared->slot_size = slot_size;
+    shared->slot_stride = stride;
+    shared->slots = capacity;
+    shared->head = 0;
+    shared->space_bell = 0;
+    shared->producers_waiting = 0;
+    shared->tail = 0;
+    shared->data_bell = 0;
+    shared->consumer_waiting = 0;
+
+    for (i = 0; i < capacity; i++) {
+      __cthreads_ipc_slot(shared, i)->seq = i;
+      __cthreads_ipc_slot(shared, i)->owner = 0;
+    }
+
+    attr.pshared = PTHREAD_PROCESS_SHARED;
+    attr.robust = PTHREAD_MUTEX_ROBUST;
+    if (cthreads_mutex_init(&shared->consumer, &attr) != 0) {
+      munmap(shared, size);
+
+      goto fail;
+    }
+
+    /* INFO: Peers mapping the file before this point reject it */
+    cthreads_atomic_store_u32(&shared->magic, __CTHREADS_IPC_MAGIC, CTHREADS_ATOMIC_RELEASE);
+
+    ipc->shared = shared;
+    ipc->size = size;
+    ipc->fd = fd;
+    ipc->position = 0;
+
     return 0;
-  #else
-    return pthread_cond_destroy(&cond->pCond);
-  #endif
-}
 
-int cthreads_cond_wait(struct cthreads_cond *cond, struct cthreads_mutex *mutex) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_cond_wait");
-  #endif
+    fail:
+      close(fd);
+      if (path) unlink(path);
 
-  #ifdef _WIN32
-    return SleepConditionVariableCS(&cond->wCond, &mutex->wMutex, INFINITE) == 0;
-  #else
-    return pthread_cond_wait(&cond->pCond, &mutex->pMutex);
-  #endif
-}
+      return 1;
+  }
 
-int cthreads_cond_timedwait(struct cthreads_cond *cond, struct cthreads_mutex *mutex, unsigned int ms) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_cond_wait");
-  #endif
+  int cthreads_ipc_open(struct cthreads_ipc *ipc, const char *path) {
+    int fd;
 
-  #ifdef _WIN32
-    return SleepConditionVariableCS(&cond->wCond, &mutex->wMutex, (DWORD)ms) == 0;
-  #else
-    struct timespec ts;
-    #ifdef CTHREADS_COND_CLOCK
-      if (clock_gettime(cond->clock, &ts)) return 1;
-    #else
-      if (clock_gettime(CLOCK_REALTIME, &ts)) return 1;
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_ipc_open");
     #endif
 
-    ts.tv_sec += ms / 1000;
-    ts.tv_nsec += (ms % 1000) * 1000000;
-    ts.tv_sec += ts.tv_nsec / 1000000000;
-    ts.tv_nsec %= 1000000000;
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) return 1;
 
-    return pthread_cond_timedwait(&cond->pCond, &mutex->pMutex, &ts);
-  #endif
-}
+    if (__cthreads_ipc_map(ipc, fd) != 0) {
+      close(fd);
+
+      return 1;
+    }
+
+    return 0;
+  }
+
+  int cthreads_ipc_open_fd(struct cthreads_ipc *ipc, int fd) {
+    int own;
 
-#ifdef CTHREADS_RWLOCK
-  int cthreads_rwlock_init(struct cthreads_rwlock *rwlock) {
     #ifdef CTHREADS_DEBUG
-      puts("cthreads_rwlock_init");
+      puts("cthreads_ipc_open_fd");
     #endif
 
-    #ifdef _WIN32
-      rwlock->wRWLock = malloc(sizeof(SRWLOCK));
-      if (!rwlock->wRWLock) return 1;
+    own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own == -1) return 1;
 
-      InitializeSRWLock(rwlock->wRWLock);
+    if (__cthreads_ipc_map(ipc, own) != 0) {
+      close(own);
 
-      return 0;
-    #else
-      return pthread_rwlock_init(&rwlock->pRWLock, NULL);
-    #endif
+      return 1;
+    }
+
+    return 0;
   }
 
-  int cthreads_rwlock_rdlock(struct cthreads_rwlock *rwlock) {
+  int cthreads_ipc_reserve(struct cthreads_ipc *ipc, void **data, unsigned int ms) {
+    struct __cthreads_ipc_shared *shared = ipc->shared;
+    uint64_t position = cthreads_atomic_load_u64(&shared->head, CTHREADS_ATOMIC_RELAXED);
+    struct __cthreads_ipc_slot *slot;
+
     #ifdef CTHREADS_DEBUG
-      puts("cthreads_rwlock_rdlock");
+      puts("cthreads_ipc_reserve");
     #endif
 
-    #ifdef _WIN32
-      AcquireSRWLockShared(rwlock->wRWLock);
+    while (1) {
+      int64_t diff;
 
-      return 0;
-    #else
-      return pthread_rwlock_rdlock(&rwlock->pRWLock);
-    #endif
+      slot = __cthreads_ipc_slot(shared, position);
+      diff = (int64_t)(cthreads_atomic_load_u64(&slot->seq, CTHREADS_ATOMIC_ACQUIRE) - position);
+
+      if (diff == 0) {
+        if (cthreads_atomic_cas_u64(&shared->head, &position, position + 1, CTHREADS_ATOMIC_RELAXED)) {
+          cthreads_atomic_store_u64(&slot->owner, (uint64_t)getpid(), CTHREADS_ATOMIC_RELAXED);
+
+          break;
+        }
+      } else if (diff < 0) {
+        /* INFO: The ring is full, wait for the consumer to release the slot a lap behind */
+        if (__cthreads_ipc_await(&slot->seq, position, &shared->space_bell, &shared->producers_waiting, 1, ms)) return CTHREADS_IPC_TIMEOUT;
+
+        position = cthreads_atomic_load_u64(&shared->head, CTHREADS_ATOMIC_RELAXED);
+      } else {
+        position = cthreads_atomic_load_u64(&shared->head, CTHREADS_ATOMIC_RELAXED);
+      }
+    }
+
+    *data = slot + 1;
+
+    return 0;
   }
 
-  int cthreads_rwlock_unlock_shared(struct cthreads_rwlock *rwlock) {
+  int cthreads_ipc_commit(struct cthreads_ipc *ipc, void *data, size_t size) {
+    struct __cthreads_ipc_shared *shared = ipc->shared;
+    struct __cthreads_ipc_slot *slot = (struct __cthreads_ipc_slot *)data - 1;
+
     #ifdef CTHREADS_DEBUG
-      puts("cthreads_rwlock_unlock_shared");
+      puts("cthreads_ipc_commit");
     #endif
 
-    #ifdef _WIN32
-      ReleaseSRWLockShared(rwlock->wRWLock);
+    if (size > shared->slot_size) return 1;
 
-      return 0;
-    #else
-      return pthread_rwlock_unlock(&rwlock->pRWLock);
-    #endif
+    slot->size = size;
+    cthreads_atomic_store_u64(&slot->owner, 0, CTHREADS_ATOMIC_RELAXED);
+    /* INFO: A reserved slot keeps the position it was claimed at until it is published */
+    cthreads_atomic_store_u64(&slot->seq, slot->seq + 1, CTHREADS_ATOMIC_RELEASE);
+
+    __cthreads_ipc_bell_ring(&shared->data_bell, &shared->consumer_waiting);
+
+    return 0;
   }
 
-  int cthreads_rwlock_unlock_exclusive(struct cthreads_rwlock *rwlock) {
+  int cthreads_ipc_acquire(struct cthreads_ipc *ipc, void **data, size_t *size, unsigned int ms) {
+    struct __cthreads_ipc_shared *shared = ipc->shared;
+    uint64_t deadline = ms == CTHREADS_INFINITE ? UINT64_MAX : __cthreads_monotonic_ns() + (uint64_t)ms * 1000000;
+    struct __cthreads_ipc_slot *slot;
+    uint64_t position;
+    int ret;
+
     #ifdef CTHREADS_DEBUG
-      puts("cthreads_rwlock_unlock_exclusive");
+      puts("cthreads_ipc_acquire");
     #endif
 
-    #ifdef _WIN32
-      ReleaseSRWLockExclusive(rwlock->wRWLock);
+    ret = cthreads_mutex_lock(&shared->consumer);
+    if (ret == EOWNERDEAD) {
+      /*
+        INFO: The previous consumer died holding the ring. If it got past moving `tail` but not
+                past freeing the slot, the slot is freed here, otherwise its message is simply
+                delivered again.
+      */
+      position = shared->tail;
+      if (position != 0) {
+        slot = __cthreads_ipc_slot(shared, position - 1);
+
+        if (cthreads_atomic_load_u64(&slot->seq, CTHREADS_ATOMIC_ACQUIRE) == position) {
+          cthreads_atomic_store_u64(&slot->seq, position - 1 + shared->slots, CTHREADS_ATOMIC_RELEASE);
+          __cthreads_ipc_bell_ring(&shared->space_bell, &shared->producers_waiting);
+        }
+      }
 
-      return 0;
-    #else
-      return pthread_rwlock_unlock(&rwlock->pRWLock);
-    #endif
+      shared->consumer_waiting = 0;
+
+      if (cthreads_mutex_consistent(&shared->consumer) != 0) {
+        cthreads_mutex_unlock(&shared->consumer);
+
+        return 1;
+      }
+    } else if (ret != 0) {
+      return 1;
+    }
+
+    /* INFO: Waits in slices, so that a message whose producer died does not hold the ring back forever */
+    while (1) {
+      uint64_t now = __cthreads_monotonic_ns();
+      unsigned int slice = __CTHREADS_IPC_OWNER_CHECK_MS;
+
+      if (deadline != UINT64_MAX) {
+        uint64_t left = deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+
+        if (left < slice) slice = (unsigned int)left;
+      }
+
+      position = shared->tail;
+      slot = __cthreads_ipc_slot(shared, position);
+
+      if (!__cthreads_ipc_await(&slot->seq, position + 1, &shared->data_bell, &shared->consumer_waiting, 0, slice)) break;
+      if (__cthreads_ipc_skip_dead(shared, position)) continue;
+
+      if (deadline != UINT64_MAX && __cthreads_monotonic_ns() >= deadline) {
+        cthreads_mutex_unlock(&shared->consumer);
+
+        return CTHREADS_IPC_TIMEOUT;
+      }
+    }
+
+    ipc->position = position;
+    *data = slot + 1;
+    *size = (size_t)slot->size;
+
+    return 0;
   }
 
-  int cthreads_rwlock_wrlock(struct cthreads_rwlock *rwlock) {
+  int cthreads_ipc_release(struct cthreads_ipc *ipc) {
+    struct __cthreads_ipc_shared *shared = ipc->shared;
+    struct __cthreads_ipc_slot *slot = __cthreads_ipc_slot(shared, ipc->position);
+
     #ifdef CTHREADS_DEBUG
-      puts("cthreads_rwlock_wrlock");
+      puts("cthreads_ipc_release");
     #endif
 
-    #ifdef _WIN32
-      AcquireSRWLockExclusive(rwlock->wRWLock);
+    /* INFO: `tail` moves first, so a consumer dying in between leaves a state the next one can repair */
+    cthreads_atomic_store_u64(&shared->tail, ipc->position + 1, CTHREADS_ATOMIC_RELEASE);
+    cthreads_atomic_store_u64(&slot->seq, ipc->position + shared->slots, CTHREADS_ATOMIC_RELEASE);
 
-      return 0;
-    #else
-      return pthread_rwlock_wrlock(&rwlock->pRWLock);
-    #endif
+    __cthreads_ipc_bell_ring(&shared->space_bell, &shared->producers_waiting);
+
+    return cthreads_mutex_unlock(&shared->consumer);
   }
 
-  int cthreads_rwlock_destroy(struct cthreads_rwlock *rwlock) {
+  int cthreads_ipc_close(struct cthreads_ipc *ipc) {
+    int ret;
+
     #ifdef CTHREADS_DEBUG
-      puts("cthreads_rwlock_destroy");
+      puts("cthreads_ipc_close");
     #endif
 
-    #ifdef _WIN32
-      free(rwlock->wRWLock);
-      rwlock->wRWLock = NULL;
+    ret = munmap(ipc->shared, ipc->size) != 0;
+    ret |= close(ipc->fd) != 0;
 
-      return 0;
-    #else
-      return pthread_rwlock_destroy(&rwlock->pRWLock);
-    #endif
+    return ret;
   }
 #endif
 
-int cthreads_error_code(void) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_error_code");
-  #endif
+#ifdef CTHREADS_TRACE
+  void cthreads_trace_begin(const char *name) {
+    __cthreads_trace_record(__CTHREADS_TRACE_BEGIN, name, NULL);
+  }
 
-  #ifdef _WIN32
-    return GetLastError();
-  #else
-    return errno;
-  #endif
-}
+  void cthreads_trace_end(const char *name) {
+    __cthreads_trace_record(__CTHREADS_TRACE_END, name, NULL);
+  }
 
-size_t cthreads_error_string(int error_code, char *buf, size_t length) {
-  #ifdef CTHREADS_DEBUG
-    puts("cthreads_error_string");
-  #endif
+  void cthreads_trace_instant(const char *name) {
+    __cthreads_trace_record(__CTHREADS_TRACE_INSTANT, name, NULL);
+  }
 
-  if (length == 0) return 0;
+  /* INFO: Protobuf encoding, just enough of it for Perfetto's TracePacket */
+  static size_t __cthreads_pb_varint(unsigned char *buf, uint64_t value) {
+    size_t len = 0;
 
-  #ifdef _WIN32
-    LPSTR error_str = NULL;
+    do {
+      buf[len++] = (unsigned char)((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+      value >>= 7;
+    } while (value);
 
-    /* 
-      INFO: The string that is written also contains a \n, which we must ignore, besides the
-              NULL terminator.
-    */
-    DWORD format_ret = FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-                                      NULL, error_code, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&error_str, 0, NULL);
-    if (format_ret == 0) {
-      strncpy(buf, "Unknown error", length - 1);
-      buf[length - 1] = '\0';
+    return len;
+  }
 
-      return sizeof("Unknown error");
-    }
+  static size_t __cthreads_pb_uint(unsigned char *buf, uint32_t field, uint64_t value) {
+    size_t len = __cthreads_pb_varint(buf, (uint64_t)field << 3);
 
-    size_t error_str_len = (size_t)format_ret;
+    return len + __cthreads_pb_varint(buf + len, value);
+  }
 
-    /* INFO: Remove trailing newline and carriage return */
-    while (error_str_len > 0 && (error_str[error_str_len - 1] == '\n' || error_str[error_str_len - 1] == '\r'))
-      error_str_len--;
-  #else
-    char error_buf[256];
-  #if defined(__GLIBC__) && defined(_GNU_SOURCE)
-    const char *error_str = strerror_r(error_code, error_buf, sizeof(error_buf));
-  #else
-    int strerror_ret = strerror_r(error_code, error_buf, sizeof(error_buf));
-    const char *error_str = (strerror_ret == 0) ? error_buf : "Unknown error";
-  #endif
-    const size_t error_str_len = strlen(error_str);
-  #endif
+  static size_t __cthreads_pb_bytes(unsigned char *buf, uint32_t field, const void *data, size_t size) {
+    size_t len = __cthreads_pb_varint(buf, ((uint64_t)field << 3) | 2);
 
-  size_t final_len = length > error_str_len ? error_str_len : length - 1;
-  if (final_len == 0) return 0;
+    len += __cthreads_pb_varint(buf + len, size);
+    memcpy(buf + len, data, size);
 
-  strncpy(buf, (char *)error_str, final_len);
-  buf[final_len] = '\0';
+    return len + size;
+  }
 
-  #ifdef _WIN32
-    LocalFree(error_str);
-  #endif
+  static size_t __cthreads_pb_string(unsigned char *buf, uint32_t field, const char *str, size_t max) {
+    size_t size = strlen(str);
 
-  return error_str_len + 1;
-}
+    return __cthreads_pb_bytes(buf, field, str, size > max ? max : size);
+  }
 
-#ifdef CTHREADS_SEMAPHORE
-  int cthreads_sem_init(struct cthreads_semaphore *sem, int initial_count) {
-    #ifdef CTHREADS_DEBUG
-      puts("cthreads_sem_init");
-    #endif
-  
-    #ifdef _WIN32
-      sem->wSemaphore = CreateSemaphore(NULL, initial_count, LONG_MAX, NULL);
+  /* INFO: Names come from the user, so quotes, backslashes and control characters are escaped for JSON */
+  static void __cthreads_trace_json_string(FILE *file, const char *str) {
+    for (; *str; str++) {
+      unsigned char c = (unsigned char)*str;
 
-      return sem->wSemaphore == NULL;
-    #else
-      return sem_init(&sem->pSemaphore,0, initial_count);
-    #endif
+      if (c == '"' || c == '\\') fprintf(file, "\\%c", c);
+      else if (c < 0x20) fprintf(file, "\\u%04x", c);
+      else fputc(c, file);
+    }
   }
-  
-  int cthreads_sem_wait(struct cthreads_semaphore *sem) {
-    #ifdef CTHREADS_DEBUG
-      puts("cthreads_sem_wait");
-    #endif
 
-    #ifdef _WIN32
-      return (WaitForSingleObject(sem->wSemaphore, INFINITE) != WAIT_OBJECT_0);
-    #else
-      return sem_wait(&sem->pSemaphore);
-    #endif
-  }
-  
-  int cthreads_sem_trywait(struct cthreads_semaphore *sem) {
-    #ifdef CTHREADS_DEBUG
-      puts("cthreads_sem_trywait");
-    #endif
+  static int __cthreads_trace_write_packet(FILE *file, const unsigned char *packet, size_t size) {
+    unsigned char header[16];
+    size_t len = __cthreads_pb_varint(header, (1 << 3) | 2);
 
-    #ifdef _WIN32
-      DWORD ret = WaitForSingleObject(sem->wSemaphore, 0);
-      if (ret == WAIT_OBJECT_0) return 0;
-      if (ret == WAIT_TIMEOUT) SetLastError(ERROR_TIMEOUT);
+    len += __cthreads_pb_varint(header + len, size);
 
-      return -1;
-    #else
-      return sem_trywait(&sem->pSemaphore);
-    #endif
+    return fwrite(header, 1, len, file) != len || fwrite(packet, 1, size, file) != size;
   }
-  
-  int cthreads_sem_timedwait(struct cthreads_semaphore *sem, unsigned int ms) {
-    #ifdef CTHREADS_DEBUG
-      puts("cthreads_sem_timedwait");
-    #endif
 
-    #ifdef _WIN32
-      DWORD ret = WaitForSingleObject(sem->wSemaphore, (DWORD)ms);
-      if (ret == WAIT_OBJECT_0) return 0;
-      if (ret == WAIT_TIMEOUT) SetLastError(ERROR_TIMEOUT);
+  /* INFO: Rings of exited threads are marked before the flush and reusable after it, unless they were reused or freed again meanwhile */
+  static void __cthreads_trace_mark_free(int done) {
+    struct __cthreads_trace_ring *ring;
 
-      return -1;
-    #else
-      struct timespec ts;
-      if (clock_gettime(CLOCK_REALTIME, &ts)) return 1;
- 
-      ts.tv_sec += ms / 1000;
-      ts.tv_nsec += (ms % 1000) * 1000000;
-      ts.tv_sec += ts.tv_nsec / 1000000000;
-      ts.tv_nsec %= 1000000000;
- 
-      return sem_timedwait(&sem->pSemaphore, &ts);
-    #endif
-  }
-  int cthreads_sem_post(struct cthreads_semaphore *sem) {
-    #ifdef CTHREADS_DEBUG
-      puts("cthreads_sem_post");
-    #endif
+    cthreads_lock_lock(&__cthreads_trace_free_lock);
 
-    #ifdef _WIN32
-      return ReleaseSemaphore(sem->wSemaphore, 1, NULL) == 0;
-    #else
-      return sem_post(&sem->pSemaphore);
-    #endif
+    for (ring = __cthreads_trace_free; ring; ring = ring->free_next) {
+      if (!done) ring->flushing = 1;
+      else if (ring->flushing) ring->flushed = 1;
+    }
+
+    cthreads_lock_unlock(&__cthreads_trace_free_lock);
   }
-  
-  int cthreads_sem_destroy(struct cthreads_semaphore *sem) {
+
+  int cthreads_trace_flush(const char *path, int format) {
+    struct __cthreads_trace_ring *ring;
+    struct __cthreads_trace_event *events;
+    uint64_t now_ns, now_ticks;
+    double ns_per_tick = 1.0;
+    unsigned long pid;
+    FILE *file;
+    int first = 1, error = 0;
+
     #ifdef CTHREADS_DEBUG
-      puts("cthreads_sem_destroy");
+      puts("cthreads_trace_flush");
     #endif
 
+    if (cthreads_atomic_load_u32(&__cthreads_trace_origin_state, CTHREADS_ATOMIC_ACQUIRE) != 2) return 0;
+
+    now_ns = __cthreads_monotonic_ns();
+    now_ticks = __cthreads_trace_ticks();
+    if (now_ticks > __cthreads_trace_origin_ticks)
+      ns_per_tick = (double)(now_ns - __cthreads_trace_origin_ns) / (double)(now_ticks - __cthreads_trace_origin_ticks);
+
     #ifdef _WIN32
-      return CloseHandle(sem->wSemaphore) == 0;
+      pid = (unsigned long)GetCurrentProcessId();
     #else
-      return sem_destroy(&sem->pSemaphore);
+      pid = (unsigned long)getpid();
     #endif
+
+    events = malloc(sizeof(struct __cthreads_trace_event) * CTHREADS_TRACE_EVENTS);
+    if (!events) return 1;
+
+    file = fopen(path, format == CTHREADS_TRACE_PERFETTO ? "wb" : "w");
+    if (!file) {
+      free(events);
+
+      return 1;
+    }
+
+    __cthreads_trace_mark_free(0);
+
+    if (format == CTHREADS_TRACE_CHROME) fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+
+    for (ring = cthreads_atomic_load_ptr((void *volatile *)&__cthreads_trace_rings, CTHREADS_ATOMIC_ACQUIRE); ring; ring = ring->next) {
+      uint64_t head = cthreads_atomic_load_u64(&ring->head, CTHREADS_ATOMIC_ACQUIRE);
+      uint64_t base = cthreads_atomic_load_u64(&ring->base, CTHREADS_ATOMIC_ACQUIRE);
+      uint64_t start = head > CTHREADS_TRACE_EVENTS ? head - CTHREADS_TRACE_EVENTS : 0;
+      uint64_t i, after;
+
+      if (start < base) start = base;
+      if (start > head) start = head;
+
+      for (i = start; i < head; i++)
+        events[i - start] = ring->events[i & (CTHREADS_TRACE_EVENTS - 1)];
+
+      /* INFO: The owner kept recording during the copy, events it overwrote meanwhile are dropped */
+      after = cthreads_atomic_load_u64(&ring->head, CTHREADS_ATOMIC_ACQUIRE);
+      if (after >= CTHREADS_TRACE_EVENTS && after - CTHREADS_TRACE_EVENTS + 1 > start) {
+        uint64_t valid = after - CTHREADS_TRACE_EVENTS + 1;
+
+        if (valid > head) valid = head;
+        memmove(events, events + (valid - start), (size_t)(head - valid) * sizeof(struct __cthreads_trace_event));
+        start = valid;
+      }
+
+      if (format == CTHREADS_TRACE_CHROME) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"cthreads %lu\"}}",
+                first ? "" : ",", pid, ring->tid, ring->tid);
+        first = 0;
+
+        for (i = start; i < head; i++) {
+          struct __cthreads_trace_event *event = &events[i - start];
+          static const char phases[] = { 'B', 'E', 'i' };
+          double us = ((double)__cthreads_trace_origin_ns + (double)(event->ticks - __cthreads_trace_origin_ticks) * ns_per_tick) / 1000.0;
+
+          fputs(",{\"name\":\"", file);
+          if (event->name) __cthreads_trace_json_string(file, event->name);
+          fprintf(file, "\",\"cat\":\"cthreads\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu%s,\"args\":{\"object\":\"%p\"}}",
+                  phases[event->type], us, pid, ring->tid,
+                  event->type == __CTHREADS_TRACE_INSTANT ? ",\"s\":\"t\"" : "", (void *)event->object);
+        }
+      } else {
+        unsigned char packet[512], nested[256], inner[192];
+        size_t len, nested_len, inner_len;
+        uint64_t uuid = (uint64_t)ring->tid + 1;
+        char name[32];
+
+        /* INFO: TrackDescriptor { uuid, thread { pid, tid, thread_name } } */
+        snprintf(name, sizeof(name), "cthreads %lu", ring->tid);
+        inner_len = __cthreads_pb_uint(inner, 1, pid);
+        inner_len += __cthreads_pb_uint(inner + inner_len, 2, ring->tid);
+        inner_len += __cthreads_pb_string(inner + inner_len, 5, name, 64);
+        nested_len = __cthreads_pb_uint(nested, 1, uuid);
+        nested_len += __cthreads_pb_bytes(nested + nested_len, 4, inner, inner_len);
+        len = __cthreads_pb_bytes(packet, 60, nested, nested_len);
+        len += __cthreads_pb_uint(packet + len, 10, 1);
+        error |= __cthreads_trace_write_packet(file, packet, len);
+
+        for (i = start; i < head; i++) {
+          struct __cthreads_trace_event *event = &events[i - start];
+          uint64_t ns = __cthreads_trace_origin_ns + (uint64_t)((double)(event->ticks - __cthreads_trace_origin_ticks) * ns_per_tick);
+
+          /* INFO: TrackEvent { type, track_uuid, name, debug_annotations { name, pointer_value } } */
+          inner_len = __cthreads_pb_string(inner, 10, "object", 64);
+          inner_len += __cthreads_pb_uint(inner + inner_len, 7, (uint64_t)(uintptr_t)event->object);
+          nested_len = __cthreads_pb_uint(nested, 9, event->type == __CTHREADS_TRACE_BEGIN ? 1 : event->type == __CTHREADS_TRACE_END ? 2 : 3);
+          nested_len += __cthreads_pb_uint(nested + nested_len, 11, uuid);
+          if (event->name) nested_len += __cthreads_pb_string(nested + nested_len, 23, event->name, 128);
+          nested_len += __cthreads_pb_bytes(nested + nested_len, 4, inner, inner_len);
+
+          len = __cthreads_pb_uint(packet, 8, ns);
+          len += __cthreads_pb_bytes(packet + len, 11, nested, nested_len);
+          len += __cthreads_pb_uint(packet + len, 10, 1);
+          error |= __cthreads_trace_write_packet(file, packet, len);
+        }
+      }
+    }
+
+    if (format == CTHREADS_TRACE_CHROME) fputs("]}\n", file);
+
+    free(events);
+
+    error |= fclose(file) != 0;
+    if (!error) __cthreads_trace_mark_free(1);
+
+    return error;
   }
 #endif
-
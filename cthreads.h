@@ -1,9 +1,19 @@
 #ifndef CTHREADS_H
 #define CTHREADS_H
 
+#include <stdint.h>
+
 struct cthreads_args {
   void *(*func)(void *data);
   void *data;
+  #ifdef __linux__
+    /* INFO: Handshake with a thread that applies its own nice value before running */
+    int nice;
+    int error;
+    uint32_t ready;
+  #endif
+  /* INFO: Registry entry handed from the creator to the new thread, kept in every build so the layout does not depend on CTHREADS_REGISTRY */
+  struct __cthreads_registry_entry *entry;
 };
 
 #ifdef _WIN32
@@ -65,6 +75,496 @@ struct cthreads_args {
   #endif
 #endif
 
+#if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+  #define CTHREADS_ATOMIC 1
+#endif
+
+/* INFO: Timeout value, in milliseconds, meaning "block until it happens" */
+#define CTHREADS_INFINITE ((unsigned int)-1)
+
+#define CTHREADS_CACHE_LINE 64
+
+#if defined(_MSC_VER)
+  #define __CTHREADS_THREAD_LOCAL __declspec(thread)
+  #define __CTHREADS_ALIGNED(n) __declspec(align(n))
+#elif defined(__GNUC__) || defined(__clang__)
+  #define __CTHREADS_THREAD_LOCAL __thread
+  #define __CTHREADS_ALIGNED(n) __attribute__((aligned(n)))
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+  #define __CTHREADS_THREAD_LOCAL _Thread_local
+#endif
+
+#ifdef CTHREADS_ATOMIC
+  /* INFO: Double-width CAS: always on 32-bit, cmpxchg16b/casp on 64-bit */
+  #if UINTPTR_MAX == 0xFFFFFFFFu
+    #define CTHREADS_ATOMIC_DWCAS 1
+    #define __CTHREADS_DWCAS_SIZE 8
+  #elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+    #define CTHREADS_ATOMIC_DWCAS 1
+    #define __CTHREADS_DWCAS_SIZE 16
+  #elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+    #define CTHREADS_ATOMIC_DWCAS 1
+    #define __CTHREADS_DWCAS_SIZE 16
+  #elif defined(_MSC_VER) && defined(_M_X64)
+    #define CTHREADS_ATOMIC_DWCAS 1
+    #define __CTHREADS_DWCAS_SIZE 16
+  #endif
+
+  #define CTHREADS_STACK 1
+  #define CTHREADS_CHANNEL 1
+  #define CTHREADS_MPSC 1
+  #define CTHREADS_DEQUE 1
+  #define CTHREADS_TRIPLEBUF 1
+  #define CTHREADS_PIPELINE 1
+  #ifdef __CTHREADS_THREAD_LOCAL
+    #define CTHREADS_OBJPOOL 1
+    #define CTHREADS_COMBINER 1
+    #define CTHREADS_SLAB 1
+    #define CTHREADS_LEFTRIGHT 1
+    #define CTHREADS_PARKING_LOT 1
+    #define CTHREADS_POOL 1
+    #define CTHREADS_PARALLEL 1
+    #define CTHREADS_TIMER 1
+  #endif
+#endif
+
+/* INFO: The userspace semaphore only needs atomics and a futex */
+#if defined(CTHREADS_ATOMIC) && !defined(CTHREADS_SEMAPHORE)
+  #define CTHREADS_SEMAPHORE 1
+#endif
+
+#ifdef CTHREADS_ATOMIC
+  #define CTHREADS_WAIT_ANY 1
+#endif
+
+#if defined(CTHREADS_ATOMIC) && defined(CTHREADS_MUTEX_ROBUST)
+  #define CTHREADS_IPC 1
+#endif
+
+#define CTHREADS_THREAD_PRIORITY 1
+#if defined(__linux__) && defined(CTHREADS_ATOMIC)
+  #define CTHREADS_THREAD_NICE 1
+#endif
+
+#if defined(_WIN32) || defined(__linux__)
+  #define CTHREADS_LOW_LATENCY 1
+#endif
+
+#if defined(CTHREADS_ATOMIC) || !defined(_WIN32)
+  #define CTHREADS_ONCE 1
+#endif
+
+/* INFO: TLS keys index a compiler thread-local array, otherwise they wrap pthread keys or TlsAlloc */
+#ifdef CTHREADS_PARKING_LOT
+  #define __CTHREADS_TLS_FAST 1
+#endif
+
+#if defined(CTHREADS_TRACE) && !(defined(CTHREADS_ATOMIC) && defined(__CTHREADS_THREAD_LOCAL))
+  #undef CTHREADS_TRACE
+#endif
+
+#if defined(CTHREADS_REGISTRY) && !defined(CTHREADS_PARKING_LOT)
+  #undef CTHREADS_REGISTRY
+#endif
+
+/* INFO: C89 has no `inline`, so it is only spelled out when the compiler is known to take it */
+#ifdef _MSC_VER
+  #define __CTHREADS_INLINE __inline
+#elif defined(__GNUC__) || defined(__clang__)
+  #define __CTHREADS_INLINE __inline__
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L
+  #define __CTHREADS_INLINE inline
+#else
+  #define __CTHREADS_INLINE
+#endif
+
+/* INFO: Traced and registry builds need the out-of-line wrappers, as they record into the library's state */
+#if defined(CTHREADS_INLINE) && (defined(CTHREADS_TRACE) || defined(CTHREADS_REGISTRY))
+  #undef CTHREADS_INLINE
+#endif
+
+#ifdef CTHREADS_INLINE
+  #define __CTHREADS_WRAPPER static __CTHREADS_INLINE
+#else
+  #define __CTHREADS_WRAPPER
+#endif
+
+#ifdef CTHREADS_ATOMIC
+  /* INFO: Memory orders of the atomics below. The Interlocked fallback treats all of them as sequentially consistent. */
+  #ifdef _MSC_VER
+    #include <intrin.h>
+
+    #define CTHREADS_ATOMIC_RELAXED 0
+    #define CTHREADS_ATOMIC_ACQUIRE 2
+    #define CTHREADS_ATOMIC_RELEASE 3
+    #define CTHREADS_ATOMIC_ACQ_REL 4
+    #define CTHREADS_ATOMIC_SEQ_CST 5
+  #else
+    #define CTHREADS_ATOMIC_RELAXED __ATOMIC_RELAXED
+    #define CTHREADS_ATOMIC_ACQUIRE __ATOMIC_ACQUIRE
+    #define CTHREADS_ATOMIC_RELEASE __ATOMIC_RELEASE
+    #define CTHREADS_ATOMIC_ACQ_REL __ATOMIC_ACQ_REL
+    #define CTHREADS_ATOMIC_SEQ_CST __ATOMIC_SEQ_CST
+  #endif
+
+  /* INFO: Rounds of `cthreads_atomic_backoff` that pause before it asks the caller to yield */
+  #define CTHREADS_ATOMIC_BACKOFF_LIMIT 6
+
+  /*
+   * Atomics on `uint8_t` (u8), `uint32_t` (u32), `uint64_t` (u64) and `void *` (ptr):
+   *
+   * - type cthreads_atomic_load_T(volatile type *p, int order)
+   * - void cthreads_atomic_store_T(volatile type *p, type value, int order)
+   * - type cthreads_atomic_exchange_T(volatile type *p, type value, int order)
+   * - int cthreads_atomic_cas_T(volatile type *p, type *expected, type desired, int order)
+   * - int cthreads_atomic_cas_weak_T(volatile type *p, type *expected, type desired, int order)
+   *
+   * and, on the integer types only:
+   *
+   * - type cthreads_atomic_fetch_add_T(volatile type *p, type value, int order)
+   * - type cthreads_atomic_fetch_or_T(volatile type *p, type value, int order)
+   * - type cthreads_atomic_fetch_and_T(volatile type *p, type value, int order)
+   *
+   * `order` is one of the CTHREADS_ATOMIC_* memory orders. The CAS functions return 1 if
+   *   `*p` held `*expected` and was replaced by `desired`, otherwise they return 0 and
+   *   store the value found in `*expected`. The weak CAS may fail spuriously, which lets
+   *   LL/SC targets skip a retry loop when the caller already has one. Fetch functions
+   *   return the value before the operation.
+   */
+  #ifdef _MSC_VER
+    /* INFO: Plain loads are acquire and plain stores release on x86, only sequentially consistent stores need a locked instruction */
+    #if defined(_M_IX86) || defined(_M_X64)
+      #define __CTHREADS_ATOMIC_X86 1
+    #endif
+
+    #define __CTHREADS_ATOMIC_MSVC_FUNCTIONS(suffix, type, itype, isuffix)                                                          \
+      static __CTHREADS_INLINE type cthreads_atomic_exchange_##suffix(volatile type *p, type v, int order) {                      \
+        (void) order;                                                                                                             \
+        return (type)_InterlockedExchange##isuffix((volatile itype *)p, (itype)v);                                                \
+      }                                                                                                                           \
+      static __CTHREADS_INLINE int cthreads_atomic_cas_##suffix(volatile type *p, type *expected, type desired, int order) {       \
+        type old = (type)_InterlockedCompareExchange##isuffix((volatile itype *)p, (itype)desired, (itype)*expected);             \
+        (void) order;                                                                                                             \
+        if (old == *expected) return 1;                                                                                           \
+        *expected = old;                                                                                                          \
+        return 0;                                                                                                                 \
+      }                                                                                                                           \
+      static __CTHREADS_INLINE int cthreads_atomic_cas_weak_##suffix(volatile type *p, type *expected, type desired, int order) {  \
+        return cthreads_atomic_cas_##suffix(p, expected, desired, order);                                                         \
+      }                                                                                                                           \
+      static __CTHREADS_INLINE type cthreads_atomic_fetch_add_##suffix(volatile type *p, type v, int order) {                     \
+        (void) order;                                                                                                             \
+        return (type)_InterlockedExchangeAdd##isuffix((volatile itype *)p, (itype)v);                                             \
+      }                                                                                                                           \
+      static __CTHREADS_INLINE type cthreads_atomic_fetch_or_##suffix(volatile type *p, type v, int order) {                      \
+        (void) order;                                                                                                             \
+        return (type)_InterlockedOr##isuffix((volatile itype *)p, (itype)v);                                                      \
+      }                                                                                                                           \
+      static __CTHREADS_INLINE type cthreads_atomic_fetch_and_##suffix(volatile type *p, type v, int order) {                     \
+        (void) order;                                                                                                             \
+        return (type)_InterlockedAnd##isuffix((volatile itype *)p, (itype)v);                                                     \
+      }
+
+    #define __CTHREADS_ATOMIC_MSVC_LOAD_STORE(suffix, type, itype, isuffix)                                                         \
+      static __CTHREADS_INLINE type cthreads_atomic_load_##suffix(volatile type *p, int order) {                                  \
+        (void) order;                                                                                                             \
+        __CTHREADS_ATOMIC_MSVC_LOAD(type, itype, isuffix)                                                                         \
+      }                                                                                                                           \
+      static __CTHREADS_INLINE void cthreads_atomic_store_##suffix(volatile type *p, type v, int order) {                         \
+        __CTHREADS_ATOMIC_MSVC_STORE(type, itype, isuffix)                                                                        \
+      }
+
+    #ifdef __CTHREADS_ATOMIC_X86
+      #define __CTHREADS_ATOMIC_MSVC_LOAD(type, itype, isuffix) \
+        type v = *p;                                            \
+        _ReadWriteBarrier();                                    \
+        return v;
+
+      #define __CTHREADS_ATOMIC_MSVC_STORE(type, itype, isuffix)                     \
+        if (order == CTHREADS_ATOMIC_SEQ_CST) {                                      \
+          _InterlockedExchange##isuffix((volatile itype *)p, (itype)v);              \
+        } else {                                                                     \
+          _ReadWriteBarrier();                                                       \
+          *p = v;                                                                    \
+        }
+    #else
+      #define __CTHREADS_ATOMIC_MSVC_LOAD(type, itype, isuffix) \
+        return (type)_InterlockedOr##isuffix((volatile itype *)p, 0);
+
+      #define __CTHREADS_ATOMIC_MSVC_STORE(type, itype, isuffix) \
+        (void) order;                                            \
+        _InterlockedExchange##isuffix((volatile itype *)p, (itype)v);
+    #endif
+
+    __CTHREADS_ATOMIC_MSVC_FUNCTIONS(u8, uint8_t, char, 8)
+    __CTHREADS_ATOMIC_MSVC_LOAD_STORE(u8, uint8_t, char, 8)
+    __CTHREADS_ATOMIC_MSVC_FUNCTIONS(u32, uint32_t, long, )
+    __CTHREADS_ATOMIC_MSVC_LOAD_STORE(u32, uint32_t, long, )
+
+    #ifdef _M_IX86
+      /* INFO: 32-bit x86 has no 64-bit exchange or arithmetic intrinsics, only cmpxchg8b */
+      static __CTHREADS_INLINE int cthreads_atomic_cas_u64(volatile uint64_t *p, uint64_t *expected, uint64_t desired, int order) {
+        uint64_t old = (uint64_t)_InterlockedCompareExchange64((volatile __int64 *)p, (__int64)desired, (__int64)*expected);
+        (void) order;
+
+        if (old == *expected) return 1;
+        *expected = old;
+
+        return 0;
+      }
+
+      static __CTHREADS_INLINE int cthreads_atomic_cas_weak_u64(volatile uint64_t *p, uint64_t *expected, uint64_t desired, int order) {
+        return cthreads_atomic_cas_u64(p, expected, desired, order);
+      }
+
+      static __CTHREADS_INLINE uint64_t cthreads_atomic_load_u64(volatile uint64_t *p, int order) {
+        (void) order;
+        return (uint64_t)_InterlockedCompareExchange64((volatile __int64 *)p, 0, 0);
+      }
+
+      static __CTHREADS_INLINE uint64_t cthreads_atomic_exchange_u64(volatile uint64_t *p, uint64_t v, int order) {
+        uint64_t old = *p;
+
+        while (!cthreads_atomic_cas_u64(p, &old, v, order));
+
+        return old;
+      }
+
+      static __CTHREADS_INLINE void cthreads_atomic_store_u64(volatile uint64_t *p, uint64_t v, int order) {
+        cthreads_atomic_exchange_u64(p, v, order);
+      }
+
+      static __CTHREADS_INLINE uint64_t cthreads_atomic_fetch_add_u64(volatile uint64_t *p, uint64_t v, int order) {
+        uint64_t old = *p;
+
+        while (!cthreads_atomic_cas_u64(p, &old, old + v, order));
+
+        return old;
+      }
+
+      static __CTHREADS_INLINE uint64_t cthreads_atomic_fetch_or_u64(volatile uint64_t *p, uint64_t v, int order) {
+        uint64_t old = *p;
+
+        while (!cthreads_atomic_cas_u64(p, &old, old | v, order));
+
+        return old;
+      }
+
+      static __CTHREADS_INLINE uint64_t cthreads_atomic_fetch_and_u64(volatile uint64_t *p, uint64_t v, int order) {
+        uint64_t old = *p;
+
+        while (!cthreads_atomic_cas_u64(p, &old, old & v, order));
+
+        return old;
+      }
+    #else
+      __CTHREADS_ATOMIC_MSVC_FUNCTIONS(u64, uint64_t, __int64, 64)
+      __CTHREADS_ATOMIC_MSVC_LOAD_STORE(u64, uint64_t, __int64, 64)
+    #endif
+
+    static __CTHREADS_INLINE void *cthreads_atomic_load_ptr(void *volatile *p, int order) {
+      (void) order;
+      #ifdef __CTHREADS_ATOMIC_X86
+        {
+          void *v = *p;
+
+          _ReadWriteBarrier();
+
+          return v;
+        }
+      #else
+        return _InterlockedCompareExchangePointer(p, NULL, NULL);
+      #endif
+    }
+
+    static __CTHREADS_INLINE void *cthreads_atomic_exchange_ptr(void *volatile *p, void *v, int order) {
+      (void) order;
+      return _InterlockedExchangePointer(p, v);
+    }
+
+    static __CTHREADS_INLINE void cthreads_atomic_store_ptr(void *volatile *p, void *v, int order) {
+      #ifdef __CTHREADS_ATOMIC_X86
+        if (order != CTHREADS_ATOMIC_SEQ_CST) {
+          _ReadWriteBarrier();
+          *p = v;
+
+          return;
+        }
+      #endif
+      cthreads_atomic_exchange_ptr(p, v, order);
+    }
+
+    static __CTHREADS_INLINE int cthreads_atomic_cas_ptr(void *volatile *p, void **expected, void *desired, int order) {
+      void *old = _InterlockedCompareExchangePointer(p, desired, *expected);
+      (void) order;
+
+      if (old == *expected) return 1;
+      *expected = old;
+
+      return 0;
+    }
+
+    static __CTHREADS_INLINE int cthreads_atomic_cas_weak_ptr(void *volatile *p, void **expected, void *desired, int order) {
+      return cthreads_atomic_cas_ptr(p, expected, desired, order);
+    }
+
+    #undef __CTHREADS_ATOMIC_MSVC_FUNCTIONS
+    #undef __CTHREADS_ATOMIC_MSVC_LOAD_STORE
+    #undef __CTHREADS_ATOMIC_MSVC_LOAD
+    #undef __CTHREADS_ATOMIC_MSVC_STORE
+  #else
+    /* INFO: A failed CAS never publishes anything, so it only needs to acquire */
+    #define __CTHREADS_FAIL_ORDER(order) ((order) == __ATOMIC_RELEASE ? __ATOMIC_RELAXED : (order) == __ATOMIC_ACQ_REL ? __ATOMIC_ACQUIRE : (order))
+
+    #define __CTHREADS_ATOMIC_FUNCTIONS(suffix, type)                                                                                  \
+      static __CTHREADS_INLINE type cthreads_atomic_load_##suffix(type volatile *p, int order) {                                     \
+        return __atomic_load_n(p, order);                                                                                            \
+      }                                                                                                                              \
+      static __CTHREADS_INLINE void cthreads_atomic_store_##suffix(type volatile *p, type v, int order) {                            \
+        __atomic_store_n(p, v, order);                                                                                               \
+      }                                                                                                                              \
+      static __CTHREADS_INLINE type cthreads_atomic_exchange_##suffix(type volatile *p, type v, int order) {                         \
+        return __atomic_exchange_n(p, v, order);                                                                                     \
+      }                                                                                                                              \
+      static __CTHREADS_INLINE int cthreads_atomic_cas_##suffix(type volatile *p, type *expected, type desired, int order) {         \
+        return __atomic_compare_exchange_n(p, expected, desired, 0, order, __CTHREADS_FAIL_ORDER(order));                           \
+      }                                                                                                                              \
+      static __CTHREADS_INLINE int cthreads_atomic_cas_weak_##suffix(type volatile *p, type *expected, type desired, int order) {    \
+        return __atomic_compare_exchange_n(p, expected, desired, 1, order, __CTHREADS_FAIL_ORDER(order));                           \
+      }
+
+    #define __CTHREADS_ATOMIC_ARITHMETIC(suffix, type)                                                                                 \
+      static __CTHREADS_INLINE type cthreads_atomic_fetch_add_##suffix(type volatile *p, type v, int order) {                        \
+        return __atomic_fetch_add(p, v, order);                                                                                      \
+      }                                                                                                                              \
+      static __CTHREADS_INLINE type cthreads_atomic_fetch_or_##suffix(type volatile *p, type v, int order) {                         \
+        return __atomic_fetch_or(p, v, order);                                                                                       \
+      }                                                                                                                              \
+      static __CTHREADS_INLINE type cthreads_atomic_fetch_and_##suffix(type volatile *p, type v, int order) {                        \
+        return __atomic_fetch_and(p, v, order);                                                                                      \
+      }
+
+    __CTHREADS_ATOMIC_FUNCTIONS(u8, uint8_t)
+    __CTHREADS_ATOMIC_FUNCTIONS(u32, uint32_t)
+    __CTHREADS_ATOMIC_FUNCTIONS(u64, uint64_t)
+    __CTHREADS_ATOMIC_FUNCTIONS(ptr, void *)
+
+    __CTHREADS_ATOMIC_ARITHMETIC(u8, uint8_t)
+    __CTHREADS_ATOMIC_ARITHMETIC(u32, uint32_t)
+    __CTHREADS_ATOMIC_ARITHMETIC(u64, uint64_t)
+
+    #undef __CTHREADS_ATOMIC_FUNCTIONS
+    #undef __CTHREADS_ATOMIC_ARITHMETIC
+  #endif
+
+  /**
+   * Orders the caller's memory accesses around this point.
+   *
+   * @param order One of the CTHREADS_ATOMIC_* memory orders. Relaxed is a no-op.
+   */
+  static __CTHREADS_INLINE void cthreads_atomic_fence(int order) {
+    #ifdef _MSC_VER
+      #ifdef __CTHREADS_ATOMIC_X86
+        /* INFO: x86 only reorders a store with a later load, which only sequential consistency forbids */
+        if (order == CTHREADS_ATOMIC_SEQ_CST) MemoryBarrier();
+        else _ReadWriteBarrier();
+      #else
+        if (order != CTHREADS_ATOMIC_RELAXED) MemoryBarrier();
+      #endif
+    #else
+      __atomic_thread_fence(order);
+    #endif
+  }
+
+  /**
+   * Tells the CPU the caller is spinning on a value, so that it can save power and hand
+   *   execution resources to a sibling hyper-thread.
+   */
+  static __CTHREADS_INLINE void cthreads_atomic_pause(void) {
+    #ifdef _MSC_VER
+      YieldProcessor();
+    #elif defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+    #elif defined(__aarch64__) || (defined(__arm__) && __ARM_ARCH >= 7)
+      __asm__ __volatile__("yield" ::: "memory");
+    #else
+      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    #endif
+  }
+
+  /**
+   * Exponential backoff for spin loops: the n-th call pauses 2^n times. Once
+   *   CTHREADS_ATOMIC_BACKOFF_LIMIT rounds were spent, it stops pausing and tells the
+   *   caller to yield or sleep instead.
+   *
+   * @param round Round counter, set to 0 before the first attempt.
+   * @return 0 while spinning is still worth it, 1 once the caller should block.
+   */
+  static __CTHREADS_INLINE int cthreads_atomic_backoff(uint32_t *round) {
+    uint32_t i;
+
+    if (*round >= CTHREADS_ATOMIC_BACKOFF_LIMIT) return 1;
+
+    for (i = 0; i < (1u << *round); i++) cthreads_atomic_pause();
+    (*round)++;
+
+    return 0;
+  }
+
+  #ifdef CTHREADS_ATOMIC_DWCAS
+    /**
+     * Compares and swaps two adjacent pointer-sized words at once.
+     *
+     * @param p Address of the words, aligned to their combined size.
+     * @param expected Words expected at `p`, replaced by the words found there on failure.
+     * @param desired Words stored at `p` on success.
+     * @return 1 if the words were swapped, 0 otherwise.
+     */
+    static __CTHREADS_INLINE int cthreads_atomic_dwcas(volatile void *p, uintptr_t expected[2], const uintptr_t desired[2]) {
+      #if __CTHREADS_DWCAS_SIZE == 8
+        union { uintptr_t words[2]; uint64_t value; } exp, des;
+
+        exp.words[0] = expected[0];
+        exp.words[1] = expected[1];
+        des.words[0] = desired[0];
+        des.words[1] = desired[1];
+
+        if (cthreads_atomic_cas_u64((volatile uint64_t *)p, &exp.value, des.value, CTHREADS_ATOMIC_ACQ_REL)) return 1;
+        expected[0] = exp.words[0];
+        expected[1] = exp.words[1];
+
+        return 0;
+      #elif defined(_MSC_VER)
+        return _InterlockedCompareExchange128((volatile __int64 *)p, (__int64)desired[1], (__int64)desired[0], (__int64 *)expected);
+      #elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+        __extension__ union { uintptr_t words[2]; unsigned __int128 value; } exp, des, old;
+
+        exp.words[0] = expected[0];
+        exp.words[1] = expected[1];
+        des.words[0] = desired[0];
+        des.words[1] = desired[1];
+
+        old.value = __sync_val_compare_and_swap(__extension__ (volatile unsigned __int128 *)p, exp.value, des.value);
+        if (old.value == exp.value) return 1;
+        expected[0] = old.words[0];
+        expected[1] = old.words[1];
+
+        return 0;
+      #else
+        /* INFO: Every x86-64 CPU but the very first K8 steppings has cmpxchg16b */
+        unsigned char ok;
+
+        __asm__ __volatile__("lock cmpxchg16b %1\n\tsetz %0"
+                             : "=q"(ok), "+m"(*(__extension__ (volatile unsigned __int128 *)p)), "+a"(expected[0]), "+d"(expected[1])
+                             : "b"(desired[0]), "c"(desired[1])
+                             : "memory", "cc");
+
+        return ok;
+      #endif
+    }
+  #endif
+#endif
+
 struct cthreads_thread {
   #ifdef _WIN32
     HANDLE wThread;
@@ -89,6 +589,15 @@ struct cthreads_thread_attr {
       size_t stack;
     #endif
   #endif
+  /* INFO: sched_priority for SCHED_FIFO/SCHED_RR on POSIX, a THREAD_PRIORITY_* value on Windows, 0 to inherit, or the lowest one of the policy when `realtime` is set */
+  int priority;
+  /* INFO: Non-zero for SCHED_FIFO (unless `schedpolicy` says otherwise) on POSIX, THREAD_PRIORITY_TIME_CRITICAL on Windows */
+  int realtime;
+  #ifdef CTHREADS_THREAD_NICE
+    int nice;
+  #endif
+  /* INFO: Applied to the thread and reported by the registry, truncated to CTHREADS_THREAD_NAME_MAX - 1 characters, ignored without CTHREADS_REGISTRY */
+  const char *name;
 };
 
 struct cthreads_mutex {
@@ -148,12 +657,20 @@ struct cthreads_rwlock {
   #else
     pthread_rwlock_t pRWLock;
   #endif
+  struct cthreads_mutex upgrade;
+  int exclusive;
 };
 #endif
 
 #ifdef CTHREADS_SEMAPHORE
   struct cthreads_semaphore {
-    #ifdef _WIN32
+    #ifdef CTHREADS_ATOMIC
+      /* INFO: Permits, also the word waiters sleep on */
+      uint32_t count;
+      uint32_t waiters;
+      /* INFO: Waiters for more than one permit or in cthreads_wait_any, which force posts to wake everyone */
+      uint32_t bulk_waiters;
+    #elif defined(_WIN32)
       HANDLE wSemaphore;
     #else
       sem_t pSemaphore;
@@ -161,135 +678,638 @@ struct cthreads_rwlock {
   };
 #endif
 
-/**
- * Creates a new thread.
- *
- * - pthread: pthread_create
- * - windows threads: CreateThread
- *
- * @param thread Pointer to the thread structure to be filled with the new thread information.
- * @param attr Pointer to the thread attributes. Set it to NULL for default attributes.
- * @param func Pointer to the function that will be executed in the new thread.
- * @param data Pointer to the data that will be passed to the thread function.
- * @param args Pointer to the thread arguments.
- * @return 0 on success, non-zero error code on failure.
- */
-int cthreads_thread_create(struct cthreads_thread *thread, struct cthreads_thread_attr *attr, void *(*func)(void *data), void *data, struct cthreads_args *args);
-
-/**
- * Detaches a thread.
- *
- * - pthread: pthread_detach
- * - windows threads: CloseHandle
- *
- * @param thread Thread structure to be detached.
- * @return 0 on success, non-zero error code on failure.
- */
-int cthreads_thread_detach(struct cthreads_thread thread);
+#ifdef CTHREADS_WAIT_ANY
+  /* INFO: Most objects a single wait may watch, as futex_waitv does */
+  #define CTHREADS_WAIT_ANY_MAX 128
+  #define CTHREADS_WAIT_TIMEOUT 2
 
-/**
- * Joins a thread.
- *
- * - pthread: pthread_join
- * - windows threads: WaitForSingleObject & GetExitCodeThread
- *
- * @param thread Pointer to the thread structure to be joined.
- * @param code Pointer to store the exit code of the joined thread.
- * @return 0 on success, non-zero error code on failure.
- */
-int cthreads_thread_join(struct cthreads_thread thread, void *code);
+  /* INFO: Fires by taking one permit */
+  #define CTHREADS_WAIT_SEMAPHORE 0
+  /* INFO: Fires once the word no longer holds `value`, changed by `cthreads_word_store` or `cthreads_word_add` */
+  #define CTHREADS_WAIT_WORD 1
 
-/**
- * Compares two thread structures for equality.
- *
- * - pthread: pthread_equal
- * - windows threads: GetCurrentThreadId
- *
- * @param thread1 First thread structure to compare.
- * @param thread2 Second thread structure to compare.
- * @return 1 if the threads are equal, zero otherwise.
- */
-int cthreads_thread_equal(struct cthreads_thread thread1, struct cthreads_thread thread2);
+  struct cthreads_wait_object {
+    int type;
+    void *object;
+    uint32_t value;
+  };
+#endif
 
-/**
- * Retrieves the thread struct of the current thread.
- *
- * - pthread: pthread_self
- * - windows threads: GetCurrentThreadId
- *
- * @return Thread struct of the current thread.
- */
-struct cthreads_thread cthreads_thread_self(void);
+#ifndef CTHREADS_TLS_KEYS
+  #define CTHREADS_TLS_KEYS 128
+#endif
 
-/**
- * Retrieves the thread identifier of the specified thread.
- * 
- * - pthread: N/A
- * - windows threads: GetThreadId
- * 
- * @param thread Thread structure to retrieve the identifier from.
- * @return Thread identifier of the specified thread.
-*/
-unsigned long cthreads_thread_id(struct cthreads_thread thread);
+struct cthreads_tls {
+  #ifdef __CTHREADS_TLS_FAST
+    size_t index;
+  #elif defined(_WIN32)
+    DWORD index;
+  #else
+    pthread_key_t key;
+  #endif
+};
 
-/**
- * Exits a thread.
- *
- * - pthread: pthread_exit
- * - windows threads: ExitThread
- *
- * @param code Pointer to the thread exit code.
- */
-void cthreads_thread_exit(void *code);
+#ifdef CTHREADS_ONCE
+  struct cthreads_once {
+    #ifdef CTHREADS_ATOMIC
+      uint32_t state;
+    #else
+      pthread_once_t pOnce;
+    #endif
+  };
 
-/**
- * Cancels a thread.
- *
- * - pthread: pthread_cancel
- * - windows threads: TerminateThread
- *
- * @param thread Thread structure to be canceled.
- * @return 0 on success, non-zero error code on failure.
- */
-int cthreads_thread_cancel(struct cthreads_thread thread);
+  #ifdef CTHREADS_ATOMIC
+    #define CTHREADS_ONCE_INIT { 0 }
 
-/**
- * Initializes a mutex.
- *
- * - pthread: pthread_mutex_init
- * - windows threads: InitializeCriticalSection
- *
- * @param mutex Pointer to the mutex structure to be initialized.
- * @param attr Pointer to the mutex attributes. Set it to NULL for default attributes. Only available if CTHREADS_MUTEX_ATTR is defined.
- * @return 0 on success, non-zero error code on failure.
- */
-#ifdef CTHREADS_MUTEX_ATTR
-  int cthreads_mutex_init(struct cthreads_mutex *mutex, struct cthreads_mutex_attr *attr);
-#else
-  int cthreads_mutex_init(struct cthreads_mutex *mutex, void *attr);
+    /* INFO: States of `state`, shared by the inline fast path and the slow path */
+    #define __CTHREADS_ONCE_RUNNING 1
+    #define __CTHREADS_ONCE_DONE 2
+    #define __CTHREADS_ONCE_CONTENDED 3
+  #else
+    #define CTHREADS_ONCE_INIT { PTHREAD_ONCE_INIT }
+  #endif
 #endif
 
-/**
- * Locks a mutex.
- *
- * - pthread: pthread_mutex_lock
- * - windows threads: EnterCriticalSection
- *
- * @param mutex Pointer to the mutex structure to be locked.
- * @return 0 on success, non-zero error code on failure.
- */
-int cthreads_mutex_lock(struct cthreads_mutex *mutex);
+#ifdef CTHREADS_STACK
+  struct cthreads_stack_node {
+    struct cthreads_stack_node *next;
+  };
 
-/**
- * Tries to lock a mutex without blocking.
- *
- * - pthread: pthread_mutex_trylock
- * - windows threads: TryEnterCriticalSection
- *
+  #ifdef CTHREADS_ATOMIC_DWCAS
+    struct __CTHREADS_ALIGNED(__CTHREADS_DWCAS_SIZE) cthreads_stack_head {
+      struct cthreads_stack_node *node;
+      uintptr_t tag;
+    };
+  #endif
+
+  struct cthreads_stack {
+    #ifdef CTHREADS_ATOMIC_DWCAS
+      struct cthreads_stack_head head;
+    #else
+      /* INFO: Node index + 1 (low 32 bits) and generation (high 32 bits) */
+      uint64_t head;
+    #endif
+    char *base;
+    size_t stride;
+  };
+#endif
+
+#ifdef CTHREADS_OBJPOOL
+  #ifndef CTHREADS_OBJPOOL_MAGAZINE
+    #define CTHREADS_OBJPOOL_MAGAZINE 32
+  #endif
+  #ifndef CTHREADS_OBJPOOL_THREADS
+    #define CTHREADS_OBJPOOL_THREADS 256
+  #endif
+
+  struct cthreads_objpool_magazines;
+
+  struct cthreads_objpool {
+    struct cthreads_stack depot;
+    char *arena;
+    size_t stride;
+    size_t capacity;
+    struct cthreads_objpool_magazines **magazines;
+  };
+#endif
+
+#ifdef CTHREADS_COMBINER
+  struct __cthreads_combiner_record;
+
+  struct cthreads_combiner {
+    /* INFO: Held by the thread currently combining */
+    uint32_t lock;
+    char __pad0[CTHREADS_CACHE_LINE - sizeof(uint32_t)];
+    /* INFO: Publication list, records are only ever prepended */
+    struct __cthreads_combiner_record *head;
+    struct __cthreads_combiner_record **records;
+  };
+#endif
+
+#ifdef CTHREADS_CHANNEL
+  #define CTHREADS_CHAN_CLOSED 1
+  #define CTHREADS_CHAN_TIMEOUT 2
+  #define CTHREADS_CHAN_INFINITE CTHREADS_INFINITE
+
+  #define CTHREADS_CHAN_SEND 0
+  #define CTHREADS_CHAN_RECV 1
+
+  struct cthreads_chan_waiter;
+
+  struct cthreads_chan {
+    struct cthreads_mutex lock;
+    char *buffer;
+    size_t size;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int closed;
+    struct cthreads_chan_waiter *recvq;
+    struct cthreads_chan_waiter *recvq_tail;
+    struct cthreads_chan_waiter *sendq;
+    struct cthreads_chan_waiter *sendq_tail;
+  };
+
+  struct cthreads_select_case {
+    struct cthreads_chan *chan;
+    int op;
+    void *data;
+  };
+#endif
+
+#ifdef CTHREADS_MPSC
+  struct cthreads_mpsc_node {
+    struct cthreads_mpsc_node *next;
+  };
+
+  struct cthreads_mpsc {
+    /* INFO: Written by producers */
+    struct cthreads_mpsc_node *head;
+    char __pad0[CTHREADS_CACHE_LINE - sizeof(void *)];
+    /* INFO: Written by the consumer */
+    struct cthreads_mpsc_node *tail;
+    uint32_t parked;
+    char __pad1[CTHREADS_CACHE_LINE - sizeof(void *) - sizeof(uint32_t)];
+    struct cthreads_mpsc_node stub;
+  };
+#endif
+
+#ifdef CTHREADS_TRIPLEBUF
+  struct cthreads_triplebuf {
+    void *buffers[3];
+    /* INFO: Buffer index in between writer and reader, with __CTHREADS_TRIPLEBUF_FRESH once published and not yet read */
+    uint32_t middle;
+    char __pad0[CTHREADS_CACHE_LINE - sizeof(uint32_t)];
+    /* INFO: Owned by the writer */
+    uint32_t back;
+    char __pad1[CTHREADS_CACHE_LINE - sizeof(uint32_t)];
+    /* INFO: Owned by the reader */
+    uint32_t front;
+  };
+#endif
+
+#ifdef CTHREADS_DEQUE
+  struct __cthreads_deque_array;
+
+  struct cthreads_deque {
+    /* INFO: Moved by thieves */
+    uint64_t top;
+    char __pad0[CTHREADS_CACHE_LINE - sizeof(uint64_t)];
+    /* INFO: Owned by the thread pushing and popping */
+    uint64_t bottom;
+    struct __cthreads_deque_array *array;
+    char __pad1[CTHREADS_CACHE_LINE - sizeof(uint64_t) - sizeof(void *)];
+  };
+#endif
+
+#ifdef CTHREADS_PARKING_LOT
+  #ifndef CTHREADS_PARKING_LOT_BUCKETS
+    #define CTHREADS_PARKING_LOT_BUCKETS 256
+  #endif
+
+  #define CTHREADS_PARK_UNPARKED 0
+  #define CTHREADS_PARK_INVALID 1
+  #define CTHREADS_PARK_TIMEOUT 2
+
+  #define CTHREADS_REQUEUE_ABORT 0
+  #define CTHREADS_REQUEUE_UNPARK_ONE_REQUEUE_REST 1
+  #define CTHREADS_REQUEUE_ALL 2
+
+  struct cthreads_lock {
+    uint8_t state;
+  };
+
+  #define CTHREADS_LOCK_INITIALIZER { 0 }
+
+  struct cthreads_condition {
+    struct cthreads_lock *lock;
+  };
+
+  #define CTHREADS_CONDITION_INITIALIZER { NULL }
+#endif
+
+#ifdef CTHREADS_SLAB
+  #ifndef CTHREADS_SLAB_BATCH
+    #define CTHREADS_SLAB_BATCH 32
+  #endif
+
+  struct __cthreads_slab_span;
+  struct __cthreads_slab_cache;
+
+  struct cthreads_slab {
+    size_t stride;
+    size_t offset;
+    size_t per_span;
+    size_t span_size;
+    /* INFO: Guards the span list */
+    struct cthreads_lock lock;
+    /* INFO: Guards the cache shared by threads without a slot */
+    struct cthreads_lock shared_lock;
+    struct __cthreads_slab_span *spans;
+    struct __cthreads_slab_cache **caches;
+    struct cthreads_slab *next;
+  };
+#endif
+
+#ifdef CTHREADS_LEFTRIGHT
+  #ifndef CTHREADS_LEFTRIGHT_STRIPES
+    #define CTHREADS_LEFTRIGHT_STRIPES 16
+  #endif
+
+  struct __cthreads_leftright_indicator;
+
+  struct cthreads_leftright {
+    /* INFO: Instance readers are directed to */
+    uint32_t left_right;
+    /* INFO: Read indicator new readers arrive on */
+    uint32_t version;
+    char __pad0[CTHREADS_CACHE_LINE - 2 * sizeof(uint32_t)];
+    /* INFO: Two versions of CTHREADS_LEFTRIGHT_STRIPES padded reader counts */
+    struct __cthreads_leftright_indicator *indicators;
+    void *instances[2];
+    /* INFO: Serializes writers */
+    struct cthreads_lock lock;
+  };
+#endif
+
+#ifdef CTHREADS_LOW_LATENCY
+  #define CTHREADS_CPU_ANY -1
+  #define CTHREADS_CPU_ISOLATED -2
+
+  /* INFO: Step of `cthreads_thread_low_latency` that failed */
+  #define CTHREADS_LOW_LATENCY_MEMLOCK 1
+  #define CTHREADS_LOW_LATENCY_PREFAULT 2
+  #define CTHREADS_LOW_LATENCY_AFFINITY 3
+  #define CTHREADS_LOW_LATENCY_PRIORITY 4
+
+  struct cthreads_low_latency_attr {
+    /* INFO: Non-zero to lock the process' current and future pages in memory, only the prefaulted stack on Windows */
+    int lock_memory;
+    /* INFO: Bytes of stack and heap to fault in now, so the hot path takes no page faults */
+    size_t stack_prefault;
+    size_t heap_prefault;
+    /* INFO: CPU to pin the thread to, CTHREADS_CPU_ISOLATED for the first isolated one, or CTHREADS_CPU_ANY */
+    int cpu;
+    /* INFO: SCHED_FIFO priority on POSIX, a THREAD_PRIORITY_* value on Windows, 0 to leave it */
+    int priority;
+  };
+#endif
+
+#ifdef CTHREADS_POOL
+  #define CTHREADS_POOL_PRIORITIES 3
+
+  #define CTHREADS_PRIORITY_HIGH 0
+  #define CTHREADS_PRIORITY_NORMAL 1
+  #define CTHREADS_PRIORITY_LOW 2
+
+  struct cthreads_task_group;
+
+  /* INFO: Caller-owned, it must stay valid until the task starts running */
+  struct cthreads_task {
+    struct cthreads_task *next;
+    void (*func)(void *data);
+    void *data;
+    struct cthreads_task_group *group;
+    unsigned int priority;
+    /* INFO: Monotonic nanoseconds, 0 for tasks without a deadline */
+    uint64_t deadline;
+  };
+
+  struct cthreads_pool_attr {
+    /* INFO: Number of workers, 0 for one per online CPU */
+    size_t threads;
+    /* INFO: Attributes of the worker threads, e.g. their schedpolicy, or NULL */
+    struct cthreads_thread_attr *thread_attr;
+    /* INFO: Share of the workers' time each priority class gets while all of them have work */
+    unsigned int weights[CTHREADS_POOL_PRIORITIES];
+    /* INFO: Elastic bounds, idle workers retire down to `min_threads`, stalls add workers up to `max_threads`. 0 keeps `threads` */
+    size_t min_threads;
+    size_t max_threads;
+    /* INFO: How long a worker above the minimum stays idle before retiring, 0 for 10 seconds */
+    unsigned int keep_alive_ms;
+    /* INFO: How long queued work may see no task start before a worker is added, 0 for 10 milliseconds */
+    unsigned int stall_ms;
+  };
+
+  #define CTHREADS_POOL_ATTR_INITIALIZER { 0, NULL, { 16, 4, 1 }, 0, 0, 0, 0 }
+
+  struct cthreads_pool_worker;
+
+  struct cthreads_pool {
+    /* INFO: `max_threads` slots, the first `threads` ones have been used by a worker */
+    struct cthreads_pool_worker *workers;
+    uint32_t threads;
+    uint32_t alive;
+    uint32_t blocked;
+    uint32_t min_threads;
+    uint32_t target_threads;
+    uint32_t max_threads;
+    uint64_t keep_alive_ns;
+    uint64_t stall_ns;
+    struct cthreads_mutex grow_lock;
+    struct cthreads_thread monitor;
+    struct cthreads_args monitor_args;
+    int monitor_started;
+    struct cthreads_thread_attr thread_attr;
+    int thread_attr_set;
+    /* INFO: Tasks submitted from threads outside the pool, one queue per priority class */
+    struct cthreads_mutex inject_lock;
+    struct cthreads_task *inject_head[CTHREADS_POOL_PRIORITIES];
+    struct cthreads_task *inject_tail[CTHREADS_POOL_PRIORITIES];
+    uint64_t strides[CTHREADS_POOL_PRIORITIES];
+    uint32_t deadlines;
+    uint32_t epoch;
+    uint32_t sleepers;
+    uint32_t shutdown;
+  };
+
+  struct cthreads_task_group {
+    struct cthreads_pool *pool;
+    /* INFO: Pending tasks times two, plus one when someone sleeps on it */
+    uint32_t state;
+  };
+#endif
+
+#ifdef CTHREADS_PARALLEL
+  /* INFO: Bytes of input each task works on at once, sized to stay in a core's L2 */
+  #ifndef CTHREADS_PARALLEL_BLOCK
+    #define CTHREADS_PARALLEL_BLOCK (128 * 1024)
+  #endif
+#endif
+
+#ifdef CTHREADS_TIMER
+  /* INFO: 64 slots per level, 6 levels span 2^36 ticks (about 795 days at 1 ms) */
+  #define CTHREADS_TIMER_SLOTS 64
+  #ifndef CTHREADS_TIMER_LEVELS
+    #define CTHREADS_TIMER_LEVELS 6
+  #endif
+
+  struct cthreads_timer_wheel;
+
+  struct cthreads_timer {
+    struct cthreads_timer *next;
+    struct cthreads_timer **pprev;
+    void (*func)(void *data);
+    void *data;
+    struct cthreads_timer_wheel *wheel;
+    /* INFO: Ticks since the wheel started */
+    uint64_t expires;
+    uint64_t period;
+    uint32_t state;
+    uint32_t slot;
+    /* INFO: Set while `task` waits in the pool's queue */
+    uint32_t queued;
+    struct cthreads_task task;
+  };
+
+  struct cthreads_timer_wheel {
+    struct cthreads_lock lock;
+    uint32_t epoch;
+    uint32_t shutdown;
+    /* INFO: Next tick to be handled, and the one the driver sleeps until */
+    uint64_t current;
+    uint64_t sleep_until;
+    uint64_t start_ns;
+    uint64_t tick_ns;
+    uint64_t occupied[CTHREADS_TIMER_LEVELS];
+    struct cthreads_timer *slots[CTHREADS_TIMER_LEVELS][CTHREADS_TIMER_SLOTS];
+    struct cthreads_pool *pool;
+    struct cthreads_thread thread;
+    struct cthreads_args args;
+  };
+#endif
+
+#ifdef CTHREADS_PIPELINE
+  /* INFO: Any number of threads run the stage, items leave it in any order */
+  #define CTHREADS_PIPELINE_PARALLEL 0
+  /* INFO: One thread runs the stage, on items in the order the first stage produced them */
+  #define CTHREADS_PIPELINE_SERIAL_IN_ORDER 1
+  /* INFO: One thread runs the stage, on items in the order they arrive */
+  #define CTHREADS_PIPELINE_SERIAL_OUT_OF_ORDER 2
+
+  struct __cthreads_pipeline_stage;
+
+  struct cthreads_pipeline {
+    struct __cthreads_pipeline_stage **stages;
+    size_t count;
+    size_t capacity;
+    /* INFO: Items produced by the first stage that did not leave the pipeline yet */
+    uint32_t live;
+    uint32_t max_live;
+    uint32_t live_epoch;
+    uint32_t live_sleepers;
+    uint64_t start_ns;
+    uint64_t end_ns;
+  };
+
+  struct cthreads_pipeline_stats {
+    /* INFO: Items the stage function ran on */
+    uint64_t items;
+    /* INFO: Nanoseconds, summed over the stage's threads, spent in the stage function */
+    uint64_t busy_ns;
+    /* INFO: Nanoseconds, summed over the stage's threads, spent waiting for an item */
+    uint64_t starved_ns;
+    /* INFO: Nanoseconds, summed over the stage's threads, spent waiting for a token of the next stage */
+    uint64_t blocked_ns;
+    /* INFO: Nanoseconds since the run started, or that it took once finished */
+    uint64_t elapsed_ns;
+    /* INFO: Items queued for or running in the stage, for the first stage every live item */
+    size_t in_flight;
+    size_t tokens;
+    size_t threads;
+  };
+#endif
+
+#ifdef CTHREADS_IPC
+  #define CTHREADS_IPC_TIMEOUT 2
+
+  struct cthreads_ipc {
+    void *shared;
+    size_t size;
+    int fd;
+    /* INFO: Position of the message acquired by this consumer */
+    uint64_t position;
+  };
+#endif
+
+#ifdef CTHREADS_TRACE
+  #ifndef CTHREADS_TRACE_EVENTS
+    /* INFO: Per-thread ring capacity, must be a power of two */
+    #define CTHREADS_TRACE_EVENTS 16384
+  #endif
+
+  #ifndef CTHREADS_TRACE_RINGS
+    /* INFO: Ring count past which exited threads' rings are reused before they were flushed */
+    #define CTHREADS_TRACE_RINGS 64
+  #endif
+
+  #define CTHREADS_TRACE_CHROME 0
+  #define CTHREADS_TRACE_PERFETTO 1
+#endif
+
+#ifdef CTHREADS_REGISTRY
+  #define CTHREADS_THREAD_NAME_MAX 16
+
+  struct cthreads_thread_stats {
+    char name[CTHREADS_THREAD_NAME_MAX];
+    /* INFO: Kernel thread ID on Linux, thread ID on Windows */
+    unsigned long tid;
+    /* INFO: Attributes the thread was created with, valid if `attr_set` */
+    struct cthreads_thread_attr attr;
+    int attr_set;
+    uint64_t cpu_ns;
+    uint64_t voluntary_switches;
+    uint64_t involuntary_switches;
+    /* INFO: Time spent asleep in cthreads waits and contended cthreads mutex and read-write lock acquisitions */
+    uint64_t blocked_ns;
+  };
+#endif
+
+/**
+ * Creates a new thread. On failure, `cthreads_error_code` tells which error the attributes
+ *   or the creation hit.
+ *
+ * - pthread: pthread_create
+ * - windows threads: CreateThread
+ *
+ * @param thread Pointer to the thread structure to be filled with the new thread information.
+ * @param attr Pointer to the thread attributes. Set it to NULL for default attributes.
+ * @param func Pointer to the function that will be executed in the new thread.
+ * @param data Pointer to the data that will be passed to the thread function.
+ * @param args Pointer to the thread arguments.
+ * @return 0 on success, non-zero error code on failure.
+ */
+int cthreads_thread_create(struct cthreads_thread *thread, struct cthreads_thread_attr *attr, void *(*func)(void *data), void *data, struct cthreads_args *args);
+
+/**
+ * Detaches a thread.
+ *
+ * - pthread: pthread_detach
+ * - windows threads: CloseHandle
+ *
+ * @param thread Thread structure to be detached.
+ * @return 0 on success, non-zero error code on failure.
+ */
+int cthreads_thread_detach(struct cthreads_thread thread);
+
+/**
+ * Joins a thread.
+ *
+ * - pthread: pthread_join
+ * - windows threads: WaitForSingleObject & GetExitCodeThread
+ *
+ * @param thread Pointer to the thread structure to be joined.
+ * @param code Pointer to store the exit code of the joined thread.
+ * @return 0 on success, non-zero error code on failure.
+ */
+int cthreads_thread_join(struct cthreads_thread thread, void *code);
+
+/**
+ * Compares two thread structures for equality.
+ *
+ * - pthread: pthread_equal
+ * - windows threads: GetCurrentThreadId
+ *
+ * @param thread1 First thread structure to compare.
+ * @param thread2 Second thread structure to compare.
+ * @return 1 if the threads are equal, zero otherwise.
+ */
+__CTHREADS_WRAPPER int cthreads_thread_equal(struct cthreads_thread thread1, struct cthreads_thread thread2);
+
+/**
+ * Retrieves the thread struct of the current thread.
+ *
+ * - pthread: pthread_self
+ * - windows threads: GetCurrentThreadId
+ *
+ * @return Thread struct of the current thread.
+ */
+__CTHREADS_WRAPPER struct cthreads_thread cthreads_thread_self(void);
+
+/**
+ * Retrieves the thread identifier of the specified thread.
+ * 
+ * - pthread: N/A
+ * - windows threads: GetThreadId
+ * 
+ * @param thread Thread structure to retrieve the identifier from.
+ * @return Thread identifier of the specified thread.
+*/
+unsigned long cthreads_thread_id(struct cthreads_thread thread);
+
+/**
+ * Exits a thread.
+ *
+ * - pthread: pthread_exit
+ * - windows threads: ExitThread
+ *
+ * @param code Pointer to the thread exit code.
+ */
+void cthreads_thread_exit(void *code);
+
+/**
+ * Cancels a thread.
+ *
+ * - pthread: pthread_cancel
+ * - windows threads: TerminateThread
+ *
+ * @param thread Thread structure to be canceled.
+ * @return 0 on success, non-zero error code on failure.
+ */
+int cthreads_thread_cancel(struct cthreads_thread thread);
+
+#ifdef CTHREADS_LOW_LATENCY
+  /**
+   * Prepares the calling thread for low-latency work, in order: locks memory, prefaults
+   *   the heap then the stack, pins the thread to a CPU and applies its realtime priority.
+   *   It stops at the first step that fails, whose OS error is kept for `cthreads_error_code`.
+   *
+   * - pthread: mlockall, mallopt, sched_setaffinity, pthread_setschedparam
+   * - windows threads: VirtualLock, SetThreadAffinityMask, SetThreadPriority
+   *
+   * @param attr Pointer to the low-latency attributes.
+   * @return 0 on success, CTHREADS_LOW_LATENCY_* of the step that failed otherwise.
+   */
+  int cthreads_thread_low_latency(struct cthreads_low_latency_attr *attr);
+#endif
+
+/**
+ * Initializes a mutex.
+ *
+ * - pthread: pthread_mutex_init
+ * - windows threads: InitializeCriticalSection
+ *
+ * @param mutex Pointer to the mutex structure to be initialized.
+ * @param attr Pointer to the mutex attributes. Set it to NULL for default attributes. Only available if CTHREADS_MUTEX_ATTR is defined.
+ * @return 0 on success, non-zero error code on failure.
+ */
+#ifdef CTHREADS_MUTEX_ATTR
+  int cthreads_mutex_init(struct cthreads_mutex *mutex, struct cthreads_mutex_attr *attr);
+#else
+  int cthreads_mutex_init(struct cthreads_mutex *mutex, void *attr);
+#endif
+
+/**
+ * Locks a mutex.
+ *
+ * - pthread: pthread_mutex_lock
+ * - windows threads: EnterCriticalSection
+ *
+ * @param mutex Pointer to the mutex structure to be locked.
+ * @return 0 on success, non-zero error code on failure.
+ */
+__CTHREADS_WRAPPER int cthreads_mutex_lock(struct cthreads_mutex *mutex);
+
+/**
+ * Tries to lock a mutex without blocking.
+ *
+ * - pthread: pthread_mutex_trylock
+ * - windows threads: TryEnterCriticalSection
+ *
  * @param mutex Pointer to the mutex structure to be locked.
  * @return 0 on success, non-zero error code on failure.
  */
-int cthreads_mutex_trylock(struct cthreads_mutex *mutex);
+__CTHREADS_WRAPPER int cthreads_mutex_trylock(struct cthreads_mutex *mutex);
 
 /**
  * Unlocks a mutex.
@@ -300,7 +1320,7 @@ int cthreads_mutex_trylock(struct cthreads_mutex *mutex);
  * @param mutex Pointer to the mutex structure to be unlocked.
  * @return 0 on success, non-zero error code on failure.
  */
-int cthreads_mutex_unlock(struct cthreads_mutex *mutex);
+__CTHREADS_WRAPPER int cthreads_mutex_unlock(struct cthreads_mutex *mutex);
 
 /**
  * Destroys a mutex.
@@ -313,6 +1333,19 @@ int cthreads_mutex_unlock(struct cthreads_mutex *mutex);
  */
 int cthreads_mutex_destroy(struct cthreads_mutex *mutex);
 
+#ifdef CTHREADS_MUTEX_ROBUST
+  /**
+   * Marks a robust mutex as consistent again, after its lock returned EOWNERDEAD because
+   *   the previous owner died while holding it.
+   *
+   * - pthread: pthread_mutex_consistent
+   *
+   * @param mutex Pointer to the mutex structure, locked by the calling thread.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_mutex_consistent(struct cthreads_mutex *mutex);
+#endif
+
 /**
  * Initializes a condition variable.
  *
@@ -338,7 +1371,7 @@ int cthreads_mutex_destroy(struct cthreads_mutex *mutex);
  * @param cond Pointer to the condition variable structure.
  * @return 0 on success, non-zero error code on failure.
  */
-int cthreads_cond_signal(struct cthreads_cond *cond);
+__CTHREADS_WRAPPER int cthreads_cond_signal(struct cthreads_cond *cond);
 
 /**
  * Broadcasts a condition variable.
@@ -349,7 +1382,7 @@ int cthreads_cond_signal(struct cthreads_cond *cond);
  * @param cond Pointer to the condition variable structure.
  * @return 0 on success, non-zero error code on failure.
  */
-int cthreads_cond_broadcast(struct cthreads_cond *cond);
+__CTHREADS_WRAPPER int cthreads_cond_broadcast(struct cthreads_cond *cond);
 
 /**
  * Destroys a condition variable.
@@ -372,7 +1405,7 @@ int cthreads_cond_destroy(struct cthreads_cond *cond);
  * @param mutex Pointer to the associated mutex structure.
  * @return 0 on success, non-zero error code on failure.
  */
-int cthreads_cond_wait(struct cthreads_cond *cond, struct cthreads_mutex *mutex);
+__CTHREADS_WRAPPER int cthreads_cond_wait(struct cthreads_cond *cond, struct cthreads_mutex *mutex);
 
 /**
  * Waits on a condition variable till set ms.
@@ -425,8 +1458,8 @@ int cthreads_cond_timedwait(struct cthreads_cond *cond, struct cthreads_mutex *m
   /**
    * Unlocks a read-write exclusive lock. 
    *
-   * - pthread: pthread_rwlock_unlock
-   * - windows threads: ReleaseSRWLockExclusive
+   * - pthread: pthread_rwlock_unlock & pthread_mutex_unlock
+   * - windows threads: ReleaseSRWLockExclusive & LeaveCriticalSection
    *
    * @note Calling this is UB if the lock was acquired by `cthreads_rwlock_rdlock` on Windows, but not POSIX.
    * @param rwlock Pointer to the read-write lock structure to be unlocked.
@@ -437,8 +1470,8 @@ int cthreads_cond_timedwait(struct cthreads_cond *cond, struct cthreads_mutex *m
   /**
    * Acquires a write lock on a read-write lock.
    *
-   * - pthread: pthread_rwlock_wrlock
-   * - windows threads: AcquireSRWLockExclusive
+   * - pthread: pthread_mutex_lock & pthread_rwlock_wrlock
+   * - windows threads: EnterCriticalSection & AcquireSRWLockExclusive
    *
    * @param rwlock Pointer to the read-write lock structure to be locked.
    * @return 0 on success, non-zero error code on failure.
@@ -446,19 +1479,69 @@ int cthreads_cond_timedwait(struct cthreads_cond *cond, struct cthreads_mutex *m
   int cthreads_rwlock_wrlock(struct cthreads_rwlock *rwlock);
 
   /**
-   * Destroys a read-write lock.
+   * Acquires an upgradable read lock. It coexists with plain readers, but not with writers
+   *   or another upgradable reader.
    *
-   * - pthread: pthread_rwlock_destroy
-   * - windows threads: N/A
+   * - pthread: pthread_mutex_lock & pthread_rwlock_rdlock
+   * - windows threads: EnterCriticalSection & AcquireSRWLockShared
    *
-   * @param rwlock Pointer to the read-write lock structure to be destroyed.
+   * @note Writers take the same gate, so `cthreads_rwlock_wrlock` costs an extra mutex lock.
+   * @param rwlock Pointer to the read-write lock structure to be locked.
    * @return 0 on success, non-zero error code on failure.
    */
-  int cthreads_rwlock_destroy(struct cthreads_rwlock *rwlock);
-#endif
+  int cthreads_rwlock_upgradable_lock(struct cthreads_rwlock *rwlock);
 
-/**
-  * Returns the platform-specific error code.
+  /**
+   * Releases an upgradable read lock that was not upgraded.
+   *
+   * - pthread: pthread_rwlock_unlock & pthread_mutex_unlock
+   * - windows threads: ReleaseSRWLockShared & LeaveCriticalSection
+   *
+   * @param rwlock Pointer to the read-write lock structure to be unlocked.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_rwlock_unlock_upgradable(struct cthreads_rwlock *rwlock);
+
+  /**
+   * Upgrades an upgradable read lock to an exclusive lock, once the plain readers drain. No
+   *   writer can run between the two, so what was read stays valid. Release it with
+   *   `cthreads_rwlock_unlock_exclusive` or `cthreads_rwlock_downgrade`.
+   *
+   * - pthread: pthread_rwlock_unlock & pthread_rwlock_wrlock
+   * - windows threads: ReleaseSRWLockShared & AcquireSRWLockExclusive
+   *
+   * @param rwlock Pointer to the read-write lock structure to be upgraded.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_rwlock_upgrade(struct cthreads_rwlock *rwlock);
+
+  /**
+   * Downgrades an exclusive lock, from `cthreads_rwlock_wrlock` or `cthreads_rwlock_upgrade`,
+   *   to a plain read lock, without letting any writer in. Release it with
+   *   `cthreads_rwlock_unlock_shared`.
+   *
+   * - pthread: pthread_rwlock_unlock & pthread_rwlock_rdlock & pthread_mutex_unlock
+   * - windows threads: ReleaseSRWLockExclusive & AcquireSRWLockShared & LeaveCriticalSection
+   *
+   * @param rwlock Pointer to the read-write lock structure to be downgraded.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_rwlock_downgrade(struct cthreads_rwlock *rwlock);
+
+  /**
+   * Destroys a read-write lock.
+   *
+   * - pthread: pthread_rwlock_destroy
+   * - windows threads: N/A
+   *
+   * @param rwlock Pointer to the read-write lock structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_rwlock_destroy(struct cthreads_rwlock *rwlock);
+#endif
+
+/**
+  * Returns the platform-specific error code.
   *
   * - pthread: errno
   * - windows: GetLastError()
@@ -483,6 +1566,7 @@ size_t cthreads_error_string(int error_code, char *buf, size_t length);
   /**
   * Initializes a semaphore.
   *
+  * - CTHREADS_ATOMIC: atomic count, waiters spin then sleep on it with a futex
   * - pthread: sem_init()
   * - windows threads: CreateSemaphore()
   *
@@ -495,6 +1579,7 @@ size_t cthreads_error_string(int error_code, char *buf, size_t length);
   /**
   * Decrease a semaphore.
   *
+  * - CTHREADS_ATOMIC: CAS on the count, futex wait while it is zero
   * - pthread: sem_wait()
   * - windows threads: WaitForSingleObject()
   *
@@ -506,6 +1591,7 @@ size_t cthreads_error_string(int error_code, char *buf, size_t length);
   /**
   * Tries to decrease a semaphore without blocking.
   *
+  * - CTHREADS_ATOMIC: CAS on the count
   * - pthread: sem_trywait()
   * - windows threads: WaitForSingleObject()
   *
@@ -518,6 +1604,7 @@ size_t cthreads_error_string(int error_code, char *buf, size_t length);
   /**
   * Waits on a condition variable till set ms.
   *
+  * - CTHREADS_ATOMIC: CAS on the count, futex wait with a timeout while it is zero
   * - pthread: sem_timedwait
   * - windows threads: WaitForSingleObject()
   *
@@ -530,6 +1617,7 @@ size_t cthreads_error_string(int error_code, char *buf, size_t length);
   /**
   * Increase a semaphore.
   *
+  * - CTHREADS_ATOMIC: CAS on the count, futex wake only if someone sleeps
   * - pthread: sem_post()
   * - windows threads: ReleaseSemaphore()
   *
@@ -541,6 +1629,7 @@ size_t cthreads_error_string(int error_code, char *buf, size_t length);
   /**
   * Destroy a semaphore.
   *
+  * - CTHREADS_ATOMIC: N/A
   * - pthread: sem_destroy()
   * - windows threads: CloseHandle()
   *
@@ -548,6 +1637,1352 @@ size_t cthreads_error_string(int error_code, char *buf, size_t length);
   * @return 0 on success, non-zero error code on failure.
   */
   int cthreads_sem_destroy(struct cthreads_semaphore *sem);
+
+  #ifdef CTHREADS_ATOMIC
+    /**
+    * Decreases a semaphore by `count` at once, blocking until that many permits are available.
+    *
+    * @param semaphore Pointer to the semaphore structure to be decreased.
+    * @param count Number of permits to take.
+    * @return 0 on success, non-zero error code on failure.
+    */
+    int cthreads_sem_wait_n(struct cthreads_semaphore *sem, unsigned int count);
+
+    /**
+    * Tries to decrease a semaphore by `count` at once without blocking.
+    *
+    * @param semaphore Pointer to the semaphore structure to be decreased.
+    * @param count Number of permits to take.
+    * @return 0 on success, non-zero error code on failure.
+    */
+    int cthreads_sem_trywait_n(struct cthreads_semaphore *sem, unsigned int count);
+
+    /**
+    * Decreases a semaphore by `count` at once, giving up after ms.
+    *
+    * @param semaphore Pointer to the semaphore structure to be decreased.
+    * @param count Number of permits to take.
+    * @param ms Time in milliseconds to give up if the permits are not taken in time.
+    * @return 0 on success, non-zero error code on failure.
+    */
+    int cthreads_sem_timedwait_n(struct cthreads_semaphore *sem, unsigned int count, unsigned int ms);
+
+    /**
+    * Increases a semaphore by `count` with a single update, waking as many single-permit
+    *   waiters as the new permits can satisfy, or every waiter if one wants several.
+    *
+    * @param semaphore Pointer to the semaphore structure to be increased.
+    * @param count Number of permits to add.
+    * @return 0 on success, non-zero error code on failure.
+    */
+    int cthreads_sem_post_n(struct cthreads_semaphore *sem, unsigned int count);
+  #endif
+#endif
+
+#ifdef CTHREADS_WAIT_ANY
+  /**
+   * Blocks until any of several objects fires, checking them in order so that the lowest
+   *   index wins when many are ready.
+   *
+   * - Linux 5.16+: futex_waitv on every object at once
+   * - otherwise: sleeps on a shared notifier that posts and word updates kick while anyone waits
+   *
+   * @param objects Array of objects to be watched.
+   * @param count Number of objects, at most CTHREADS_WAIT_ANY_MAX.
+   * @param ms Time in milliseconds to give up, or CTHREADS_INFINITE.
+   * @param index Where to store the index of the object that fired. May be NULL.
+   * @return 0 on success, CTHREADS_WAIT_TIMEOUT on timeout, other non-zero error code on failure.
+   */
+  int cthreads_wait_any(struct cthreads_wait_object *objects, size_t count, unsigned int ms, size_t *index);
+
+  /**
+   * Stores a value into a word and wakes every `cthreads_wait_any` watching it.
+   *
+   * @param word Pointer to the word.
+   * @param value Value to be stored.
+   */
+  void cthreads_word_store(uint32_t *word, uint32_t value);
+
+  /**
+   * Adds to a word, e.g. a doorbell counter, and wakes every `cthreads_wait_any` watching it.
+   *
+   * @param word Pointer to the word.
+   * @param value Value to be added.
+   * @return Value of the word before the addition.
+   */
+  uint32_t cthreads_word_add(uint32_t *word, uint32_t value);
+#endif
+
+/**
+ * Creates a thread-local storage key, whose value starts as NULL in every thread.
+ *
+ * With compiler thread-local storage, keys index a per-thread array of CTHREADS_TLS_KEYS
+ *   values and reading one is a single load. Otherwise they wrap pthread keys, or TlsAlloc
+ *   on Windows, where destructors are not supported.
+ *
+ * @param tls Pointer to the key structure to be initialized.
+ * @param destructor Function run with the non-NULL value of each thread when it exits, including through `cthreads_thread_exit`. Can be NULL.
+ * @return 0 on success, non-zero error code on failure.
+ */
+int cthreads_tls_create(struct cthreads_tls *tls, void (*destructor)(void *value));
+
+/**
+ * Sets the calling thread's value of a key.
+ *
+ * @param tls Pointer to the key structure.
+ * @param value Value to be stored.
+ * @return 0 on success, non-zero error code on failure.
+ */
+int cthreads_tls_set(struct cthreads_tls *tls, void *value);
+
+/**
+ * Gets the calling thread's value of a key.
+ *
+ * @param tls Pointer to the key structure.
+ * @return Value of the key, NULL if the calling thread never set it.
+ */
+#ifdef __CTHREADS_TLS_FAST
+  extern __CTHREADS_THREAD_LOCAL void *__cthreads_tls_values[CTHREADS_TLS_KEYS];
+
+  static __CTHREADS_INLINE void *cthreads_tls_get(struct cthreads_tls *tls) {
+    return __cthreads_tls_values[tls->index];
+  }
+#else
+  void *cthreads_tls_get(struct cthreads_tls *tls);
+#endif
+
+/**
+ * Deletes a key without running any destructor. The key's index may be reused by a later key.
+ *
+ * @param tls Pointer to the key structure to be deleted.
+ * @return 0 on success, non-zero error code on failure.
+ */
+int cthreads_tls_delete(struct cthreads_tls *tls);
+
+#ifdef CTHREADS_ONCE
+  /* INFO: Slow path of `cthreads_once`, taken until the function completed */
+  int __cthreads_once(struct cthreads_once *once, void (*func)(void));
+
+  /**
+   * Runs a function exactly once per once structure, however many threads call this.
+   *   Callers arriving while it runs wait for it to complete. Once it completed, this
+   *   costs a single acquire load.
+   *
+   * @param once Pointer to the once structure, initialized with CTHREADS_ONCE_INIT.
+   * @param func Function to be run.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  static __CTHREADS_INLINE int cthreads_once(struct cthreads_once *once, void (*func)(void)) {
+    #ifdef CTHREADS_ATOMIC
+      if (cthreads_atomic_load_u32(&once->state, CTHREADS_ATOMIC_ACQUIRE) == __CTHREADS_ONCE_DONE) return 0;
+    #endif
+
+    return __cthreads_once(once, func);
+  }
+#endif
+
+#ifdef CTHREADS_STACK
+  /**
+   * Initializes a lock-free LIFO (Treiber stack) of intrusive nodes.
+   *
+   * - CTHREADS_ATOMIC_DWCAS: pointer + tag head, swapped with a double-width CAS
+   * - otherwise: index + generation head packed in 64 bits, swapped with a 64-bit CAS
+   *
+   * @note Popped nodes may still be read by concurrent poppers, so their memory must stay
+   *         mapped while the stack is in use (e.g. an arena or a pool).
+   * @param stack Pointer to the stack structure to be initialized.
+   * @param base Start of the array every node lives in. May be NULL if CTHREADS_ATOMIC_DWCAS is defined.
+   * @param stride Distance in bytes between two nodes of `base`.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_stack_init(struct cthreads_stack *stack, void *base, size_t stride);
+
+  /**
+   * Pushes a node onto a lock-free stack.
+   *
+   * @param stack Pointer to the stack structure.
+   * @param node Pointer to the node to be pushed.
+   */
+  void cthreads_stack_push(struct cthreads_stack *stack, struct cthreads_stack_node *node);
+
+  /**
+   * Pushes an already linked chain of nodes onto a lock-free stack with a single CAS.
+   *
+   * @param stack Pointer to the stack structure.
+   * @param first First node of the chain, which will become the new top.
+   * @param last Last node of the chain, whose `next` field will be overwritten.
+   */
+  void cthreads_stack_push_chain(struct cthreads_stack *stack, struct cthreads_stack_node *first, struct cthreads_stack_node *last);
+
+  /**
+   * Pops the top node of a lock-free stack.
+   *
+   * @param stack Pointer to the stack structure.
+   * @return Popped node, or NULL if the stack is empty.
+   */
+  struct cthreads_stack_node *cthreads_stack_pop(struct cthreads_stack *stack);
+
+  /**
+   * Detaches every node of a lock-free stack at once.
+   *
+   * @param stack Pointer to the stack structure.
+   * @return Former top node, linked through `next`, or NULL if the stack was empty.
+   */
+  struct cthreads_stack_node *cthreads_stack_pop_all(struct cthreads_stack *stack);
+#endif
+
+#ifdef CTHREADS_OBJPOOL
+  /**
+   * Initializes a fixed-capacity object pool.
+   *
+   * Each thread caches up to two magazines of CTHREADS_OBJPOOL_MAGAZINE objects, and only
+   *   touches the shared lock-free depot when both are full or both are empty. Threads
+   *   beyond the first CTHREADS_OBJPOOL_THREADS alive go straight to the depot.
+   *
+   * @param pool Pointer to the pool structure to be initialized.
+   * @param object_size Size in bytes of each object.
+   * @param capacity Number of objects the pool holds.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_objpool_init(struct cthreads_objpool *pool, size_t object_size, size_t capacity);
+
+  /**
+   * Takes an object from a pool.
+   *
+   * @param pool Pointer to the pool structure.
+   * @return Pointer to the object, or NULL if the pool is exhausted.
+   */
+  void *cthreads_objpool_alloc(struct cthreads_objpool *pool);
+
+  /**
+   * Returns an object to a pool. The object may be freed by any thread.
+   *
+   * @param pool Pointer to the pool structure.
+   * @param object Pointer to the object, previously returned by `cthreads_objpool_alloc`.
+   */
+  void cthreads_objpool_free(struct cthreads_objpool *pool, void *object);
+
+  /**
+   * Moves the objects cached by the calling thread back to the shared depot.
+   *
+   * @param pool Pointer to the pool structure.
+   */
+  void cthreads_objpool_flush(struct cthreads_objpool *pool);
+
+  /**
+   * Destroys a pool, releasing every object at once.
+   *
+   * @param pool Pointer to the pool structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_objpool_destroy(struct cthreads_objpool *pool);
+
+  #define CTHREADS_OBJPOOL_INIT_TYPE(pool, type, capacity) cthreads_objpool_init((pool), sizeof(type), (capacity))
+  #define CTHREADS_OBJPOOL_NEW(pool, type) ((type *)cthreads_objpool_alloc(pool))
+#endif
+
+#ifdef CTHREADS_COMBINER
+  /**
+   * Initializes a flat combiner, which serializes operations on a shared structure.
+   *
+   * Each thread publishes its operation in its own record, and whichever thread takes the
+   *   combiner lock runs every pending operation in a batch while the others spin, then park,
+   *   on their record. Threads beyond the first CTHREADS_OBJPOOL_THREADS alive take the lock
+   *   and run their own operation.
+   *
+   * @param combiner Pointer to the combiner structure to be initialized.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_combiner_init(struct cthreads_combiner *combiner);
+
+  /**
+   * Runs an operation under the combiner, possibly on another thread, and returns once it ran.
+   *
+   * @param combiner Pointer to the combiner structure.
+   * @param func Operation to be run, storing its result through `data`.
+   * @param data Argument of the operation.
+   * @note Calling this from inside an operation of the same combiner deadlocks.
+   */
+  void cthreads_combiner_execute(struct cthreads_combiner *combiner, void (*func)(void *data), void *data);
+
+  /**
+   * Destroys a combiner. No operation may be in flight.
+   *
+   * @param combiner Pointer to the combiner structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_combiner_destroy(struct cthreads_combiner *combiner);
+#endif
+
+#ifdef CTHREADS_SLAB
+  /**
+   * Initializes a growable slab allocator for objects of a single size.
+   *
+   * Objects are rounded up to a multiple of CTHREADS_CACHE_LINE, so two of them never share
+   *   a line, and carved out of spans owned by the thread that allocated them. Each thread
+   *   allocates from and frees its own objects to a private cache without atomics. Objects
+   *   freed by another thread are batched, up to CTHREADS_SLAB_BATCH per owner, and returned
+   *   to the owning cache with a single atomic operation. When a thread exits its pending
+   *   batches are flushed, and its cache is adopted by the next thread taking its slot.
+   *   Threads beyond the first CTHREADS_OBJPOOL_THREADS alive share one locked cache.
+   *
+   * @param slab Pointer to the slab structure to be initialized.
+   * @param object_size Size in bytes of each object.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_slab_init(struct cthreads_slab *slab, size_t object_size);
+
+  /**
+   * Takes an object from a slab, growing it by a span when the calling thread has none cached.
+   *
+   * @param slab Pointer to the slab structure.
+   * @return Pointer to the object, aligned to CTHREADS_CACHE_LINE, or NULL if out of memory.
+   */
+  void *cthreads_slab_alloc(struct cthreads_slab *slab);
+
+  /**
+   * Returns an object to a slab. The object may be freed by any thread.
+   *
+   * @param slab Pointer to the slab structure.
+   * @param object Pointer to the object, previously returned by `cthreads_slab_alloc`.
+   */
+  void cthreads_slab_free(struct cthreads_slab *slab, void *object);
+
+  /**
+   * Returns the objects the calling thread freed on behalf of other threads to their owners.
+   *
+   * @param slab Pointer to the slab structure.
+   */
+  void cthreads_slab_flush(struct cthreads_slab *slab);
+
+  /**
+   * Destroys a slab, releasing every span at once. No thread may use it anymore.
+   *
+   * @param slab Pointer to the slab structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_slab_destroy(struct cthreads_slab *slab);
+
+  #define CTHREADS_SLAB_INIT_TYPE(slab, type) cthreads_slab_init((slab), sizeof(type))
+  #define CTHREADS_SLAB_NEW(slab, type) ((type *)cthreads_slab_alloc(slab))
+#endif
+
+#ifdef CTHREADS_LEFTRIGHT
+  /**
+   * Initializes a left-right, which publishes a read-mostly structure kept in two instances.
+   *
+   * Readers are wait-free: they announce themselves on a striped read indicator and read
+   *   whichever instance they are directed to. A writer applies its change to the other
+   *   instance, directs new readers to it, waits for the readers still on the old one to
+   *   leave, then applies the same change to it. Writers never block readers, only each
+   *   other.
+   *
+   * @param lr Pointer to the left-right structure to be initialized.
+   * @param left Pointer to the first instance.
+   * @param right Pointer to the second instance, identical to the first one.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_leftright_init(struct cthreads_leftright *lr, void *left, void *right);
+
+  /**
+   * Starts a read, never blocking.
+   *
+   * @param lr Pointer to the left-right structure.
+   * @param token Filled with the value to be passed to `cthreads_leftright_read_end`.
+   * @return Pointer to the instance to be read, which must not be modified.
+   */
+  const void *cthreads_leftright_read_begin(struct cthreads_leftright *lr, size_t *token);
+
+  /**
+   * Ends a read, after which the instance must not be accessed anymore.
+   *
+   * @param lr Pointer to the left-right structure.
+   * @param token Value filled by `cthreads_leftright_read_begin`.
+   */
+  void cthreads_leftright_read_end(struct cthreads_leftright *lr, size_t token);
+
+  /**
+   * Applies a change to both instances, one after the other, returning once both are updated.
+   *
+   * @param lr Pointer to the left-right structure.
+   * @param apply Function applying the change to the instance it receives. It runs twice, and must leave both instances identical.
+   * @param data Argument of `apply`.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_leftright_write(struct cthreads_leftright *lr, void (*apply)(void *instance, void *data), void *data);
+
+  /**
+   * Destroys a left-right. The instances are left to the caller.
+   *
+   * @param lr Pointer to the left-right structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_leftright_destroy(struct cthreads_leftright *lr);
+#endif
+
+#ifdef CTHREADS_CHANNEL
+  /**
+   * Initializes a channel.
+   *
+   * @param chan Pointer to the channel structure to be initialized.
+   * @param size Size in bytes of each element.
+   * @param capacity Number of buffered elements. Set it to 0 for an unbuffered (rendezvous) channel.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_chan_init(struct cthreads_chan *chan, size_t size, size_t capacity);
+
+  /**
+   * Sends an element, blocking until it is buffered or handed off to a receiver.
+   *
+   * @param chan Pointer to the channel structure.
+   * @param data Pointer to the element to be copied into the channel.
+   * @return 0 on success, CTHREADS_CHAN_CLOSED if the channel is closed.
+   */
+  int cthreads_chan_send(struct cthreads_chan *chan, const void *data);
+
+  /**
+   * Sends an element, blocking at most `ms` milliseconds.
+   *
+   * @param chan Pointer to the channel structure.
+   * @param data Pointer to the element to be copied into the channel.
+   * @param ms Time in milliseconds to give up after. Set it to 0 to never block.
+   * @return 0 on success, CTHREADS_CHAN_CLOSED if the channel is closed, CTHREADS_CHAN_TIMEOUT on timeout.
+   */
+  int cthreads_chan_timedsend(struct cthreads_chan *chan, const void *data, unsigned int ms);
+
+  /**
+   * Receives an element, blocking until one is available or the channel is closed.
+   *
+   * @param chan Pointer to the channel structure.
+   * @param data Pointer to where the element is copied. May be NULL to discard it. Zeroed on CTHREADS_CHAN_CLOSED.
+   * @return 0 on success, CTHREADS_CHAN_CLOSED if the channel is closed and drained.
+   */
+  int cthreads_chan_recv(struct cthreads_chan *chan, void *data);
+
+  /**
+   * Receives an element, blocking at most `ms` milliseconds.
+   *
+   * @param chan Pointer to the channel structure.
+   * @param data Pointer to where the element is copied. May be NULL to discard it.
+   * @param ms Time in milliseconds to give up after. Set it to 0 to never block.
+   * @return 0 on success, CTHREADS_CHAN_CLOSED if the channel is closed and drained, CTHREADS_CHAN_TIMEOUT on timeout.
+   */
+  int cthreads_chan_timedrecv(struct cthreads_chan *chan, void *data, unsigned int ms);
+
+  /**
+   * Closes a channel. Blocked receivers get CTHREADS_CHAN_CLOSED once the buffer is
+   *   drained, blocked and future senders get it immediately.
+   *
+   * @param chan Pointer to the channel structure.
+   * @return 0 on success, non-zero if the channel was already closed.
+   */
+  int cthreads_chan_close(struct cthreads_chan *chan);
+
+  /**
+   * Destroys a channel. No thread may be blocked on it.
+   *
+   * @param chan Pointer to the channel structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_chan_destroy(struct cthreads_chan *chan);
+
+  /**
+   * Waits until any of the send or receive cases can proceed, and performs exactly one of them.
+   *
+   * Blocked cases are queued directly on their channels, so the peer that makes one ready
+   *   hands the element off and wakes only this thread. Cases with a NULL channel are ignored.
+   *
+   * @param cases Array of cases, each a channel, CTHREADS_CHAN_SEND or CTHREADS_CHAN_RECV and an element pointer.
+   * @param count Number of cases.
+   * @param ms Time in milliseconds to give up after. Set it to 0 to never block, or CTHREADS_CHAN_INFINITE.
+   * @param selected Pointer to store the index of the performed case.
+   * @return 0 on success, CTHREADS_CHAN_CLOSED if the performed case hit a closed channel, CTHREADS_CHAN_TIMEOUT on timeout.
+   */
+  int cthreads_select(struct cthreads_select_case *cases, size_t count, unsigned int ms, size_t *selected);
+#endif
+
+#ifdef CTHREADS_MPSC
+  /**
+   * Initializes an intrusive, unbounded multi-producer single-consumer queue (Vyukov).
+   *
+   * @param queue Pointer to the queue structure to be initialized.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_mpsc_init(struct cthreads_mpsc *queue);
+
+  /**
+   * Pushes a node. Wait-free: a single atomic exchange, plus a wake if the consumer is parked.
+   *
+   * @param queue Pointer to the queue structure.
+   * @param node Pointer to the node to be pushed, owned by the queue until popped.
+   */
+  void cthreads_mpsc_push(struct cthreads_mpsc *queue, struct cthreads_mpsc_node *node);
+
+  /**
+   * Pops the oldest node. Only the consumer may call it.
+   *
+   * @note NULL may also be returned while a producer is between its exchange and its link.
+   * @param queue Pointer to the queue structure.
+   * @return Popped node, or NULL if the queue is empty.
+   */
+  struct cthreads_mpsc_node *cthreads_mpsc_pop(struct cthreads_mpsc *queue);
+
+  /**
+   * Pops every linked node at once. Only the consumer may call it.
+   *
+   * @param queue Pointer to the queue structure.
+   * @return Oldest popped node, linked in FIFO order through `next`, or NULL if the queue is empty.
+   */
+  struct cthreads_mpsc_node *cthreads_mpsc_pop_all(struct cthreads_mpsc *queue);
+
+  /**
+   * Checks whether the queue is empty. Only the consumer may call it.
+   *
+   * @param queue Pointer to the queue structure.
+   * @return 1 if the queue is empty, zero otherwise.
+   */
+  int cthreads_mpsc_empty(struct cthreads_mpsc *queue);
+
+  /**
+   * Parks the consumer until the queue becomes non-empty, `cthreads_mpsc_unpark` is called
+   *   or `ms` elapse. Producers only issue a wake when they find the consumer parked.
+   *
+   * - linux: futex
+   * - windows: WaitOnAddress
+   *
+   * @param queue Pointer to the queue structure.
+   * @param ms Time in milliseconds to give up after, or CTHREADS_INFINITE.
+   * @return 0 if the consumer was woken or the queue is non-empty, non-zero on timeout.
+   */
+  int cthreads_mpsc_park(struct cthreads_mpsc *queue, unsigned int ms);
+
+  /**
+   * Wakes the consumer if it is parked, e.g. to make it notice a shutdown.
+   *
+   * @param queue Pointer to the queue structure.
+   */
+  void cthreads_mpsc_unpark(struct cthreads_mpsc *queue);
+#endif
+
+#ifdef CTHREADS_TRIPLEBUF
+  /**
+   * Initializes a triple buffer, which hands the latest value from a single writer to a
+   *   single reader. Neither side ever blocks or waits on the other: the writer fills a
+   *   buffer of its own and swaps it with the one in the middle, and the reader takes the
+   *   middle one when it holds something newer.
+   *
+   * @param buffer Pointer to the triple buffer structure to be initialized.
+   * @param first Pointer to the buffer the reader starts with.
+   * @param second Pointer to the buffer the writer starts with.
+   * @param third Pointer to the buffer starting in the middle.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_triplebuf_init(struct cthreads_triplebuf *buffer, void *first, void *second, void *third);
+
+  /**
+   * Gets the buffer the writer fills next. It stays the same until `cthreads_triplebuf_publish`.
+   *
+   * @param buffer Pointer to the triple buffer structure.
+   * @return Pointer to the writer's buffer, whose contents are stale.
+   */
+  void *cthreads_triplebuf_write_buffer(struct cthreads_triplebuf *buffer);
+
+  /**
+   * Publishes the writer's buffer, replacing any value the reader did not take yet.
+   *
+   * @param buffer Pointer to the triple buffer structure.
+   */
+  void cthreads_triplebuf_publish(struct cthreads_triplebuf *buffer);
+
+  /**
+   * Gets the latest published buffer. It stays valid until the next call.
+   *
+   * @param buffer Pointer to the triple buffer structure.
+   * @param updated Set to 1 if a newer value was published since the last call, 0 otherwise. Can be NULL.
+   * @return Pointer to the reader's buffer.
+   */
+  const void *cthreads_triplebuf_read(struct cthreads_triplebuf *buffer, int *updated);
+#endif
+
+#ifdef CTHREADS_DEQUE
+  /**
+   * Initializes a Chase-Lev work-stealing deque of pointers. Its owner pushes and pops at the
+   *   bottom with plain stores and a fence, thieves steal from the top with a CAS.
+   *
+   * @param deque Pointer to the deque structure to be initialized.
+   * @param capacity Initial capacity, rounded up to a power of two, 0 for the default. It doubles when full.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_deque_init(struct cthreads_deque *deque, size_t capacity);
+
+  /**
+   * Pushes an item at the bottom of a deque. Only the owner may call it.
+   *
+   * @param deque Pointer to the deque structure.
+   * @param item Item to be pushed, must not be NULL.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_deque_push(struct cthreads_deque *deque, void *item);
+
+  /**
+   * Pops the newest item from the bottom of a deque. Only the owner may call it.
+   *
+   * @param deque Pointer to the deque structure.
+   * @return Item, or NULL if the deque was empty or its last item was stolen.
+   */
+  void *cthreads_deque_pop(struct cthreads_deque *deque);
+
+  /**
+   * Steals the oldest item from the top of a deque. Any thread may call it.
+   *
+   * @param deque Pointer to the deque structure.
+   * @return Item, or NULL if the deque was empty.
+   */
+  void *cthreads_deque_steal(struct cthreads_deque *deque);
+
+  /**
+   * Steals up to half of the items of a deque, oldest first, in one call. Any thread may call it.
+   *
+   * @param deque Pointer to the deque structure.
+   * @param items Array receiving the stolen items.
+   * @param max Size of `items`.
+   * @return Number of items stolen.
+   */
+  size_t cthreads_deque_steal_half(struct cthreads_deque *deque, void **items, size_t max);
+
+  /**
+   * Retrieves the number of items in a deque, which may be outdated as soon as it returns.
+   *
+   * @param deque Pointer to the deque structure.
+   * @return Number of items.
+   */
+  size_t cthreads_deque_size(struct cthreads_deque *deque);
+
+  /**
+   * Destroys a deque, along with the arrays it outgrew. No thread may be using it.
+   *
+   * @param deque Pointer to the deque structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_deque_destroy(struct cthreads_deque *deque);
+#endif
+
+#ifdef CTHREADS_PARKING_LOT
+  /**
+   * Parks the calling thread in the wait queue keyed by `address`, in a global table of
+   *   CTHREADS_PARKING_LOT_BUCKETS hashed queues.
+   *
+   * `validate` runs with the queue locked and may refuse to park. `before_sleep` runs once
+   *   queued, with the queue unlocked. On timeout, `timed_out` runs with the queue locked,
+   *   receiving the key the thread was queued on and whether threads are left on it.
+   *
+   * @param address Key of the wait queue, usually the address of the primitive.
+   * @param validate Callback returning non-zero to park. May be NULL.
+   * @param before_sleep Callback run before sleeping. May be NULL.
+   * @param timed_out Callback run on timeout. May be NULL.
+   * @param context Pointer passed to every callback.
+   * @param ms Time in milliseconds to give up after, or CTHREADS_INFINITE.
+   * @param token Pointer to store the token given by the unparking thread. May be NULL.
+   * @return CTHREADS_PARK_UNPARKED, CTHREADS_PARK_INVALID or CTHREADS_PARK_TIMEOUT.
+   */
+  int cthreads_park(const void *address, int (*validate)(void *context), void (*before_sleep)(void *context),
+                    void (*timed_out)(void *context, const void *address, int have_more), void *context,
+                    unsigned int ms, uintptr_t *token);
+
+  /**
+   * Unparks the oldest thread parked on `address`.
+   *
+   * @param address Key of the wait queue.
+   * @param callback Callback run with the queue locked, receiving whether a thread was unparked and
+   *                   whether threads are left, returning the token handed to the thread. May be NULL.
+   * @param context Pointer passed to the callback.
+   * @return Number of unparked threads, 0 or 1.
+   */
+  size_t cthreads_unpark_one(const void *address, uintptr_t (*callback)(void *context, size_t unparked, int have_more), void *context);
+
+  /**
+   * Unparks every thread parked on `address`.
+   *
+   * @param address Key of the wait queue.
+   * @param token Token handed to every unparked thread.
+   * @return Number of unparked threads.
+   */
+  size_t cthreads_unpark_all(const void *address, uintptr_t token);
+
+  /**
+   * Moves threads parked on `from` to the queue of `to` without waking them, optionally
+   *   unparking the oldest one first. Used to avoid thundering herds on broadcasts.
+   *
+   * @param from Key of the source wait queue.
+   * @param to Key of the target wait queue.
+   * @param validate Callback run with both queues locked, returning a CTHREADS_REQUEUE_* operation.
+   * @param callback Callback run with both queues locked, receiving the operation and the number of unparked and
+   *                   requeued threads, returning the token handed to the unparked thread. May be NULL.
+   * @param context Pointer passed to the callbacks.
+   * @return Number of unparked threads, 0 or 1.
+   */
+  size_t cthreads_unpark_requeue(const void *from, const void *to, int (*validate)(void *context),
+                                 uintptr_t (*callback)(void *context, int op, size_t unparked, size_t requeued), void *context);
+
+  /**
+   * Initializes a 1-byte lock. Equivalent to CTHREADS_LOCK_INITIALIZER.
+   *
+   * @param lock Pointer to the lock structure to be initialized.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_lock_init(struct cthreads_lock *lock);
+
+  /**
+   * Locks a 1-byte lock, spinning briefly before parking in the parking lot.
+   *
+   * @param lock Pointer to the lock structure to be locked.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_lock_lock(struct cthreads_lock *lock);
+
+  /**
+   * Tries to lock a 1-byte lock without blocking.
+   *
+   * @param lock Pointer to the lock structure to be locked.
+   * @return 0 on success, non-zero if the lock is held.
+   */
+  int cthreads_lock_trylock(struct cthreads_lock *lock);
+
+  /**
+   * Unlocks a 1-byte lock, unparking one waiter if any is parked.
+   *
+   * @param lock Pointer to the lock structure to be unlocked.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_lock_unlock(struct cthreads_lock *lock);
+
+  /**
+   * Initializes a pointer-sized condition variable. Equivalent to CTHREADS_CONDITION_INITIALIZER.
+   *
+   * @param cond Pointer to the condition variable structure to be initialized.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_condition_init(struct cthreads_condition *cond);
+
+  /**
+   * Waits on a condition variable. All concurrent waiters must use the same lock.
+   *
+   * @param cond Pointer to the condition variable structure.
+   * @param lock Pointer to the associated lock, held by the caller.
+   * @return 0 on success, non-zero if another lock is already associated with waiters.
+   */
+  int cthreads_condition_wait(struct cthreads_condition *cond, struct cthreads_lock *lock);
+
+  /**
+   * Waits on a condition variable till set ms.
+   *
+   * @param cond Pointer to the condition variable structure.
+   * @param lock Pointer to the associated lock, held by the caller.
+   * @param ms Time in milliseconds to unlock if not unlocked in time.
+   * @return 0 on success, CTHREADS_PARK_TIMEOUT on timeout, other non-zero on failure.
+   */
+  int cthreads_condition_timedwait(struct cthreads_condition *cond, struct cthreads_lock *lock, unsigned int ms);
+
+  /**
+   * Signals a condition variable, unparking a single waiter.
+   *
+   * @param cond Pointer to the condition variable structure.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_condition_signal(struct cthreads_condition *cond);
+
+  /**
+   * Broadcasts a condition variable. One waiter is unparked and the rest are requeued onto
+   *   the lock, so they are woken one at a time as it is released.
+   *
+   * @param cond Pointer to the condition variable structure.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_condition_broadcast(struct cthreads_condition *cond);
+#endif
+
+#ifdef CTHREADS_POOL
+  /**
+   * Initializes a work-stealing thread pool. Each worker owns a deque it pushes and
+   *   pops at the bottom, idle workers steal from the top of the others' deques.
+   *
+   * @param pool Pointer to the pool structure to be initialized.
+   * @param threads Number of worker threads, 0 for one per online CPU.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pool_init(struct cthreads_pool *pool, size_t threads);
+
+  /**
+   * Initializes a work-stealing thread pool with attributes. Every worker keeps a deque
+   *   per priority class and a heap of deadline tasks. Deadline tasks run first, earliest
+   *   deadline first, then each worker serves the non-empty class of its own deques and the
+   *   injection queues that got the least of its weighted share (stride scheduling), so low
+   *   priority work slows down but never starves. Only when all of those are empty does it
+   *   steal, from deadline heaps first, then from the highest priority class with work.
+   *
+   *   With `max_threads` or `min_threads` set, the pool is elastic: a monitor thread adds a
+   *   worker whenever tasks stay queued for `stall_ms` without any worker starting one, and
+   *   workers idle for `keep_alive_ms` retire.
+   *
+   * @param pool Pointer to the pool structure to be initialized.
+   * @param attr Pointer to the pool attributes, starting from CTHREADS_POOL_ATTR_INITIALIZER.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pool_init_attr(struct cthreads_pool *pool, struct cthreads_pool_attr *attr);
+
+  /**
+   * Submits a detached task to a pool. Submissions from a worker of the pool go to its own
+   *   deque, others go to the pool's shared queue. The task gets the priority of the task
+   *   submitting it, CTHREADS_PRIORITY_NORMAL outside of the pool.
+   *
+   * @param pool Pointer to the pool structure.
+   * @param task Pointer to the task storage, untouched by the pool once `func` is called.
+   * @param func Function to be run by the task.
+   * @param data Data to be passed to the function.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pool_submit(struct cthreads_pool *pool, struct cthreads_task *task, void (*func)(void *data), void *data);
+
+  /**
+   * Submits a detached task to a pool in a given priority class.
+   *
+   * @param pool Pointer to the pool structure.
+   * @param task Pointer to the task storage, untouched by the pool once `func` is called.
+   * @param func Function to be run by the task.
+   * @param data Data to be passed to the function.
+   * @param priority CTHREADS_PRIORITY_HIGH, CTHREADS_PRIORITY_NORMAL or CTHREADS_PRIORITY_LOW.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pool_submit_priority(struct cthreads_pool *pool, struct cthreads_task *task, void (*func)(void *data), void *data, unsigned int priority);
+
+  /**
+   * Submits a detached task with a deadline to a pool. Deadline tasks run before any
+   *   priority class, earliest deadline first, and the tasks they submit are high priority.
+   *
+   * @param pool Pointer to the pool structure.
+   * @param task Pointer to the task storage, untouched by the pool once `func` is called.
+   * @param func Function to be run by the task.
+   * @param data Data to be passed to the function.
+   * @param ms Deadline, in milliseconds from now.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pool_submit_deadline(struct cthreads_pool *pool, struct cthreads_task *task, void (*func)(void *data), void *data, unsigned int ms);
+
+  /**
+   * Destroys a pool, running the tasks still queued before its workers exit.
+   *
+   * @param pool Pointer to the pool structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pool_destroy(struct cthreads_pool *pool);
+
+  /**
+   * Tells the pool that the task running on the calling worker is about to block, e.g. on
+   *   I/O. If that leaves fewer runnable workers than the pool's `threads` while tasks are
+   *   queued, an idle worker is woken or, up to `max_threads`, a new one is started. Does
+   *   nothing outside of a pool's worker.
+   *
+   * @return 0 on success, non-zero error code if a needed worker could not be started.
+   */
+  int cthreads_pool_blocking_begin(void);
+
+  /**
+   * Tells the pool that the task running on the calling worker is done blocking.
+   *
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pool_blocking_end(void);
+
+  /**
+   * Initializes a fork-join task group, whose tasks run on a pool.
+   *
+   * @param group Pointer to the task group structure to be initialized.
+   * @param pool Pointer to the pool running the group's tasks.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_task_group_init(struct cthreads_task_group *group, struct cthreads_pool *pool);
+
+  /**
+   * Spawns a task into a group, with the priority of the task spawning it. Tasks may spawn
+   *   more tasks into any group.
+   *
+   * @param group Pointer to the task group structure.
+   * @param task Pointer to the task storage, which must stay valid until the group is synced.
+   * @param func Function to be run by the task.
+   * @param data Data to be passed to the function.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_task_group_spawn(struct cthreads_task_group *group, struct cthreads_task *task, void (*func)(void *data), void *data);
+
+  /**
+   * Waits until every task spawned into a group has finished. Instead of blocking, the
+   *   calling thread runs pending tasks: from its own deque if it is a worker of the pool,
+   *   then from the shared queue and the other workers' deques, so recursive fork-join
+   *   never starves the pool. Any thread can sync, it then takes part in the pool's work
+   *   until the group is done.
+   *
+   * @param group Pointer to the task group structure.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_task_group_sync(struct cthreads_task_group *group);
+#endif
+
+#ifdef CTHREADS_PARALLEL
+  /**
+   * Sorts an array in parallel: cache-sized blocks are copied out and sorted with qsort,
+   *   then oversampled splitters cut every block into buckets, and each bucket is merged
+   *   from all blocks at once straight back into the array. The data crosses memory twice,
+   *   however many blocks there are. Equal elements may be reordered. Needs a temporary
+   *   copy of the array.
+   *
+   * @param pool Pool whose workers take part, with the calling thread, or NULL to sort on the calling thread only.
+   * @param base Array to be sorted.
+   * @param count Number of elements.
+   * @param size Size in bytes of each element.
+   * @param compare Comparison function, as for qsort.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_parallel_sort(struct cthreads_pool *pool, void *base, size_t count, size_t size, int (*compare)(const void *a, const void *b));
+
+  /**
+   * Computes an inclusive prefix scan in parallel: element i of the output combines
+   *   elements 0 to i of the input. Single pass over memory with decoupled look-back: each
+   *   cache-sized block is reduced, gets the total of the blocks before it, then is scanned
+   *   while still in cache.
+   *
+   * @param pool Pool whose workers take part, with the calling thread, or NULL to scan on the calling thread only.
+   * @param input Array to be scanned.
+   * @param output Array receiving the scan, which may be `input`.
+   * @param count Number of elements.
+   * @param size Size in bytes of each element.
+   * @param op Associative operator, combining `element` into `accumulator`, the earlier of both.
+   * @param data Argument of the operator.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_parallel_inclusive_scan(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t size, void (*op)(void *accumulator, const void *element, void *data), void *data);
+
+  /**
+   * Computes an exclusive prefix scan in parallel: element i of the output combines `init`
+   *   and elements 0 to i - 1 of the input.
+   *
+   * @param pool Pool whose workers take part, with the calling thread, or NULL to scan on the calling thread only.
+   * @param input Array to be scanned.
+   * @param output Array receiving the scan, which may be `input`.
+   * @param count Number of elements.
+   * @param size Size in bytes of each element.
+   * @param init Value the scan starts from, usually the identity of the operator.
+   * @param op Associative operator, combining `element` into `accumulator`, the earlier of both.
+   * @param data Argument of the operator.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_parallel_exclusive_scan(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t size, const void *init, void (*op)(void *accumulator, const void *element, void *data), void *data);
+
+  /**
+   * Applies a function to every element of an array in parallel, in cache-sized blocks.
+   *
+   * @param pool Pool whose workers take part, with the calling thread, or NULL to run on the calling thread only.
+   * @param input Array of input elements.
+   * @param output Array of output elements, which may be `input` if both sizes are equal.
+   * @param count Number of elements.
+   * @param in_size Size in bytes of each input element.
+   * @param out_size Size in bytes of each output element.
+   * @param func Function writing the transform of `in` into `out`.
+   * @param data Argument of the function.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_parallel_transform(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t in_size, size_t out_size, void (*func)(const void *in, void *out, void *data), void *data);
+
+  /**
+   * Copies the elements matching a predicate in parallel, keeping their order. The
+   *   predicate runs once per element, and offsets come from the same single-pass
+   *   look-back as the scans.
+   *
+   * @param pool Pool whose workers take part, with the calling thread, or NULL to run on the calling thread only.
+   * @param input Array of elements.
+   * @param output Array receiving the matching elements, which must not overlap `input`.
+   * @param count Number of elements.
+   * @param size Size in bytes of each element.
+   * @param predicate Function returning non-zero for the elements to be copied.
+   * @param data Argument of the predicate.
+   * @param copied Pointer to store the number of copied elements.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_parallel_copy_if(struct cthreads_pool *pool, const void *input, void *output, size_t count, size_t size, int (*predicate)(const void *element, void *data), void *data, size_t *copied);
+#endif
+
+#ifdef CTHREADS_TIMER
+  /**
+   * Initializes a hierarchical timing wheel and starts the thread driving it, which sleeps
+   *   until the next tick where a timer expires or moves down a level.
+   *
+   * @param wheel Pointer to the wheel structure to be initialized.
+   * @param resolution_ms Length of a tick in milliseconds, 0 meaning 1.
+   * @param pool Pool the expired callbacks are submitted to, or NULL to run them on the driver thread.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_timer_wheel_init(struct cthreads_timer_wheel *wheel, unsigned int resolution_ms, struct cthreads_pool *pool);
+
+  /**
+   * Schedules a timer, in O(1). Starting a pending timer moves it.
+   *
+   * @param wheel Pointer to the wheel structure.
+   * @param timer Pointer to the timer structure, zeroed before its first start, which must stay valid while it is pending or running.
+   * @param delay_ms Time in milliseconds until the first expiry, rounded up to whole ticks.
+   * @param period_ms Time in milliseconds between expiries, or 0 for a one-shot timer.
+   * @param func Callback to be run on expiry.
+   * @param data Argument of the callback.
+   * @return 0 on success, non-zero error code on failure.
+   * @note A periodic timer is only rescheduled once its callback returned, so runs never overlap.
+   * @note Expiries while the previous callback is still queued on the pool run it only once, as the latest callback.
+   */
+  int cthreads_timer_start(struct cthreads_timer_wheel *wheel, struct cthreads_timer *timer, unsigned int delay_ms, unsigned int period_ms, void (*func)(void *data), void *data);
+
+  /**
+   * Cancels a timer that was started at least once, in O(1).
+   *
+   * @param wheel Pointer to the wheel structure.
+   * @param timer Pointer to the timer structure.
+   * @return 0 if the timer was stopped before its callback started, non-zero otherwise.
+   * @note A periodic timer whose callback is running is not rescheduled, but must not be freed before the callback returned,
+   *   nor any timer whose callback is still queued on the pool.
+   */
+  int cthreads_timer_cancel(struct cthreads_timer_wheel *wheel, struct cthreads_timer *timer);
+
+  /**
+   * Stops the driver thread and destroys a wheel. Pending timers are dropped, callbacks
+   *   already submitted to the pool must have run before.
+   *
+   * @param wheel Pointer to the wheel structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_timer_wheel_destroy(struct cthreads_timer_wheel *wheel);
+#endif
+
+#ifdef CTHREADS_PIPELINE
+  /**
+   * Initializes an empty pipeline.
+   *
+   * @param pipeline Pointer to the pipeline structure to be initialized.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pipeline_init(struct cthreads_pipeline *pipeline);
+
+  /**
+   * Appends a stage to a pipeline. The first stage is the input: its function is called
+   *   with a NULL item and returns the next item, or NULL once the input is exhausted.
+   *   Every other stage receives the item returned by the previous one and returns the
+   *   item passed on, or NULL to drop it.
+   *
+   * A stage admits at most `tokens` items, queued or running, and whoever hands it more
+   *   waits, so a slow stage throttles the ones before it. The first stage's tokens bound
+   *   the items alive in the whole pipeline, which is also capped by the tokens of every
+   *   CTHREADS_PIPELINE_SERIAL_IN_ORDER stage, as those must be able to hold every live
+   *   item to restore their order.
+   *
+   * @param pipeline Pointer to the pipeline structure.
+   * @param mode CTHREADS_PIPELINE_PARALLEL, CTHREADS_PIPELINE_SERIAL_IN_ORDER or CTHREADS_PIPELINE_SERIAL_OUT_OF_ORDER. The first stage must be serial.
+   * @param threads Number of threads running a parallel stage, 0 meaning 1. Ignored for serial stages.
+   * @param tokens Maximum number of items admitted into the stage, 0 for 16 per thread, or no bound of its own for the first stage.
+   * @param func Stage function, called with an item and `data`.
+   * @param data Argument of the stage function.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pipeline_add_stage(struct cthreads_pipeline *pipeline, int mode, size_t threads, size_t tokens, void *(*func)(void *item, void *data), void *data);
+
+  /**
+   * Runs a pipeline until its input is exhausted and every item left the last stage.
+   *   The first stage runs on the calling thread, every other one on its own threads,
+   *   handing items over through lock-free bounded queues. A pipeline may be run again.
+   *
+   * @param pipeline Pointer to the pipeline structure.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pipeline_run(struct cthreads_pipeline *pipeline);
+
+  /**
+   * Reports the throughput and occupancy of a stage, during or after a run. The busiest
+   *   stage, by `busy_ns / threads`, bounds the throughput of the whole pipeline, and
+   *   stages before it spend their time in `blocked_ns`, the ones after it in `starved_ns`.
+   *
+   * @param pipeline Pointer to the pipeline structure.
+   * @param stage Index of the stage, in the order they were added.
+   * @param stats Pointer to the structure filled with the stage's counters.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pipeline_stats(struct cthreads_pipeline *pipeline, size_t stage, struct cthreads_pipeline_stats *stats);
+
+  /**
+   * Destroys a pipeline and its stages. It must not be running.
+   *
+   * @param pipeline Pointer to the pipeline structure to be destroyed.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_pipeline_destroy(struct cthreads_pipeline *pipeline);
+#endif
+
+#ifdef CTHREADS_IPC
+  /**
+   * Creates an IPC ring of fixed-size message slots in shared memory. Any number of
+   *   processes may produce, lock-free, while consumers take turns through a process-shared
+   *   robust mutex. Sleeping peers are woken through process-shared futexes.
+   *
+   * @param ipc Pointer to the IPC structure to be initialized.
+   * @param path Path of the file backing the ring, which must not exist yet, or NULL for an anonymous memfd to be shared through `fd`.
+   * @param slot_size Maximum size in bytes of a message.
+   * @param slots Number of slots, rounded up to a power of two.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_ipc_create(struct cthreads_ipc *ipc, const char *path, size_t slot_size, size_t slots);
+
+  /**
+   * Maps an IPC ring created by another process from its backing file.
+   *
+   * @param ipc Pointer to the IPC structure to be initialized.
+   * @param path Path of the file backing the ring.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_ipc_open(struct cthreads_ipc *ipc, const char *path);
+
+  /**
+   * Maps an IPC ring from a file descriptor inherited or received from another process.
+   *   The descriptor is duplicated, so the caller keeps ownership of it.
+   *
+   * @param ipc Pointer to the IPC structure to be initialized.
+   * @param fd File descriptor of the ring.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_ipc_open_fd(struct cthreads_ipc *ipc, int fd);
+
+  /**
+   * Reserves a slot to write a message into, in place.
+   *
+   * @param ipc Pointer to the IPC structure.
+   * @param data Pointer to where the slot's payload address will be stored.
+   * @param ms Maximum time to wait for a free slot, in milliseconds, or CTHREADS_INFINITE.
+   * @return 0 on success, CTHREADS_IPC_TIMEOUT if the ring stayed full.
+   */
+  int cthreads_ipc_reserve(struct cthreads_ipc *ipc, void **data, unsigned int ms);
+
+  /**
+   * Publishes a reserved slot to the consumers. Every reserved slot must be committed,
+   *   as consumers take messages in order. Only when the producer's process exits first
+   *   do consumers skip the slot, once they notice it is gone.
+   *
+   * @param ipc Pointer to the IPC structure.
+   * @param data Payload address returned by `cthreads_ipc_reserve`.
+   * @param size Size in bytes of the message, at most the ring's slot size.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_ipc_commit(struct cthreads_ipc *ipc, void *data, size_t size);
+
+  /**
+   * Acquires the oldest message, to be read in place, and the consumer role along with it.
+   *   If the previous consumer died holding the role, the ring is repaired and the message
+   *   it did not release is delivered again. While the oldest message is reserved but not
+   *   committed, its producer is checked every 100 milliseconds, and if its process no longer
+   *   exists the message is skipped.
+   *
+   * @param ipc Pointer to the IPC structure.
+   * @param data Pointer to where the message's address will be stored.
+   * @param size Pointer to where the message's size will be stored.
+   * @param ms Maximum time to wait for a message, in milliseconds, or CTHREADS_INFINITE.
+   * @return 0 on success, CTHREADS_IPC_TIMEOUT if no message arrived.
+   */
+  int cthreads_ipc_acquire(struct cthreads_ipc *ipc, void **data, size_t *size, unsigned int ms);
+
+  /**
+   * Releases the acquired message's slot to the producers and gives up the consumer role.
+   *   Must be called by the thread that acquired it.
+   *
+   * @param ipc Pointer to the IPC structure.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_ipc_release(struct cthreads_ipc *ipc);
+
+  /**
+   * Unmaps an IPC ring. The backing file, if any, is left for the caller to unlink.
+   *
+   * @param ipc Pointer to the IPC structure.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_ipc_close(struct cthreads_ipc *ipc);
+#endif
+
+#ifdef CTHREADS_TRACE
+  /**
+   * Begins a user-defined span on the calling thread's trace.
+   *
+   * @param name Name of the span, a string that must outlive the next flush.
+   */
+  void cthreads_trace_begin(const char *name);
+
+  /**
+   * Ends the innermost user-defined span on the calling thread's trace.
+   *
+   * @param name Name of the span, a string that must outlive the next flush.
+   */
+  void cthreads_trace_end(const char *name);
+
+  /**
+   * Records a user-defined instant event on the calling thread's trace.
+   *
+   * @param name Name of the event, a string that must outlive the next flush.
+   */
+  void cthreads_trace_instant(const char *name);
+
+  /**
+   * Writes the events still held by every thread's ring buffer to a file. Threads may keep
+   *   recording during the flush, events overwritten meanwhile are dropped. Once written, the
+   *   rings of exited threads may be reused by new threads.
+   *
+   * @param path Path of the file to be written.
+   * @param format CTHREADS_TRACE_CHROME for Chrome JSON or CTHREADS_TRACE_PERFETTO for a Perfetto protobuf trace.
+   * @return 0 on success, non-zero error code on failure.
+   */
+  int cthreads_trace_flush(const char *path, int format);
+#else
+  #define cthreads_trace_begin(name) ((void)0)
+  #define cthreads_trace_end(name) ((void)0)
+  #define cthreads_trace_instant(name) ((void)0)
+  #define cthreads_trace_flush(path, format) 0
+#endif
+
+#ifdef CTHREADS_REGISTRY
+  /**
+   * Reports every live thread created by `cthreads_thread_create`.
+   *
+   * CPU time comes from each thread's CPU clock, and context switches are read from
+   *   /proc on Linux, being left at 0 elsewhere. Blocked time counts the sleeps of the
+   *   library's own waits, not spinning nor blocking outside of it.
+   *
+   * @param stats Array filled with up to `max` threads.
+   * @param max Number of elements of `stats`.
+   * @return Number of live threads, which may exceed `max`.
+   */
+  size_t cthreads_registry_snapshot(struct cthreads_thread_stats *stats, size_t max);
+#endif
+
+#ifdef CTHREADS_INLINE
+  /* INFO: Thin wrappers, defined here so that each call compiles down to the OS primitive */
+  #ifdef CTHREADS_DEBUG
+    #include <stdio.h>
+  #endif
+
+  static __CTHREADS_INLINE int cthreads_thread_equal(struct cthreads_thread thread1, struct cthreads_thread thread2) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_thread_equal");
+    #endif
+
+    #ifdef _WIN32
+      return thread1.wThreadId == thread2.wThreadId;
+    #else
+      return pthread_equal(thread1.pThread, thread2.pThread);
+    #endif
+  }
+
+  static __CTHREADS_INLINE struct cthreads_thread cthreads_thread_self(void) {
+    struct cthreads_thread t;
+
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_thread_self");
+    #endif
+
+    #ifdef _WIN32
+      /* INFO: No real handle, only the ID. */
+      t.wThread = NULL;
+      t.wThreadId = GetCurrentThreadId();
+    #else
+      t.pThread = pthread_self();
+    #endif
+
+    return t;
+  }
+
+  static __CTHREADS_INLINE int cthreads_mutex_lock(struct cthreads_mutex *mutex) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mutex_lock");
+    #endif
+
+    #ifdef _WIN32
+      EnterCriticalSection(&mutex->wMutex);
+
+      return 0;
+    #else
+      return pthread_mutex_lock(&mutex->pMutex);
+    #endif
+  }
+
+  static __CTHREADS_INLINE int cthreads_mutex_trylock(struct cthreads_mutex *mutex) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mutex_trylock");
+    #endif
+
+    #ifdef _WIN32
+      return TryEnterCriticalSection(&mutex->wMutex) == 0;
+    #else
+      return pthread_mutex_trylock(&mutex->pMutex);
+    #endif
+  }
+
+  static __CTHREADS_INLINE int cthreads_mutex_unlock(struct cthreads_mutex *mutex) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_mutex_unlock");
+    #endif
+
+    #ifdef _WIN32
+      LeaveCriticalSection(&mutex->wMutex);
+
+      return 0;
+    #else
+      return pthread_mutex_unlock(&mutex->pMutex);
+    #endif
+  }
+
+  static __CTHREADS_INLINE int cthreads_cond_signal(struct cthreads_cond *cond) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_cond_signal");
+    #endif
+
+    #ifdef _WIN32
+      WakeConditionVariable(&cond->wCond);
+
+      return 0;
+    #else
+      return pthread_cond_signal(&cond->pCond);
+    #endif
+  }
+
+  static __CTHREADS_INLINE int cthreads_cond_broadcast(struct cthreads_cond *cond) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_cond_broadcast");
+    #endif
+
+    #ifdef _WIN32
+      WakeAllConditionVariable(&cond->wCond);
+
+      return 0;
+    #else
+      return pthread_cond_broadcast(&cond->pCond);
+    #endif
+  }
+
+  static __CTHREADS_INLINE int cthreads_cond_wait(struct cthreads_cond *cond, struct cthreads_mutex *mutex) {
+    #ifdef CTHREADS_DEBUG
+      puts("cthreads_cond_wait");
+    #endif
+
+    #ifdef _WIN32
+      return SleepConditionVariableCS(&cond->wCond, &mutex->wMutex, INFINITE) == 0;
+    #else
+      return pthread_cond_wait(&cond->pCond, &mutex->pMutex);
+    #endif
+  }
+#endif
+
+/* INFO: Single-header use: define CTHREADS_IMPLEMENTATION in exactly one translation unit */
+#if defined(CTHREADS_IMPLEMENTATION) && !defined(__CTHREADS_IMPLEMENTATION_INCLUDED)
+  #define __CTHREADS_IMPLEMENTATION_INCLUDED 1
+  #include "cthreads.c"
 #endif
 
 #endif /* CTHREADS_H */
@@ -0,0 +1,147 @@
+/*
+  INFO: Stress test for the work-stealing deque, its owner racing thieves, and for the pool built on it.
+
+        Build it next to the library, for example:
+          cc -O2 -I. tests/deque_stress.c cthreads.c -lpthread -o deque_stress
+
+        The owner pushes 300k items into a deque that starts with a capacity of 4, popping every
+          third one back, while one thief steals single items and two steal half of the deque at
+          a time. Every item must come out exactly once, across the growths of the array.
+
+        Then a pool task spawns 300k tasks into a group from a worker, so that they land in its
+          deque and the other workers steal them in halves. Every task must run exactly once.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cthreads.h"
+
+#define TEST_ITEMS 300000
+#define TEST_THIEVES 3
+#define TEST_BATCH 16
+#define TEST_WORKERS 4
+
+static struct cthreads_deque deque;
+static uint32_t *seen;
+static uint32_t done;
+
+static struct cthreads_task_group group;
+static struct cthreads_task *tasks;
+
+static void mark(void *item) {
+  cthreads_atomic_fetch_add_u32(&seen[(uintptr_t)item - 1], 1, CTHREADS_ATOMIC_RELAXED);
+}
+
+static void *thief(void *data) {
+  void *items[TEST_BATCH];
+
+  /* INFO: The first thief steals one item at a time, the others half of the deque */
+  while (!cthreads_atomic_load_u32(&done, CTHREADS_ATOMIC_ACQUIRE) || cthreads_deque_size(&deque)) {
+    if (data == NULL) {
+      void *item = cthreads_deque_steal(&deque);
+
+      if (item) mark(item);
+    } else {
+      size_t count = cthreads_deque_steal_half(&deque, items, TEST_BATCH);
+      size_t i;
+
+      for (i = 0; i < count; i++)
+        mark(items[i]);
+    }
+  }
+
+  return NULL;
+}
+
+static int check(const char *name) {
+  size_t i;
+
+  for (i = 0; i < TEST_ITEMS; i++) {
+    if (seen[i] != 1) {
+      printf("%s: item %lu seen %u times\n", name, (unsigned long)i, seen[i]);
+
+      return 1;
+    }
+
+    seen[i] = 0;
+  }
+
+  return 0;
+}
+
+static int deque_race(void) {
+  struct cthreads_thread thieves[TEST_THIEVES];
+  struct cthreads_args args[TEST_THIEVES];
+  void *item;
+  size_t i;
+
+  cthreads_deque_init(&deque, 4);
+  done = 0;
+
+  for (i = 0; i < TEST_THIEVES; i++)
+    cthreads_thread_create(&thieves[i], NULL, thief, (void *)i, &args[i]);
+
+  for (i = 0; i < TEST_ITEMS; i++) {
+    cthreads_deque_push(&deque, (void *)(uintptr_t)(i + 1));
+
+    if (i % 3 == 0 && (item = cthreads_deque_pop(&deque))) mark(item);
+  }
+
+  while ((item = cthreads_deque_pop(&deque)))
+    mark(item);
+
+  cthreads_atomic_store_u32(&done, 1, CTHREADS_ATOMIC_RELEASE);
+
+  for (i = 0; i < TEST_THIEVES; i++)
+    cthreads_thread_join(thieves[i], NULL);
+
+  cthreads_deque_destroy(&deque);
+
+  return check("deque");
+}
+
+static void leaf(void *data) {
+  mark(data);
+}
+
+static void root(void *data) {
+  size_t i;
+
+  (void) data;
+
+  for (i = 0; i < TEST_ITEMS; i++)
+    cthreads_task_group_spawn(&group, &tasks[i], leaf, (void *)(uintptr_t)(i + 1));
+}
+
+static int pool_race(void) {
+  struct cthreads_pool pool;
+  struct cthreads_task root_task;
+
+  tasks = malloc(TEST_ITEMS * sizeof(*tasks));
+  if (!tasks) return 1;
+
+  cthreads_pool_init(&pool, TEST_WORKERS);
+  cthreads_task_group_init(&group, &pool);
+
+  cthreads_task_group_spawn(&group, &root_task, root, NULL);
+  cthreads_task_group_sync(&group);
+
+  cthreads_pool_destroy(&pool);
+  free(tasks);
+
+  return check("pool");
+}
+
+int main(void) {
+  seen = calloc(TEST_ITEMS, sizeof(*seen));
+  if (!seen) return 1;
+
+  if (deque_race() || pool_race()) return 1;
+
+  free(seen);
+
+  puts("ok");
+
+  return 0;
+}
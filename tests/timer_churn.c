@@ -0,0 +1,196 @@
+/*
+  INFO: Regression test for the timer wheel under churn, and for timers expiring again while their
+          callback is still queued on the pool.
+
+        Build it next to the library, for example:
+          cc -O2 -I. tests/timer_churn.c cthreads.c -lpthread -o timer_churn
+
+        200k one-shot timers are started and 90% of them cancelled again, once with callbacks run
+          on the driver thread and once on a pool. Every timer that was not cancelled must fire
+          exactly once, none of the cancelled ones.
+
+        Then the only worker of a pool is kept busy while a one-shot and a periodic timer are
+          restarted and expire again behind it. Their task must not be submitted a second time
+          while queued, so the one-shot callback runs once, with the data of the latest start.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #define TEST_SLEEP_MS(ms) Sleep(ms)
+#else
+  #include <unistd.h>
+  #define TEST_SLEEP_MS(ms) usleep((ms) * 1000)
+#endif
+
+#include "cthreads.h"
+
+#define TEST_TIMERS 200000
+#define TEST_RESTARTS 5
+
+struct churn_timer {
+  struct cthreads_timer timer;
+  uint32_t cancelled;
+  uint32_t fired;
+};
+
+static struct churn_timer *timers;
+static uint32_t fired_total;
+static uint32_t blocked;
+static uint32_t once_count;
+static uint32_t once_last;
+static uint32_t periodic_count;
+
+static void churn_callback(void *data) {
+  struct churn_timer *timer = data;
+
+  cthreads_atomic_fetch_add_u32(&timer->fired, 1, CTHREADS_ATOMIC_RELAXED);
+  cthreads_atomic_fetch_add_u32(&fired_total, 1, CTHREADS_ATOMIC_RELAXED);
+}
+
+static void block_worker(void *data) {
+  (void) data;
+
+  while (cthreads_atomic_load_u32(&blocked, CTHREADS_ATOMIC_ACQUIRE))
+    TEST_SLEEP_MS(1);
+}
+
+static void once_callback(void *data) {
+  cthreads_atomic_store_u32(&once_last, (uint32_t)(uintptr_t)data, CTHREADS_ATOMIC_RELAXED);
+  cthreads_atomic_fetch_add_u32(&once_count, 1, CTHREADS_ATOMIC_RELAXED);
+}
+
+static void periodic_callback(void *data) {
+  (void) data;
+
+  cthreads_atomic_fetch_add_u32(&periodic_count, 1, CTHREADS_ATOMIC_RELAXED);
+}
+
+static int churn(struct cthreads_pool *pool) {
+  struct cthreads_timer_wheel wheel;
+  uint32_t expected = 0;
+  int i;
+
+  timers = calloc(TEST_TIMERS, sizeof(*timers));
+  if (!timers) return 1;
+
+  fired_total = 0;
+  srand(1);
+
+  cthreads_timer_wheel_init(&wheel, 1, pool);
+
+  for (i = 0; i < TEST_TIMERS; i++) {
+    /* INFO: A few timers far out, so that they cascade down from the upper levels */
+    unsigned int delay_ms = i % 1000 == 0 ? 1000 + rand() % 1000 : rand() % 300;
+
+    cthreads_timer_start(&wheel, &timers[i].timer, delay_ms, 0, churn_callback, &timers[i]);
+  }
+
+  /* INFO: Timers that fired before their cancel count as not cancelled */
+  for (i = 0; i < TEST_TIMERS; i++) {
+    if (i % 10 != 0 && cthreads_timer_cancel(&wheel, &timers[i].timer) == 0) timers[i].cancelled = 1;
+    else expected++;
+  }
+
+  for (i = 0; i < 1000 && cthreads_atomic_load_u32(&fired_total, CTHREADS_ATOMIC_ACQUIRE) < expected; i++)
+    TEST_SLEEP_MS(10);
+
+  /* INFO: Leaves time for callbacks that should not run at all */
+  TEST_SLEEP_MS(100);
+
+  cthreads_timer_wheel_destroy(&wheel);
+
+  for (i = 0; i < TEST_TIMERS; i++) {
+    uint32_t fired = cthreads_atomic_load_u32(&timers[i].fired, CTHREADS_ATOMIC_ACQUIRE);
+
+    if (fired != (timers[i].cancelled ? 0u : 1u)) {
+      printf("%s: timer %d fired %u times (cancelled: %u)\n", pool ? "pool" : "inline", i, fired, timers[i].cancelled);
+
+      free(timers);
+
+      return 1;
+    }
+  }
+
+  free(timers);
+
+  return 0;
+}
+
+static int restart_while_queued(void) {
+  struct cthreads_pool pool;
+  struct cthreads_timer_wheel wheel;
+  struct cthreads_task block;
+  struct cthreads_timer once, periodic;
+  uint32_t count;
+  int i;
+
+  memset(&once, 0, sizeof(once));
+  memset(&periodic, 0, sizeof(periodic));
+
+  cthreads_pool_init(&pool, 1);
+  cthreads_timer_wheel_init(&wheel, 1, &pool);
+
+  cthreads_atomic_store_u32(&blocked, 1, CTHREADS_ATOMIC_RELEASE);
+  cthreads_pool_submit(&pool, &block, block_worker, NULL);
+  TEST_SLEEP_MS(20);
+
+  /* INFO: Each start expires while the callback of the previous one is still queued, alone in the queue */
+  for (i = 1; i <= TEST_RESTARTS; i++) {
+    cthreads_timer_start(&wheel, &once, 1, 0, once_callback, (void *)(uintptr_t)i);
+    TEST_SLEEP_MS(20);
+  }
+
+  /* INFO: A periodic timer is not rescheduled while queued, but it is when started again */
+  for (i = 0; i < TEST_RESTARTS; i++) {
+    cthreads_timer_start(&wheel, &periodic, 1, 5, periodic_callback, NULL);
+    TEST_SLEEP_MS(20);
+  }
+
+  cthreads_atomic_store_u32(&blocked, 0, CTHREADS_ATOMIC_RELEASE);
+  TEST_SLEEP_MS(200);
+
+  cthreads_timer_cancel(&wheel, &periodic);
+  TEST_SLEEP_MS(20);
+
+  count = cthreads_atomic_load_u32(&periodic_count, CTHREADS_ATOMIC_ACQUIRE);
+
+  cthreads_timer_wheel_destroy(&wheel);
+  cthreads_pool_destroy(&pool);
+
+  if (once_count != 1 || once_last != TEST_RESTARTS) {
+    printf("restart: one-shot ran %u times, last with %u\n", once_count, once_last);
+
+    return 1;
+  }
+
+  /* INFO: Resumes after the worker is free again, about every 5 ms of the 200 ms */
+  if (count < 2 || count > 60) {
+    printf("restart: periodic ran %u times\n", count);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+int main(void) {
+  struct cthreads_pool pool;
+
+  if (churn(NULL)) return 1;
+
+  cthreads_pool_init(&pool, 2);
+
+  if (churn(&pool)) return 1;
+
+  cthreads_pool_destroy(&pool);
+
+  if (restart_while_queued()) return 1;
+
+  puts("ok");
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+/*
+  INFO: Regression test for a lost semaphore wakeup between cthreads_wait_any and cthreads_sem_wait.
+
+        Build it next to the library, for example:
+          cc -O2 -I. tests/wait_any_sem.c cthreads.c -lpthread -o wait_any_sem
+
+        A thread sleeps in cthreads_wait_any on {word, semaphore}, another in cthreads_sem_wait
+          on the same semaphore. The word is changed without a wake, then a single permit is
+          posted. Should the post's only wake go to the cthreads_wait_any thread, it returns for
+          the word and leaves the permit, which the cthreads_sem_wait thread must still get.
+*/
+
+#include <stdio.h>
+
+#ifdef _WIN32
+  #include <windows.h>
+  #define TEST_SLEEP_MS(ms) Sleep(ms)
+#else
+  #include <unistd.h>
+  #define TEST_SLEEP_MS(ms) usleep((ms) * 1000)
+#endif
+
+#include "cthreads.h"
+
+#define TEST_ROUNDS 5
+
+static struct cthreads_semaphore sem;
+static uint32_t word;
+static uint32_t waiter_done;
+static uint32_t any_done;
+static size_t any_index;
+
+static void *any_thread(void *data) {
+  struct cthreads_wait_object objects[2];
+
+  (void) data;
+
+  objects[0].type = CTHREADS_WAIT_WORD;
+  objects[0].object = &word;
+  objects[0].value = 0;
+  objects[1].type = CTHREADS_WAIT_SEMAPHORE;
+  objects[1].object = &sem;
+  objects[1].value = 0;
+
+  cthreads_wait_any(objects, 2, CTHREADS_INFINITE, &any_index);
+  cthreads_atomic_store_u32(&any_done, 1, CTHREADS_ATOMIC_SEQ_CST);
+
+  return NULL;
+}
+
+static void *sem_thread(void *data) {
+  (void) data;
+
+  cthreads_sem_wait(&sem);
+  cthreads_atomic_store_u32(&waiter_done, 1, CTHREADS_ATOMIC_SEQ_CST);
+
+  return NULL;
+}
+
+int main(void) {
+  int round;
+
+  for (round = 0; round < TEST_ROUNDS; round++) {
+    struct cthreads_thread any, waiter;
+    struct cthreads_args any_args, waiter_args;
+    int i;
+
+    cthreads_sem_init(&sem, 0);
+    word = 0;
+    waiter_done = 0;
+    any_done = 0;
+
+    /* INFO: The cthreads_wait_any thread sleeps first, so it is first in line for the wake */
+    cthreads_thread_create(&any, NULL, any_thread, NULL, &any_args);
+    TEST_SLEEP_MS(100);
+    cthreads_thread_create(&waiter, NULL, sem_thread, NULL, &waiter_args);
+    TEST_SLEEP_MS(100);
+
+    /* INFO: Changed without a wake, so only the post wakes anyone */
+    cthreads_atomic_store_u32(&word, 1, CTHREADS_ATOMIC_SEQ_CST);
+    cthreads_sem_post(&sem);
+
+    for (i = 0; i < 200 && !(cthreads_atomic_load_u32(&waiter_done, CTHREADS_ATOMIC_SEQ_CST) && cthreads_atomic_load_u32(&any_done, CTHREADS_ATOMIC_SEQ_CST)); i++)
+      TEST_SLEEP_MS(10);
+
+    if (!cthreads_atomic_load_u32(&any_done, CTHREADS_ATOMIC_SEQ_CST) || !cthreads_atomic_load_u32(&waiter_done, CTHREADS_ATOMIC_SEQ_CST)) {
+      printf("round %d: lost wakeup (wait_any done: %u, sem_wait done: %u)\n", round, any_done, waiter_done);
+
+      return 1;
+    }
+
+    cthreads_thread_join(any, NULL);
+    cthreads_thread_join(waiter, NULL);
+    cthreads_sem_destroy(&sem);
+  }
+
+  puts("ok");
+
+  return 0;
+}